@@ -0,0 +1,165 @@
+/*
+ * fuzz_decompress.c - fuzzing entry point for the decompressors
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+/*
+ * Build with libFuzzer:
+ *    clang -O1 -g -fsanitize=fuzzer,address -Isrc/libdivsufsort/include -Isrc fuzz/fuzz_decompress.c src/expand.c -o fuzz_decompress
+ *
+ * Build for AFL, or to replay inputs, with a main() that runs each file given on the command line, or stdin without arguments:
+ *    afl-clang-fast -O1 -g -DSALVADOR_FUZZ_MAIN -Isrc/libdivsufsort/include -Isrc fuzz/fuzz_decompress.c src/expand.c -o fuzz_decompress
+ *
+ * The first 4 bytes of each input select the flags, the output buffer size and the dictionary size; the rest is the compressed data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "format.h"
+#include "expand.h"
+#include "libsalvador.h"
+
+#define FUZZ_HEADER_SIZE 4
+#define FUZZ_FAST_SLACK 16
+
+int LLVMFuzzerTestOneInput(const unsigned char *pData, size_t nSize) {
+   static const unsigned int nFlagsTable[4] = { 0, FLG_IS_INVERTED, FLG_IS_BACKWARD, FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD };
+   unsigned char *pSafeBuffer, *pFastBuffer;
+   unsigned int nFlags;
+   size_t nMaxOutBufferSize, nDictionarySize, nBufferSize, i;
+   size_t nValidatedSize, nSafeSize, nFastSize;
+   int nIsNative;
+
+   if (nSize < FUZZ_HEADER_SIZE)
+      return 0;
+
+   nFlags = nFlagsTable[pData[0] & 3];
+   nIsNative = (nFlags & FLG_NATIVE_BACKWARD) ? 1 : 0;
+   nMaxOutBufferSize = ((size_t)pData[1]) | (((size_t)pData[2]) << 8);
+   nDictionarySize = ((size_t)pData[3]) << 4;
+   pData += FUZZ_HEADER_SIZE;
+   nSize -= FUZZ_HEADER_SIZE;
+
+   nBufferSize = nDictionarySize + nMaxOutBufferSize + FUZZ_FAST_SLACK;
+   pSafeBuffer = (unsigned char *)malloc(nBufferSize);
+   pFastBuffer = (unsigned char *)malloc(nBufferSize);
+   if (!pSafeBuffer || !pFastBuffer) {
+      if (pFastBuffer) free(pFastBuffer);
+      if (pSafeBuffer) free(pSafeBuffer);
+      return 0;
+   }
+
+   /* The dictionary is in front of the decompression buffer for forward data, and follows it for backward data in file order */
+   for (i = 0; i < nBufferSize; i++)
+      pSafeBuffer[i] = (unsigned char)(i * 151 + 7);
+   memcpy(pFastBuffer, pSafeBuffer, nBufferSize);
+
+   nValidatedSize = salvador_validate_compressed_data(pData, nSize, nMaxOutBufferSize, nDictionarySize, nFlags);
+   nSafeSize = salvador_decompress(pData, pSafeBuffer, nSize, nMaxOutBufferSize, nDictionarySize, nFlags);
+   nFastSize = salvador_decompress_fast(pData, pFastBuffer, nSize, nMaxOutBufferSize, nDictionarySize, nFlags);
+
+   /* Validation must never accept data that the decoder rejects, or that decompresses to another size */
+   if (nValidatedSize != (size_t)-1 && nValidatedSize != nSafeSize)
+      abort();
+
+   /* Any size returned by a decoder must fit in the buffer */
+   if (nSafeSize != (size_t)-1 && nSafeSize > nMaxOutBufferSize)
+      abort();
+
+   /* The fast decoder only rejects more corrupted data than the safe one; when it succeeds, it must produce the same output */
+   if (nFastSize != (size_t)-1) {
+      if (nFastSize != nSafeSize)
+         abort();
+
+      if (nIsNative) {
+         if (memcmp(pSafeBuffer + nMaxOutBufferSize - nSafeSize, pFastBuffer + nMaxOutBufferSize - nFastSize, nSafeSize))
+            abort();
+      }
+      else {
+         if (memcmp(pSafeBuffer + nDictionarySize, pFastBuffer + nDictionarySize, nSafeSize))
+            abort();
+      }
+   }
+
+   free(pFastBuffer);
+   free(pSafeBuffer);
+   return 0;
+}
+
+#ifdef SALVADOR_FUZZ_MAIN
+static int fuzz_run_file(FILE *f) {
+   unsigned char *pData = NULL;
+   size_t nSize = 0, nCapacity = 0, nRead;
+
+   do {
+      if (nSize == nCapacity) {
+         unsigned char *pNewData;
+
+         nCapacity = nCapacity ? (nCapacity * 2) : 65536;
+         pNewData = (unsigned char *)realloc(pData, nCapacity);
+         if (!pNewData) {
+            free(pData);
+            return 100;
+         }
+         pData = pNewData;
+      }
+
+      nRead = fread(pData + nSize, 1, nCapacity - nSize, f);
+      nSize += nRead;
+   } while (nRead);
+
+   LLVMFuzzerTestOneInput(pData, nSize);
+   free(pData);
+   return 0;
+}
+
+int main(int argc, char **argv) {
+   int i;
+
+   if (argc < 2)
+      return fuzz_run_file(stdin);
+
+   for (i = 1; i < argc; i++) {
+      FILE *f = fopen(argv[i], "rb");
+      int nResult;
+
+      if (!f) {
+         fprintf(stderr, "error opening '%s' for reading\n", argv[i]);
+         return 100;
+      }
+
+      nResult = fuzz_run_file(f);
+      fclose(f);
+      if (nResult)
+         return nResult;
+   }
+
+   return 0;
+}
+#endif /* SALVADOR_FUZZ_MAIN */
@@ -0,0 +1,282 @@
+/*
+ * arena.c - compressor working memory implementation
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#include "arena.h"
+
+/**
+ * Allocate memory with allocator callbacks, or with the C heap
+ *
+ * @param pAllocator allocator callbacks, with NULL functions for the C heap
+ * @param nSize number of bytes to allocate
+ *
+ * @return allocated memory, or NULL for failure
+ */
+void *salvador_mem_alloc(const salvador_allocator *pAllocator, const size_t nSize) {
+   if (pAllocator->alloc_func)
+      return pAllocator->alloc_func(nSize, pAllocator->user_data);
+   else
+      return malloc(nSize);
+}
+
+/**
+ * Grow or shrink memory allocated with salvador_mem_alloc()
+ *
+ * @param pAllocator allocator callbacks that the memory was allocated with
+ * @param pMemory memory to resize, or NULL
+ * @param nOldSize current size of the memory in bytes
+ * @param nNewSize new size in bytes
+ *
+ * @return resized memory, or NULL for failure, in which case the memory is left as it was
+ */
+void *salvador_mem_realloc(const salvador_allocator *pAllocator, void *pMemory, const size_t nOldSize, const size_t nNewSize) {
+   void *pNewMemory;
+
+   if (!pAllocator->alloc_func)
+      return realloc(pMemory, nNewSize);
+
+   /* The callbacks can't resize memory; move it to a new allocation instead */
+   pNewMemory = pAllocator->alloc_func(nNewSize, pAllocator->user_data);
+   if (pNewMemory && pMemory) {
+      memcpy(pNewMemory, pMemory, (nOldSize < nNewSize) ? nOldSize : nNewSize);
+      pAllocator->free_func(pMemory, pAllocator->user_data);
+   }
+
+   return pNewMemory;
+}
+
+/**
+ * Free memory allocated with salvador_mem_alloc()
+ *
+ * @param pAllocator allocator callbacks that the memory was allocated with
+ * @param pMemory memory to free, or NULL
+ */
+void salvador_mem_free(const salvador_allocator *pAllocator, void *pMemory) {
+   if (pMemory) {
+      if (pAllocator->free_func)
+         pAllocator->free_func(pMemory, pAllocator->user_data);
+      else
+         free(pMemory);
+   }
+}
+
+/**
+ * Map memory for an arena directly from the OS, asking for huge pages
+ *
+ * On Windows, large pages are only granted to processes that hold the privilege to lock pages in memory; regular pages are mapped
+ * otherwise. On Linux, explicit huge pages are used if some are reserved, and transparent huge pages are requested otherwise
+ *
+ * @param nSize number of bytes to map
+ * @param pMappedSize returned size of the mapping in bytes, at least nSize
+ *
+ * @return mapped memory, or NULL for failure
+ */
+static unsigned char *salvador_arena_map(const size_t nSize, size_t *pMappedSize) {
+#ifdef _WIN32
+   const size_t nLargePageSize = (size_t)GetLargePageMinimum();
+   unsigned char *pMemory;
+
+   if (nLargePageSize) {
+      const size_t nLargeSize = (nSize + nLargePageSize - 1) & ~(nLargePageSize - 1);
+
+      pMemory = (unsigned char *)VirtualAlloc(NULL, nLargeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+      if (pMemory) {
+         *pMappedSize = nLargeSize;
+         return pMemory;
+      }
+   }
+
+   pMemory = (unsigned char *)VirtualAlloc(NULL, nSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+   if (pMemory)
+      *pMappedSize = nSize;
+   return pMemory;
+#elif defined(MAP_ANONYMOUS)
+   const size_t nMapSize = (nSize + SALVADOR_HUGE_PAGE_SIZE - 1) & ~((size_t)SALVADOR_HUGE_PAGE_SIZE - 1);
+   unsigned char *pMemory;
+   size_t nHeadSize;
+
+#ifdef MAP_HUGETLB
+   pMemory = (unsigned char *)mmap(NULL, nMapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+   if (pMemory != (unsigned char *)MAP_FAILED) {
+      *pMappedSize = nMapSize;
+      return pMemory;
+   }
+#endif
+
+   /* Map an extra huge page, and trim the mapping so that it starts on a huge page boundary, for transparent huge pages to back all of it */
+   pMemory = (unsigned char *)mmap(NULL, nMapSize + SALVADOR_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (pMemory == (unsigned char *)MAP_FAILED)
+      return NULL;
+
+   nHeadSize = (SALVADOR_HUGE_PAGE_SIZE - ((size_t)pMemory & (SALVADOR_HUGE_PAGE_SIZE - 1))) & (SALVADOR_HUGE_PAGE_SIZE - 1);
+   if (nHeadSize)
+      munmap(pMemory, nHeadSize);
+   if (nHeadSize != SALVADOR_HUGE_PAGE_SIZE)
+      munmap(pMemory + nHeadSize + nMapSize, SALVADOR_HUGE_PAGE_SIZE - nHeadSize);
+   pMemory += nHeadSize;
+
+#ifdef MADV_HUGEPAGE
+   madvise(pMemory, nMapSize, MADV_HUGEPAGE);
+#endif
+
+   *pMappedSize = nMapSize;
+   return pMemory;
+#else
+   *pMappedSize = 0;
+   return NULL;
+#endif
+}
+
+/**
+ * Set an arena up to only count the bytes that the tables carved out of it need, before it is allocated
+ *
+ * @param pArena arena to set up
+ * @param pSource source of the memory for the arena, or NULL for the C heap
+ */
+void salvador_arena_measure(salvador_arena *pArena, const salvador_memory_source *pSource) {
+   memset(pArena, 0, sizeof(salvador_arena));
+   if (pSource)
+      pArena->allocator = pSource->allocator;
+}
+
+/**
+ * Allocate an arena, for the number of bytes counted since salvador_arena_measure()
+ *
+ * @param pArena arena to allocate
+ * @param pSource source of the memory for the arena, or NULL for the C heap
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_arena_init(salvador_arena *pArena, const salvador_memory_source *pSource) {
+   const size_t nSize = pArena->used;
+   const int nHugePages = pSource ? pSource->huge_pages : 0;
+
+   pArena->base = NULL;
+   pArena->memory = NULL;
+   pArena->size = 0;
+   pArena->used = 0;
+   pArena->mapped_size = 0;
+   pArena->is_borrowed = 0;
+
+   if (pSource && pSource->block) {
+      const size_t nAlignSize = (SALVADOR_ARENA_ALIGNMENT - ((size_t)pSource->block & (SALVADOR_ARENA_ALIGNMENT - 1))) & (SALVADOR_ARENA_ALIGNMENT - 1);
+
+      if (pSource->block_size < nAlignSize || (pSource->block_size - nAlignSize) < nSize)
+         return 100;
+      pArena->memory = pSource->block;
+      pArena->is_borrowed = 1;
+   }
+   else if (pArena->allocator.alloc_func) {
+      pArena->memory = (unsigned char *)pArena->allocator.alloc_func(nSize + SALVADOR_ARENA_ALIGNMENT - 1, pArena->allocator.user_data);
+   }
+   else {
+      if (nHugePages && nSize >= SALVADOR_HUGE_PAGE_SIZE)
+         pArena->memory = salvador_arena_map(nSize, &pArena->mapped_size);
+      if (!pArena->memory)
+         pArena->memory = (unsigned char *)malloc(nSize + SALVADOR_ARENA_ALIGNMENT - 1);
+   }
+
+   if (!pArena->memory)
+      return 100;
+
+   pArena->base = pArena->memory + ((SALVADOR_ARENA_ALIGNMENT - ((size_t)pArena->memory & (SALVADOR_ARENA_ALIGNMENT - 1))) & (SALVADOR_ARENA_ALIGNMENT - 1));
+   pArena->size = nSize;
+   return 0;
+}
+
+/**
+ * Carve a table out of an arena
+ *
+ * @param pArena arena
+ * @param nSize size of the table in bytes
+ *
+ * @return table, aligned to SALVADOR_ARENA_ALIGNMENT, or NULL if the arena only counts bytes or is full
+ */
+void *salvador_arena_carve(salvador_arena *pArena, const size_t nSize) {
+   const size_t nOffset = (pArena->used + SALVADOR_ARENA_ALIGNMENT - 1) & ~((size_t)SALVADOR_ARENA_ALIGNMENT - 1);
+
+   if (!pArena->base) {
+      pArena->used = nOffset + nSize;
+      return NULL;
+   }
+
+   if (nOffset > pArena->size || nSize > (pArena->size - nOffset))
+      return NULL;
+
+   pArena->used = nOffset + nSize;
+   return pArena->base + nOffset;
+}
+
+/**
+ * Get the number of bytes that an arena takes out of a memory block supplied by the caller
+ *
+ * @param pArena arena
+ *
+ * @return number of bytes, including the alignment of its start
+ */
+size_t salvador_arena_get_footprint(const salvador_arena *pArena) {
+   if (pArena->memory)
+      return (size_t)(pArena->base - pArena->memory) + pArena->size;
+   else
+      return 0;
+}
+
+/**
+ * Free an arena, if it was allocated
+ *
+ * @param pArena arena to free
+ */
+void salvador_arena_destroy(salvador_arena *pArena) {
+   if (pArena->memory && !pArena->is_borrowed) {
+      if (pArena->mapped_size) {
+#ifdef _WIN32
+         VirtualFree(pArena->memory, 0, MEM_RELEASE);
+#else
+         munmap(pArena->memory, pArena->mapped_size);
+#endif
+      }
+      else {
+         salvador_mem_free(&pArena->allocator, pArena->memory);
+      }
+   }
+
+   pArena->base = NULL;
+   pArena->memory = NULL;
+   pArena->size = 0;
+   pArena->used = 0;
+   pArena->mapped_size = 0;
+   pArena->is_borrowed = 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * arena.h - compressor working memory definitions
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Alignment of the tables carved out of an arena, in bytes: one cache line */
+#define SALVADOR_ARENA_ALIGNMENT 64
+
+/** Smallest arena that is mapped with huge pages, in bytes */
+#define SALVADOR_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/** Memory allocator callbacks, for hosts that control where the working memory of the compressor comes from */
+typedef struct _salvador_allocator {
+   void *(*alloc_func)(size_t nSize, void *pUserData);   /**< allocate nSize bytes, aligned for any type, or return NULL for failure */
+   void (*free_func)(void *pMemory, void *pUserData);    /**< free memory returned by alloc_func */
+   void *user_data;                                      /**< user data passed to both callbacks */
+} salvador_allocator;
+
+/** Where the arena of a compression context comes from */
+typedef struct _salvador_memory_source {
+   salvador_allocator allocator;    /**< allocator callbacks, or NULL functions for the C heap */
+   unsigned char *block;            /**< memory block supplied by the caller to carve the arena out of, or NULL to allocate it */
+   size_t block_size;               /**< size of that block in bytes */
+   int huge_pages;                  /**< 1 to map arenas allocated without callbacks from the OS, asking for huge pages, 0 for the C heap */
+} salvador_memory_source;
+
+/** Single block of memory that the fixed-size tables of a compression context are carved out of */
+typedef struct _salvador_arena {
+   unsigned char *base;             /**< start of the arena, aligned to SALVADOR_ARENA_ALIGNMENT, or NULL if it only counts bytes */
+   unsigned char *memory;           /**< memory as allocated, or as supplied by the caller */
+   size_t size;                     /**< usable size of the arena in bytes */
+   size_t used;                     /**< bytes carved out so far, including alignment */
+   size_t mapped_size;              /**< size of the mapping if the arena was mapped from the OS, 0 otherwise */
+   int is_borrowed;                 /**< 1 if the memory was supplied by the caller, and isn't freed with the arena */
+   salvador_allocator allocator;    /**< allocator callbacks, also used for the tables that grow while compressing */
+} salvador_arena;
+
+/**
+ * Allocate memory with allocator callbacks, or with the C heap
+ *
+ * @param pAllocator allocator callbacks, with NULL functions for the C heap
+ * @param nSize number of bytes to allocate
+ *
+ * @return allocated memory, or NULL for failure
+ */
+void *salvador_mem_alloc(const salvador_allocator *pAllocator, const size_t nSize);
+
+/**
+ * Grow or shrink memory allocated with salvador_mem_alloc()
+ *
+ * @param pAllocator allocator callbacks that the memory was allocated with
+ * @param pMemory memory to resize, or NULL
+ * @param nOldSize current size of the memory in bytes
+ * @param nNewSize new size in bytes
+ *
+ * @return resized memory, or NULL for failure, in which case the memory is left as it was
+ */
+void *salvador_mem_realloc(const salvador_allocator *pAllocator, void *pMemory, const size_t nOldSize, const size_t nNewSize);
+
+/**
+ * Free memory allocated with salvador_mem_alloc()
+ *
+ * @param pAllocator allocator callbacks that the memory was allocated with
+ * @param pMemory memory to free, or NULL
+ */
+void salvador_mem_free(const salvador_allocator *pAllocator, void *pMemory);
+
+/**
+ * Set an arena up to only count the bytes that the tables carved out of it need, before it is allocated
+ *
+ * @param pArena arena to set up
+ * @param pSource source of the memory for the arena, or NULL for the C heap
+ */
+void salvador_arena_measure(salvador_arena *pArena, const salvador_memory_source *pSource);
+
+/**
+ * Allocate an arena, for the number of bytes counted since salvador_arena_measure()
+ *
+ * @param pArena arena to allocate
+ * @param pSource source of the memory for the arena, or NULL for the C heap
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_arena_init(salvador_arena *pArena, const salvador_memory_source *pSource);
+
+/**
+ * Carve a table out of an arena
+ *
+ * @param pArena arena
+ * @param nSize size of the table in bytes
+ *
+ * @return table, aligned to SALVADOR_ARENA_ALIGNMENT, or NULL if the arena only counts bytes or is full
+ */
+void *salvador_arena_carve(salvador_arena *pArena, const size_t nSize);
+
+/**
+ * Get the number of bytes that an arena takes out of a memory block supplied by the caller
+ *
+ * @param pArena arena
+ *
+ * @return number of bytes, including the alignment of its start
+ */
+size_t salvador_arena_get_footprint(const salvador_arena *pArena);
+
+/**
+ * Free an arena, if it was allocated
+ *
+ * @param pArena arena to free
+ */
+void salvador_arena_destroy(salvador_arena *pArena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ARENA_H */
@@ -0,0 +1,363 @@
+/*
+ * dictionary.c - prepared dictionary implementation
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dictionary.h"
+#include "format.h"
+#include "shrink.h"
+#include "libsalvador.h"
+#include "simd.h"
+
+#define DICTIONARY_SAVED_HEADER_SIZE 16
+#define DICTIONARY_SAVED_VERSION 1
+
+/**
+ * Allocate prepared dictionary and copy the dictionary bytes into it, along with the bytes to index, in the order that the compressor walks them
+ *
+ * @param pDictionaryData dictionary bytes
+ * @param nDictionarySize dictionary size in bytes
+ * @param nFlags compression flags that the dictionary is used with
+ *
+ * @return prepared dictionary with unset suffix array and LCP, or NULL for failure
+ */
+static salvador_dictionary *salvador_dictionary_alloc(const unsigned char *pDictionaryData, const size_t nDictionarySize, const unsigned int nFlags) {
+   salvador_dictionary *pDictionary;
+   int i;
+
+   if (!nDictionarySize || nDictionarySize > BLOCK_SIZE)
+      return NULL;
+
+   pDictionary = (salvador_dictionary *)malloc(sizeof(salvador_dictionary));
+   if (!pDictionary)
+      return NULL;
+
+   pDictionary->size = (int)nDictionarySize;
+   pDictionary->flags = ((nFlags & FLG_IS_BACKWARD) && (nFlags & FLG_NATIVE_BACKWARD)) ? (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD) : 0;
+   pDictionary->indexed_size = (pDictionary->size < MAX_OFFSET) ? pDictionary->size : MAX_OFFSET;
+   pDictionary->data = (unsigned char *)malloc(pDictionary->size);
+   pDictionary->indexed_data = (unsigned char *)malloc(pDictionary->indexed_size);
+   pDictionary->suffix_array = (int *)malloc(pDictionary->indexed_size * sizeof(int));
+   pDictionary->lcp = (int *)malloc(pDictionary->indexed_size * sizeof(int));
+
+   if (!pDictionary->data || !pDictionary->indexed_data || !pDictionary->suffix_array || !pDictionary->lcp) {
+      salvador_dictionary_destroy(pDictionary);
+      return NULL;
+   }
+
+   memcpy(pDictionary->data, pDictionaryData, pDictionary->size);
+
+   if (pDictionary->flags & FLG_NATIVE_BACKWARD) {
+      /* The dictionary follows the input, and is walked from its first byte backwards; the bytes closest to the input come last */
+      for (i = 0; i < pDictionary->indexed_size; i++)
+         pDictionary->indexed_data[i] = pDictionaryData[pDictionary->indexed_size - 1 - i];
+   }
+   else {
+      memcpy(pDictionary->indexed_data, pDictionaryData + (pDictionary->size - pDictionary->indexed_size), pDictionary->indexed_size);
+   }
+
+   return pDictionary;
+}
+
+/**
+ * Prepare dictionary for compressing many inputs. The dictionary is suffix-sorted and indexed once, and shared read-only by all
+ * the compression contexts that it is attached to, on any number of threads
+ *
+ * @param pDictionaryData dictionary bytes
+ * @param nDictionarySize dictionary size in bytes
+ * @param nFlags compression flags that the dictionary is used with; only FLG_IS_BACKWARD and FLG_NATIVE_BACKWARD matter
+ *
+ * @return prepared dictionary, or NULL for failure
+ */
+salvador_dictionary *salvador_dictionary_create(const unsigned char *pDictionaryData, const size_t nDictionarySize, const unsigned int nFlags) {
+   salvador_dictionary *pDictionary = salvador_dictionary_alloc(pDictionaryData, nDictionarySize, nFlags);
+   divsufsort_ctx_t divsufsort_context;
+   const unsigned char *pData;
+   int *PLCP;
+   int nSize, nCurLen, i;
+
+   if (!pDictionary)
+      return NULL;
+
+   pData = pDictionary->indexed_data;
+   nSize = pDictionary->indexed_size;
+
+   if (divsufsort_init(&divsufsort_context)) {
+      salvador_dictionary_destroy(pDictionary);
+      return NULL;
+   }
+   if (divsufsort_build_array(&divsufsort_context, pData, (saidx_t *)pDictionary->suffix_array, nSize) != 0) {
+      divsufsort_destroy(&divsufsort_context);
+      salvador_dictionary_destroy(pDictionary);
+      return NULL;
+   }
+   divsufsort_destroy(&divsufsort_context);
+
+   /* Compute the permuted LCP (Karkkainen method), like the match finder does, then rotate it into the LCP */
+   PLCP = (int *)malloc(nSize * sizeof(int));
+   if (!PLCP) {
+      salvador_dictionary_destroy(pDictionary);
+      return NULL;
+   }
+
+   PLCP[pDictionary->suffix_array[0]] = -1;
+   for (i = 1; i < nSize; i++)
+      PLCP[pDictionary->suffix_array[i]] = pDictionary->suffix_array[i - 1];
+
+   nCurLen = 0;
+   for (i = 0; i < nSize; i++) {
+      const int nPrev = PLCP[i];
+
+      if (nPrev == -1) {
+         PLCP[i] = 0;
+         continue;
+      }
+      const int nMaxLen = (i > nPrev) ? (nSize - i) : (nSize - nPrev);
+      while (nCurLen < nMaxLen && pData[i + nCurLen] == pData[nPrev + nCurLen]) nCurLen++;
+      PLCP[i] = nCurLen;
+      if (nCurLen > 0)
+         nCurLen--;
+   }
+
+   for (i = 0; i < nSize; i++) {
+      const int nLen = PLCP[pDictionary->suffix_array[i]];
+      pDictionary->lcp[i] = (nLen < (int)LCP_MAX) ? nLen : (int)LCP_MAX;
+   }
+
+   free(PLCP);
+   return pDictionary;
+}
+
+/**
+ * Destroy prepared dictionary and free up all associated resources
+ *
+ * @param pDictionary prepared dictionary, or NULL
+ */
+void salvador_dictionary_destroy(salvador_dictionary *pDictionary) {
+   if (pDictionary) {
+      if (pDictionary->lcp) {
+         free(pDictionary->lcp);
+         pDictionary->lcp = NULL;
+      }
+      if (pDictionary->suffix_array) {
+         free(pDictionary->suffix_array);
+         pDictionary->suffix_array = NULL;
+      }
+      if (pDictionary->indexed_data) {
+         free(pDictionary->indexed_data);
+         pDictionary->indexed_data = NULL;
+      }
+      if (pDictionary->data) {
+         free(pDictionary->data);
+         pDictionary->data = NULL;
+      }
+      free(pDictionary);
+   }
+}
+
+/**
+ * Get the bytes of a prepared dictionary, to place them next to the data to compress, or to decompress with
+ *
+ * @param pDictionary prepared dictionary
+ * @param pDictionarySize pointer to returned dictionary size in bytes
+ *
+ * @return dictionary bytes, as supplied when the dictionary was created
+ */
+const unsigned char *salvador_dictionary_get_data(const salvador_dictionary *pDictionary, size_t *pDictionarySize) {
+   *pDictionarySize = (size_t)pDictionary->size;
+   return pDictionary->data;
+}
+
+/**
+ * Get the number of bytes needed to save a prepared dictionary
+ *
+ * @param pDictionary prepared dictionary
+ *
+ * @return saved size in bytes
+ */
+size_t salvador_dictionary_get_saved_size(const salvador_dictionary *pDictionary) {
+   return DICTIONARY_SAVED_HEADER_SIZE + (size_t)pDictionary->size + (size_t)pDictionary->indexed_size * 4;
+}
+
+/**
+ * Write 32-bit little-endian value
+ *
+ * @param pOut output buffer
+ * @param nValue value to write
+ */
+static void salvador_dictionary_write_le32(unsigned char *pOut, const unsigned int nValue) {
+   pOut[0] = nValue & 0xff;
+   pOut[1] = (nValue >> 8) & 0xff;
+   pOut[2] = (nValue >> 16) & 0xff;
+   pOut[3] = (nValue >> 24) & 0xff;
+}
+
+/**
+ * Read 32-bit little-endian value
+ *
+ * @param pIn input buffer
+ *
+ * @return value
+ */
+static unsigned int salvador_dictionary_read_le32(const unsigned char *pIn) {
+   return ((unsigned int)pIn[0]) | (((unsigned int)pIn[1]) << 8) | (((unsigned int)pIn[2]) << 16) | (((unsigned int)pIn[3]) << 24);
+}
+
+/**
+ * Save prepared dictionary, so that it can be loaded again without suffix-sorting it
+ *
+ * @param pDictionary prepared dictionary
+ * @param pOutBuffer buffer for saved dictionary
+ * @param nMaxOutBufferSize maximum capacity of buffer, at least salvador_dictionary_get_saved_size() bytes
+ *
+ * @return saved size in bytes, or -1 for error
+ */
+size_t salvador_dictionary_save(const salvador_dictionary *pDictionary, unsigned char *pOutBuffer, const size_t nMaxOutBufferSize) {
+   const size_t nSavedSize = salvador_dictionary_get_saved_size(pDictionary);
+   unsigned char *pOut = pOutBuffer;
+   int i;
+
+   if (nMaxOutBufferSize < nSavedSize)
+      return -1;
+
+   memcpy(pOut, "SLVD", 4);
+   pOut[4] = DICTIONARY_SAVED_VERSION;
+   pOut[5] = (pDictionary->flags & FLG_NATIVE_BACKWARD) ? 1 : 0;
+   pOut[6] = 0;
+   pOut[7] = 0;
+   salvador_dictionary_write_le32(pOut + 8, (unsigned int)pDictionary->size);
+   salvador_dictionary_write_le32(pOut + 12, (unsigned int)pDictionary->indexed_size);
+   pOut += DICTIONARY_SAVED_HEADER_SIZE;
+
+   memcpy(pOut, pDictionary->data, pDictionary->size);
+   pOut += pDictionary->size;
+
+   for (i = 0; i < pDictionary->indexed_size; i++, pOut += 4)
+      salvador_dictionary_write_le32(pOut, (unsigned int)pDictionary->suffix_array[i]);
+
+   return nSavedSize;
+}
+
+/**
+ * Check whether data holds a saved prepared dictionary
+ *
+ * @param pData data to check
+ * @param nDataSize size of data in bytes
+ *
+ * @return 1 if the data starts like a saved prepared dictionary, 0 otherwise
+ */
+int salvador_dictionary_is_saved(const unsigned char *pData, const size_t nDataSize) {
+   return (nDataSize >= DICTIONARY_SAVED_HEADER_SIZE && !memcmp(pData, "SLVD", 4) && pData[4] == DICTIONARY_SAVED_VERSION) ? 1 : 0;
+}
+
+/**
+ * Load saved prepared dictionary. The saved suffix array is checked, so that corrupted data is rejected instead of producing
+ * invalid matches
+ *
+ * @param pData saved dictionary
+ * @param nDataSize size of saved dictionary in bytes
+ *
+ * @return prepared dictionary, or NULL for failure
+ */
+salvador_dictionary *salvador_dictionary_load(const unsigned char *pData, const size_t nDataSize) {
+   salvador_dictionary *pDictionary;
+   const unsigned char *pSuffixArray;
+   unsigned char *pSeen;
+   size_t nDictionarySize, nIndexedSize;
+   int i;
+
+   if (!salvador_dictionary_is_saved(pData, nDataSize) || (pData[5] & ~1) || pData[6] || pData[7])
+      return NULL;
+
+   nDictionarySize = salvador_dictionary_read_le32(pData + 8);
+   nIndexedSize = salvador_dictionary_read_le32(pData + 12);
+   if (!nDictionarySize || nDictionarySize > BLOCK_SIZE || nIndexedSize != ((nDictionarySize < MAX_OFFSET) ? nDictionarySize : MAX_OFFSET) ||
+      nDataSize != (DICTIONARY_SAVED_HEADER_SIZE + nDictionarySize + nIndexedSize * 4))
+      return NULL;
+
+   pDictionary = salvador_dictionary_alloc(pData + DICTIONARY_SAVED_HEADER_SIZE, nDictionarySize, (pData[5] & 1) ? (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD) : 0);
+   if (!pDictionary)
+      return NULL;
+
+   /* The suffix array must be a permutation of the indexed positions */
+   pSeen = (unsigned char *)calloc(nIndexedSize, 1);
+   if (!pSeen) {
+      salvador_dictionary_destroy(pDictionary);
+      return NULL;
+   }
+
+   pSuffixArray = pData + DICTIONARY_SAVED_HEADER_SIZE + nDictionarySize;
+   for (i = 0; i < (int)nIndexedSize; i++) {
+      const unsigned int nPos = salvador_dictionary_read_le32(pSuffixArray + i * 4);
+
+      if (nPos >= nIndexedSize || pSeen[nPos]) {
+         free(pSeen);
+         salvador_dictionary_destroy(pDictionary);
+         return NULL;
+      }
+      pSeen[nPos] = 1;
+      pDictionary->suffix_array[i] = (int)nPos;
+   }
+   free(pSeen);
+
+   /* Compare neighbouring suffixes directly instead of trusting the saved order. The match finder only relies on the LCP to report
+    * matches, so an exact LCP is enough for the matches to be valid; checking the order too catches a corrupted file. */
+   pDictionary->lcp[0] = 0;
+   for (i = 1; i < (int)nIndexedSize; i++) {
+      const int nPrevPos = pDictionary->suffix_array[i - 1];
+      const int nCurPos = pDictionary->suffix_array[i];
+      const int nPrevLen = (int)nIndexedSize - nPrevPos;
+      const int nCurLen = (int)nIndexedSize - nCurPos;
+      int nMaxLen = (nPrevLen < nCurLen) ? nPrevLen : nCurLen;
+      int nLen;
+
+      if (nMaxLen > (int)LCP_MAX)
+         nMaxLen = LCP_MAX;
+      nLen = salvador_get_common_len(pDictionary->indexed_data + nPrevPos, pDictionary->indexed_data + nCurPos, nMaxLen);
+
+      if (nLen < nMaxLen) {
+         if (pDictionary->indexed_data[nPrevPos + nLen] >= pDictionary->indexed_data[nCurPos + nLen])
+            break;
+      }
+      else if (nLen < (int)LCP_MAX && nLen != nPrevLen) {
+         /* A suffix that is a prefix of the next one sorts first */
+         break;
+      }
+
+      pDictionary->lcp[i] = nLen;
+   }
+
+   if (i < (int)nIndexedSize) {
+      salvador_dictionary_destroy(pDictionary);
+      return NULL;
+   }
+
+   return pDictionary;
+}
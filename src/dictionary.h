@@ -0,0 +1,125 @@
+/*
+ * dictionary.h - prepared dictionary definitions
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#ifndef _DICTIONARY_H
+#define _DICTIONARY_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Prepared dictionary */
+typedef struct _salvador_dictionary {
+   unsigned char *data;              /**< dictionary bytes, as supplied */
+   int size;                         /**< dictionary size in bytes */
+   int flags;                        /**< FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD if prepared for native backward compression, 0 otherwise */
+   unsigned char *indexed_data;      /**< bytes that matches can reach: the end of the dictionary, up to the maximum offset, in the order that the compressor walks them */
+   int indexed_size;                 /**< number of indexed bytes */
+   int *suffix_array;                /**< suffix array of the indexed bytes */
+   int *lcp;                         /**< length of the prefix shared with the previous suffix in the suffix array, up to LCP_MAX */
+} salvador_dictionary;
+
+/**
+ * Prepare dictionary for compressing many inputs. The dictionary is suffix-sorted and indexed once, and shared read-only by all
+ * the compression contexts that it is attached to, on any number of threads
+ *
+ * @param pDictionaryData dictionary bytes
+ * @param nDictionarySize dictionary size in bytes
+ * @param nFlags compression flags that the dictionary is used with; only FLG_IS_BACKWARD and FLG_NATIVE_BACKWARD matter
+ *
+ * @return prepared dictionary, or NULL for failure
+ */
+salvador_dictionary *salvador_dictionary_create(const unsigned char *pDictionaryData, const size_t nDictionarySize, const unsigned int nFlags);
+
+/**
+ * Destroy prepared dictionary and free up all associated resources
+ *
+ * @param pDictionary prepared dictionary, or NULL
+ */
+void salvador_dictionary_destroy(salvador_dictionary *pDictionary);
+
+/**
+ * Get the bytes of a prepared dictionary, to place them next to the data to compress, or to decompress with
+ *
+ * @param pDictionary prepared dictionary
+ * @param pDictionarySize pointer to returned dictionary size in bytes
+ *
+ * @return dictionary bytes, as supplied when the dictionary was created
+ */
+const unsigned char *salvador_dictionary_get_data(const salvador_dictionary *pDictionary, size_t *pDictionarySize);
+
+/**
+ * Get the number of bytes needed to save a prepared dictionary
+ *
+ * @param pDictionary prepared dictionary
+ *
+ * @return saved size in bytes
+ */
+size_t salvador_dictionary_get_saved_size(const salvador_dictionary *pDictionary);
+
+/**
+ * Save prepared dictionary, so that it can be loaded again without suffix-sorting it
+ *
+ * @param pDictionary prepared dictionary
+ * @param pOutBuffer buffer for saved dictionary
+ * @param nMaxOutBufferSize maximum capacity of buffer, at least salvador_dictionary_get_saved_size() bytes
+ *
+ * @return saved size in bytes, or -1 for error
+ */
+size_t salvador_dictionary_save(const salvador_dictionary *pDictionary, unsigned char *pOutBuffer, const size_t nMaxOutBufferSize);
+
+/**
+ * Check whether data holds a saved prepared dictionary
+ *
+ * @param pData data to check
+ * @param nDataSize size of data in bytes
+ *
+ * @return 1 if the data starts like a saved prepared dictionary, 0 otherwise
+ */
+int salvador_dictionary_is_saved(const unsigned char *pData, const size_t nDataSize);
+
+/**
+ * Load saved prepared dictionary. The saved suffix array is checked, so that corrupted data is rejected instead of producing
+ * invalid matches
+ *
+ * @param pData saved dictionary
+ * @param nDataSize size of saved dictionary in bytes
+ *
+ * @return prepared dictionary, or NULL for failure
+ */
+salvador_dictionary *salvador_dictionary_load(const unsigned char *pData, const size_t nDataSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DICTIONARY_H */
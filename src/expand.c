@@ -40,6 +40,29 @@
 #define FORCE_INLINE __attribute__((always_inline))
 #endif /* _MSC_VER */
 
+/** Gamma values that grow this large are rejected while they are read: they can't be valid, and shifting them further would overflow an int */
+#define SAFE_MAX_ELIAS_VALUE 0x40000000
+
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline FORCE_INLINE int salvador_clz32(const unsigned int nValue) {
+   unsigned long nIndex;
+
+   _BitScanReverse(&nIndex, nValue);
+   return 31 - (int)nIndex;
+}
+
+static inline FORCE_INLINE int salvador_ctz32(const unsigned int nValue) {
+   unsigned long nIndex;
+
+   _BitScanForward(&nIndex, nValue);
+   return (int)nIndex;
+}
+#else /* _MSC_VER */
+#define salvador_clz32(__nValue) __builtin_clz(__nValue)
+#define salvador_ctz32(__nValue) __builtin_ctz(__nValue)
+#endif /* _MSC_VER */
+
 static inline FORCE_INLINE int salvador_read_bit(const unsigned char **ppInBlock, const unsigned char *pDataEnd, int *nCurBitMask, unsigned char *bits) {
    int nBit;
 
@@ -65,11 +88,13 @@ static inline FORCE_INLINE int salvador_read_elias(const unsigned char** ppInBlo
 
    if (nIsBackward) {
       while (salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits) == 1) {
+         if (nValue >= SAFE_MAX_ELIAS_VALUE) return -1;
          nValue = (nValue << 1) | salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits);
       }
    }
    else {
       while (!salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits)) {
+         if (nValue >= SAFE_MAX_ELIAS_VALUE) return -1;
          nValue = (nValue << 1) | salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits);
       }
    }
@@ -81,6 +106,7 @@ static inline FORCE_INLINE int salvador_read_elias_inverted(const unsigned char*
    int nValue = nInitialValue;
 
    while (!salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits)) {
+      if (nValue >= SAFE_MAX_ELIAS_VALUE) return -1;
       nValue = (nValue << 1) | (salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits) ^ 1);
    }
 
@@ -94,6 +120,7 @@ static inline FORCE_INLINE int salvador_read_elias_prefix(const unsigned char**
       if (nFirstBit) {
          nValue = (nValue << 1) | salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits);
          while (salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits) == 1) {
+            if (nValue >= SAFE_MAX_ELIAS_VALUE) return -1;
             nValue = (nValue << 1) | salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits);
          }
       }
@@ -102,6 +129,7 @@ static inline FORCE_INLINE int salvador_read_elias_prefix(const unsigned char**
       if (!nFirstBit) {
          nValue = (nValue << 1) | salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits);
          while (!salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits)) {
+            if (nValue >= SAFE_MAX_ELIAS_VALUE) return -1;
             nValue = (nValue << 1) | salvador_read_bit(ppInBlock, pDataEnd, nCurBitMask, bits);
          }
       }
@@ -110,25 +138,89 @@ static inline FORCE_INLINE int salvador_read_elias_prefix(const unsigned char**
    return nValue;
 }
 
+static inline FORCE_INLINE int salvador_read_bit_native(const unsigned char **ppInBlock, const unsigned char *pDataStart, int *nCurBitMask, unsigned char *bits) {
+   int nBit;
+
+   const unsigned char* pInBlock = *ppInBlock;
+
+   if ((*nCurBitMask) == 0) {
+      if (pInBlock <= pDataStart) return -1;
+      (*bits) = *--pInBlock;
+      (*nCurBitMask) = 128;
+   }
+
+   nBit = ((*bits) & 128) ? 1 : 0;
+
+   (*bits) <<= 1;
+   (*nCurBitMask) >>= 1;
+
+   *ppInBlock = pInBlock;
+   return nBit;
+}
+
+static inline FORCE_INLINE int salvador_read_elias_native(const unsigned char** ppInBlock, const unsigned char* pDataStart, const int nInitialValue, int* nCurBitMask, unsigned char* bits) {
+   int nValue = nInitialValue;
+
+   while (salvador_read_bit_native(ppInBlock, pDataStart, nCurBitMask, bits) == 1) {
+      if (nValue >= SAFE_MAX_ELIAS_VALUE) return -1;
+      nValue = (nValue << 1) | salvador_read_bit_native(ppInBlock, pDataStart, nCurBitMask, bits);
+   }
+
+   return nValue;
+}
+
+static inline FORCE_INLINE int salvador_read_elias_prefix_native(const unsigned char** ppInBlock, const unsigned char* pDataStart, const int nInitialValue, int* nCurBitMask, unsigned char* bits, unsigned int nFirstBit) {
+   int nValue = nInitialValue;
+
+   if (nFirstBit) {
+      nValue = (nValue << 1) | salvador_read_bit_native(ppInBlock, pDataStart, nCurBitMask, bits);
+      while (salvador_read_bit_native(ppInBlock, pDataStart, nCurBitMask, bits) == 1) {
+         if (nValue >= SAFE_MAX_ELIAS_VALUE) return -1;
+         nValue = (nValue << 1) | salvador_read_bit_native(ppInBlock, pDataStart, nCurBitMask, bits);
+      }
+   }
+
+   return nValue;
+}
+
 /**
- * Get maximum decompressed size of compressed data
+ * Get in-place safe distance from the largest lead of the output over the consumed compressed bytes
+ *
+ * @param nInputSize compressed size in bytes
+ * @param nDecompressedSize decompressed size in bytes
+ * @param nMaxLead largest number of bytes written, minus the number of compressed bytes consumed, at the point of any write
+ *
+ * @return safe distance
+ */
+static size_t salvador_get_safe_distance_from_lead(size_t nInputSize, size_t nDecompressedSize, long long nMaxLead) {
+   /* The buffer must hold the compressed data plus the largest lead, and the whole decompressed data */
+   long long nBufferSize = (long long)nInputSize + nMaxLead;
+
+   if (nBufferSize < (long long)nDecompressedSize)
+      nBufferSize = (long long)nDecompressedSize;
+   return (size_t)(nBufferSize - nDecompressedSize);
+}
+
+/**
+ * Scan backward compressed data in file order, reading it from the end (FLG_NATIVE_BACKWARD), without decompressing it
  *
  * @param pInputData compressed data
  * @param nInputSize compressed size in bytes
- * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer, or (size_t)-1 for no limit
+ * @param nDictionarySize size of dictionary after the decompression buffer, or (size_t)-1 to not check match offsets
+ * @param pSafeDistance pointer to returned in-place safe distance (see salvador_get_inplace_safe_distance()), or NULL
  *
- * @return maximum decompressed size
+ * @return decompressed size, or -1 for error
  */
-size_t salvador_get_max_decompressed_size(const unsigned char *pInputData, size_t nInputSize, const unsigned int nFlags) {
-   const unsigned char* pInputDataEnd = pInputData + nInputSize;
+static size_t salvador_scan_compressed_data_native(const unsigned char *pInputData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, size_t *pSafeDistance) {
+   const unsigned char* pCurInData = pInputData + nInputSize;
    int nCurBitMask = 0;
    unsigned char bits = 0;
    int nIsFirstCommand = 1;
-   const int nIsInverted = (nFlags & FLG_IS_INVERTED) && !(nFlags & FLG_IS_BACKWARD);
-   const int nIsBackward = (nFlags & FLG_IS_BACKWARD) ? 1 : 0;
-   int nDecompressedSize = 0;
+   size_t nDecompressedSize = 0;
+   long long nMaxLead = 0;
 
-   if (pInputData >= pInputDataEnd)
+   if (pCurInData <= pInputData)
       return -1;
 
    while (1) {
@@ -141,18 +233,21 @@ size_t salvador_get_max_decompressed_size(const unsigned char *pInputData, size_
       }
       else {
          /* Read match with offset / literals bit */
-         nIsMatchWithOffset = salvador_read_bit(&pInputData, pInputDataEnd, &nCurBitMask, &bits);
+         nIsMatchWithOffset = salvador_read_bit_native(&pCurInData, pInputData, &nCurBitMask, &bits);
          if (nIsMatchWithOffset == -1)
             return -1;
       }
 
       if (nIsMatchWithOffset == 0) {
-         unsigned int nLiterals = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
+         unsigned int nLiterals = salvador_read_elias_native(&pCurInData, pInputData, 1, &nCurBitMask, &bits);
 
-         /* Count literals */
+         /* Count literals; they are copied before any output is written over the bytes they are read from */
 
-         if ((pInputData + nLiterals) <= pInputDataEnd) {
-            pInputData += nLiterals;
+         if ((long long)nDecompressedSize - (long long)(pInputData + nInputSize - pCurInData) > nMaxLead)
+            nMaxLead = (long long)nDecompressedSize - (long long)(pInputData + nInputSize - pCurInData);
+
+         if (nLiterals <= (unsigned int)(pCurInData - pInputData) && nLiterals <= (nMaxOutBufferSize - nDecompressedSize)) {
+            pCurInData -= nLiterals;
             nDecompressedSize += nLiterals;
          }
          else {
@@ -161,7 +256,7 @@ size_t salvador_get_max_decompressed_size(const unsigned char *pInputData, size_
 
          /* Read match with offset / rep match bit */
 
-         nIsMatchWithOffset = salvador_read_bit(&pInputData, pInputDataEnd, &nCurBitMask, &bits);
+         nIsMatchWithOffset = salvador_read_bit_native(&pCurInData, pInputData, &nCurBitMask, &bits);
          if (nIsMatchWithOffset == -1)
             return -1;
       }
@@ -171,62 +266,192 @@ size_t salvador_get_max_decompressed_size(const unsigned char *pInputData, size_
       if (nIsMatchWithOffset) {
          /* Match with offset */
 
-         unsigned int nMatchOffsetHighByte;
-
-         if (nIsInverted)
-            nMatchOffsetHighByte = salvador_read_elias_inverted(&pInputData, pInputDataEnd, 1, &nCurBitMask, &bits);
-         else
-            nMatchOffsetHighByte = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
+         unsigned int nMatchOffsetHighByte = salvador_read_elias_native(&pCurInData, pInputData, 1, &nCurBitMask, &bits);
 
          if (nMatchOffsetHighByte == 256)
             break;
+         if (nMatchOffsetHighByte > 256)
+            return -1;
 
-         if (pInputData >= pInputDataEnd)
+         if (pCurInData <= pInputData)
             return -1;
 
-         unsigned int nMatchOffsetLowByte = (unsigned int)(*pInputData++);
+         unsigned int nMatchOffsetLowByte = (unsigned int)(*--pCurInData);
+         const size_t nMatchOffset = (size_t)((((nMatchOffsetHighByte - 1) << 7) | (nMatchOffsetLowByte >> 1)) + 1);
 
-         nMatchLen = salvador_read_elias_prefix(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits, nMatchOffsetLowByte & 1);
+         /* The match must start in the bytes decompressed so far, or in the dictionary */
+         if (nMatchOffset > nDictionarySize && (nMatchOffset - nDictionarySize) > nDecompressedSize)
+            return -1;
+
+         nMatchLen = salvador_read_elias_prefix_native(&pCurInData, pInputData, 1, &nCurBitMask, &bits, nMatchOffsetLowByte & 1);
 
          nMatchLen += (2 - 1);
       }
       else {
-         /* Rep-match */
+         /* Rep-match; the rep offset was already checked, and the output only grew since */
 
-         nMatchLen = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
+         nMatchLen = salvador_read_elias_native(&pCurInData, pInputData, 1, &nCurBitMask, &bits);
       }
 
-      /* Count matched bytes */
+      /* Count matched bytes; the match must not overwrite compressed bytes that weren't read yet */
+      if (nMatchLen == 0 || nMatchLen == (unsigned int)-1 || nMatchLen > (nMaxOutBufferSize - nDecompressedSize))
+         return -1;
       nDecompressedSize += nMatchLen;
+
+      if ((long long)nDecompressedSize - (long long)(pInputData + nInputSize - pCurInData) > nMaxLead)
+         nMaxLead = (long long)nDecompressedSize - (long long)(pInputData + nInputSize - pCurInData);
    }
 
+   if (pSafeDistance)
+      *pSafeDistance = salvador_get_safe_distance_from_lead(nInputSize, nDecompressedSize, nMaxLead);
    return nDecompressedSize;
 }
 
 /**
- * Decompress data in memory
+ * Decompress backward compressed data in file order, reading it from the end and writing the output from the end (FLG_NATIVE_BACKWARD)
  *
  * @param pInputData compressed data
- * @param pOutData buffer for decompressed data
+ * @param pOutData buffer for decompressed data, followed by the dictionary
  * @param nInputSize compressed size in bytes
- * @param nMaxOutBufferSize maximum capacity of decompression buffer
- * @param nDictionarySize size of dictionary in front of input data (0 for none)
- * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer, not counting the dictionary
+ * @param nDictionarySize size of dictionary after the decompression buffer (0 for none)
+ * @param nInPlace 1 if the compressed data is at the start of the decompression buffer and must not be overwritten before it is read, 0 otherwise
  *
- * @return actual decompressed size, or -1 for error
+ * @return actual decompressed size, or -1 for error; the decompressed data ends at pOutData + nMaxOutBufferSize
  */
-size_t salvador_decompress(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags) {
-   const unsigned char *pInputDataEnd = pInputData + nInputSize;
-   unsigned char *pCurOutData = pOutData + nDictionarySize;
-   const unsigned char *pOutDataEnd = pCurOutData + nMaxOutBufferSize;
+static size_t salvador_decompress_native(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const int nInPlace) {
+   const unsigned char *pCurInData = pInputData + nInputSize;
+   unsigned char *pOutDataEnd = pOutData + nMaxOutBufferSize;
+   unsigned char *pCurOutData = pOutDataEnd;
+   const unsigned char *pDictionaryEnd = pOutDataEnd + nDictionarySize;
    int nCurBitMask = 0;
    unsigned char bits = 0;
    int nMatchOffset = 1;
    int nIsFirstCommand = 1;
+
+   if (pCurInData <= pInputData && pCurOutData > pOutData)
+      return -1;
+
+   while (1) {
+      unsigned int nIsMatchWithOffset;
+
+      if (nIsFirstCommand) {
+         /* The first command is always literals */
+         nIsFirstCommand = 0;
+         nIsMatchWithOffset = 0;
+      }
+      else {
+         /* Read match with offset / literals bit */
+         nIsMatchWithOffset = salvador_read_bit_native(&pCurInData, pInputData, &nCurBitMask, &bits);
+         if (nIsMatchWithOffset == -1)
+            return -1;
+      }
+
+      if (nIsMatchWithOffset == 0) {
+         unsigned int nLiterals = salvador_read_elias_native(&pCurInData, pInputData, 1, &nCurBitMask, &bits);
+
+         /* Copy literals; they are stored in file order, just like the output */
+
+         if (nLiterals <= (unsigned int)(pCurInData - pInputData) &&
+            nLiterals <= (size_t)(pCurOutData - pOutData) &&
+            (!nInPlace || pCurOutData >= pCurInData)) {
+            pCurInData -= nLiterals;
+            pCurOutData -= nLiterals;
+            if (nInPlace)
+               memmove(pCurOutData, pCurInData, nLiterals);
+            else
+               memcpy(pCurOutData, pCurInData, nLiterals);
+         }
+         else {
+            return -1;
+         }
+
+         /* Read match with offset / rep match bit */
+
+         nIsMatchWithOffset = salvador_read_bit_native(&pCurInData, pInputData, &nCurBitMask, &bits);
+         if (nIsMatchWithOffset == -1)
+            return -1;
+      }
+
+      unsigned int nMatchLen;
+
+      if (nIsMatchWithOffset) {
+         /* Match with offset */
+
+         unsigned int nMatchOffsetHighByte = salvador_read_elias_native(&pCurInData, pInputData, 1, &nCurBitMask, &bits);
+
+         if (nMatchOffsetHighByte == 256)
+            break;
+         nMatchOffsetHighByte--;
+
+         if (pCurInData <= pInputData)
+            return -1;
+
+         unsigned int nMatchOffsetLowByte = (unsigned int)(*--pCurInData);
+         nMatchOffset = (nMatchOffsetHighByte << 7) | (nMatchOffsetLowByte >> 1);
+         nMatchOffset++;
+
+         nMatchLen = salvador_read_elias_prefix_native(&pCurInData, pInputData, 1, &nCurBitMask, &bits, nMatchOffsetLowByte & 1);
+
+         nMatchLen += (2 - 1);
+      }
+      else {
+         /* Rep-match */
+
+         nMatchLen = salvador_read_elias_native(&pCurInData, pInputData, 1, &nCurBitMask, &bits);
+      }
+
+      /* Copy matched bytes, from the already decompressed bytes (or the dictionary) that follow */
+      if (nMatchOffset >= 1 && nMatchOffset <= (pDictionaryEnd - pCurOutData)) {
+         const unsigned char* pSrc = pCurOutData + nMatchOffset;
+
+         if (nMatchLen <= (size_t)(pCurOutData - pOutData) &&
+            (!nInPlace || nMatchLen <= (size_t)(pCurOutData - pCurInData))) {
+            while (nMatchLen) {
+               *--pCurOutData = *--pSrc;
+               nMatchLen--;
+            }
+         }
+         else {
+            return -1;
+         }
+      }
+      else {
+         return -1;
+      }
+   }
+
+   return (size_t)(pOutDataEnd - pCurOutData);
+}
+
+/**
+ * Scan compressed data without decompressing it, checking that each command fits the compressed data and the decompression buffer,
+ * and optionally get its in-place safe distance
+ *
+ * @param pInputData compressed data
+ * @param nInputSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer, or (size_t)-1 for no limit
+ * @param nDictionarySize size of dictionary in front of the decompressed data, or (size_t)-1 to not check match offsets
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param pSafeDistance pointer to returned in-place safe distance (see salvador_get_inplace_safe_distance()), or NULL
+ *
+ * @return decompressed size, or -1 for error
+ */
+static size_t salvador_scan_compressed_data(const unsigned char *pInputData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags, size_t *pSafeDistance) {
+   const unsigned char* pInputDataStart = pInputData;
+   const unsigned char* pInputDataEnd = pInputData + nInputSize;
+   int nCurBitMask = 0;
+   unsigned char bits = 0;
+   int nIsFirstCommand = 1;
    const int nIsInverted = (nFlags & FLG_IS_INVERTED) && !(nFlags & FLG_IS_BACKWARD);
    const int nIsBackward = (nFlags & FLG_IS_BACKWARD) ? 1 : 0;
+   size_t nDecompressedSize = 0;
+   long long nMaxLead = 0;
 
-   if (pInputData >= pInputDataEnd && pCurOutData < pOutDataEnd)
+   if ((nFlags & FLG_IS_BACKWARD) && (nFlags & FLG_NATIVE_BACKWARD))
+      return salvador_scan_compressed_data_native(pInputData, nInputSize, nMaxOutBufferSize, nDictionarySize, pSafeDistance);
+
+   if (pInputData >= pInputDataEnd)
       return -1;
 
    while (1) {
@@ -247,13 +472,14 @@ size_t salvador_decompress(const unsigned char *pInputData, unsigned char *pOutD
       if (nIsMatchWithOffset == 0) {
          unsigned int nLiterals = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
 
-         /* Copy literals */
+         /* Count literals; they are copied before any output is written over the bytes they are read from */
 
-         if ((pInputData + nLiterals) <= pInputDataEnd &&
-            (pCurOutData + nLiterals) <= pOutDataEnd) {
-            memcpy(pCurOutData, pInputData, nLiterals);
+         if ((long long)nDecompressedSize - (long long)(pInputData - pInputDataStart) > nMaxLead)
+            nMaxLead = (long long)nDecompressedSize - (long long)(pInputData - pInputDataStart);
+
+         if (nLiterals <= (size_t)(pInputDataEnd - pInputData) && nLiterals <= (nMaxOutBufferSize - nDecompressedSize)) {
             pInputData += nLiterals;
-            pCurOutData += nLiterals;
+            nDecompressedSize += nLiterals;
          }
          else {
             return -1;
@@ -280,50 +506,813 @@ size_t salvador_decompress(const unsigned char *pInputData, unsigned char *pOutD
 
          if (nMatchOffsetHighByte == 256)
             break;
-         nMatchOffsetHighByte--;
+         if (nMatchOffsetHighByte > 256)
+            return -1;
 
          if (pInputData >= pInputDataEnd)
             return -1;
 
          unsigned int nMatchOffsetLowByte = (unsigned int)(*pInputData++);
-         if (nIsBackward)
-            nMatchOffset = (nMatchOffsetHighByte << 7) | (nMatchOffsetLowByte >> 1);
-         else
-            nMatchOffset = (nMatchOffsetHighByte << 7) | (127 - (nMatchOffsetLowByte >> 1));
-         nMatchOffset++;
+         const size_t nMatchOffset = (size_t)((((nMatchOffsetHighByte - 1) << 7) | (nIsBackward ? (nMatchOffsetLowByte >> 1) : (127 - (nMatchOffsetLowByte >> 1)))) + 1);
+
+         /* The match must start in the bytes decompressed so far, or in the dictionary */
+         if (nMatchOffset > nDictionarySize && (nMatchOffset - nDictionarySize) > nDecompressedSize)
+            return -1;
 
          nMatchLen = salvador_read_elias_prefix(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits, nMatchOffsetLowByte & 1);
 
          nMatchLen += (2 - 1);
       }
       else {
-         /* Rep-match */
+         /* Rep-match; the rep offset was already checked, and the output only grew since */
 
          nMatchLen = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
       }
 
-      /* Copy matched bytes */
-      const unsigned char* pSrc = pCurOutData - nMatchOffset;
-      if (pSrc >= pOutData) {
-         if ((pSrc + nMatchLen) <= pOutDataEnd) {
-            if ((pCurOutData + nMatchLen) <= pOutDataEnd) {
-               while (nMatchLen) {
-                  *pCurOutData++ = *pSrc++;
-                  nMatchLen--;
-               }
-            }
-            else {
-               return -1;
-            }
-         }
-         else {
-            return -1;
-         }
-      }
-      else {
+      /* Count matched bytes; the match must not overwrite compressed bytes that weren't read yet */
+      if (nMatchLen == 0 || nMatchLen == (unsigned int)-1 || nMatchLen > (nMaxOutBufferSize - nDecompressedSize))
          return -1;
-      }
+      nDecompressedSize += nMatchLen;
+
+      if ((long long)nDecompressedSize - (long long)(pInputData - pInputDataStart) > nMaxLead)
+         nMaxLead = (long long)nDecompressedSize - (long long)(pInputData - pInputDataStart);
    }
 
-   return (size_t)(pCurOutData - pOutData) - nDictionarySize;
+   if (pSafeDistance)
+      *pSafeDistance = salvador_get_safe_distance_from_lead(nInputSize, nDecompressedSize, nMaxLead);
+   return nDecompressedSize;
+}
+
+/**
+ * Get maximum decompressed size of compressed data
+ *
+ * @param pInputData compressed data
+ * @param nInputSize compressed size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return maximum decompressed size
+ */
+size_t salvador_get_max_decompressed_size(const unsigned char *pInputData, size_t nInputSize, const unsigned int nFlags) {
+   return salvador_scan_compressed_data(pInputData, nInputSize, (size_t)-1, (size_t)-1, nFlags, NULL);
+}
+
+/**
+ * Check compressed data without decompressing it: the structure of the commands, and the bounds of their offsets and lengths
+ *
+ * @param pInputData compressed data
+ * @param nInputSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the decompression buffer instead
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return exact decompressed size, or -1 if the data is corrupted or doesn't decompress within nMaxOutBufferSize bytes
+ */
+size_t salvador_validate_compressed_data(const unsigned char *pInputData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags) {
+   if (nMaxOutBufferSize == (size_t)-1 || nDictionarySize == (size_t)-1)
+      return -1;
+   return salvador_scan_compressed_data(pInputData, nInputSize, nMaxOutBufferSize, nDictionarySize, nFlags, NULL);
+}
+
+/**
+ * Get the number of bytes that a buffer must have, on top of the decompressed size, for salvador_decompress_inplace() to decompress
+ * the data without overwriting compressed bytes that weren't read yet
+ *
+ * @param pInputData compressed data
+ * @param nInputSize compressed size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return safe distance in bytes, or -1 for error
+ */
+size_t salvador_get_inplace_safe_distance(const unsigned char *pInputData, size_t nInputSize, const unsigned int nFlags) {
+   size_t nSafeDistance = 0;
+
+   if (salvador_scan_compressed_data(pInputData, nInputSize, (size_t)-1, (size_t)-1, nFlags, &nSafeDistance) == (size_t)-1)
+      return -1;
+   return nSafeDistance;
+}
+
+/**
+ * Decode forward compressed data, from the specified decoder state
+ *
+ * @param pInputData next compressed byte to read
+ * @param pInputDataEnd end of compressed data
+ * @param pOutData start of the decompressed data that matches can reference, including the dictionary
+ * @param pCurOutData next decompressed byte to write
+ * @param pOutDataEnd end of decompression buffer
+ * @param nCurBitMask mask of the next bit to read from the current bits byte, 0 if the next bit starts a new byte
+ * @param bits current bits byte, shifted so that the next bit to read is bit 7
+ * @param nMatchOffset current rep match offset
+ * @param nIsFirstCommand 1 if decoding starts with the first command of the stream, that is always literals, 0 otherwise
+ * @param nStopWhenFull 1 to stop once the decompression buffer is full, 0 to decode until the end of data marker
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nInPlace 1 if the compressed data is at the end of the decompression buffer and must not be overwritten before it is read, 0 otherwise
+ *
+ * @return offset of the end of the decompressed data from pOutData, or -1 for error
+ */
+static inline FORCE_INLINE size_t salvador_decompress_forward(const unsigned char *pInputData, const unsigned char *pInputDataEnd, unsigned char *pOutData, unsigned char *pCurOutData, const unsigned char *pOutDataEnd,
+      int nCurBitMask, unsigned char bits, int nMatchOffset, int nIsFirstCommand, const int nStopWhenFull, const unsigned int nFlags, const int nInPlace) {
+   const int nIsInverted = (nFlags & FLG_IS_INVERTED) && !(nFlags & FLG_IS_BACKWARD);
+   const int nIsBackward = (nFlags & FLG_IS_BACKWARD) ? 1 : 0;
+
+   while (1) {
+      unsigned int nIsMatchWithOffset;
+
+      if (nStopWhenFull && pCurOutData == pOutDataEnd)
+         break;
+
+      if (nIsFirstCommand) {
+         /* The first command is always literals */
+         nIsFirstCommand = 0;
+         nIsMatchWithOffset = 0;
+      }
+      else {
+         /* Read match with offset / literals bit */
+         nIsMatchWithOffset = salvador_read_bit(&pInputData, pInputDataEnd, &nCurBitMask, &bits);
+         if (nIsMatchWithOffset == -1)
+            return -1;
+      }
+
+      if (nIsMatchWithOffset == 0) {
+         unsigned int nLiterals = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
+
+         /* Copy literals */
+
+         if ((pInputData + nLiterals) <= pInputDataEnd &&
+            (pCurOutData + nLiterals) <= pOutDataEnd &&
+            (!nInPlace || pCurOutData <= pInputData)) {
+            if (nInPlace)
+               memmove(pCurOutData, pInputData, nLiterals);
+            else
+               memcpy(pCurOutData, pInputData, nLiterals);
+            pInputData += nLiterals;
+            pCurOutData += nLiterals;
+         }
+         else {
+            return -1;
+         }
+
+         /* Read match with offset / rep match bit */
+
+         nIsMatchWithOffset = salvador_read_bit(&pInputData, pInputDataEnd, &nCurBitMask, &bits);
+         if (nIsMatchWithOffset == -1)
+            return -1;
+      }
+
+      unsigned int nMatchLen;
+
+      if (nIsMatchWithOffset) {
+         /* Match with offset */
+
+         unsigned int nMatchOffsetHighByte;
+
+         if (nIsInverted)
+            nMatchOffsetHighByte = salvador_read_elias_inverted(&pInputData, pInputDataEnd, 1, &nCurBitMask, &bits);
+         else
+            nMatchOffsetHighByte = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
+
+         if (nMatchOffsetHighByte == 256)
+            break;
+         nMatchOffsetHighByte--;
+
+         if (pInputData >= pInputDataEnd)
+            return -1;
+
+         unsigned int nMatchOffsetLowByte = (unsigned int)(*pInputData++);
+         if (nIsBackward)
+            nMatchOffset = (nMatchOffsetHighByte << 7) | (nMatchOffsetLowByte >> 1);
+         else
+            nMatchOffset = (nMatchOffsetHighByte << 7) | (127 - (nMatchOffsetLowByte >> 1));
+         nMatchOffset++;
+
+         nMatchLen = salvador_read_elias_prefix(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits, nMatchOffsetLowByte & 1);
+
+         nMatchLen += (2 - 1);
+      }
+      else {
+         /* Rep-match */
+
+         nMatchLen = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
+      }
+
+      /* Copy matched bytes */
+      const unsigned char* pSrc = pCurOutData - nMatchOffset;
+      if (pSrc >= pOutData) {
+         if ((pSrc + nMatchLen) <= pOutDataEnd) {
+            if ((pCurOutData + nMatchLen) <= pOutDataEnd &&
+               (!nInPlace || (pCurOutData + nMatchLen) <= pInputData)) {
+               while (nMatchLen) {
+                  *pCurOutData++ = *pSrc++;
+                  nMatchLen--;
+               }
+            }
+            else {
+               return -1;
+            }
+         }
+         else {
+            return -1;
+         }
+      }
+      else {
+         return -1;
+      }
+   }
+
+   return (size_t)(pCurOutData - pOutData);
+}
+
+/**
+ * Decompress data in memory
+ *
+ * @param pInputData compressed data
+ * @param pOutData buffer for decompressed data
+ * @param nInputSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param nDictionarySize size of dictionary in front of input data (0 for none)
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t salvador_decompress(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags) {
+   const unsigned char *pInputDataEnd = pInputData + nInputSize;
+   unsigned char *pCurOutData = pOutData + nDictionarySize;
+   const unsigned char *pOutDataEnd = pCurOutData + nMaxOutBufferSize;
+   size_t nOutDataEnd;
+
+   if ((nFlags & FLG_IS_BACKWARD) && (nFlags & FLG_NATIVE_BACKWARD))
+      return salvador_decompress_native(pInputData, pOutData, nInputSize, nMaxOutBufferSize, nDictionarySize, 0);
+
+   if (pInputData >= pInputDataEnd && pCurOutData < pOutDataEnd)
+      return -1;
+
+   nOutDataEnd = salvador_decompress_forward(pInputData, pInputDataEnd, pOutData, pCurOutData, pOutDataEnd, 0, 0, 1, 1, 0, nFlags, 0);
+   return (nOutDataEnd != (size_t)-1) ? (nOutDataEnd - nDictionarySize) : (size_t)-1;
+}
+
+/**
+ * Decompress part of forward compressed data in memory, starting at a checkpoint recorded by salvador_compress_indexed(), until the end
+ * of data marker or until the decompression buffer is full
+ *
+ * @param pInputData compressed data, from its beginning
+ * @param pOutData buffer for the data decompressed from the checkpoint
+ * @param nInputSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer; decoding stops once it is full, which must happen between two commands
+ * @param pCheckpoint checkpoint to start decoding from
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t salvador_decompress_checkpoint(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, const salvador_checkpoint *pCheckpoint, const unsigned int nFlags) {
+   int nCurBitMask = 0;
+   unsigned char bits = 0;
+
+   if (nFlags & FLG_IS_BACKWARD)
+      return -1;
+   if (pCheckpoint->in_offset > nInputSize || pCheckpoint->rep_offset < MIN_OFFSET || pCheckpoint->rep_offset > MAX_OFFSET ||
+      pCheckpoint->bit_shift < -1 || pCheckpoint->bit_shift > 7)
+      return -1;
+
+   if (pCheckpoint->bit_shift != -1) {
+      /* Pick up the bits that are left in the byte that is being read */
+      const int nConsumedBits = 7 - pCheckpoint->bit_shift;
+
+      if (pCheckpoint->bits_offset >= pCheckpoint->in_offset)
+         return -1;
+      bits = (unsigned char)(pInputData[pCheckpoint->bits_offset] << nConsumedBits);
+      nCurBitMask = 128 >> nConsumedBits;
+   }
+
+   return salvador_decompress_forward(pInputData + pCheckpoint->in_offset, pInputData + nInputSize, pOutData, pOutData, pOutData + nMaxOutBufferSize,
+      nCurBitMask, bits, pCheckpoint->rep_offset, (pCheckpoint->out_offset == 0) ? 1 : 0, 1, nFlags, 0);
+}
+
+/**
+ * Decompress data in place, in a buffer that holds the compressed data and receives the decompressed data over it
+ *
+ * Forward data, and backward data that was reversed by the caller, must be placed at the end of the buffer, and is decompressed
+ * to the start of the buffer. Backward data in file order (FLG_NATIVE_BACKWARD) must be placed at the start of the buffer, and is
+ * decompressed so that it ends at the end of the buffer. The buffer must be at least as large as the decompressed size plus the
+ * distance returned by salvador_get_inplace_safe_distance() for the data to decompress. No memory is allocated.
+ *
+ * @param pBuffer buffer holding the compressed data, that receives the decompressed data
+ * @param nBufferSize size of buffer in bytes
+ * @param nInputSize compressed size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return actual decompressed size, or -1 for error, including when decompressing would overwrite compressed bytes that weren't read yet
+ */
+size_t salvador_decompress_inplace(unsigned char *pBuffer, size_t nBufferSize, size_t nInputSize, const unsigned int nFlags) {
+   const unsigned char *pInputData = pBuffer + nBufferSize - nInputSize;
+
+   if (nInputSize == 0 || nInputSize > nBufferSize)
+      return -1;
+
+   if ((nFlags & FLG_IS_BACKWARD) && (nFlags & FLG_NATIVE_BACKWARD))
+      return salvador_decompress_native(pBuffer, pBuffer, nInputSize, nBufferSize, 0, 1);
+
+   return salvador_decompress_forward(pInputData, pBuffer + nBufferSize, pBuffer, pBuffer, pBuffer + nBufferSize, 0, 0, 1, 1, 0, nFlags, 1);
+}
+
+/** Empty fast decoder bit reservoir: only the sentinel bit is left */
+#define FAST_BITS_EMPTY 0x80000000U
+
+/** Largest gamma value accepted by the fast decoder; anything larger can't be valid */
+#define FAST_MAX_ELIAS_VALUE 0x40000000
+
+/** Number of bytes that a wide match copy may write past the end of the match */
+#define FAST_COPY_SLACK 16
+
+/**
+ * Read one bit from the fast decoder bit reservoir, refilling it from the input if it is empty
+ *
+ * The reservoir holds the remaining bits of the current byte at the top, followed by a sentinel bit
+ *
+ * @return bit value, or -1 for error
+ */
+static inline FORCE_INLINE int salvador_fast_read_bit(const unsigned char **ppInBlock, const unsigned char *pDataEnd, unsigned int *nBitBuffer) {
+   unsigned int nBits = *nBitBuffer;
+   int nBit;
+
+   if (nBits == FAST_BITS_EMPTY) {
+      if ((*ppInBlock) >= pDataEnd) return -1;
+      nBits = (((unsigned int)*(*ppInBlock)++) << 24) | 0x00800000U;
+   }
+
+   nBit = (int)(nBits >> 31);
+   *nBitBuffer = nBits << 1;
+   return nBit;
+}
+
+/**
+ * Read an interlaced Elias gamma value using the fast decoder bit reservoir
+ *
+ * When the whole value is held in the reservoir, its length is found with a single count of leading zeros instead of one test per bit
+ *
+ * @return value, or -1 for error
+ */
+static inline FORCE_INLINE int salvador_fast_read_elias(const unsigned char **ppInBlock, const unsigned char *pDataEnd, const int nInitialValue, const int nIsBackward, const int nIsInverted, unsigned int *nBitBuffer) {
+   unsigned int nBits = *nBitBuffer;
+   int nValue = nInitialValue;
+
+   if (nBits == FAST_BITS_EMPTY && (*ppInBlock) < pDataEnd)
+      nBits = (((unsigned int)*(*ppInBlock)++) << 24) | 0x00800000U;
+
+   /* Continuation bits sit at every other position from the top; keep those before the sentinel that end the value */
+   const unsigned int nValidMask = ~((2U << salvador_ctz32(nBits)) - 1U);
+   const unsigned int nEndBits = (nIsBackward ? ~nBits : nBits) & nValidMask & 0xaaaaaaaaU;
+
+   if (nEndBits) {
+      const int nDataBits = salvador_clz32(nEndBits) >> 1;
+      int i;
+
+      for (i = 0; i < nDataBits; i++)
+         nValue = (nValue << 1) | (int)((nBits >> (30 - (i << 1))) & 1);
+      if (nIsInverted)
+         nValue ^= (1 << nDataBits) - 1;
+
+      *nBitBuffer = nBits << ((nDataBits << 1) + 1);
+      return nValue;
+   }
+
+   /* The value continues into the next byte(s), read it bit by bit */
+   *nBitBuffer = nBits;
+   while (1) {
+      const int nBit = salvador_fast_read_bit(ppInBlock, pDataEnd, nBitBuffer);
+
+      if (nBit < 0) return -1;
+      if (nBit != nIsBackward) break;
+
+      const int nDataBit = salvador_fast_read_bit(ppInBlock, pDataEnd, nBitBuffer);
+      if (nDataBit < 0 || nValue >= FAST_MAX_ELIAS_VALUE) return -1;
+      nValue = (nValue << 1) | (nDataBit ^ nIsInverted);
+   }
+
+   return nValue;
+}
+
+/**
+ * Decompress data in memory, using the fast decoder
+ *
+ * This decoder keeps the control bits in a reservoir register, reads gamma values with a count of leading zeros, checks bounds
+ * once per command and copies matches that don't overlap their own output with wide copies. It returns the same results as
+ * salvador_decompress(), except that corrupted data with gamma values too large for an int is always rejected. The output buffer
+ * should have 16 bytes of slack after the decompressed data for the wide copies to be used up to the end.
+ *
+ * @param pInputData compressed data
+ * @param pOutData buffer for decompressed data
+ * @param nInputSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param nDictionarySize size of dictionary in front of input data (0 for none)
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t salvador_decompress_fast(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags) {
+   const unsigned char *pInputDataEnd = pInputData + nInputSize;
+   unsigned char *pCurOutData = pOutData + nDictionarySize;
+   const unsigned char *pOutDataEnd = pCurOutData + nMaxOutBufferSize;
+   unsigned int nBitBuffer = FAST_BITS_EMPTY;
+   size_t nMatchOffset = 1;
+   const int nIsInverted = (nFlags & FLG_IS_INVERTED) && !(nFlags & FLG_IS_BACKWARD);
+   const int nIsBackward = (nFlags & FLG_IS_BACKWARD) ? 1 : 0;
+   int nIsMatchWithOffset = 0;
+
+   /* Backward data in file order is decoded by the safe decoder */
+   if ((nFlags & FLG_IS_BACKWARD) && (nFlags & FLG_NATIVE_BACKWARD))
+      return salvador_decompress_native(pInputData, pOutData, nInputSize, nMaxOutBufferSize, nDictionarySize, 0);
+
+   if (pInputData >= pInputDataEnd && pCurOutData < pOutDataEnd)
+      return -1;
+
+   while (1) {
+      int nMatchLen;
+
+      if (nIsMatchWithOffset == 0) {
+         /* Literals; the first command always is */
+         const int nLiterals = salvador_fast_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, 0, &nBitBuffer);
+
+         if (nLiterals < 0 ||
+            (size_t)nLiterals > (size_t)(pInputDataEnd - pInputData) ||
+            (size_t)nLiterals > (size_t)(pOutDataEnd - pCurOutData))
+            return -1;
+
+         if (nLiterals <= FAST_COPY_SLACK &&
+            (size_t)(pInputDataEnd - pInputData) >= FAST_COPY_SLACK &&
+            (size_t)(pOutDataEnd - pCurOutData) >= FAST_COPY_SLACK) {
+            /* Short run with room to spare on both sides: one fixed-size copy instead of a variable-length one */
+            memcpy(pCurOutData, pInputData, FAST_COPY_SLACK);
+         }
+         else {
+            memcpy(pCurOutData, pInputData, nLiterals);
+         }
+         pInputData += nLiterals;
+         pCurOutData += nLiterals;
+
+         /* Read match with offset / rep match bit */
+         nIsMatchWithOffset = salvador_fast_read_bit(&pInputData, pInputDataEnd, &nBitBuffer);
+         if (nIsMatchWithOffset < 0)
+            return -1;
+      }
+
+      if (nIsMatchWithOffset) {
+         /* Match with offset */
+         const int nMatchOffsetHighByte = salvador_fast_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, nIsInverted, &nBitBuffer);
+
+         if (nMatchOffsetHighByte == 256)
+            break;
+         if (nMatchOffsetHighByte < 0 || pInputData >= pInputDataEnd)
+            return -1;
+
+         const unsigned int nMatchOffsetLowByte = (unsigned int)(*pInputData++);
+         if (nIsBackward)
+            nMatchOffset = ((nMatchOffsetHighByte - 1) << 7) | (nMatchOffsetLowByte >> 1);
+         else
+            nMatchOffset = ((nMatchOffsetHighByte - 1) << 7) | (127 - (nMatchOffsetLowByte >> 1));
+         nMatchOffset++;
+
+         /* The low bit of the offset byte is the first continuation bit of the match length */
+         if ((int)(nMatchOffsetLowByte & 1) == nIsBackward) {
+            const int nFirstDataBit = salvador_fast_read_bit(&pInputData, pInputDataEnd, &nBitBuffer);
+
+            if (nFirstDataBit < 0)
+               return -1;
+            nMatchLen = salvador_fast_read_elias(&pInputData, pInputDataEnd, 2 | nFirstDataBit, nIsBackward, 0, &nBitBuffer);
+         }
+         else {
+            nMatchLen = 1;
+         }
+
+         if (nMatchLen < 0)
+            return -1;
+         nMatchLen += (2 - 1);
+      }
+      else {
+         /* Rep-match */
+         nMatchLen = salvador_fast_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, 0, &nBitBuffer);
+         if (nMatchLen < 0)
+            return -1;
+      }
+
+      /* Copy matched bytes, checking bounds once for the whole match */
+      if (nMatchOffset > (size_t)(pCurOutData - pOutData) ||
+         (size_t)nMatchLen > (size_t)(pOutDataEnd - pCurOutData))
+         return -1;
+
+      const unsigned char *pSrc = pCurOutData - nMatchOffset;
+
+      if (nMatchOffset >= FAST_COPY_SLACK && (size_t)(pOutDataEnd - pCurOutData) >= ((size_t)nMatchLen + FAST_COPY_SLACK)) {
+         /* Each 16-byte piece is read before it is written, so the copy behaves as if done byte by byte */
+         unsigned char *pDst = pCurOutData;
+
+         pCurOutData += nMatchLen;
+         do {
+            memcpy(pDst, pSrc, 16);
+            pDst += 16;
+            pSrc += 16;
+         } while (pDst < pCurOutData);
+      }
+      else if (nMatchOffset >= 8 && (size_t)(pOutDataEnd - pCurOutData) >= ((size_t)nMatchLen + FAST_COPY_SLACK)) {
+         /* Same with 8-byte pieces */
+         unsigned char *pDst = pCurOutData;
+
+         pCurOutData += nMatchLen;
+         do {
+            memcpy(pDst, pSrc, 8);
+            pDst += 8;
+            pSrc += 8;
+         } while (pDst < pCurOutData);
+      }
+      else if (nMatchOffset == 1) {
+         memset(pCurOutData, *pSrc, nMatchLen);
+         pCurOutData += nMatchLen;
+      }
+      else if ((size_t)nMatchLen > (nMatchOffset << 1)) {
+         /* Long overlapping match: the repeated pattern doubles in size after each copy, so no copy overlaps itself */
+         size_t nChunkSize = nMatchOffset;
+
+         while ((size_t)nMatchLen > nChunkSize) {
+            memcpy(pCurOutData, pSrc, nChunkSize);
+            pCurOutData += nChunkSize;
+            nMatchLen -= (int)nChunkSize;
+            nChunkSize <<= 1;
+         }
+         memcpy(pCurOutData, pSrc, nMatchLen);
+         pCurOutData += nMatchLen;
+      }
+      else {
+         while (nMatchLen) {
+            *pCurOutData++ = *pSrc++;
+            nMatchLen--;
+         }
+      }
+
+      /* Read match with offset / literals bit */
+      nIsMatchWithOffset = salvador_fast_read_bit(&pInputData, pInputDataEnd, &nBitBuffer);
+      if (nIsMatchWithOffset < 0)
+         return -1;
+   }
+
+   return (size_t)(pCurOutData - pOutData) - nDictionarySize;
+}
+
+/** Size of streaming decompression window, must be a power of two larger than MAX_OFFSET */
+#define STREAM_WINDOW_SIZE 0x10000
+
+/** Size of streaming decompression input buffer */
+#define STREAM_INPUT_SIZE 0x4000
+
+/** Number of buffered input bytes that guarantees that a whole command header, excluding literals, can be read */
+#define STREAM_INPUT_MARGIN 64
+
+/** Streaming decompression state */
+typedef struct _salvador_stream_decoder {
+   salvador_stream_read_func read_func;
+   salvador_stream_write_func write_func;
+   void *user_data;
+   unsigned char *window;
+   unsigned char *in_buffer;
+   int in_eof;
+   size_t out_pos;
+   size_t flushed_pos;
+} salvador_stream_decoder;
+
+/**
+ * Top up the streaming input buffer, if it is running low
+ *
+ * @param pStream streaming decompression state
+ * @param ppInputData pointer to current input position, updated
+ * @param ppInputDataEnd pointer to end of buffered input, updated
+ */
+static void salvador_stream_fill(salvador_stream_decoder *pStream, const unsigned char **ppInputData, const unsigned char **ppInputDataEnd) {
+   size_t nRemaining = (size_t)(*ppInputDataEnd - *ppInputData);
+
+   if (nRemaining >= STREAM_INPUT_MARGIN || pStream->in_eof)
+      return;
+
+   memmove(pStream->in_buffer, *ppInputData, nRemaining);
+
+   while (nRemaining < STREAM_INPUT_SIZE && !pStream->in_eof) {
+      size_t nRead = pStream->read_func(pStream->in_buffer + nRemaining, STREAM_INPUT_SIZE - nRemaining, pStream->user_data);
+
+      if (nRead == 0 || nRead > (STREAM_INPUT_SIZE - nRemaining))
+         pStream->in_eof = 1;
+      else
+         nRemaining += nRead;
+   }
+
+   *ppInputData = pStream->in_buffer;
+   *ppInputDataEnd = pStream->in_buffer + nRemaining;
+}
+
+/**
+ * Send all decompressed bytes that haven't been written out yet to the output callback
+ *
+ * @param pStream streaming decompression state
+ *
+ * @return 0 for success, -1 for error
+ */
+static int salvador_stream_flush(salvador_stream_decoder *pStream) {
+   while (pStream->flushed_pos != pStream->out_pos) {
+      const size_t nWindowOffset = pStream->flushed_pos & (STREAM_WINDOW_SIZE - 1);
+      size_t nSize = pStream->out_pos - pStream->flushed_pos;
+
+      if (nSize > (STREAM_WINDOW_SIZE - nWindowOffset))
+         nSize = STREAM_WINDOW_SIZE - nWindowOffset;
+
+      if (pStream->write_func(pStream->window + nWindowOffset, nSize, pStream->user_data))
+         return -1;
+      pStream->flushed_pos += nSize;
+   }
+
+   return 0;
+}
+
+/**
+ * Decompress data from an input callback to an output callback, keeping only a bounded window of history in memory
+ *
+ * @param read_func callback that supplies compressed data
+ * @param write_func callback that receives decompressed data
+ * @param pUserData user data passed to both callbacks
+ * @param pDictionaryData dictionary that the data was compressed with (NULL for none)
+ * @param nDictionarySize size of dictionary in bytes (0 for none)
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t salvador_decompress_stream(salvador_stream_read_func read_func, salvador_stream_write_func write_func, void *pUserData, const unsigned char *pDictionaryData, size_t nDictionarySize, const unsigned int nFlags) {
+   salvador_stream_decoder stream;
+   const unsigned char *pInputData = NULL;
+   const unsigned char *pInputDataEnd = NULL;
+   int nCurBitMask = 0;
+   unsigned char bits = 0;
+   size_t nMatchOffset = 1;
+   int nIsFirstCommand = 1;
+   const int nIsInverted = (nFlags & FLG_IS_INVERTED) && !(nFlags & FLG_IS_BACKWARD);
+   const int nIsBackward = (nFlags & FLG_IS_BACKWARD) ? 1 : 0;
+   size_t nResult = -1;
+
+   /* Backward data in file order needs to be read from its end */
+   if ((nFlags & FLG_IS_BACKWARD) && (nFlags & FLG_NATIVE_BACKWARD))
+      return -1;
+
+   if (!pDictionaryData)
+      nDictionarySize = 0;
+
+   stream.read_func = read_func;
+   stream.write_func = write_func;
+   stream.user_data = pUserData;
+   stream.in_eof = 0;
+   stream.out_pos = nDictionarySize;
+   stream.flushed_pos = nDictionarySize;
+   stream.window = (unsigned char *)malloc(STREAM_WINDOW_SIZE + STREAM_INPUT_SIZE);
+   if (!stream.window)
+      return -1;
+   stream.in_buffer = stream.window + STREAM_WINDOW_SIZE;
+
+   if (nDictionarySize) {
+      /* Load the end of the dictionary into the window, at the positions it will be referenced from */
+      size_t nDictionaryOffset = (nDictionarySize > STREAM_WINDOW_SIZE) ? (nDictionarySize - STREAM_WINDOW_SIZE) : 0;
+
+      for (; nDictionaryOffset < nDictionarySize; nDictionaryOffset++)
+         stream.window[nDictionaryOffset & (STREAM_WINDOW_SIZE - 1)] = pDictionaryData[nDictionaryOffset];
+   }
+
+   salvador_stream_fill(&stream, &pInputData, &pInputDataEnd);
+   if (pInputData >= pInputDataEnd) {
+      free(stream.window);
+      return -1;
+   }
+
+   while (1) {
+      unsigned int nIsMatchWithOffset;
+
+      salvador_stream_fill(&stream, &pInputData, &pInputDataEnd);
+
+      if (nIsFirstCommand) {
+         /* The first command is always literals */
+         nIsFirstCommand = 0;
+         nIsMatchWithOffset = 0;
+      }
+      else {
+         /* Read match with offset / literals bit */
+         nIsMatchWithOffset = salvador_read_bit(&pInputData, pInputDataEnd, &nCurBitMask, &bits);
+         if (nIsMatchWithOffset == -1)
+            break;
+      }
+
+      if (nIsMatchWithOffset == 0) {
+         unsigned int nLiterals = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
+
+         if ((int)nLiterals < 0)
+            break;
+
+         /* Copy literals, in as many pieces as the input buffer and the window require */
+
+         while (nLiterals) {
+            const size_t nWindowOffset = stream.out_pos & (STREAM_WINDOW_SIZE - 1);
+            size_t nCopySize = nLiterals;
+
+            if (pInputData == pInputDataEnd) {
+               salvador_stream_fill(&stream, &pInputData, &pInputDataEnd);
+               if (pInputData == pInputDataEnd)
+                  break;
+            }
+            if ((stream.out_pos - stream.flushed_pos) == STREAM_WINDOW_SIZE) {
+               if (salvador_stream_flush(&stream))
+                  break;
+            }
+
+            if (nCopySize > (size_t)(pInputDataEnd - pInputData))
+               nCopySize = (size_t)(pInputDataEnd - pInputData);
+            if (nCopySize > (STREAM_WINDOW_SIZE - nWindowOffset))
+               nCopySize = STREAM_WINDOW_SIZE - nWindowOffset;
+            if (nCopySize > (STREAM_WINDOW_SIZE - (stream.out_pos - stream.flushed_pos)))
+               nCopySize = STREAM_WINDOW_SIZE - (stream.out_pos - stream.flushed_pos);
+
+            memcpy(stream.window + nWindowOffset, pInputData, nCopySize);
+            pInputData += nCopySize;
+            stream.out_pos += nCopySize;
+            nLiterals -= (unsigned int)nCopySize;
+         }
+
+         if (nLiterals)
+            break;
+
+         /* Read match with offset / rep match bit */
+
+         salvador_stream_fill(&stream, &pInputData, &pInputDataEnd);
+
+         nIsMatchWithOffset = salvador_read_bit(&pInputData, pInputDataEnd, &nCurBitMask, &bits);
+         if (nIsMatchWithOffset == -1)
+            break;
+      }
+
+      unsigned int nMatchLen;
+
+      if (nIsMatchWithOffset) {
+         /* Match with offset */
+
+         unsigned int nMatchOffsetHighByte;
+
+         if (nIsInverted)
+            nMatchOffsetHighByte = salvador_read_elias_inverted(&pInputData, pInputDataEnd, 1, &nCurBitMask, &bits);
+         else
+            nMatchOffsetHighByte = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
+
+         if (nMatchOffsetHighByte == 256) {
+            if (!salvador_stream_flush(&stream))
+               nResult = stream.out_pos - nDictionarySize;
+            break;
+         }
+         nMatchOffsetHighByte--;
+
+         if (pInputData >= pInputDataEnd)
+            break;
+
+         unsigned int nMatchOffsetLowByte = (unsigned int)(*pInputData++);
+         if (nIsBackward)
+            nMatchOffset = (nMatchOffsetHighByte << 7) | (nMatchOffsetLowByte >> 1);
+         else
+            nMatchOffset = (nMatchOffsetHighByte << 7) | (127 - (nMatchOffsetLowByte >> 1));
+         nMatchOffset++;
+
+         nMatchLen = salvador_read_elias_prefix(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits, nMatchOffsetLowByte & 1);
+
+         nMatchLen += (2 - 1);
+      }
+      else {
+         /* Rep-match */
+
+         nMatchLen = salvador_read_elias(&pInputData, pInputDataEnd, 1, nIsBackward, &nCurBitMask, &bits);
+      }
+
+      /* Copy matched bytes from the window */
+      if ((int)nMatchLen < 0 || nMatchOffset > stream.out_pos || nMatchOffset > MAX_OFFSET)
+         break;
+
+      while (nMatchLen) {
+         size_t nCopySize = nMatchLen;
+
+         if ((stream.out_pos - stream.flushed_pos) == STREAM_WINDOW_SIZE) {
+            if (salvador_stream_flush(&stream))
+               break;
+         }
+
+         if (nCopySize > (STREAM_WINDOW_SIZE - (stream.out_pos - stream.flushed_pos)))
+            nCopySize = STREAM_WINDOW_SIZE - (stream.out_pos - stream.flushed_pos);
+         nMatchLen -= (unsigned int)nCopySize;
+
+         while (nCopySize) {
+            stream.window[stream.out_pos & (STREAM_WINDOW_SIZE - 1)] = stream.window[(stream.out_pos - nMatchOffset) & (STREAM_WINDOW_SIZE - 1)];
+            stream.out_pos++;
+            nCopySize--;
+         }
+      }
+
+      if (nMatchLen)
+         break;
+   }
+
+   free(stream.window);
+   return nResult;
 }
@@ -37,6 +37,37 @@
 extern "C" {
 #endif
 
+/** Decoder state at a point of forward compressed data where decompression can start without any previous output */
+typedef struct _salvador_checkpoint {
+   size_t out_offset;   /**< offset of the first byte decompressed from this checkpoint, 0 for the start of the data */
+   size_t in_offset;    /**< offset of the next compressed byte to read */
+   size_t bits_offset;  /**< offset of the compressed byte that control bits are being read from, if bit_shift isn't -1 */
+   int bit_shift;       /**< index of the next bit to read in that byte, from 7 (most significant) to 0, or -1 if the next bit starts a new byte */
+   int rep_offset;      /**< current rep match offset */
+} salvador_checkpoint;
+
+/**
+ * Streaming decompression input callback
+ *
+ * @param pBuffer buffer to fill with compressed data
+ * @param nMaxSize maximum number of bytes to read
+ * @param pUserData user data passed to salvador_decompress_stream()
+ *
+ * @return number of bytes read, 0 at the end of the compressed data
+ */
+typedef size_t (*salvador_stream_read_func)(void *pBuffer, size_t nMaxSize, void *pUserData);
+
+/**
+ * Streaming decompression output callback
+ *
+ * @param pData decompressed bytes
+ * @param nSize number of decompressed bytes
+ * @param pUserData user data passed to salvador_decompress_stream()
+ *
+ * @return 0 to continue, non-zero to abort decompression
+ */
+typedef int (*salvador_stream_write_func)(const void *pData, size_t nSize, void *pUserData);
+
 /**
  * Get maximum decompressed size of compressed data
  *
@@ -48,6 +79,36 @@ extern "C" {
  */
 size_t salvador_get_max_decompressed_size(const unsigned char *pInputData, size_t nInputSize, const unsigned int nFlags);
 
+/**
+ * Check compressed data without decompressing it: the structure of the commands, and the bounds of their offsets and lengths
+ *
+ * This only reads the control bits and skips over the literals, without writing any output, and returns as soon as a command can't
+ * be valid. When it succeeds, salvador_decompress() succeeds for the same data, buffer size and dictionary size, and returns the same
+ * size; the reverse isn't always true, as a few malformed streams that no compressor emits are only rejected here. Untrusted data can
+ * be checked with this before allocating a buffer for it and decompressing it.
+ *
+ * @param pInputData compressed data
+ * @param nInputSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the decompression buffer instead
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return exact decompressed size, or -1 if the data is corrupted or doesn't decompress within nMaxOutBufferSize bytes
+ */
+size_t salvador_validate_compressed_data(const unsigned char *pInputData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags);
+
+/**
+ * Get the number of bytes that a buffer must have, on top of the decompressed size, for salvador_decompress_inplace() to decompress
+ * the data without overwriting compressed bytes that weren't read yet
+ *
+ * @param pInputData compressed data
+ * @param nInputSize compressed size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return safe distance in bytes, or -1 for error
+ */
+size_t salvador_get_inplace_safe_distance(const unsigned char *pInputData, size_t nInputSize, const unsigned int nFlags);
+
 /**
  * Decompress data in memory
  *
@@ -55,13 +116,79 @@ size_t salvador_get_max_decompressed_size(const unsigned char *pInputData, size_
  * @param pOutData buffer for decompressed data
  * @param nInputSize compressed size in bytes
  * @param nMaxOutBufferSize maximum capacity of decompression buffer
- * @param nDictionarySize size of dictionary in front of input data (0 for none)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the decompression buffer instead
  * @param nFlags compression flags (set to FLG_IS_INVERTED)
  *
- * @return actual decompressed size, or -1 for error
+ * @return actual decompressed size, or -1 for error; with FLG_NATIVE_BACKWARD, the decompressed data ends at pOutData + nMaxOutBufferSize
  */
 size_t salvador_decompress(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags);
 
+/**
+ * Decompress part of forward compressed data in memory, starting at a checkpoint recorded by salvador_compress_indexed(), until the end
+ * of data marker or until the decompression buffer is full
+ *
+ * @param pInputData compressed data, from its beginning
+ * @param pOutData buffer for the data decompressed from the checkpoint
+ * @param nInputSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer; decoding stops once it is full, which must happen between two commands
+ * @param pCheckpoint checkpoint to start decoding from
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t salvador_decompress_checkpoint(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, const salvador_checkpoint *pCheckpoint, const unsigned int nFlags);
+
+/**
+ * Decompress data in place, in a buffer that holds the compressed data and receives the decompressed data over it
+ *
+ * Forward data, and backward data that was reversed by the caller, must be placed at the end of the buffer, and is decompressed
+ * to the start of the buffer. Backward data in file order (FLG_NATIVE_BACKWARD) must be placed at the start of the buffer, and is
+ * decompressed so that it ends at the end of the buffer. The buffer must be at least as large as the decompressed size plus the
+ * distance returned by salvador_get_inplace_safe_distance() for the data to decompress. No memory is allocated.
+ *
+ * @param pBuffer buffer holding the compressed data, that receives the decompressed data
+ * @param nBufferSize size of buffer in bytes
+ * @param nInputSize compressed size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return actual decompressed size, or -1 for error, including when decompressing would overwrite compressed bytes that weren't read yet
+ */
+size_t salvador_decompress_inplace(unsigned char *pBuffer, size_t nBufferSize, size_t nInputSize, const unsigned int nFlags);
+
+/**
+ * Decompress data in memory, using the fast decoder
+ *
+ * This decoder keeps the control bits in a reservoir register, reads gamma values with a count of leading zeros, checks bounds
+ * once per command and copies matches that don't overlap their own output with wide copies. It returns the same results as
+ * salvador_decompress(), except that corrupted data with gamma values too large for an int is always rejected. The output buffer
+ * should have 16 bytes of slack after the decompressed data for the wide copies to be used up to the end. Backward data in file order
+ * (FLG_NATIVE_BACKWARD) is decoded with the same decoder as salvador_decompress().
+ *
+ * @param pInputData compressed data
+ * @param pOutData buffer for decompressed data
+ * @param nInputSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the decompression buffer instead
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return actual decompressed size, or -1 for error; with FLG_NATIVE_BACKWARD, the decompressed data ends at pOutData + nMaxOutBufferSize
+ */
+size_t salvador_decompress_fast(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags);
+
+/**
+ * Decompress data from an input callback to an output callback, keeping only a bounded window of history in memory
+ *
+ * @param read_func callback that supplies compressed data
+ * @param write_func callback that receives decompressed data
+ * @param pUserData user data passed to both callbacks
+ * @param pDictionaryData dictionary that the data was compressed with (NULL for none)
+ * @param nDictionarySize size of dictionary in bytes (0 for none)
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t salvador_decompress_stream(salvador_stream_read_func read_func, salvador_stream_write_func write_func, void *pUserData, const unsigned char *pDictionaryData, size_t nDictionarySize, const unsigned int nFlags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -40,4 +40,8 @@
 
 #define MIN_MATCH_SIZE 1
 
+#define FRAME_HEADER_SIZE 16
+
+#define MIN_CHECKPOINT_INTERVAL 256
+
 #endif /* _FORMAT_H */
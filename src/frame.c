@@ -0,0 +1,396 @@
+/*
+ * frame.c - size-prefixed container implementation
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+#include "format.h"
+#include "libsalvador.h"
+
+#define FRAME_VERSION 1
+
+#define FRAME_FLG_IS_INVERTED 1
+#define FRAME_FLG_IS_BACKWARD 2
+#define FRAME_FLG_HAS_INDEX 4
+
+#define FRAME_CHECKPOINT_SIZE 16
+
+/**
+ * Write 32-bit little-endian value
+ *
+ * @param pOut output buffer
+ * @param nValue value to write
+ */
+static void salvador_frame_write_le32(unsigned char *pOut, const unsigned int nValue) {
+   pOut[0] = nValue & 0xff;
+   pOut[1] = (nValue >> 8) & 0xff;
+   pOut[2] = (nValue >> 16) & 0xff;
+   pOut[3] = (nValue >> 24) & 0xff;
+}
+
+/**
+ * Read 32-bit little-endian value
+ *
+ * @param pIn input buffer
+ *
+ * @return value
+ */
+static unsigned int salvador_frame_read_le32(const unsigned char *pIn) {
+   return ((unsigned int)pIn[0]) | (((unsigned int)pIn[1]) << 8) | (((unsigned int)pIn[2]) << 16) | (((unsigned int)pIn[3]) << 24);
+}
+
+/**
+ * Locate the block index that follows the compressed stream of a frame
+ *
+ * @param pInputData frame data
+ * @param nInputSize frame size in bytes
+ * @param pCompressedSize pointer to returned size of compressed stream in bytes
+ * @param pNumCheckpoints pointer to returned number of checkpoints in the index
+ *
+ * @return pointer to first checkpoint, or NULL if the data isn't a frame with an index
+ */
+static const unsigned char *salvador_frame_get_index(const unsigned char *pInputData, const size_t nInputSize, size_t *pCompressedSize, size_t *pNumCheckpoints) {
+   size_t nOriginalSize;
+   unsigned int nFrameFlags;
+
+   if (salvador_read_frame_header(pInputData, nInputSize, &nOriginalSize, pCompressedSize, &nFrameFlags) == (size_t)-1 || !(pInputData[5] & FRAME_FLG_HAS_INDEX))
+      return NULL;
+
+   *pNumCheckpoints = salvador_frame_read_le32(pInputData + FRAME_HEADER_SIZE + *pCompressedSize);
+   if (*pNumCheckpoints != (nInputSize - FRAME_HEADER_SIZE - *pCompressedSize - 4) / FRAME_CHECKPOINT_SIZE)
+      return NULL;
+   return pInputData + FRAME_HEADER_SIZE + *pCompressedSize + 4;
+}
+
+/**
+ * Write the header of a frame: a compressed stream prefixed with its decompressed and compressed sizes, so that it can be decompressed
+ * into an exactly sized buffer in one pass
+ *
+ * @param pOutData buffer for header
+ * @param nMaxOutDataSize maximum capacity of buffer
+ * @param nOriginalSize decompressed size in bytes, not including the dictionary
+ * @param nCompressedSize size of compressed stream in bytes, not including the header
+ * @param nFlags compression flags that the stream was compressed with; FLG_IS_INVERTED and FLG_IS_BACKWARD are recorded
+ *
+ * @return header size in bytes, or -1 for error
+ */
+size_t salvador_write_frame_header(unsigned char *pOutData, const size_t nMaxOutDataSize, const size_t nOriginalSize, const size_t nCompressedSize, const unsigned int nFlags) {
+   if (nMaxOutDataSize < FRAME_HEADER_SIZE || nOriginalSize > 0xffffffffUL || nCompressedSize > 0xffffffffUL)
+      return -1;
+
+   memcpy(pOutData, "SLVF", 4);
+   pOutData[4] = FRAME_VERSION;
+   pOutData[5] = ((nFlags & FLG_IS_INVERTED) ? FRAME_FLG_IS_INVERTED : 0) | ((nFlags & FLG_IS_BACKWARD) ? FRAME_FLG_IS_BACKWARD : 0);
+   pOutData[6] = 0;
+   pOutData[7] = 0;
+   salvador_frame_write_le32(pOutData + 8, (unsigned int)nOriginalSize);
+   salvador_frame_write_le32(pOutData + 12, (unsigned int)nCompressedSize);
+
+   return FRAME_HEADER_SIZE;
+}
+
+/**
+ * Read the header of a frame, and check that the whole compressed stream is present; only the header itself is read
+ *
+ * @param pInputData frame data
+ * @param nInputSize frame size in bytes
+ * @param pOriginalSize pointer to returned decompressed size in bytes, not including the dictionary
+ * @param pCompressedSize pointer to returned size of compressed stream in bytes, that follows the header
+ * @param pFlags pointer to returned compression flags that the stream was compressed with (FLG_IS_INVERTED, FLG_IS_BACKWARD)
+ *
+ * @return header size in bytes, or -1 if the data isn't a frame
+ */
+size_t salvador_read_frame_header(const unsigned char *pInputData, const size_t nInputSize, size_t *pOriginalSize, size_t *pCompressedSize, unsigned int *pFlags) {
+   size_t nCompressedSize;
+
+   if (nInputSize < FRAME_HEADER_SIZE || memcmp(pInputData, "SLVF", 4) || pInputData[4] != FRAME_VERSION ||
+      (pInputData[5] & ~(FRAME_FLG_IS_INVERTED | FRAME_FLG_IS_BACKWARD | FRAME_FLG_HAS_INDEX)) || pInputData[6] || pInputData[7])
+      return -1;
+
+   nCompressedSize = salvador_frame_read_le32(pInputData + 12);
+   if (pInputData[5] & FRAME_FLG_HAS_INDEX) {
+      /* The block index follows the compressed stream: number of checkpoints, then the checkpoints */
+      size_t nIndexSize;
+
+      if (nCompressedSize > (nInputSize - FRAME_HEADER_SIZE) || (nInputSize - FRAME_HEADER_SIZE - nCompressedSize) < 4)
+         return -1;
+      nIndexSize = nInputSize - FRAME_HEADER_SIZE - nCompressedSize - 4;
+      if (nIndexSize % FRAME_CHECKPOINT_SIZE)
+         return -1;
+   }
+   else {
+      if (nCompressedSize != (nInputSize - FRAME_HEADER_SIZE))
+         return -1;
+   }
+
+   *pOriginalSize = salvador_frame_read_le32(pInputData + 8);
+   *pCompressedSize = nCompressedSize;
+   *pFlags = ((pInputData[5] & FRAME_FLG_IS_INVERTED) ? FLG_IS_INVERTED : 0) | ((pInputData[5] & FRAME_FLG_IS_BACKWARD) ? FLG_IS_BACKWARD : 0);
+
+   return FRAME_HEADER_SIZE;
+}
+
+/**
+ * Compress memory into a frame
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for frame
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of buffer, at least FRAME_HEADER_SIZE bytes more than for salvador_compress()
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param nNumThreads number of threads to use (0 for one per CPU)
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return frame size, including the header, or -1 for error
+ */
+size_t salvador_compress_frame(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+      const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, int nNumThreads, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats) {
+   size_t nCompressedSize;
+
+   if (nMaxOutBufferSize < FRAME_HEADER_SIZE || nDictionarySize > nInputSize)
+      return -1;
+
+   nCompressedSize = salvador_compress_parallel(pInputData, pOutBuffer + FRAME_HEADER_SIZE, nInputSize, nMaxOutBufferSize - FRAME_HEADER_SIZE, nFlags, nMaxOffset, nDictionarySize, nNumThreads, progress, pStats);
+   if (nCompressedSize == (size_t)-1)
+      return -1;
+
+   if (salvador_write_frame_header(pOutBuffer, nMaxOutBufferSize, nInputSize - nDictionarySize, nCompressedSize, nFlags) == (size_t)-1)
+      return -1;
+
+   return FRAME_HEADER_SIZE + nCompressedSize;
+}
+
+/**
+ * Get decompressed size of a frame, without decoding it
+ *
+ * @param pInputData frame data
+ * @param nInputSize frame size in bytes
+ *
+ * @return decompressed size in bytes, or -1 if the data isn't a frame
+ */
+size_t salvador_get_frame_decompressed_size(const unsigned char *pInputData, const size_t nInputSize) {
+   size_t nOriginalSize, nCompressedSize;
+   unsigned int nFrameFlags;
+
+   if (salvador_read_frame_header(pInputData, nInputSize, &nOriginalSize, &nCompressedSize, &nFrameFlags) == (size_t)-1)
+      return -1;
+   return nOriginalSize;
+}
+
+/**
+ * Decompress a frame in memory, in one pass
+ *
+ * @param pInputData frame data
+ * @param pOutData buffer for decompressed data
+ * @param nInputSize frame size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer, not counting the dictionary; at least salvador_get_frame_decompressed_size() bytes
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the decompressed data instead
+ * @param nFlags compression flags (set to FLG_IS_INVERTED); the frame must have been compressed with the same format
+ *
+ * @return actual decompressed size, or -1 for error; the data starts at pOutData + nDictionarySize, or at pOutData with FLG_NATIVE_BACKWARD
+ */
+size_t salvador_decompress_frame(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags) {
+   size_t nHeaderSize, nOriginalSize, nCompressedSize, nDecompressedSize;
+   unsigned int nFrameFlags;
+
+   nHeaderSize = salvador_read_frame_header(pInputData, nInputSize, &nOriginalSize, &nCompressedSize, &nFrameFlags);
+   if (nHeaderSize == (size_t)-1 || nFrameFlags != (nFlags & (FLG_IS_INVERTED | FLG_IS_BACKWARD)))
+      return -1;
+
+   /* Decode into exactly the decompressed size, so that backward data also ends up at the start of the buffer */
+   if (nOriginalSize > nMaxOutBufferSize)
+      return -1;
+   nDecompressedSize = salvador_decompress(pInputData + nHeaderSize, pOutData, nCompressedSize, nOriginalSize, nDictionarySize, nFlags);
+
+   return (nDecompressedSize == nOriginalSize) ? nDecompressedSize : (size_t)-1;
+}
+
+/**
+ * Get maximum size of a frame with a block index
+ *
+ * @param nInputSize input(source) size in bytes
+ * @param nCheckpointInterval approximate number of bytes between checkpoints, at least MIN_CHECKPOINT_INTERVAL
+ *
+ * @return maximum frame size, or -1 for error
+ */
+size_t salvador_get_max_indexed_frame_size(const size_t nInputSize, const size_t nCheckpointInterval) {
+   const int nMaxCheckpoints = salvador_get_max_checkpoints(nInputSize, nCheckpointInterval);
+
+   if (nMaxCheckpoints < 0)
+      return -1;
+   return FRAME_HEADER_SIZE + salvador_get_max_compressed_size(nInputSize) + 4 + (size_t)nMaxCheckpoints * FRAME_CHECKPOINT_SIZE;
+}
+
+/**
+ * Compress memory into a frame with a block index, so that any part of the data can be decompressed with salvador_decompress_range()
+ * without decoding it from the start. The compressed stream is the same as the output of salvador_compress_indexed()
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for frame
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of buffer, at least salvador_get_max_indexed_frame_size()
+ * @param nFlags compression flags (set to FLG_IS_INVERTED); backward compression isn't supported
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nCheckpointInterval approximate number of bytes between checkpoints, at least MIN_CHECKPOINT_INTERVAL
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return frame size, including the header and the index, or -1 for error
+ */
+size_t salvador_compress_indexed_frame(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+      const unsigned int nFlags, const size_t nMaxOffset, const size_t nCheckpointInterval, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats) {
+   const int nMaxCheckpoints = salvador_get_max_checkpoints(nInputSize, nCheckpointInterval);
+   salvador_checkpoint *pCheckpoints;
+   size_t nCompressedSize, nFrameSize;
+   int nNumCheckpoints = 0, i;
+
+   if (nMaxCheckpoints < 0 || nMaxOutBufferSize < FRAME_HEADER_SIZE)
+      return -1;
+
+   pCheckpoints = (salvador_checkpoint *)malloc(nMaxCheckpoints * sizeof(salvador_checkpoint));
+   if (!pCheckpoints)
+      return -1;
+
+   nCompressedSize = salvador_compress_indexed(pInputData, pOutBuffer + FRAME_HEADER_SIZE, nInputSize, nMaxOutBufferSize - FRAME_HEADER_SIZE, nFlags, nMaxOffset, nCheckpointInterval,
+      pCheckpoints, nMaxCheckpoints, &nNumCheckpoints, progress, pStats);
+   if (nCompressedSize == (size_t)-1 || (nMaxOutBufferSize - FRAME_HEADER_SIZE - nCompressedSize) < (4 + (size_t)nNumCheckpoints * FRAME_CHECKPOINT_SIZE) ||
+      salvador_write_frame_header(pOutBuffer, nMaxOutBufferSize, nInputSize, nCompressedSize, nFlags) == (size_t)-1) {
+      free(pCheckpoints);
+      return -1;
+   }
+   pOutBuffer[5] |= FRAME_FLG_HAS_INDEX;
+
+   /* Write the index after the compressed stream, so that the stream stays right after the header */
+   nFrameSize = FRAME_HEADER_SIZE + nCompressedSize;
+   salvador_frame_write_le32(pOutBuffer + nFrameSize, (unsigned int)nNumCheckpoints);
+   nFrameSize += 4;
+
+   for (i = 0; i < nNumCheckpoints; i++) {
+      unsigned char *pOut = pOutBuffer + nFrameSize;
+
+      salvador_frame_write_le32(pOut, (unsigned int)pCheckpoints[i].out_offset);
+      salvador_frame_write_le32(pOut + 4, (unsigned int)pCheckpoints[i].in_offset);
+      salvador_frame_write_le32(pOut + 8, (unsigned int)pCheckpoints[i].bits_offset);
+      pOut[12] = pCheckpoints[i].rep_offset & 0xff;
+      pOut[13] = (pCheckpoints[i].rep_offset >> 8) & 0xff;
+      pOut[14] = (unsigned char)(pCheckpoints[i].bit_shift + 1);
+      pOut[15] = 0;
+      nFrameSize += FRAME_CHECKPOINT_SIZE;
+   }
+
+   free(pCheckpoints);
+   return nFrameSize;
+}
+
+/**
+ * Decompress part of a frame that has a block index, decoding from the closest checkpoint before it instead of from the start
+ *
+ * @param pInputData frame data
+ * @param nInputSize frame size in bytes
+ * @param pOutData buffer for decompressed data, of at least nSize bytes
+ * @param nOffset offset of the first byte to decompress
+ * @param nSize number of bytes to decompress
+ * @param nFlags compression flags (set to FLG_IS_INVERTED); the frame must have been compressed with the same format
+ *
+ * @return nSize, or -1 for error
+ */
+size_t salvador_decompress_range(const unsigned char *pInputData, const size_t nInputSize, unsigned char *pOutData, const size_t nOffset, const size_t nSize, const unsigned int nFlags) {
+   const unsigned char *pIndex;
+   const unsigned char *pStream = pInputData + FRAME_HEADER_SIZE;
+   salvador_checkpoint checkpoint;
+   size_t nOriginalSize, nCompressedSize, nNumCheckpoints, nRangeEnd, nDecodeEnd, nDecodedSize;
+   size_t nPrevOutOffset = 0, i;
+   unsigned int nFrameFlags;
+   unsigned char *pDecodedData;
+
+   if (salvador_read_frame_header(pInputData, nInputSize, &nOriginalSize, &nCompressedSize, &nFrameFlags) == (size_t)-1 ||
+      nFrameFlags != (nFlags & (FLG_IS_INVERTED | FLG_IS_BACKWARD)) || (nFlags & FLG_IS_BACKWARD))
+      return -1;
+
+   pIndex = salvador_frame_get_index(pInputData, nInputSize, &nCompressedSize, &nNumCheckpoints);
+   if (!pIndex || !nNumCheckpoints || nOffset > nOriginalSize || nSize > (nOriginalSize - nOffset))
+      return -1;
+   if (!nSize)
+      return 0;
+
+   /* Find the last checkpoint at or before the range, and the first one after it, where decoding can stop */
+
+   nRangeEnd = nOffset + nSize;
+   nDecodeEnd = nOriginalSize;
+   checkpoint.out_offset = 0;
+   checkpoint.in_offset = 0;
+   checkpoint.bits_offset = 0;
+   checkpoint.bit_shift = -1;
+   checkpoint.rep_offset = 1;
+
+   for (i = 0; i < nNumCheckpoints; i++) {
+      const unsigned char *pCheckpoint = pIndex + i * FRAME_CHECKPOINT_SIZE;
+      const size_t nOutOffset = salvador_frame_read_le32(pCheckpoint);
+
+      if ((i == 0 && nOutOffset != 0) || (i != 0 && nOutOffset <= nPrevOutOffset) || nOutOffset > nOriginalSize)
+         return -1;
+      nPrevOutOffset = nOutOffset;
+
+      if (nOutOffset <= nOffset) {
+         checkpoint.out_offset = nOutOffset;
+         checkpoint.in_offset = salvador_frame_read_le32(pCheckpoint + 4);
+         checkpoint.bits_offset = salvador_frame_read_le32(pCheckpoint + 8);
+         checkpoint.rep_offset = ((int)pCheckpoint[12]) | (((int)pCheckpoint[13]) << 8);
+         checkpoint.bit_shift = ((int)pCheckpoint[14]) - 1;
+      }
+      else if (nOutOffset >= nRangeEnd) {
+         nDecodeEnd = nOutOffset;
+         break;
+      }
+   }
+
+   if (nOffset == checkpoint.out_offset && nDecodeEnd == nRangeEnd) {
+      /* The range covers whole segments; decode straight into the output */
+      nDecodedSize = salvador_decompress_checkpoint(pStream, pOutData, nCompressedSize, nSize, &checkpoint, nFlags);
+      return (nDecodedSize == nSize) ? nSize : (size_t)-1;
+   }
+
+   pDecodedData = (unsigned char *)malloc(nDecodeEnd - checkpoint.out_offset);
+   if (!pDecodedData)
+      return -1;
+
+   nDecodedSize = salvador_decompress_checkpoint(pStream, pDecodedData, nCompressedSize, nDecodeEnd - checkpoint.out_offset, &checkpoint, nFlags);
+   if (nDecodedSize != (nDecodeEnd - checkpoint.out_offset)) {
+      free(pDecodedData);
+      return -1;
+   }
+
+   memcpy(pOutData, pDecodedData + (nOffset - checkpoint.out_offset), nSize);
+   free(pDecodedData);
+   return nSize;
+}
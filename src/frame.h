@@ -0,0 +1,159 @@
+/*
+ * frame.h - size-prefixed container definitions
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include "shrink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Write the header of a frame: a compressed stream prefixed with its decompressed and compressed sizes, so that it can be decompressed
+ * into an exactly sized buffer in one pass. The header is FRAME_HEADER_SIZE bytes and is followed by the compressed stream, unchanged;
+ * decompressors that don't know about frames, such as the asm unpackers, just start reading after the header.
+ *
+ * @param pOutData buffer for header
+ * @param nMaxOutDataSize maximum capacity of buffer
+ * @param nOriginalSize decompressed size in bytes, not including the dictionary
+ * @param nCompressedSize size of compressed stream in bytes, not including the header
+ * @param nFlags compression flags that the stream was compressed with; FLG_IS_INVERTED and FLG_IS_BACKWARD are recorded
+ *
+ * @return header size in bytes, or -1 for error
+ */
+size_t salvador_write_frame_header(unsigned char *pOutData, const size_t nMaxOutDataSize, const size_t nOriginalSize, const size_t nCompressedSize, const unsigned int nFlags);
+
+/**
+ * Read the header of a frame, and check that the whole compressed stream is present; only the header itself is read
+ *
+ * @param pInputData frame data
+ * @param nInputSize frame size in bytes
+ * @param pOriginalSize pointer to returned decompressed size in bytes, not including the dictionary
+ * @param pCompressedSize pointer to returned size of compressed stream in bytes, that follows the header
+ * @param pFlags pointer to returned compression flags that the stream was compressed with (FLG_IS_INVERTED, FLG_IS_BACKWARD)
+ *
+ * @return header size in bytes, or -1 if the data isn't a frame
+ */
+size_t salvador_read_frame_header(const unsigned char *pInputData, const size_t nInputSize, size_t *pOriginalSize, size_t *pCompressedSize, unsigned int *pFlags);
+
+/**
+ * Compress memory into a frame
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for frame
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of buffer, at least FRAME_HEADER_SIZE bytes more than for salvador_compress()
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param nNumThreads number of threads to use (0 for one per CPU)
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return frame size, including the header, or -1 for error
+ */
+size_t salvador_compress_frame(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+   const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, int nNumThreads, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats);
+
+/**
+ * Get decompressed size of a frame, without decoding it
+ *
+ * @param pInputData frame data
+ * @param nInputSize frame size in bytes
+ *
+ * @return decompressed size in bytes, or -1 if the data isn't a frame
+ */
+size_t salvador_get_frame_decompressed_size(const unsigned char *pInputData, const size_t nInputSize);
+
+/**
+ * Decompress a frame in memory, in one pass
+ *
+ * @param pInputData frame data
+ * @param pOutData buffer for decompressed data
+ * @param nInputSize frame size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer, not counting the dictionary; at least salvador_get_frame_decompressed_size() bytes
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the decompressed data instead
+ * @param nFlags compression flags (set to FLG_IS_INVERTED); the frame must have been compressed with the same format
+ *
+ * @return actual decompressed size, or -1 for error; the data starts at pOutData + nDictionarySize, or at pOutData with FLG_NATIVE_BACKWARD
+ */
+size_t salvador_decompress_frame(const unsigned char *pInputData, unsigned char *pOutData, size_t nInputSize, size_t nMaxOutBufferSize, size_t nDictionarySize, const unsigned int nFlags);
+
+/**
+ * Get maximum size of a frame with a block index
+ *
+ * @param nInputSize input(source) size in bytes
+ * @param nCheckpointInterval approximate number of bytes between checkpoints, at least MIN_CHECKPOINT_INTERVAL
+ *
+ * @return maximum frame size, or -1 for error
+ */
+size_t salvador_get_max_indexed_frame_size(const size_t nInputSize, const size_t nCheckpointInterval);
+
+/**
+ * Compress memory into a frame with a block index, so that any part of the data can be decompressed with salvador_decompress_range()
+ * without decoding it from the start. The index of checkpoints follows the compressed stream, which is the same as the output of
+ * salvador_compress_indexed(); salvador_decompress_frame() and the regular decompressors, after skipping the header, decode it as usual
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for frame
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of buffer, at least salvador_get_max_indexed_frame_size()
+ * @param nFlags compression flags (set to FLG_IS_INVERTED); backward compression isn't supported
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nCheckpointInterval approximate number of bytes between checkpoints, at least MIN_CHECKPOINT_INTERVAL
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return frame size, including the header and the index, or -1 for error
+ */
+size_t salvador_compress_indexed_frame(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+   const unsigned int nFlags, const size_t nMaxOffset, const size_t nCheckpointInterval, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats);
+
+/**
+ * Decompress part of a frame that has a block index, decoding from the closest checkpoint before it instead of from the start
+ *
+ * @param pInputData frame data
+ * @param nInputSize frame size in bytes
+ * @param pOutData buffer for decompressed data, of at least nSize bytes
+ * @param nOffset offset of the first byte to decompress
+ * @param nSize number of bytes to decompress
+ * @param nFlags compression flags (set to FLG_IS_INVERTED); the frame must have been compressed with the same format
+ *
+ * @return nSize, or -1 for error
+ */
+size_t salvador_decompress_range(const unsigned char *pInputData, const size_t nInputSize, unsigned char *pOutData, const size_t nOffset, const size_t nSize, const unsigned int nFlags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FRAME_H */
@@ -54,6 +54,7 @@ typedef int saidx_t;
 typedef struct _divsufsort_ctx_t {
    saidx_t *bucket_A;
    saidx_t *bucket_B;
+   saint_t num_threads;    /**< number of threads to sort type B* substrings on; 1 after divsufsort_init() */
 } divsufsort_ctx_t;
 
 /*- Prototypes -*/
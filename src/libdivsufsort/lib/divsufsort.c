@@ -27,17 +27,136 @@
 #include "divsufsort_private.h"
 #ifdef _OPENMP
 # include <omp.h>
+#else
+# include "../../thread.h"
 #endif
 
+/** Smallest input, in bytes, that type B* substrings are sorted for on several threads */
+#define SSSORT_MIN_PARALLEL_SIZE 32768
+
+/** Maximum number of threads that type B* substrings are sorted on */
+#define SSSORT_MAX_THREADS 16
+
 
 /*- Private Functions -*/
 
+#ifndef _OPENMP
+/** Type B* buckets shared by all the threads sorting them */
+typedef struct _sssort_job_t {
+   const sauchar_t *T;
+   saidx_t *PAb;
+   saidx_t *SA;
+   saidx_t *bucket_B;
+   saidx_t bufsize;
+   saidx_t n;
+   saidx_t m;
+   saint_t c0;
+   saint_t c1;
+   saidx_t j;
+   salvador_mutex lock;
+} sssort_job_t;
+
+/** Thread sorting type B* buckets, with its own part of the free space in SA as work buffer */
+typedef struct _sssort_worker_t {
+   sssort_job_t *job;
+   saidx_t *curbuf;
+   salvador_thread thread;
+} sssort_worker_t;
+
+/**
+ * Sort type B* buckets until none are left. This is the bucket loop of the OpenMP build, with the critical section replaced by a mutex
+ *
+ * @param arg worker (sssort_worker_t *)
+ */
+static void sssort_worker_func(void *arg) {
+   sssort_worker_t *worker = (sssort_worker_t *)arg;
+   sssort_job_t *job = worker->job;
+   saidx_t *bucket_B = job->bucket_B;
+   saidx_t k = 0, l;
+   saint_t d0, d1;
+
+   for (;;) {
+      /* Claim the next bucket that holds more than one entry, walking down from the last one */
+      salvador_mutex_lock(&job->lock);
+      if (0 < (l = job->j)) {
+         d0 = job->c0, d1 = job->c1;
+         do {
+            k = BUCKET_BSTAR(d0, d1);
+            if (--d1 <= d0) {
+               d1 = ALPHABET_SIZE - 1;
+               if (--d0 < 0) { break; }
+            }
+         } while (((l - k) <= 1) && (0 < (l = k)));
+         job->c0 = d0, job->c1 = d1, job->j = k;
+      }
+      salvador_mutex_unlock(&job->lock);
+
+      if (l == 0) { break; }
+      sssort(job->T, job->PAb, job->SA + k, job->SA + l,
+             worker->curbuf, job->bufsize, 2, job->n, *(job->SA + k) == (job->m - 1));
+   }
+}
+
+/**
+ * Sort type B* buckets on several threads. The calling thread takes part; if threads can't be started, it sorts the remaining buckets on its own
+ *
+ * @param T input string
+ * @param PAb positions of type B* suffixes
+ * @param SA suffix array, with type B* suffixes sorted by their first two characters
+ * @param bucket_B bucket array
+ * @param n length of input string
+ * @param m number of type B* suffixes
+ * @param num_threads number of threads to use, including the calling thread
+ *
+ * @return 0 for success, non-zero if the buckets weren't sorted and the caller must sort them itself
+ */
+static int sssort_parallel(const sauchar_t *T, saidx_t *PAb, saidx_t *SA, saidx_t *bucket_B, saidx_t n, saidx_t m, saint_t num_threads) {
+   sssort_job_t job;
+   sssort_worker_t workers[SSSORT_MAX_THREADS];
+   saint_t num_started, i;
+
+   if (num_threads > SSSORT_MAX_THREADS)
+      num_threads = SSSORT_MAX_THREADS;
+   if (salvador_mutex_init(&job.lock))
+      return 100;
+
+   job.T = T;
+   job.PAb = PAb;
+   job.SA = SA;
+   job.bucket_B = bucket_B;
+   job.bufsize = (n - (2 * m)) / num_threads;
+   job.n = n;
+   job.m = m;
+   job.c0 = ALPHABET_SIZE - 2;
+   job.c1 = ALPHABET_SIZE - 1;
+   job.j = m;
+
+   for (i = 0; i < num_threads; i++) {
+      workers[i].job = &job;
+      workers[i].curbuf = SA + m + i * job.bufsize;
+   }
+
+   for (num_started = 1; num_started < num_threads; num_started++) {
+      if (salvador_thread_create(&workers[num_started].thread, sssort_worker_func, &workers[num_started]))
+         break;
+   }
+
+   sssort_worker_func(&workers[0]);
+
+   for (i = 1; i < num_started; i++)
+      salvador_thread_join(&workers[i].thread);
+
+   salvador_mutex_destroy(&job.lock);
+   return 0;
+}
+#endif
+
 /* Sorts suffixes of type B*. */
 static
 saidx_t
 sort_typeBstar(const sauchar_t *T, saidx_t *SA,
                saidx_t *bucket_A, saidx_t *bucket_B,
-               saidx_t n) {
+               saidx_t n, saint_t num_threads) {
   saidx_t *PAb, *ISAb, *buf;
 #ifdef _OPENMP
   saidx_t *curbuf;
@@ -130,13 +249,16 @@ note:
       }
     }
 #else
-    buf = SA + m, bufsize = n - (2 * m);
-    for(c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0) {
-      for(c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1) {
-        i = BUCKET_BSTAR(c0, c1);
-        if(1 < (j - i)) {
-          sssort(T, PAb, SA + i, SA + j,
-                 buf, bufsize, 2, n, *(SA + i) == (m - 1));
+    if((num_threads <= 1) || (n < SSSORT_MIN_PARALLEL_SIZE) ||
+       (sssort_parallel(T, PAb, SA, bucket_B, n, m, num_threads) != 0)) {
+      buf = SA + m, bufsize = n - (2 * m);
+      for(c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0) {
+        for(c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1) {
+          i = BUCKET_BSTAR(c0, c1);
+          if(1 < (j - i)) {
+            sssort(T, PAb, SA + i, SA + j,
+                   buf, bufsize, 2, n, *(SA + i) == (m - 1));
+          }
         }
       }
     }
@@ -335,6 +457,7 @@ construct_BWT(const sauchar_t *T, saidx_t *SA,
 int divsufsort_init(divsufsort_ctx_t *ctx) {
    ctx->bucket_A = (saidx_t *)malloc(BUCKET_A_SIZE * sizeof(saidx_t));
    ctx->bucket_B = NULL;
+   ctx->num_threads = 1;
 
    if (ctx->bucket_A) {
       ctx->bucket_B = (saidx_t *)malloc(BUCKET_B_SIZE * sizeof(saidx_t));
@@ -379,7 +502,7 @@ divsufsort_build_array(divsufsort_ctx_t *ctx, const sauchar_t *T, saidx_t *SA, s
 
   /* Suffixsort. */
   if((ctx->bucket_A != NULL) && (ctx->bucket_B != NULL)) {
-    m = sort_typeBstar(T, SA, ctx->bucket_A, ctx->bucket_B, n);
+    m = sort_typeBstar(T, SA, ctx->bucket_A, ctx->bucket_B, n, ctx->num_threads);
     construct_SA(T, SA, ctx->bucket_A, ctx->bucket_B, n, m);
   } else {
     err = -2;
@@ -405,7 +528,7 @@ divbwt(const sauchar_t *T, sauchar_t *U, saidx_t *A, saidx_t n) {
 
   /* Burrows-Wheeler Transform. */
   if((B != NULL) && (bucket_A != NULL) && (bucket_B != NULL)) {
-    m = sort_typeBstar(T, B, bucket_A, bucket_B, n);
+    m = sort_typeBstar(T, B, bucket_A, bucket_B, n, 1);
     pidx = construct_BWT(T, B, bucket_A, bucket_B, n, m);
 
     /* Copy to output string. */
@@ -33,9 +33,31 @@
 
 #include "format.h"
 #include "shrink.h"
+#include "dictionary.h"
 #include "expand.h"
+#include "frame.h"
 
 #define FLG_IS_INVERTED  1       /**< Use inverted (V2) format */
 #define FLG_IS_BACKWARD  2       /**< Use backward encoding */
+#define FLG_FAST_MATCHFINDER  4  /**< Find matches with hash chains instead of the suffix array: much faster, but compresses less */
+#define FLG_PHASE_STATS  8       /**< Measure the time spent in each compression phase, in the compression stats */
+#define FLG_NATIVE_BACKWARD  16  /**< With FLG_IS_BACKWARD: data is in file order, and is walked from the end by the library, instead of being reversed by the caller */
+#define FLG_PIPELINE  32         /**< Find the matches for the next block on a second thread, while the current one is optimized and written (single-threaded compression only) */
+#define FLG_HUGE_PAGES  64       /**< Map the working memory of the compressor from the OS with huge pages, for fewer TLB misses; the huge pages are resident in full even where the tables aren't touched */
+
+#define FLG_CHAIN_CANDIDATES_SHIFT  8
+#define FLG_CHAIN_CANDIDATES(__n)   (((__n) & 0xff) << FLG_CHAIN_CANDIDATES_SHIFT)  /**< Number of hash chain candidates to check per position with FLG_FAST_MATCHFINDER (1..255, 0 for default) */
+
+#define MIN_COMPRESSION_LEVEL 1  /**< Fastest compression level */
+#define MAX_COMPRESSION_LEVEL 9  /**< Best compressing level, and the default */
+
+#define FLG_LEVEL_SHIFT  16
+#define FLG_LEVEL(__n)   (((__n) & 0xf) << FLG_LEVEL_SHIFT)  /**< Compression level (MIN_COMPRESSION_LEVEL..MAX_COMPRESSION_LEVEL, 0 for default: MAX_COMPRESSION_LEVEL, or level 2 with FLG_FAST_MATCHFINDER) */
+
+#define FLG_BLOCK_SIZE_SHIFT  20
+#define FLG_BLOCK_SIZE(__n)   (((__n) & 0x7) << FLG_BLOCK_SIZE_SHIFT)  /**< Optimize blocks of (64 KB << n) bytes (0..6, up to 4 MB; 0 for default: 64 KB), for fewer restarts of the parse at the cost of memory; always 64 KB with SALVADOR_COMPACT_ARRIVALS */
+
+#define FLG_PARSE_SEGMENTS_SHIFT  24
+#define FLG_PARSE_SEGMENTS(__n)   (((__n) & 0xf) << FLG_PARSE_SEGMENTS_SHIFT)  /**< Experimental: pick the final matches of each block as n segments on n threads (2..15, 0 for off), from a few likely rep offsets at the start of each; compresses slightly less, and needs about twice the memory for the optimizer */
 
 #endif /* _LIB_SALVADOR_H */
@@ -32,6 +32,8 @@
 #include "matchfinder.h"
 #include "format.h"
 #include "libsalvador.h"
+#include "thread.h"
+#include "simd.h"
 
 /**
  * Hash index into TAG_BITS
@@ -55,6 +57,7 @@ static inline int salvador_get_index_tag(unsigned int nIndex) {
  */
 int salvador_build_suffix_array(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize) {
    unsigned long long *intervals = pCompressor->intervals;
+   long long nStartTime = (pCompressor->flags & FLG_PHASE_STATS) ? salvador_get_time() : 0LL;
 
    /* Build suffix array from input data */
    saidx_t *suffixArray = (saidx_t*)intervals;
@@ -62,6 +65,13 @@ int salvador_build_suffix_array(salvador_compressor *pCompressor, const unsigned
       return 100;
    }
 
+   if (pCompressor->flags & FLG_PHASE_STATS) {
+      const long long nSortedTime = salvador_get_time();
+
+      pCompressor->stats.sort_time += nSortedTime - nStartTime;
+      nStartTime = nSortedTime;
+   }
+
    int i, r;
 
    for (i = nInWindowSize - 1; i >= 0; i--) {
@@ -171,6 +181,9 @@ int salvador_build_suffix_array(salvador_compressor *pCompressor, const unsigned
    for (; top > pCompressor->open_intervals; top--)
       intervals[*top & POS_MASK] = *(top - 1);
 
+   if (pCompressor->flags & FLG_PHASE_STATS)
+      pCompressor->stats.interval_time += salvador_get_time() - nStartTime;
+
    /* Success */
    return 0;
 }
@@ -346,6 +359,293 @@ static int salvador_find_matches_at(salvador_compressor *pCompressor, const int
    return (int)(matchptr - pMatches);
 }
 
+/**
+ * Parse input data and reset hash chains, for finding matches quickly instead of using the suffix array
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_build_hash_chains(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize) {
+   const long long nStartTime = (pCompressor->flags & FLG_PHASE_STATS) ? salvador_get_time() : 0LL;
+
+   pCompressor->in_window = pInWindow;
+   pCompressor->in_window_size = nInWindowSize;
+
+   /* The chain links are stored in the intervals table, that is unused in this mode; they are filled in as positions are scanned */
+   memset(pCompressor->hash_head, 0xff, (1 << HASH_CHAIN_BITS) * sizeof(int));
+
+   if (pCompressor->flags & FLG_PHASE_STATS)
+      pCompressor->stats.interval_time += salvador_get_time() - nStartTime;
+   return 0;
+}
+
+/**
+ * Parse input data and build the data structures used for finding matches, using the match finder selected in the compression flags
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ * @param nDictionarySize number of bytes at the start of the window that come from the dictionary (0 for none)
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_build_match_index(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize, const int nDictionarySize) {
+   const salvador_dictionary *pDictionary = pCompressor->dictionary;
+
+   pCompressor->index_start = 0;
+   if (pCompressor->flags & FLG_FAST_MATCHFINDER)
+      return salvador_build_hash_chains(pCompressor, pInWindow, nInWindowSize);
+
+   pCompressor->in_window = pInWindow;
+   pCompressor->in_window_size = nInWindowSize;
+
+   if (pDictionary && nDictionarySize > 0 && nDictionarySize < nInWindowSize &&
+      (nDictionarySize <= pDictionary->indexed_size || pCompressor->max_offset <= pDictionary->indexed_size)) {
+      /* Leave the dictionary out of the suffix array if the prepared one indexes all the bytes that matches can reach in it */
+      const int nCheckSize = (nDictionarySize < pDictionary->indexed_size) ? nDictionarySize : pDictionary->indexed_size;
+
+      if (!memcmp(pInWindow + nDictionarySize - nCheckSize, pDictionary->indexed_data + pDictionary->indexed_size - nCheckSize, nCheckSize))
+         pCompressor->index_start = nDictionarySize;
+   }
+
+   return salvador_build_suffix_array(pCompressor, pInWindow + pCompressor->index_start, nInWindowSize - pCompressor->index_start);
+}
+
+/**
+ * Find matches at the specified offset in the input window, that start in the prepared dictionary attached to the compression context
+ *
+ * The matches are found in the suffix array of the prepared dictionary, and are all further away than the matches found in the suffix
+ * array of the window, so that only the ones that are also longer are returned; like for the window, each match is shorter and closer
+ * than the previous one
+ *
+ * @param pCompressor compression context
+ * @param nOffset offset to find matches at, in the input window
+ * @param nMinMatchLen length that matches must exceed (the longest match found in the window)
+ * @param pMatches pointer to returned matches
+ * @param pMatchDepth pointer to returned match depths
+ * @param nMaxMatches maximum number of matches to return
+ *
+ * @return number of matches
+ */
+static int salvador_find_dictionary_matches_at(salvador_compressor *pCompressor, const int nOffset, const int nMinMatchLen, salvador_match *pMatches, unsigned short *pMatchDepth, const int nMaxMatches) {
+   const salvador_dictionary *pDictionary = pCompressor->dictionary;
+   const unsigned char *pInWindowAtPos = pCompressor->in_window + nOffset;
+   const unsigned char *pIndexedData = pDictionary->indexed_data;
+   const int *suffix_array = pDictionary->suffix_array;
+   const int *lcp = pDictionary->lcp;
+   const int nIndexedSize = pDictionary->indexed_size;
+   /* Window offset of the first indexed byte, which is negative if the window doesn't hold all of them */
+   const int nIndexedStart = pCompressor->index_start - nIndexedSize;
+   const int nMaxOffset = pCompressor->max_offset;
+   int nMaxLen = pCompressor->in_window_size - nOffset;
+   int nLow, nHigh, nLowLen, nHighLen, nBestLen, nBestRank;
+   int nLevel, nMostRecentPos, nPrevLen, nPrevOffset, nSteps, nMatches;
+
+   if (nMaxLen > (int)LCP_MAX)
+      nMaxLen = LCP_MAX;
+   if (nMaxLen <= nMinMatchLen || !nMaxMatches || (nOffset - pCompressor->index_start) >= nMaxOffset)
+      return 0;
+
+   /* Binary search for the suffix that shares the longest prefix, skipping the bytes known to be shared with both bounds */
+   nLow = 0;
+   nHigh = nIndexedSize;
+   nLowLen = nHighLen = 0;
+   nBestLen = 0;
+   nBestRank = 0;
+   while (nLow < nHigh) {
+      const int nMid = (nLow + nHigh) >> 1;
+      const int nPos = suffix_array[nMid];
+      const int nSuffixLen = nIndexedSize - nPos;
+      const int nCmpLen = (nSuffixLen < nMaxLen) ? nSuffixLen : nMaxLen;
+      int nLen = (nLowLen < nHighLen) ? nLowLen : nHighLen;
+
+      nLen += salvador_get_common_len(pInWindowAtPos + nLen, pIndexedData + nPos + nLen, nCmpLen - nLen);
+      if (nLen > nBestLen) {
+         nBestLen = nLen;
+         nBestRank = nMid;
+      }
+      if (nLen >= nMaxLen)
+         break;
+
+      if (nLen >= nSuffixLen || pInWindowAtPos[nLen] > pIndexedData[nPos + nLen]) {
+         nLow = nMid + 1;
+         nLowLen = nLen;
+      }
+      else {
+         nHigh = nMid;
+         nHighLen = nLen;
+      }
+   }
+
+   if (nBestLen <= nMinMatchLen)
+      return 0;
+
+   /* Widen the range of suffixes around the best one, one shared length at a time, and return the most recent position for
+    * each length, while it gets closer. Stop at a fixed number of steps, so that highly repetitive dictionaries stay fast. */
+   nLow = nHigh = nBestRank;
+   nLevel = nBestLen;
+   nMostRecentPos = suffix_array[nBestRank];
+   nPrevLen = 0;
+   nPrevOffset = 0;
+   nSteps = 0;
+   nMatches = 0;
+   for (;;) {
+      int nPos;
+
+      while (nLow > 0 && lcp[nLow] >= nLevel && nSteps < 256) {
+         nLow--;
+         nSteps++;
+         nPos = suffix_array[nLow];
+         if (nPos > nMostRecentPos)
+            nMostRecentPos = nPos;
+      }
+      while (nHigh < (nIndexedSize - 1) && lcp[nHigh + 1] >= nLevel && nSteps < 256) {
+         nHigh++;
+         nSteps++;
+         nPos = suffix_array[nHigh];
+         if (nPos > nMostRecentPos)
+            nMostRecentPos = nPos;
+      }
+
+      const int nMatchPos = nIndexedStart + nMostRecentPos;
+      const int nMatchOffset = nOffset - nMatchPos;
+      if (nMatchPos >= 0 && nMatchOffset <= nMaxOffset && nMatchOffset != nPrevOffset) {
+         if (nPrevLen > 2 && nMatchOffset == (nPrevOffset - 1) && nLevel == (nPrevLen - 1) && nMatches && pMatchDepth[nMatches - 1] < LCP_MAX) {
+            pMatchDepth[nMatches - 1]++;
+         }
+         else {
+            pMatches[nMatches].length = (unsigned short)nLevel;
+            pMatches[nMatches].offset = (unsigned short)nMatchOffset;
+            pMatchDepth[nMatches] = 0;
+            nMatches++;
+         }
+
+         nPrevLen = nLevel;
+         nPrevOffset = nMatchOffset;
+      }
+
+      if (nMatches >= nMaxMatches || nSteps >= 256)
+         break;
+
+      /* Move on to the longest length shared with a suffix outside of the range */
+      const int nLowLcp = (nLow > 0) ? lcp[nLow] : 0;
+      const int nHighLcp = (nHigh < (nIndexedSize - 1)) ? lcp[nHigh + 1] : 0;
+      nLevel = (nLowLcp > nHighLcp) ? nLowLcp : nHighLcp;
+      if (nLevel <= nMinMatchLen)
+         break;
+   }
+
+   return nMatches;
+}
+
+/**
+ * Find matches at the specified offset in the input window, using hash chains, and insert the offset into its chain
+ *
+ * @param pCompressor compression context
+ * @param nOffset offset to find matches at, in the input window
+ * @param pMatches pointer to returned matches
+ * @param pMatchDepth pointer to returned match depths
+ * @param nMaxMatches maximum number of matches to return (0 for none)
+ *
+ * @return number of matches
+ */
+static int salvador_find_hashed_matches_at(salvador_compressor *pCompressor, const int nOffset, salvador_match *pMatches, unsigned short *pMatchDepth, const int nMaxMatches) {
+   const unsigned char *pInWindow = pCompressor->in_window;
+   int *hash_chain = (int*)pCompressor->intervals;
+   const int nMaxOffset = pCompressor->max_offset;
+   int nMaxLen, nBestLen, nCandidates, nMatchPos, nMatches, i;
+   unsigned int nHash;
+
+   if ((nOffset + 2) > pCompressor->in_window_size)
+      return 0;
+
+   /* Chains are keyed by the first two bytes, so that every candidate matches at least two bytes */
+   nHash = ((unsigned int)pInWindow[nOffset]) | (((unsigned int)pInWindow[nOffset + 1]) << 8);
+   nMatchPos = pCompressor->hash_head[nHash];
+   hash_chain[nOffset] = nMatchPos;
+   pCompressor->hash_head[nHash] = nOffset;
+
+   if (!nMaxMatches)
+      return 0;
+
+   nMaxLen = pCompressor->in_window_size - nOffset;
+   if (nMaxLen > LCP_MAX)
+      nMaxLen = LCP_MAX;
+
+   /* Walk back from the closest candidate, and keep each candidate that is longer than all the closer ones */
+   nBestLen = 1;
+   nMatches = 0;
+   for (nCandidates = pCompressor->max_chain_candidates; nCandidates > 0 && nMatchPos >= 0; nCandidates--, nMatchPos = hash_chain[nMatchPos]) {
+      const unsigned char *pInWindowAtPos = pInWindow + nOffset;
+      const unsigned char *pInWindowMax = pInWindowAtPos + nMaxLen;
+      const int nMatchOffset = nOffset - nMatchPos;
+
+      if (nMatchOffset > nMaxOffset)
+         break;
+      if (pInWindowAtPos[nBestLen] != pInWindowAtPos[nBestLen - nMatchOffset])
+         continue;
+
+      pInWindowAtPos += 2;
+      pInWindowAtPos += salvador_get_common_len(pInWindowAtPos, pInWindowAtPos - nMatchOffset, (const int)(pInWindowMax - pInWindowAtPos));
+
+      const int nMatchLen = (const int)(pInWindowAtPos - (pInWindow + nOffset));
+      if (nMatchLen > nBestLen) {
+         pMatches[nMatches].length = (unsigned short)nMatchLen;
+         pMatches[nMatches].offset = (unsigned short)nMatchOffset;
+         pMatchDepth[nMatches] = 0;
+         nMatches++;
+         nBestLen = nMatchLen;
+
+         if (nMatches >= nMaxMatches || nMatchLen >= nMaxLen)
+            break;
+      }
+   }
+
+   /* Return the longest match first, like the suffix array match finder */
+   for (i = 0; i < (nMatches >> 1); i++) {
+      const salvador_match match = pMatches[i];
+
+      pMatches[i] = pMatches[nMatches - 1 - i];
+      pMatches[nMatches - 1 - i] = match;
+   }
+
+   return nMatches;
+}
+
+/**
+ * Find matches at the specified offset in the input window, when the suffix array only indexes the bytes after the attached dictionary
+ *
+ * @param pCompressor compression context
+ * @param nOffset offset to find matches at, in the input window
+ * @param pMatches pointer to returned matches
+ * @param pMatchDepth pointer to returned match depths
+ * @param nMaxMatches maximum number of matches to return (0 for none)
+ *
+ * @return number of matches
+ */
+static int salvador_find_attached_matches_at(salvador_compressor *pCompressor, const int nOffset, salvador_match *pMatches, unsigned short *pMatchDepth, const int nMaxMatches) {
+   salvador_match windowMatch[NMATCHES_PER_INDEX];
+   unsigned short windowMatchDepth[NMATCHES_PER_INDEX];
+   int nWindowMatches, nMatches;
+
+   if (nOffset < pCompressor->index_start)
+      return 0;
+
+   nWindowMatches = salvador_find_matches_at(pCompressor, nOffset - pCompressor->index_start, windowMatch, windowMatchDepth, (nMaxMatches < NMATCHES_PER_INDEX) ? nMaxMatches : NMATCHES_PER_INDEX);
+
+   /* Matches into the dictionary are further away, so they come first, as the longer ones */
+   nMatches = salvador_find_dictionary_matches_at(pCompressor, nOffset, nWindowMatches ? windowMatch[0].length : 0, pMatches, pMatchDepth, nMaxMatches);
+   if (nWindowMatches > (nMaxMatches - nMatches))
+      nWindowMatches = nMaxMatches - nMatches;
+
+   memcpy(pMatches + nMatches, windowMatch, nWindowMatches * sizeof(salvador_match));
+   memcpy(pMatchDepth + nMatches, windowMatchDepth, nWindowMatches * sizeof(unsigned short));
+   return nMatches + nWindowMatches;
+}
+
 /**
  * Skip previously compressed bytes
  *
@@ -354,39 +654,103 @@ static int salvador_find_matches_at(salvador_compressor *pCompressor, const int
  * @param nEndOffset offset to skip to in input window (typically the number of previously compressed bytes)
  */
 void salvador_skip_matches(salvador_compressor *pCompressor, const int nStartOffset, const int nEndOffset) {
+   const long long nStartTime = (pCompressor->flags & FLG_PHASE_STATS) ? salvador_get_time() : 0LL;
    salvador_match match;
    unsigned short depth;
    int i;
 
    /* Skipping still requires scanning for matches, as this also performs a lazy update of the intervals. However,
     * we don't store the matches. */
-   for (i = nStartOffset; i < nEndOffset; i++) {
-      salvador_find_matches_at(pCompressor, i, &match, &depth, 0);
+   if (pCompressor->flags & FLG_FAST_MATCHFINDER) {
+      for (i = nStartOffset; i < nEndOffset; i++) {
+         salvador_find_hashed_matches_at(pCompressor, i, &match, &depth, 0);
+      }
    }
+   else {
+      /* Only the bytes after the attached dictionary, if any, are in the suffix array */
+      for (i = (nStartOffset > pCompressor->index_start) ? nStartOffset : pCompressor->index_start; i < nEndOffset; i++) {
+         salvador_find_matches_at(pCompressor, i - pCompressor->index_start, &match, &depth, 0);
+      }
+   }
+
+   if (pCompressor->flags & FLG_PHASE_STATS)
+      pCompressor->stats.find_matches_time += salvador_get_time() - nStartTime;
 }
 
 /**
- * Find all matches for the data to be compressed
+ * Find all matches for the data to be compressed, and append them to the match store
+ *
+ * Each row of the match store holds the matches found for one position, followed by NMATCH_ROW_RESERVE empty slots (within a
+ * maximum of nMatchesPerOffset) for the matches that the optimizer inserts later. The row for a position starts at
+ * match_row[position - nRowOffset] in the match pool and ends where the next row starts.
  *
  * @param pCompressor compression context
  * @param nMatchesPerOffset maximum number of matches to store for each offset
  * @param nStartOffset current offset in input window (typically the number of previously compressed bytes)
  * @param nEndOffset offset to end finding matches at (typically the size of the total input window in bytes
+ * @param nRowOffset offset in input window that the first row of the match store is for (typically nStartOffset)
+ *
+ * @return 0 for success, non-zero for failure
  */
-void salvador_find_all_matches(salvador_compressor *pCompressor, const int nMatchesPerOffset, const int nStartOffset, const int nEndOffset) {
-   salvador_match *pMatch = pCompressor->match;
-   unsigned short *pMatchDepth = pCompressor->match_depth;
+int salvador_find_all_matches(salvador_compressor *pCompressor, const int nMatchesPerOffset, const int nStartOffset, const int nEndOffset, const int nRowOffset) {
+   int *match_row = pCompressor->match_row + (nStartOffset - nRowOffset);
+   const long long nStartTime = (pCompressor->flags & FLG_PHASE_STATS) ? salvador_get_time() : 0LL;
+   long long nMatchesFound = 0;
    int i;
 
-   for (i = nStartOffset; i < nEndOffset; i++) {
-      const int nMatches = salvador_find_matches_at(pCompressor, i, pMatch, pMatchDepth, nMatchesPerOffset);
+   if (nStartOffset == nRowOffset)
+      match_row[0] = 0;
+
+   for (i = nStartOffset; i < nEndOffset; i++, match_row++) {
+      const int nRowStart = match_row[0];
+      int nMatches, nRowSize;
+
+      if ((nRowStart + nMatchesPerOffset) > pCompressor->match_pool_size) {
+         /* Grow the match pool. Rows are only referenced by their index in the pool, so it can move. */
+         int nNewPoolSize = pCompressor->match_pool_size * 2;
+         salvador_match *pNewMatch;
+         unsigned short *pNewMatchDepth;
+
+         if (nNewPoolSize < (nRowStart + nMatchesPerOffset))
+            nNewPoolSize = nRowStart + nMatchesPerOffset;
 
-      if (nMatches < nMatchesPerOffset) {
-         memset(pMatch + nMatches, 0, (nMatchesPerOffset - nMatches) * sizeof(salvador_match));
-         memset(pMatchDepth + nMatches, 0, (nMatchesPerOffset - nMatches) * sizeof(unsigned short));
+         pNewMatch = (salvador_match *)salvador_mem_realloc(&pCompressor->arena.allocator, pCompressor->match, pCompressor->match_pool_size * sizeof(salvador_match), nNewPoolSize * sizeof(salvador_match));
+         if (!pNewMatch)
+            return 100;
+         pCompressor->match = pNewMatch;
+
+         pNewMatchDepth = (unsigned short *)salvador_mem_realloc(&pCompressor->arena.allocator, pCompressor->match_depth, pCompressor->match_pool_size * sizeof(unsigned short), nNewPoolSize * sizeof(unsigned short));
+         if (!pNewMatchDepth)
+            return 100;
+         pCompressor->match_depth = pNewMatchDepth;
+
+         pCompressor->match_pool_size = nNewPoolSize;
       }
 
-      pMatch += nMatchesPerOffset;
-      pMatchDepth += nMatchesPerOffset;
+      salvador_match *pMatch = pCompressor->match + nRowStart;
+      unsigned short *pMatchDepth = pCompressor->match_depth + nRowStart;
+
+      if (pCompressor->flags & FLG_FAST_MATCHFINDER)
+         nMatches = salvador_find_hashed_matches_at(pCompressor, i, pMatch, pMatchDepth, nMatchesPerOffset);
+      else if (pCompressor->index_start)
+         nMatches = salvador_find_attached_matches_at(pCompressor, i, pMatch, pMatchDepth, nMatchesPerOffset);
+      else
+         nMatches = salvador_find_matches_at(pCompressor, i, pMatch, pMatchDepth, nMatchesPerOffset);
+
+      /* Leave room for the matches inserted later; the row is terminated by an empty slot unless it is full */
+      nRowSize = nMatches + NMATCH_ROW_RESERVE;
+      if (nRowSize > nMatchesPerOffset)
+         nRowSize = nMatchesPerOffset;
+
+      memset(pMatch + nMatches, 0, (nRowSize - nMatches) * sizeof(salvador_match));
+      memset(pMatchDepth + nMatches, 0, (nRowSize - nMatches) * sizeof(unsigned short));
+      match_row[1] = nRowStart + nRowSize;
+
+      nMatchesFound += nMatches;
    }
+
+   pCompressor->stats.num_matches_found += nMatchesFound;
+   if (pCompressor->flags & FLG_PHASE_STATS)
+      pCompressor->stats.find_matches_time += salvador_get_time() - nStartTime;
+   return 0;
 }
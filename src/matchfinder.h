@@ -48,6 +48,29 @@ extern "C" {
  */
 int salvador_build_suffix_array(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize);
 
+/**
+ * Parse input data and reset hash chains, for finding matches quickly instead of using the suffix array
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_build_hash_chains(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize);
+
+/**
+ * Parse input data and build the data structures used for finding matches, using the match finder selected in the compression flags
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ * @param nDictionarySize number of bytes at the start of the window that come from the dictionary (0 for none)
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_build_match_index(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize, const int nDictionarySize);
+
 /**
  * Skip previously compressed bytes
  *
@@ -58,14 +81,17 @@ int salvador_build_suffix_array(salvador_compressor *pCompressor, const unsigned
 void salvador_skip_matches(salvador_compressor *pCompressor, const int nStartOffset, const int nEndOffset);
 
 /**
- * Find all matches for the data to be compressed
+ * Find all matches for the data to be compressed, and append them to the match store
  *
  * @param pCompressor compression context
  * @param nMatchesPerOffset maximum number of matches to store for each offset
  * @param nStartOffset current offset in input window (typically the number of previously compressed bytes)
  * @param nEndOffset offset to end finding matches at (typically the size of the total input window in bytes
+ * @param nRowOffset offset in input window that the first row of the match store is for (typically nStartOffset)
+ *
+ * @return 0 for success, non-zero for failure
  */
-void salvador_find_all_matches(salvador_compressor *pCompressor, const int nMatchesPerOffset, const int nStartOffset, const int nEndOffset);
+int salvador_find_all_matches(salvador_compressor *pCompressor, const int nMatchesPerOffset, const int nStartOffset, const int nEndOffset, const int nRowOffset);
 
 #ifdef __cplusplus
 }
@@ -33,16 +33,26 @@
 #include <string.h>
 #ifdef _WIN32
 #include <windows.h>
+#include <psapi.h>
 #include <sys/timeb.h>
 #else
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
 #endif
 #include "libsalvador.h"
+#include "thread.h"
 
 #define OPT_VERBOSE        1
 #define OPT_STATS          2
 #define OPT_BACKWARD       4
 #define OPT_CLASSIC        8
+#define OPT_FRAME          16
+#define OPT_INPLACE        32
 
 #define TOOL_VERSION "1.4.2"
 
@@ -99,6 +109,283 @@ static void do_reverse_buffer(unsigned char *pBuffer, size_t nBufferSize) {
 
 /*---------------------------------------------------------------------------*/
 
+/** Whole file held in memory, mapped when possible and read or written with stdio otherwise */
+typedef struct _file_buffer {
+   unsigned char *data;
+   size_t size;
+   const char *filename;
+   int is_mapped;
+#ifdef _WIN32
+   HANDLE file;
+   HANDLE mapping;
+#else
+   int fd;
+   dev_t device;
+   ino_t inode;
+#endif
+} file_buffer;
+
+/**
+ * Get a whole input file in memory. If no space needs to be reserved around it, the file is mapped instead of being read
+ *
+ * @param pszFilename name of file to read
+ * @param nReserveBefore number of bytes to reserve before the file's contents, for the caller to fill
+ * @param nReserveAfter number of bytes to reserve after the file's contents, for the caller to fill
+ * @param nWritable non-zero to allow modifying the data in memory; modifications are never written to the file
+ * @param pBuffer buffer to fill out; pBuffer->data points at the reserved space, followed by pBuffer->size bytes of file data
+ *
+ * @return 0 for success, non-zero for failure (an error message is printed)
+ */
+static int do_open_input_buffer(const char *pszFilename, const size_t nReserveBefore, const size_t nReserveAfter, const int nWritable, file_buffer *pBuffer) {
+   FILE *f_in;
+
+   pBuffer->data = NULL;
+   pBuffer->size = 0;
+   pBuffer->filename = pszFilename;
+   pBuffer->is_mapped = 0;
+
+#ifdef _WIN32
+   pBuffer->file = INVALID_HANDLE_VALUE;
+   pBuffer->mapping = NULL;
+
+   if (!nReserveBefore && !nReserveAfter) {
+      LARGE_INTEGER nFileSize;
+
+      pBuffer->file = CreateFileA(pszFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      if (pBuffer->file != INVALID_HANDLE_VALUE && GetFileSizeEx(pBuffer->file, &nFileSize) && nFileSize.QuadPart > 0 && (unsigned long long)nFileSize.QuadPart <= (unsigned long long)((size_t)-1)) {
+         pBuffer->mapping = CreateFileMappingA(pBuffer->file, NULL, nWritable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+         if (pBuffer->mapping) {
+            pBuffer->data = (unsigned char *)MapViewOfFile(pBuffer->mapping, nWritable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+            if (pBuffer->data) {
+               pBuffer->size = (size_t)nFileSize.QuadPart;
+               pBuffer->is_mapped = 1;
+               return 0;
+            }
+            CloseHandle(pBuffer->mapping);
+            pBuffer->mapping = NULL;
+         }
+      }
+      if (pBuffer->file != INVALID_HANDLE_VALUE) {
+         CloseHandle(pBuffer->file);
+         pBuffer->file = INVALID_HANDLE_VALUE;
+      }
+   }
+#else
+   pBuffer->fd = -1;
+
+   if (!nReserveBefore && !nReserveAfter) {
+      struct stat st;
+
+      pBuffer->fd = open(pszFilename, O_RDONLY);
+      if (pBuffer->fd >= 0 && !fstat(pBuffer->fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 && (unsigned long long)st.st_size <= (unsigned long long)((size_t)-1)) {
+         void *pMapping = mmap(NULL, (size_t)st.st_size, PROT_READ | (nWritable ? PROT_WRITE : 0), MAP_PRIVATE, pBuffer->fd, 0);
+
+         if (pMapping != MAP_FAILED) {
+            pBuffer->data = (unsigned char *)pMapping;
+            pBuffer->size = (size_t)st.st_size;
+            pBuffer->device = st.st_dev;
+            pBuffer->inode = st.st_ino;
+            pBuffer->is_mapped = 1;
+            return 0;
+         }
+      }
+      if (pBuffer->fd >= 0) {
+         close(pBuffer->fd);
+         pBuffer->fd = -1;
+      }
+   }
+#endif
+
+   /* Mapping isn't possible or wanted; read the file instead */
+
+   f_in = fopen(pszFilename, "rb");
+   if (!f_in) {
+      fprintf(stderr, "error opening '%s' for reading\n", pszFilename);
+      return 100;
+   }
+
+   fseek(f_in, 0, SEEK_END);
+   pBuffer->size = (size_t)ftell(f_in);
+   fseek(f_in, 0, SEEK_SET);
+
+   pBuffer->data = (unsigned char *)malloc(nReserveBefore + pBuffer->size + nReserveAfter + 1);
+   if (!pBuffer->data) {
+      fclose(f_in);
+      fprintf(stderr, "out of memory for reading '%s', %zu bytes needed\n", pszFilename, pBuffer->size);
+      return 100;
+   }
+
+   if (fread(pBuffer->data + nReserveBefore, 1, pBuffer->size, f_in) != pBuffer->size) {
+      free(pBuffer->data);
+      pBuffer->data = NULL;
+      fclose(f_in);
+      fprintf(stderr, "I/O error while reading '%s'\n", pszFilename);
+      return 100;
+   }
+
+   fclose(f_in);
+   return 0;
+}
+
+/**
+ * Get zero-filled memory for a whole output file. If no space needs to be reserved around it, the output file is mapped and
+ * written directly
+ *
+ * @param pszFilename name of file to write
+ * @param nReserveBefore number of bytes to reserve before the file's contents, that aren't written out
+ * @param nMaxSize maximum size of the file's contents
+ * @param nReserveAfter number of bytes to reserve after the file's contents, that aren't written out
+ * @param pInBuffer input buffer that stays open while the output is written (NULL for none); the output isn't mapped over it
+ * @param pBuffer buffer to fill out; pBuffer->data points at the reserved space, followed by nMaxSize bytes for the file data
+ *
+ * @return 0 for success, non-zero for failure (an error message is printed)
+ */
+static int do_open_output_buffer(const char *pszFilename, const size_t nReserveBefore, const size_t nMaxSize, const size_t nReserveAfter, const file_buffer *pInBuffer, file_buffer *pBuffer) {
+   pBuffer->data = NULL;
+   pBuffer->size = nMaxSize;
+   pBuffer->filename = pszFilename;
+   pBuffer->is_mapped = 0;
+
+#ifdef _WIN32
+   pBuffer->file = INVALID_HANDLE_VALUE;
+   pBuffer->mapping = NULL;
+
+   /* Windows refuses to truncate a file that is mapped, so an output file that is also the mapped input fails here and is written
+    * with stdio once the input is no longer needed */
+   if (!nReserveBefore && !nReserveAfter && nMaxSize > 0) {
+      pBuffer->file = CreateFileA(pszFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+      if (pBuffer->file != INVALID_HANDLE_VALUE) {
+         LARGE_INTEGER nMappingSize;
+
+         nMappingSize.QuadPart = (LONGLONG)nMaxSize;
+         pBuffer->mapping = CreateFileMappingA(pBuffer->file, NULL, PAGE_READWRITE, nMappingSize.HighPart, nMappingSize.LowPart, NULL);
+         if (pBuffer->mapping) {
+            pBuffer->data = (unsigned char *)MapViewOfFile(pBuffer->mapping, FILE_MAP_WRITE, 0, 0, 0);
+            if (pBuffer->data) {
+               pBuffer->is_mapped = 1;
+               return 0;
+            }
+            CloseHandle(pBuffer->mapping);
+            pBuffer->mapping = NULL;
+         }
+         CloseHandle(pBuffer->file);
+         pBuffer->file = INVALID_HANDLE_VALUE;
+      }
+   }
+#else
+   pBuffer->fd = -1;
+
+   if (!nReserveBefore && !nReserveAfter && nMaxSize > 0) {
+      struct stat st;
+
+      /* Never truncate a file that is also the mapped input */
+      if (!pInBuffer || !pInBuffer->is_mapped || stat(pszFilename, &st) || st.st_dev != pInBuffer->device || st.st_ino != pInBuffer->inode) {
+         pBuffer->fd = open(pszFilename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+         if (pBuffer->fd >= 0 && !ftruncate(pBuffer->fd, (off_t)nMaxSize)) {
+            void *pMapping = mmap(NULL, nMaxSize, PROT_READ | PROT_WRITE, MAP_SHARED, pBuffer->fd, 0);
+
+            if (pMapping != MAP_FAILED) {
+               pBuffer->data = (unsigned char *)pMapping;
+               pBuffer->is_mapped = 1;
+               return 0;
+            }
+         }
+         if (pBuffer->fd >= 0) {
+            close(pBuffer->fd);
+            pBuffer->fd = -1;
+         }
+      }
+   }
+#endif
+
+   /* Mapping isn't possible or wanted; write the file out when closing the buffer instead */
+
+   pBuffer->data = (unsigned char *)malloc(nReserveBefore + nMaxSize + nReserveAfter + 1);
+   if (!pBuffer->data) {
+      fprintf(stderr, "out of memory for writing '%s', %zu bytes needed\n", pszFilename, nMaxSize);
+      return 100;
+   }
+
+   memset(pBuffer->data, 0, nReserveBefore + nMaxSize + nReserveAfter);
+   return 0;
+}
+
+/**
+ * Release a file buffer. For output buffers, write out the file or discard it
+ *
+ * @param pBuffer buffer to release
+ * @param nReserveBefore for output buffers, number of bytes reserved before the file's contents, that aren't written out
+ * @param nFinalSize for output buffers, size of the file's contents to write out, or -1 to discard the output file
+ * @param nIsOutput non-zero for an output buffer, 0 for an input buffer
+ *
+ * @return 0 for success, non-zero for failure (an error message is printed)
+ */
+static int do_close_buffer(file_buffer *pBuffer, const size_t nReserveBefore, const size_t nFinalSize, const int nIsOutput) {
+   int nResult = 0;
+
+   if (!pBuffer->data)
+      return 0;
+
+   if (pBuffer->is_mapped) {
+#ifdef _WIN32
+      UnmapViewOfFile(pBuffer->data);
+      CloseHandle(pBuffer->mapping);
+      if (nIsOutput) {
+         LARGE_INTEGER nFileSize;
+
+         /* Trim the mapped file to the size of its contents */
+         nFileSize.QuadPart = (nFinalSize != (size_t)-1) ? (LONGLONG)nFinalSize : 0;
+         if (!SetFilePointerEx(pBuffer->file, nFileSize, NULL, FILE_BEGIN) || !SetEndOfFile(pBuffer->file))
+            nResult = 100;
+      }
+      CloseHandle(pBuffer->file);
+      pBuffer->mapping = NULL;
+      pBuffer->file = INVALID_HANDLE_VALUE;
+#else
+      munmap(pBuffer->data, pBuffer->size);
+      if (nIsOutput) {
+         /* Trim the mapped file to the size of its contents */
+         if (ftruncate(pBuffer->fd, (nFinalSize != (size_t)-1) ? (off_t)nFinalSize : 0))
+            nResult = 100;
+      }
+      close(pBuffer->fd);
+      pBuffer->fd = -1;
+#endif
+
+      if (nIsOutput && nFinalSize == (size_t)-1) {
+         /* Don't leave an empty output file behind */
+         remove(pBuffer->filename);
+      }
+      else if (nResult) {
+         fprintf(stderr, "I/O error while writing '%s'\n", pBuffer->filename);
+      }
+   }
+   else {
+      if (nIsOutput && nFinalSize != (size_t)-1) {
+         FILE *f_out = fopen(pBuffer->filename, "wb");
+
+         if (f_out) {
+            if (fwrite(pBuffer->data + nReserveBefore, 1, nFinalSize, f_out) != nFinalSize)
+               nResult = 100;
+            if (fclose(f_out))
+               nResult = 100;
+            if (nResult)
+               fprintf(stderr, "I/O error while writing '%s'\n", pBuffer->filename);
+         }
+         else {
+            fprintf(stderr, "error opening '%s' for writing\n", pBuffer->filename);
+            nResult = 100;
+         }
+      }
+      free(pBuffer->data);
+   }
+
+   pBuffer->data = NULL;
+   return nResult;
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void compression_progress(long long nOriginalSize, long long nCompressedSize) {
    if (nOriginalSize >= 512 * 1024) {
       fprintf(stdout, "\r%lld => %lld (%g %%)     \b\b\b\b\b", nOriginalSize, nCompressedSize, (double)(nCompressedSize * 100.0 / nOriginalSize));
@@ -106,224 +393,1165 @@ static void compression_progress(long long nOriginalSize, long long nCompressedS
    }
 }
 
-static int do_compress(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, const unsigned int nMaxWindowSize) {
-   long long nStartTime = 0LL, nEndTime = 0LL;
-   size_t nOriginalSize = 0L, nCompressedSize = 0L, nMaxCompressedSize;
-   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
-   salvador_stats stats;
-   unsigned char *pDecompressedData;
-   unsigned char *pCompressedData;
+typedef struct _stream_files {
+   FILE *f_in;
+   FILE *f_out;
+} stream_files;
 
-   if (nOptions & OPT_BACKWARD)
-      nFlags |= FLG_IS_BACKWARD;
+static size_t stream_read(void *pBuffer, size_t nMaxSize, void *pUserData) {
+   return fread(pBuffer, 1, nMaxSize, ((stream_files *)pUserData)->f_in);
+}
 
-   if (nOptions & OPT_VERBOSE) {
-      nStartTime = do_get_time();
-   }
+static int stream_write(const void *pData, size_t nSize, void *pUserData) {
+   return (fwrite(pData, 1, nSize, ((stream_files *)pUserData)->f_out) == nSize) ? 0 : -1;
+}
 
-   FILE* f_dict = NULL;
+static int do_compress_stream(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, const unsigned int nMaxWindowSize, const unsigned int nEffortFlags,
+      salvador_stats *pStats, size_t *pOriginalSize, size_t *pCompressedSize) {
+   salvador_stream_compressor *pStream;
+   unsigned char *pDictionaryData = NULL;
+   unsigned char *pInChunk;
    size_t nDictionarySize = 0;
+   size_t nOriginalSize = 0L, nCompressedSize, nReadSize;
+   stream_files files;
+   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+
+   nFlags |= nEffortFlags;
+   if (nOptions & OPT_STATS)
+      nFlags |= FLG_PHASE_STATS;
+
    if (pszDictionaryFilename) {
-      /* Open the dictionary */
-      f_dict = fopen(pszDictionaryFilename, "rb");
+      /* Read the dictionary */
+      FILE *f_dict = fopen(pszDictionaryFilename, "rb");
       if (!f_dict) {
          fprintf(stderr, "error opening dictionary '%s' for reading\n", pszDictionaryFilename);
          return 100;
       }
 
-      /* Get dictionary size */
       fseek(f_dict, 0, SEEK_END);
       nDictionarySize = (size_t)ftell(f_dict);
       fseek(f_dict, 0, SEEK_SET);
 
       if (nDictionarySize > BLOCK_SIZE) nDictionarySize = BLOCK_SIZE;
-   }
-
-   /* Read the whole original file in memory */
-
-   FILE *f_in = fopen(pszInFilename, "rb");
-   if (!f_in) {
-      if (f_dict) fclose(f_dict);
-      fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
-      return 100;
-   }
-
-   fseek(f_in, 0, SEEK_END);
-   nOriginalSize = (size_t)ftell(f_in);
-   fseek(f_in, 0, SEEK_SET);
 
-   pDecompressedData = (unsigned char*)malloc(nDictionarySize + nOriginalSize);
-   if (!pDecompressedData) {
-      fclose(f_in);
-      if (f_dict) fclose(f_dict);
-      fprintf(stderr, "out of memory for reading '%s', %zu bytes needed\n", pszInFilename, nOriginalSize);
-      return 100;
-   }
+      pDictionaryData = (unsigned char *)malloc(nDictionarySize ? nDictionarySize : 1);
+      if (!pDictionaryData) {
+         fclose(f_dict);
+         fprintf(stderr, "out of memory for reading dictionary '%s', %zu bytes needed\n", pszDictionaryFilename, nDictionarySize);
+         return 100;
+      }
 
-   if (f_dict) {
-      /* Read dictionary data */
-      if (fread(pDecompressedData + ((nOptions & OPT_BACKWARD) ? nOriginalSize : 0), 1, nDictionarySize, f_dict) != nDictionarySize) {
-         free(pDecompressedData);
-         fclose(f_in);
+      if (fread(pDictionaryData, 1, nDictionarySize, f_dict) != nDictionarySize) {
+         free(pDictionaryData);
          fclose(f_dict);
          fprintf(stderr, "I/O error while reading dictionary '%s'\n", pszDictionaryFilename);
          return 100;
       }
 
       fclose(f_dict);
-      f_dict = NULL;
    }
 
-   /* Read input file data */
-   if (fread(pDecompressedData + ((nOptions & OPT_BACKWARD) ? 0 : nDictionarySize), 1, nOriginalSize, f_in) != nOriginalSize) {
-      free(pDecompressedData);
-      fclose(f_in);
-      fprintf(stderr, "I/O error while reading '%s'\n", pszInFilename);
+   pInChunk = (unsigned char *)malloc(BLOCK_SIZE);
+   pStream = salvador_stream_compressor_create(nFlags, nMaxWindowSize, pDictionaryData, nDictionarySize, stream_write, &files, compression_progress);
+   if (pDictionaryData) free(pDictionaryData);
+   if (!pInChunk || !pStream) {
+      salvador_stream_compressor_destroy(pStream);
+      if (pInChunk) free(pInChunk);
+      fprintf(stderr, "out of memory for compressing '%s'\n", pszInFilename);
       return 100;
    }
 
-   fclose(f_in);
-   f_in = NULL;
+   files.f_in = fopen(pszInFilename, "rb");
+   if (!files.f_in) {
+      salvador_stream_compressor_destroy(pStream);
+      free(pInChunk);
+      fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
+      return 100;
+   }
 
-   if (nOptions & OPT_BACKWARD)
-      do_reverse_buffer(pDecompressedData, nDictionarySize + nOriginalSize);
+   files.f_out = fopen(pszOutFilename, "wb");
+   if (!files.f_out) {
+      fclose(files.f_in);
+      salvador_stream_compressor_destroy(pStream);
+      free(pInChunk);
+      fprintf(stderr, "error opening '%s' for writing\n", pszOutFilename);
+      return 100;
+   }
 
-   /* Allocate max compressed size */
+   if (nOptions & OPT_FRAME) {
+      /* Leave room for the frame header, that is written once the sizes are known */
+      unsigned char cFrameHeader[FRAME_HEADER_SIZE];
 
-   nMaxCompressedSize = salvador_get_max_compressed_size(nDictionarySize + nOriginalSize);
+      memset(cFrameHeader, 0, FRAME_HEADER_SIZE);
+      if (fwrite(cFrameHeader, 1, FRAME_HEADER_SIZE, files.f_out) != FRAME_HEADER_SIZE) {
+         fclose(files.f_out);
+         fclose(files.f_in);
+         salvador_stream_compressor_destroy(pStream);
+         free(pInChunk);
+         remove(pszOutFilename);
+         fprintf(stderr, "I/O error while writing '%s'\n", pszOutFilename);
+         return 100;
+      }
+   }
 
-   pCompressedData = (unsigned char*)malloc(nMaxCompressedSize);
-   if (!pCompressedData) {
-      free(pDecompressedData);
-      fprintf(stderr, "out of memory for compressing '%s', %zu bytes needed\n", pszInFilename, nMaxCompressedSize);
-      return 100;
+   /* Push the input through the compressor one chunk at a time */
+
+   while ((nReadSize = fread(pInChunk, 1, BLOCK_SIZE, files.f_in)) > 0) {
+      if (salvador_stream_compress(pStream, pInChunk, nReadSize))
+         break;
+      nOriginalSize += nReadSize;
    }
 
-   memset(pCompressedData, 0, nMaxCompressedSize);
+   if (ferror(files.f_in) || nReadSize)
+      nCompressedSize = -1;
+   else
+      nCompressedSize = salvador_stream_compress_finish(pStream, pStats);
 
-   nCompressedSize = salvador_compress(pDecompressedData, pCompressedData, nDictionarySize + nOriginalSize, nMaxCompressedSize, nFlags, nMaxWindowSize, nDictionarySize, compression_progress, &stats);
+   if ((nOptions & OPT_FRAME) && nCompressedSize != (size_t)-1) {
+      unsigned char cFrameHeader[FRAME_HEADER_SIZE];
 
-   if (nOptions & OPT_VERBOSE) {
-      nEndTime = do_get_time();
+      if (salvador_write_frame_header(cFrameHeader, FRAME_HEADER_SIZE, nOriginalSize, nCompressedSize, nFlags) == (size_t)-1 ||
+         fseek(files.f_out, 0, SEEK_SET) || fwrite(cFrameHeader, 1, FRAME_HEADER_SIZE, files.f_out) != FRAME_HEADER_SIZE)
+         nCompressedSize = -1;
+      else
+         nCompressedSize += FRAME_HEADER_SIZE;
    }
 
+   fclose(files.f_out);
+   fclose(files.f_in);
+   salvador_stream_compressor_destroy(pStream);
+   free(pInChunk);
+
    if (nCompressedSize == (size_t)-1) {
-      free(pCompressedData);
-      free(pDecompressedData);
+      remove(pszOutFilename);
       fprintf(stderr, "compression error for '%s'\n", pszInFilename);
       return 100;
    }
 
-   if (nOptions & OPT_BACKWARD)
-      do_reverse_buffer(pCompressedData, nCompressedSize);
-
-   /* Write whole compressed file out */
-
-   FILE *f_out = fopen(pszOutFilename, "wb");
-   if (!f_out) {
-      free(pCompressedData);
-      free(pDecompressedData);
-      fprintf(stderr, "error opening '%s' for writing\n", pszOutFilename);
-      return 100;
-   }
-   
-   fwrite(pCompressedData, 1, nCompressedSize, f_out);
-   fclose(f_out);
-
-   free(pCompressedData);
-   free(pDecompressedData);
+   *pOriginalSize = nOriginalSize;
+   *pCompressedSize = nCompressedSize;
+   return 0;
+}
 
+static void print_compression_stats(const char *pszInFilename, const unsigned int nOptions, const long long nStartTime, const long long nEndTime, const size_t nOriginalSize, const size_t nCompressedSize,
+      const salvador_stats *pStats) {
    if (nOptions & OPT_VERBOSE) {
       double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
       double fSpeed = ((double)nOriginalSize / 1048576.0) / fDelta;
       fprintf(stdout, "\rCompressed '%s' in %g seconds, %.02g Mb/s, %d tokens (%g bytes/token), %zu into %zu bytes ==> %g %%\n",
-         pszInFilename, fDelta, fSpeed, stats.commands_divisor, (double)nOriginalSize / (double)stats.commands_divisor,
+         pszInFilename, fDelta, fSpeed, pStats->commands_divisor, (double)nOriginalSize / (double)pStats->commands_divisor,
          nOriginalSize, nCompressedSize, (double)(nCompressedSize * 100.0 / nOriginalSize));
    }
 
    if (nOptions & OPT_STATS) {
-      if (stats.literals_divisor > 0)
-         fprintf(stdout, "Literals: min: %d avg: %d max: %d count: %d\n", stats.min_literals, stats.total_literals / stats.literals_divisor, stats.max_literals, stats.literals_divisor);
+      if (pStats->literals_divisor > 0)
+         fprintf(stdout, "Literals: min: %d avg: %d max: %d count: %d\n", pStats->min_literals, pStats->total_literals / pStats->literals_divisor, pStats->max_literals, pStats->literals_divisor);
       else
          fprintf(stdout, "Literals: none\n");
 
       fprintf(stdout, "Normal matches: %d rep matches: %d EOD: %d\n",
-         stats.num_normal_matches, stats.num_rep_matches, stats.num_eod);
+         pStats->num_normal_matches, pStats->num_rep_matches, pStats->num_eod);
 
-      if (stats.match_divisor > 0) {
-         fprintf(stdout, "Offsets: min: %d avg: %d max: %d count: %d\n", stats.min_offset, (int)(stats.total_offsets / (long long)stats.match_divisor), stats.max_offset, stats.match_divisor);
-         fprintf(stdout, "Match lens: min: %d avg: %d max: %d count: %d\n", stats.min_match_len, stats.total_match_lens / stats.match_divisor, stats.max_match_len, stats.match_divisor);
+      if (pStats->match_divisor > 0) {
+         fprintf(stdout, "Offsets: min: %d avg: %d max: %d count: %d\n", pStats->min_offset, (int)(pStats->total_offsets / (long long)pStats->match_divisor), pStats->max_offset, pStats->match_divisor);
+         fprintf(stdout, "Match lens: min: %d avg: %d max: %d count: %d\n", pStats->min_match_len, pStats->total_match_lens / pStats->match_divisor, pStats->max_match_len, pStats->match_divisor);
       }
       else {
          fprintf(stdout, "Offsets: none\n");
          fprintf(stdout, "Match lens: none\n");
       }
-      if (stats.rle1_divisor > 0) {
-         fprintf(stdout, "RLE1 lens: min: %d avg: %d max: %d count: %d\n", stats.min_rle1_len, stats.total_rle1_lens / stats.rle1_divisor, stats.max_rle1_len, stats.rle1_divisor);
+      if (pStats->rle1_divisor > 0) {
+         fprintf(stdout, "RLE1 lens: min: %d avg: %d max: %d count: %d\n", pStats->min_rle1_len, pStats->total_rle1_lens / pStats->rle1_divisor, pStats->max_rle1_len, pStats->rle1_divisor);
       }
       else {
          fprintf(stdout, "RLE1 lens: none\n");
       }
-      if (stats.rle2_divisor > 0) {
-         fprintf(stdout, "RLE2 lens: min: %d avg: %d max: %d count: %d\n", stats.min_rle2_len, stats.total_rle2_lens / stats.rle2_divisor, stats.max_rle2_len, stats.rle2_divisor);
+      if (pStats->rle2_divisor > 0) {
+         fprintf(stdout, "RLE2 lens: min: %d avg: %d max: %d count: %d\n", pStats->min_rle2_len, pStats->total_rle2_lens / pStats->rle2_divisor, pStats->max_rle2_len, pStats->rle2_divisor);
       }
       else {
          fprintf(stdout, "RLE2 lens: none\n");
       }
-      fprintf(stdout, "Safe distance: %d (0x%X)\n", stats.safe_dist, stats.safe_dist);
+      fprintf(stdout, "Safe distance: %d (0x%X)\n", pStats->safe_dist, pStats->safe_dist);
+
+      fprintf(stdout, "Blocks: %d incompressible: %d reduce passes: %d matches found: %lld forward rep matches: %lld\n",
+         pStats->num_blocks, pStats->num_literal_blocks, pStats->num_reduce_passes, pStats->num_matches_found, pStats->num_forward_matches);
+      fprintf(stdout, "Arrivals inserted: %lld evicted: %lld\n", pStats->num_arrivals_inserted, pStats->num_arrivals_evicted);
+      if (pStats->num_segments)
+         fprintf(stdout, "Parse segments: %d optimized again: %d\n", pStats->num_segments, pStats->num_segment_reparses);
+      fprintf(stdout, "Phase times (ms): suffix sort: %.1f LCP intervals: %.1f find matches: %.1f supplement: %.1f\n",
+         (double)pStats->sort_time / 1000.0, (double)pStats->interval_time / 1000.0, (double)pStats->find_matches_time / 1000.0, (double)pStats->supplement_time / 1000.0);
+      fprintf(stdout, "                  first pass: %.1f final pass: %.1f reduce: %.1f write: %.1f\n",
+         (double)pStats->first_pass_time / 1000.0, (double)pStats->final_pass_time / 1000.0, (double)pStats->reduce_time / 1000.0, (double)pStats->write_time / 1000.0);
    }
-   return 0;
 }
 
-/*---------------------------------------------------------------------------*/
-
-static int do_decompress(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions) {
+static int do_compress(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, const unsigned int nMaxWindowSize, const unsigned int nEffortFlags, const int nNumThreads,
+      const size_t nCheckpointInterval) {
    long long nStartTime = 0LL, nEndTime = 0LL;
-   size_t nCompressedSize, nMaxDecompressedSize, nOriginalSize;
-   unsigned char *pCompressedData;
-   unsigned char *pDecompressedData;
+   size_t nOriginalSize = 0L, nCompressedSize = 0L, nMaxCompressedSize;
    int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+   salvador_stats stats;
+   file_buffer inBuffer, outBuffer;
+   unsigned char *pDecompressedData;
+   unsigned char *pCompressedData;
 
    if (nOptions & OPT_BACKWARD)
-      nFlags |= FLG_IS_BACKWARD;
+      nFlags |= (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD);
+   nFlags |= nEffortFlags;
+   if (nOptions & OPT_STATS)
+      nFlags |= FLG_PHASE_STATS;
 
-   /* Read the whole compressed file in memory */
+   if (nOptions & OPT_VERBOSE) {
+      nStartTime = do_get_time();
+   }
 
-   FILE *f_in = fopen(pszInFilename, "rb");
-   if (!f_in) {
-      fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
-      return 100;
+   if (!(nOptions & OPT_BACKWARD) && nNumThreads == 1 && !nCheckpointInterval) {
+      /* Forward single-threaded compression streams from file to file; the other modes need the whole input in memory */
+      if (do_compress_stream(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nMaxWindowSize, nEffortFlags, &stats, &nOriginalSize, &nCompressedSize))
+         return 100;
+
+      if (nOptions & OPT_VERBOSE) {
+         nEndTime = do_get_time();
+      }
+
+      print_compression_stats(pszInFilename, nOptions, nStartTime, nEndTime, nOriginalSize, nCompressedSize, &stats);
+      return 0;
    }
 
-   fseek(f_in, 0, SEEK_END);
-   nCompressedSize = (size_t)ftell(f_in);
-   fseek(f_in, 0, SEEK_SET);
+   FILE* f_dict = NULL;
+   size_t nDictionarySize = 0;
+   if (pszDictionaryFilename) {
+      /* Open the dictionary */
+      f_dict = fopen(pszDictionaryFilename, "rb");
+      if (!f_dict) {
+         fprintf(stderr, "error opening dictionary '%s' for reading\n", pszDictionaryFilename);
+         return 100;
+      }
 
-   pCompressedData = (unsigned char*)malloc(nCompressedSize);
-   if (!pCompressedData) {
-      fclose(f_in);
-      fprintf(stderr, "out of memory for reading '%s', %zu bytes needed\n", pszInFilename, nCompressedSize);
+      /* Get dictionary size */
+      fseek(f_dict, 0, SEEK_END);
+      nDictionarySize = (size_t)ftell(f_dict);
+      fseek(f_dict, 0, SEEK_SET);
+
+      if (nDictionarySize > BLOCK_SIZE) nDictionarySize = BLOCK_SIZE;
+   }
+
+   /* Get the whole original file in memory, after the dictionary; backward compression reads the data from the end, so the
+    * dictionary goes after the file instead */
+
+   if (do_open_input_buffer(pszInFilename, (nOptions & OPT_BACKWARD) ? 0 : nDictionarySize, (nOptions & OPT_BACKWARD) ? nDictionarySize : 0, 0, &inBuffer)) {
+      if (f_dict) fclose(f_dict);
       return 100;
    }
 
-   if (fread(pCompressedData, 1, nCompressedSize, f_in) != nCompressedSize) {
-      free(pCompressedData);
-      fclose(f_in);
-      fprintf(stderr, "I/O error while reading '%s'\n", pszInFilename);
+   nOriginalSize = inBuffer.size;
+   pDecompressedData = inBuffer.data;
+
+   if (f_dict) {
+      /* Read dictionary data */
+      if (fread(pDecompressedData + ((nOptions & OPT_BACKWARD) ? nOriginalSize : 0), 1, nDictionarySize, f_dict) != nDictionarySize) {
+         do_close_buffer(&inBuffer, 0, 0, 0);
+         fclose(f_dict);
+         fprintf(stderr, "I/O error while reading dictionary '%s'\n", pszDictionaryFilename);
+         return 100;
+      }
+
+      fclose(f_dict);
+      f_dict = NULL;
+   }
+
+   /* Compress straight into the output file, sized for the worst case and trimmed afterwards */
+
+   if (nCheckpointInterval)
+      nMaxCompressedSize = salvador_get_max_indexed_frame_size(nOriginalSize, nCheckpointInterval);
+   else
+      nMaxCompressedSize = salvador_get_max_compressed_size(nDictionarySize + nOriginalSize);
+   if ((nOptions & OPT_FRAME) && !nCheckpointInterval)
+      nMaxCompressedSize += FRAME_HEADER_SIZE;
+
+   if (do_open_output_buffer(pszOutFilename, 0, nMaxCompressedSize, 0, &inBuffer, &outBuffer)) {
+      do_close_buffer(&inBuffer, 0, 0, 0);
       return 100;
    }
 
-   fclose(f_in);
-   f_in = NULL;
+   pCompressedData = outBuffer.data;
+
+   if (nCheckpointInterval)
+      nCompressedSize = salvador_compress_indexed_frame(pDecompressedData, pCompressedData, nOriginalSize, nMaxCompressedSize, nFlags, nMaxWindowSize, nCheckpointInterval, compression_progress, &stats);
+   else if (nOptions & OPT_FRAME)
+      nCompressedSize = salvador_compress_frame(pDecompressedData, pCompressedData, nDictionarySize + nOriginalSize, nMaxCompressedSize, nFlags, nMaxWindowSize, nDictionarySize, nNumThreads, compression_progress, &stats);
+   else if (nNumThreads != 1)
+      nCompressedSize = salvador_compress_parallel(pDecompressedData, pCompressedData, nDictionarySize + nOriginalSize, nMaxCompressedSize, nFlags, nMaxWindowSize, nDictionarySize, nNumThreads, compression_progress, &stats);
+   else
+      nCompressedSize = salvador_compress(pDecompressedData, pCompressedData, nDictionarySize + nOriginalSize, nMaxCompressedSize, nFlags, nMaxWindowSize, nDictionarySize, compression_progress, &stats);
+
+   if (nOptions & OPT_VERBOSE) {
+      nEndTime = do_get_time();
+   }
+
+   do_close_buffer(&inBuffer, 0, 0, 0);
+
+   if (nCompressedSize == (size_t)-1) {
+      do_close_buffer(&outBuffer, 0, (size_t)-1, 1);
+      fprintf(stderr, "compression error for '%s'\n", pszInFilename);
+      return 100;
+   }
+
+   if (do_close_buffer(&outBuffer, 0, nCompressedSize, 1))
+      return 100;
+
+   print_compression_stats(pszInFilename, nOptions, nStartTime, nEndTime, nOriginalSize, nCompressedSize, &stats);
+   return 0;
+}
+
+static int do_estimate(const char *pszInFilename, const char *pszDictionaryFilename, const unsigned int nOptions, const unsigned int nMaxWindowSize, const unsigned int nEffortFlags) {
+   static const int nModes[2] = { SALVADOR_ESTIMATE_GREEDY, SALVADOR_ESTIMATE_EXACT };
+   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+   size_t nOriginalSize, nDictionarySize = 0;
+   file_buffer inBuffer;
+   FILE *f_dict = NULL;
+   int i;
+
+   if (nOptions & OPT_BACKWARD)
+      nFlags |= (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD);
+   nFlags |= nEffortFlags;
+
+   if (pszDictionaryFilename) {
+      f_dict = fopen(pszDictionaryFilename, "rb");
+      if (!f_dict) {
+         fprintf(stderr, "error opening dictionary '%s' for reading\n", pszDictionaryFilename);
+         return 100;
+      }
+
+      fseek(f_dict, 0, SEEK_END);
+      nDictionarySize = (size_t)ftell(f_dict);
+      fseek(f_dict, 0, SEEK_SET);
+
+      if (nDictionarySize > BLOCK_SIZE) nDictionarySize = BLOCK_SIZE;
+   }
+
+   /* Read the file and the dictionary as for compressing, but don't open any output */
+
+   if (do_open_input_buffer(pszInFilename, (nOptions & OPT_BACKWARD) ? 0 : nDictionarySize, (nOptions & OPT_BACKWARD) ? nDictionarySize : 0, 0, &inBuffer)) {
+      if (f_dict) fclose(f_dict);
+      return 100;
+   }
+   nOriginalSize = inBuffer.size;
+
+   if (f_dict) {
+      if (fread(inBuffer.data + ((nOptions & OPT_BACKWARD) ? nOriginalSize : 0), 1, nDictionarySize, f_dict) != nDictionarySize) {
+         do_close_buffer(&inBuffer, 0, 0, 0);
+         fclose(f_dict);
+         fprintf(stderr, "I/O error while reading dictionary '%s'\n", pszDictionaryFilename);
+         return 100;
+      }
+
+      fclose(f_dict);
+      f_dict = NULL;
+   }
+
+   for (i = 0; i < 2; i++) {
+      long long nStartTime = do_get_time();
+      size_t nCompressedSize = salvador_estimate_compressed_size(inBuffer.data, nDictionarySize + nOriginalSize, nFlags, nMaxWindowSize, nDictionarySize, nModes[i]);
+      long long nEndTime = do_get_time();
+
+      if (nCompressedSize == (size_t)-1) {
+         do_close_buffer(&inBuffer, 0, 0, 0);
+         fprintf(stderr, "error estimating the compressed size of '%s'\n", pszInFilename);
+         return 100;
+      }
+
+      fprintf(stdout, "%s compressed size of '%s': %zu bytes (%.02f%%) in %g seconds\n", (nModes[i] == SALVADOR_ESTIMATE_EXACT) ? "Exact" : "Greedy estimate of the",
+         pszInFilename, nCompressedSize, nOriginalSize ? ((double)nCompressedSize / (double)nOriginalSize * 100.0) : 0.0, (double)(nEndTime - nStartTime) / 1000000.0);
+   }
+
+   do_close_buffer(&inBuffer, 0, 0, 0);
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+typedef struct _batch_entry {
+   const char *pszInFilename;
+   const char *pszOutFilename;
+   const char *pszDictionaryFilename;
+   const salvador_dictionary *pDictionary;
+   unsigned int nOptions;
+   unsigned int nMaxWindowSize;
+   size_t nOriginalSize;
+   size_t nCompressedSize;
+   long long nTime;
+   int nResult;
+} batch_entry;
+
+typedef struct _batch_job {
+   batch_entry *pEntries;
+   int nNumEntries;
+   int nNextEntry;
+   int nNumDone;
+   unsigned int nEffortFlags;
+   int nVerifyCompression;
+   salvador_mutex lock;
+} batch_job;
+
+typedef struct _batch_worker {
+   batch_job *pJob;
+   salvador_thread thread;
+} batch_worker;
+
+static salvador_dictionary *do_prepare_dictionary(const char *pszDictionaryFilename, const unsigned int nOptions) {
+   salvador_dictionary *pDictionary;
+   unsigned char *pDictionaryData;
+   size_t nDictionarySize;
+   FILE *f_dict;
+
+   /* Read the whole dictionary file, which is either a dictionary or one that was already prepared with -prepare */
+   f_dict = fopen(pszDictionaryFilename, "rb");
+   if (!f_dict) {
+      fprintf(stderr, "error opening dictionary '%s' for reading\n", pszDictionaryFilename);
+      return NULL;
+   }
+
+   fseek(f_dict, 0, SEEK_END);
+   nDictionarySize = (size_t)ftell(f_dict);
+   fseek(f_dict, 0, SEEK_SET);
+
+   pDictionaryData = (unsigned char *)malloc(nDictionarySize ? nDictionarySize : 1);
+   if (!pDictionaryData) {
+      fclose(f_dict);
+      fprintf(stderr, "out of memory for reading dictionary '%s', %zu bytes needed\n", pszDictionaryFilename, nDictionarySize);
+      return NULL;
+   }
+
+   if (fread(pDictionaryData, 1, nDictionarySize, f_dict) != nDictionarySize) {
+      free(pDictionaryData);
+      fclose(f_dict);
+      fprintf(stderr, "I/O error while reading dictionary '%s'\n", pszDictionaryFilename);
+      return NULL;
+   }
+   fclose(f_dict);
+
+   if (salvador_dictionary_is_saved(pDictionaryData, nDictionarySize)) {
+      pDictionary = salvador_dictionary_load(pDictionaryData, nDictionarySize);
+      if (!pDictionary)
+         fprintf(stderr, "invalid prepared dictionary '%s'\n", pszDictionaryFilename);
+   }
+   else {
+      if (nDictionarySize > BLOCK_SIZE) nDictionarySize = BLOCK_SIZE;
+
+      pDictionary = salvador_dictionary_create(pDictionaryData, nDictionarySize, (nOptions & OPT_BACKWARD) ? (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD) : 0);
+      if (!pDictionary)
+         fprintf(stderr, "error preparing dictionary '%s'\n", pszDictionaryFilename);
+   }
+
+   free(pDictionaryData);
+   return pDictionary;
+}
+
+static int do_save_prepared_dictionary(const char *pszDictionaryFilename, const char *pszOutFilename, const unsigned int nOptions) {
+   salvador_dictionary *pDictionary;
+   unsigned char *pSavedData;
+   size_t nSavedSize;
+   FILE *f_out;
+
+   pDictionary = do_prepare_dictionary(pszDictionaryFilename, nOptions);
+   if (!pDictionary)
+      return 100;
+
+   nSavedSize = salvador_dictionary_get_saved_size(pDictionary);
+   pSavedData = (unsigned char *)malloc(nSavedSize);
+   if (!pSavedData) {
+      salvador_dictionary_destroy(pDictionary);
+      fprintf(stderr, "out of memory for saving dictionary, %zu bytes needed\n", nSavedSize);
+      return 100;
+   }
+
+   if (salvador_dictionary_save(pDictionary, pSavedData, nSavedSize) != nSavedSize) {
+      free(pSavedData);
+      salvador_dictionary_destroy(pDictionary);
+      fprintf(stderr, "error saving prepared dictionary\n");
+      return 100;
+   }
+   salvador_dictionary_destroy(pDictionary);
+
+   f_out = fopen(pszOutFilename, "wb");
+   if (!f_out) {
+      free(pSavedData);
+      fprintf(stderr, "error opening '%s' for writing\n", pszOutFilename);
+      return 100;
+   }
+
+   if (fwrite(pSavedData, 1, nSavedSize, f_out) != nSavedSize) {
+      fclose(f_out);
+      free(pSavedData);
+      fprintf(stderr, "I/O error while writing '%s'\n", pszOutFilename);
+      return 100;
+   }
+
+   fclose(f_out);
+   free(pSavedData);
+   return 0;
+}
+
+static int do_compress_batch_entry(salvador_context *pContext, batch_entry *pEntry, const unsigned int nEffortFlags, const int nVerifyCompression) {
+   const unsigned int nOptions = pEntry->nOptions;
+   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+   const size_t nFrameHeaderSize = (nOptions & OPT_FRAME) ? FRAME_HEADER_SIZE : 0;
+   size_t nOriginalSize, nDictionarySize = 0, nMaxCompressedSize, nCompressedSize;
+   const unsigned char *pDictionaryData = NULL;
+   unsigned char *pDecompressedData;
+   unsigned char *pCompressedData;
+
+   if (nOptions & OPT_BACKWARD)
+      nFlags |= (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD);
+   nFlags |= nEffortFlags;
+
+   /* The dictionary was read and prepared once for the whole batch */
+   if (pEntry->pDictionary)
+      pDictionaryData = salvador_dictionary_get_data(pEntry->pDictionary, &nDictionarySize);
+   salvador_context_set_dictionary(pContext, pEntry->pDictionary);
+
+   /* Read the whole original file in memory, after the dictionary (or before it, for backward compression) */
+
+   FILE *f_in = fopen(pEntry->pszInFilename, "rb");
+   if (!f_in) {
+      fprintf(stderr, "error opening '%s' for reading\n", pEntry->pszInFilename);
+      return 100;
+   }
+
+   fseek(f_in, 0, SEEK_END);
+   nOriginalSize = (size_t)ftell(f_in);
+   fseek(f_in, 0, SEEK_SET);
+
+   nMaxCompressedSize = nFrameHeaderSize + salvador_get_max_compressed_size(nDictionarySize + nOriginalSize);
+
+   pDecompressedData = (unsigned char*)malloc(nDictionarySize + nOriginalSize + (nVerifyCompression ? (nDictionarySize + nOriginalSize) : 0));
+   if (!pDecompressedData) {
+      fclose(f_in);
+      fprintf(stderr, "out of memory for reading '%s', %zu bytes needed\n", pEntry->pszInFilename, nOriginalSize);
+      return 100;
+   }
+
+   if (pDictionaryData)
+      memcpy(pDecompressedData + ((nOptions & OPT_BACKWARD) ? nOriginalSize : 0), pDictionaryData, nDictionarySize);
+
+   if (fread(pDecompressedData + ((nOptions & OPT_BACKWARD) ? 0 : nDictionarySize), 1, nOriginalSize, f_in) != nOriginalSize) {
+      free(pDecompressedData);
+      fclose(f_in);
+      fprintf(stderr, "I/O error while reading '%s'\n", pEntry->pszInFilename);
+      return 100;
+   }
+
+   fclose(f_in);
+   f_in = NULL;
+
+   pCompressedData = (unsigned char*)malloc(nMaxCompressedSize);
+   if (!pCompressedData) {
+      free(pDecompressedData);
+      fprintf(stderr, "out of memory for compressing '%s', %zu bytes needed\n", pEntry->pszInFilename, nMaxCompressedSize);
+      return 100;
+   }
+
+   nCompressedSize = salvador_context_compress(pContext, pDecompressedData, pCompressedData + nFrameHeaderSize, nDictionarySize + nOriginalSize, nMaxCompressedSize - nFrameHeaderSize, nFlags, pEntry->nMaxWindowSize, nDictionarySize, NULL, NULL);
+   if (nCompressedSize != (size_t)-1 && nFrameHeaderSize) {
+      if (salvador_write_frame_header(pCompressedData, nFrameHeaderSize, nOriginalSize, nCompressedSize, nFlags) == (size_t)-1)
+         nCompressedSize = -1;
+      else
+         nCompressedSize += nFrameHeaderSize;
+   }
+   if (nCompressedSize == (size_t)-1) {
+      free(pCompressedData);
+      free(pDecompressedData);
+      fprintf(stderr, "compression error for '%s'\n", pEntry->pszInFilename);
+      return 100;
+   }
+
+   if (nVerifyCompression) {
+      /* Decompress again in memory, after the same dictionary, and compare */
+      unsigned char *pVerifyData = pDecompressedData + nDictionarySize + nOriginalSize;
+      size_t nVerifySize;
+
+      if (nOptions & OPT_BACKWARD) {
+         /* Backward data is decompressed from the end of the output area, towards the start; the dictionary follows */
+         memcpy(pVerifyData + nOriginalSize, pDecompressedData + nOriginalSize, nDictionarySize);
+         if (nFrameHeaderSize)
+            nVerifySize = salvador_decompress_frame(pCompressedData, pVerifyData, nCompressedSize, nOriginalSize, nDictionarySize, nFlags);
+         else
+            nVerifySize = salvador_decompress(pCompressedData, pVerifyData, nCompressedSize, nOriginalSize, nDictionarySize, nFlags);
+      }
+      else {
+         memcpy(pVerifyData, pDecompressedData, nDictionarySize);
+         if (nFrameHeaderSize)
+            nVerifySize = salvador_decompress_frame(pCompressedData, pVerifyData, nCompressedSize, nDictionarySize + nOriginalSize, nDictionarySize, nFlags);
+         else
+            nVerifySize = salvador_decompress(pCompressedData, pVerifyData, nCompressedSize, nDictionarySize + nOriginalSize, nDictionarySize, nFlags);
+         pVerifyData += nDictionarySize;
+      }
+
+      if (nVerifySize != nOriginalSize ||
+         memcmp(pVerifyData, pDecompressedData + ((nOptions & OPT_BACKWARD) ? 0 : nDictionarySize), nOriginalSize)) {
+         free(pCompressedData);
+         free(pDecompressedData);
+         fprintf(stderr, "error comparing compressed file '%s' with original '%s'\n", pEntry->pszOutFilename, pEntry->pszInFilename);
+         return 100;
+      }
+   }
+
+   /* Write whole compressed file out */
+
+   FILE *f_out = fopen(pEntry->pszOutFilename, "wb");
+   if (!f_out) {
+      free(pCompressedData);
+      free(pDecompressedData);
+      fprintf(stderr, "error opening '%s' for writing\n", pEntry->pszOutFilename);
+      return 100;
+   }
+
+   if (fwrite(pCompressedData, 1, nCompressedSize, f_out) != nCompressedSize) {
+      fclose(f_out);
+      free(pCompressedData);
+      free(pDecompressedData);
+      fprintf(stderr, "I/O error while writing '%s'\n", pEntry->pszOutFilename);
+      return 100;
+   }
+   fclose(f_out);
+
+   free(pCompressedData);
+   free(pDecompressedData);
+
+   pEntry->nOriginalSize = nOriginalSize;
+   pEntry->nCompressedSize = nCompressedSize;
+   return 0;
+}
+
+static void do_compress_batch_worker(void *pArg) {
+   batch_worker *pWorker = (batch_worker *)pArg;
+   batch_job *pJob = pWorker->pJob;
+   salvador_context *pContext;
+
+   /* Each worker keeps one single-threaded compression context, that is reused for all the files it compresses */
+   pContext = salvador_context_create(1);
+
+   while (1) {
+      batch_entry *pEntry;
+      long long nStartTime;
+      int nEntryIdx;
+
+      salvador_mutex_lock(&pJob->lock);
+      nEntryIdx = pJob->nNextEntry;
+      if (nEntryIdx < pJob->nNumEntries)
+         pJob->nNextEntry++;
+      salvador_mutex_unlock(&pJob->lock);
+
+      if (nEntryIdx >= pJob->nNumEntries)
+         break;
+
+      pEntry = &pJob->pEntries[nEntryIdx];
+      nStartTime = do_get_time();
+      if (pContext) {
+         pEntry->nResult = do_compress_batch_entry(pContext, pEntry, pJob->nEffortFlags, pJob->nVerifyCompression);
+      }
+      else {
+         fprintf(stderr, "out of memory for compressing '%s'\n", pEntry->pszInFilename);
+         pEntry->nResult = 100;
+      }
+      pEntry->nTime = do_get_time() - nStartTime;
+
+      salvador_mutex_lock(&pJob->lock);
+      pJob->nNumDone++;
+      if (!pEntry->nResult) {
+         double fDelta = ((double)pEntry->nTime) / 1000000.0;
+
+         fprintf(stdout, "[%d/%d] '%s' => '%s': %zu into %zu bytes ==> %g %%, %g seconds, %g Mb/s\n", pJob->nNumDone, pJob->nNumEntries,
+            pEntry->pszInFilename, pEntry->pszOutFilename, pEntry->nOriginalSize, pEntry->nCompressedSize,
+            pEntry->nOriginalSize ? (double)(pEntry->nCompressedSize * 100.0 / pEntry->nOriginalSize) : 0.0,
+            fDelta, (fDelta > 0.0) ? ((double)pEntry->nOriginalSize / 1048576.0) / fDelta : 0.0);
+      }
+      salvador_mutex_unlock(&pJob->lock);
+   }
+
+   if (pContext)
+      salvador_context_destroy(pContext);
+}
+
+static char *do_get_manifest_token(char **ppszCur) {
+   char *pszCur = *ppszCur;
+   char *pszToken;
+
+   while (*pszCur == ' ' || *pszCur == '\t')
+      pszCur++;
+
+   if (*pszCur == '\"') {
+      /* Quoted token, for filenames with spaces */
+      pszToken = ++pszCur;
+      while (*pszCur && *pszCur != '\"')
+         pszCur++;
+   }
+   else {
+      pszToken = pszCur;
+      while (*pszCur && *pszCur != ' ' && *pszCur != '\t')
+         pszCur++;
+      if (pszToken == pszCur)
+         return NULL;
+   }
+
+   if (*pszCur)
+      *pszCur++ = 0;
+   *ppszCur = pszCur;
+   return pszToken;
+}
+
+static int do_parse_manifest(char *pszManifestData, const char *pszManifestFilename, batch_entry **ppEntries, int *nNumEntries, int *nMaxEntries,
+      const char *pszDictionaryFilename, const unsigned int nOptions, const unsigned int nMaxWindowSize) {
+   char *pszLine = pszManifestData;
+   int nLine = 0;
+
+   while (*pszLine) {
+      char *pszCur = pszLine;
+      char *pszLineEnd;
+      const char *pszFilenames[2] = { NULL, NULL };
+      batch_entry entry;
+      char *pszToken;
+      int nNumFilenames = 0;
+
+      /* Split off one line; the manifest data is zero-terminated */
+      nLine++;
+      while (*pszLine && *pszLine != '\n')
+         pszLine++;
+      pszLineEnd = pszLine;
+      if (*pszLine)
+         pszLine++;
+      if (pszLineEnd > pszCur && pszLineEnd[-1] == '\r')
+         pszLineEnd--;
+      *pszLineEnd = 0;
+
+      memset(&entry, 0, sizeof(entry));
+      entry.pszDictionaryFilename = pszDictionaryFilename;
+      entry.nOptions = nOptions;
+      entry.nMaxWindowSize = nMaxWindowSize;
+
+      /* Parse "[-b] [-classic] [-frame] [-w <size>] [-D <file>] <infile> <outfile>"; empty lines and lines starting with # are skipped */
+      while (*pszCur == ' ' || *pszCur == '\t')
+         pszCur++;
+      if (*pszCur == '#')
+         continue;
+
+      while ((pszToken = do_get_manifest_token(&pszCur)) != NULL) {
+         if (!strcmp(pszToken, "-b")) {
+            entry.nOptions |= OPT_BACKWARD;
+         }
+         else if (!strcmp(pszToken, "-classic")) {
+            entry.nOptions |= OPT_CLASSIC;
+         }
+         else if (!strcmp(pszToken, "-frame")) {
+            entry.nOptions |= OPT_FRAME;
+         }
+         else if (!strcmp(pszToken, "-w")) {
+            char *pszValue = do_get_manifest_token(&pszCur);
+            char *pEnd = NULL;
+
+            if (pszValue)
+               entry.nMaxWindowSize = (unsigned int)strtol(pszValue, &pEnd, 10);
+            if (!pszValue || !pEnd || pEnd == pszValue || *pEnd || entry.nMaxWindowSize < 16 || entry.nMaxWindowSize > MAX_OFFSET) {
+               fprintf(stderr, "%s:%d: invalid window size\n", pszManifestFilename, nLine);
+               return 100;
+            }
+         }
+         else if (!strcmp(pszToken, "-D")) {
+            entry.pszDictionaryFilename = do_get_manifest_token(&pszCur);
+            if (!entry.pszDictionaryFilename) {
+               fprintf(stderr, "%s:%d: missing dictionary filename\n", pszManifestFilename, nLine);
+               return 100;
+            }
+         }
+         else if (nNumFilenames < 2) {
+            pszFilenames[nNumFilenames++] = pszToken;
+         }
+         else {
+            fprintf(stderr, "%s:%d: unexpected '%s'\n", pszManifestFilename, nLine, pszToken);
+            return 100;
+         }
+      }
+
+      if (nNumFilenames == 2) {
+         if (*nNumEntries == *nMaxEntries) {
+            const int nNewMaxEntries = (*nMaxEntries) ? ((*nMaxEntries) * 2) : 256;
+            batch_entry *pNewEntries = (batch_entry *)realloc(*ppEntries, nNewMaxEntries * sizeof(batch_entry));
+
+            if (!pNewEntries) {
+               fprintf(stderr, "out of memory for reading manifest '%s'\n", pszManifestFilename);
+               return 100;
+            }
+            *ppEntries = pNewEntries;
+            *nMaxEntries = nNewMaxEntries;
+         }
+
+         entry.pszInFilename = pszFilenames[0];
+         entry.pszOutFilename = pszFilenames[1];
+         (*ppEntries)[(*nNumEntries)++] = entry;
+      }
+      else if (nNumFilenames) {
+         fprintf(stderr, "%s:%d: expected an input and an output filename\n", pszManifestFilename, nLine);
+         return 100;
+      }
+   }
+
+   return 0;
+}
+
+static void do_destroy_batch_dictionaries(salvador_dictionary **pDictionaries, const int nNumDictionaries) {
+   int i;
+
+   for (i = 0; i < nNumDictionaries; i++)
+      salvador_dictionary_destroy(pDictionaries[i]);
+   free(pDictionaries);
+}
+
+static int do_compress_batch(const char *pszManifestFilename, const char **ppszFilenames, const int nNumFilenames, const char *pszDictionaryFilename, const unsigned int nOptions,
+      const unsigned int nMaxWindowSize, const unsigned int nEffortFlags, int nNumThreads, const int nVerifyCompression) {
+   char *pszManifestData = NULL;
+   batch_entry *pEntries = NULL;
+   int nNumEntries = 0, nMaxEntries = 0;
+   salvador_dictionary **pDictionaries;
+   int nNumDictionaries = 0;
+   batch_worker *pWorkers;
+   batch_job job;
+   long long nStartTime, nEndTime;
+   size_t nTotalOriginalSize = 0, nTotalCompressedSize = 0;
+   int nNumStarted, nNumFailed = 0;
+   int i;
+
+   if (pszManifestFilename) {
+      /* Read the whole manifest in memory; entries point into it */
+      FILE *f_manifest = strcmp(pszManifestFilename, "-") ? fopen(pszManifestFilename, "rb") : stdin;
+      size_t nManifestSize = 0, nMaxManifestSize = 0, nReadBytes;
+
+      if (!f_manifest) {
+         fprintf(stderr, "error opening manifest '%s' for reading\n", pszManifestFilename);
+         return 100;
+      }
+
+      do {
+         if (nManifestSize == nMaxManifestSize) {
+            char *pszNewData;
+
+            nMaxManifestSize = nMaxManifestSize ? (nMaxManifestSize * 2) : 65536;
+            pszNewData = (char *)realloc(pszManifestData, nMaxManifestSize + 1);
+            if (!pszNewData) {
+               if (f_manifest != stdin) fclose(f_manifest);
+               free(pszManifestData);
+               fprintf(stderr, "out of memory for reading manifest '%s'\n", pszManifestFilename);
+               return 100;
+            }
+            pszManifestData = pszNewData;
+         }
+
+         nReadBytes = fread(pszManifestData + nManifestSize, 1, nMaxManifestSize - nManifestSize, f_manifest);
+         nManifestSize += nReadBytes;
+      } while (nReadBytes);
+
+      if (f_manifest != stdin) fclose(f_manifest);
+      pszManifestData[nManifestSize] = 0;
+
+      if (do_parse_manifest(pszManifestData, pszManifestFilename, &pEntries, &nNumEntries, &nMaxEntries, pszDictionaryFilename, nOptions, nMaxWindowSize)) {
+         free(pEntries);
+         free(pszManifestData);
+         return 100;
+      }
+   }
+
+   /* Add the input and output pairs given on the command line */
+
+   if (nNumFilenames) {
+      batch_entry *pNewEntries = (batch_entry *)realloc(pEntries, (nNumEntries + nNumFilenames / 2) * sizeof(batch_entry));
+
+      if (!pNewEntries) {
+         free(pEntries);
+         free(pszManifestData);
+         fprintf(stderr, "out of memory for batch compression\n");
+         return 100;
+      }
+      pEntries = pNewEntries;
+
+      for (i = 0; (i + 1) < nNumFilenames; i += 2) {
+         batch_entry *pEntry = &pEntries[nNumEntries++];
+
+         memset(pEntry, 0, sizeof(batch_entry));
+         pEntry->pszInFilename = ppszFilenames[i];
+         pEntry->pszOutFilename = ppszFilenames[i + 1];
+         pEntry->pszDictionaryFilename = pszDictionaryFilename;
+         pEntry->nOptions = nOptions;
+         pEntry->nMaxWindowSize = nMaxWindowSize;
+      }
+   }
+
+   if (!nNumEntries) {
+      free(pEntries);
+      free(pszManifestData);
+      fprintf(stderr, "no files to compress\n");
+      return 100;
+   }
+
+   /* Read and prepare each dictionary once, for each direction it is used in, and share it with all the files that use it */
+
+   pDictionaries = (salvador_dictionary **)calloc(nNumEntries, sizeof(salvador_dictionary *));
+   if (!pDictionaries) {
+      free(pEntries);
+      free(pszManifestData);
+      fprintf(stderr, "out of memory for batch compression\n");
+      return 100;
+   }
+
+   for (i = 0; i < nNumEntries; i++) {
+      if (pEntries[i].pszDictionaryFilename) {
+         int j;
+
+         for (j = 0; j < i; j++) {
+            if (pEntries[j].pszDictionaryFilename && !strcmp(pEntries[j].pszDictionaryFilename, pEntries[i].pszDictionaryFilename) &&
+               (pEntries[j].nOptions & OPT_BACKWARD) == (pEntries[i].nOptions & OPT_BACKWARD))
+               break;
+         }
+
+         if (j < i) {
+            pEntries[i].pDictionary = pEntries[j].pDictionary;
+         }
+         else {
+            pDictionaries[nNumDictionaries] = do_prepare_dictionary(pEntries[i].pszDictionaryFilename, pEntries[i].nOptions);
+            if (!pDictionaries[nNumDictionaries]) {
+               do_destroy_batch_dictionaries(pDictionaries, nNumDictionaries);
+               free(pEntries);
+               free(pszManifestData);
+               return 100;
+            }
+            pEntries[i].pDictionary = pDictionaries[nNumDictionaries++];
+         }
+      }
+   }
+
+   if (nNumThreads <= 0)
+      nNumThreads = salvador_get_num_cpus();
+   if (nNumThreads > nNumEntries)
+      nNumThreads = nNumEntries;
+
+   pWorkers = (batch_worker *)malloc(nNumThreads * sizeof(batch_worker));
+   if (!pWorkers) {
+      do_destroy_batch_dictionaries(pDictionaries, nNumDictionaries);
+      free(pEntries);
+      free(pszManifestData);
+      fprintf(stderr, "out of memory for batch compression\n");
+      return 100;
+   }
+
+   job.pEntries = pEntries;
+   job.nNumEntries = nNumEntries;
+   job.nNextEntry = 0;
+   job.nNumDone = 0;
+   job.nEffortFlags = nEffortFlags;
+   job.nVerifyCompression = nVerifyCompression;
+   if (salvador_mutex_init(&job.lock)) {
+      free(pWorkers);
+      do_destroy_batch_dictionaries(pDictionaries, nNumDictionaries);
+      free(pEntries);
+      free(pszManifestData);
+      fprintf(stderr, "error starting batch compression\n");
+      return 100;
+   }
+
+   /* Spread the files over the workers; the main thread runs one of them */
+
+   nStartTime = do_get_time();
+
+   for (nNumStarted = 1; nNumStarted < nNumThreads; nNumStarted++) {
+      pWorkers[nNumStarted].pJob = &job;
+      if (salvador_thread_create(&pWorkers[nNumStarted].thread, do_compress_batch_worker, &pWorkers[nNumStarted]))
+         break;
+   }
+
+   pWorkers[0].pJob = &job;
+   do_compress_batch_worker(&pWorkers[0]);
+
+   for (i = 1; i < nNumStarted; i++) {
+      salvador_thread_join(&pWorkers[i].thread);
+   }
+
+   nEndTime = do_get_time();
+
+   salvador_mutex_destroy(&job.lock);
+   free(pWorkers);
+
+   /* Report aggregate throughput */
+
+   for (i = 0; i < nNumEntries; i++) {
+      if (pEntries[i].nResult) {
+         nNumFailed++;
+      }
+      else {
+         nTotalOriginalSize += pEntries[i].nOriginalSize;
+         nTotalCompressedSize += pEntries[i].nCompressedSize;
+      }
+   }
+
+   {
+      double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
+
+      fprintf(stdout, "Compressed %d of %d files on %d thread%s in %g seconds, %g Mb/s, %zu into %zu bytes ==> %g %%\n",
+         nNumEntries - nNumFailed, nNumEntries, nNumStarted, (nNumStarted != 1) ? "s" : "", fDelta,
+         (fDelta > 0.0) ? ((double)nTotalOriginalSize / 1048576.0) / fDelta : 0.0,
+         nTotalOriginalSize, nTotalCompressedSize, nTotalOriginalSize ? (double)(nTotalCompressedSize * 100.0 / nTotalOriginalSize) : 0.0);
+   }
+
+   do_destroy_batch_dictionaries(pDictionaries, nNumDictionaries);
+   free(pEntries);
+   free(pszManifestData);
+
+   return nNumFailed ? 100 : 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int do_decompress_stream(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions) {
+   long long nStartTime = 0LL, nEndTime = 0LL;
+   size_t nOriginalSize, nFrameOriginalSize = 0;
+   unsigned char *pDictionaryData = NULL;
+   size_t nDictionarySize = 0;
+   stream_files files;
+   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+
+   if (pszDictionaryFilename) {
+      /* Read the dictionary */
+      FILE *f_dict = fopen(pszDictionaryFilename, "rb");
+      if (!f_dict) {
+         fprintf(stderr, "error opening dictionary '%s' for reading\n", pszDictionaryFilename);
+         return 100;
+      }
+
+      fseek(f_dict, 0, SEEK_END);
+      nDictionarySize = (size_t)ftell(f_dict);
+      fseek(f_dict, 0, SEEK_SET);
+
+      if (nDictionarySize > BLOCK_SIZE) nDictionarySize = BLOCK_SIZE;
+
+      pDictionaryData = (unsigned char *)malloc(nDictionarySize ? nDictionarySize : 1);
+      if (!pDictionaryData) {
+         fclose(f_dict);
+         fprintf(stderr, "out of memory for reading dictionary '%s', %zu bytes needed\n", pszDictionaryFilename, nDictionarySize);
+         return 100;
+      }
+
+      if (fread(pDictionaryData, 1, nDictionarySize, f_dict) != nDictionarySize) {
+         free(pDictionaryData);
+         fclose(f_dict);
+         fprintf(stderr, "I/O error while reading dictionary '%s'\n", pszDictionaryFilename);
+         return 100;
+      }
+
+      fclose(f_dict);
+   }
+
+   files.f_in = fopen(pszInFilename, "rb");
+   if (!files.f_in) {
+      if (pDictionaryData) free(pDictionaryData);
+      fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
+      return 100;
+   }
+
+   files.f_out = fopen(pszOutFilename, "wb");
+   if (!files.f_out) {
+      fclose(files.f_in);
+      if (pDictionaryData) free(pDictionaryData);
+      fprintf(stderr, "error opening '%s' for writing\n", pszOutFilename);
+      return 100;
+   }
+
+   if (nOptions & OPT_FRAME) {
+      /* Read the frame header; the compressed stream follows it */
+      unsigned char cFrameHeader[FRAME_HEADER_SIZE];
+      size_t nFileSize, nFrameCompressedSize;
+      unsigned int nFrameFlags;
+
+      fseek(files.f_in, 0, SEEK_END);
+      nFileSize = (size_t)ftell(files.f_in);
+      fseek(files.f_in, 0, SEEK_SET);
+
+      if (fread(cFrameHeader, 1, FRAME_HEADER_SIZE, files.f_in) != FRAME_HEADER_SIZE ||
+         salvador_read_frame_header(cFrameHeader, nFileSize, &nFrameOriginalSize, &nFrameCompressedSize, &nFrameFlags) == (size_t)-1 ||
+         nFrameFlags != (unsigned int)nFlags) {
+         fclose(files.f_out);
+         fclose(files.f_in);
+         if (pDictionaryData) free(pDictionaryData);
+         remove(pszOutFilename);
+         fprintf(stderr, "invalid compressed format for file '%s'\n", pszInFilename);
+         return 100;
+      }
+   }
+
+   if (nOptions & OPT_VERBOSE) {
+      nStartTime = do_get_time();
+   }
+
+   /* Decompress through a bounded window, without holding either file in memory */
+
+   nOriginalSize = salvador_decompress_stream(stream_read, stream_write, &files, pDictionaryData, nDictionarySize, nFlags);
+   if ((nOptions & OPT_FRAME) && nOriginalSize != nFrameOriginalSize)
+      nOriginalSize = -1;
+
+   if (nOptions & OPT_VERBOSE) {
+      nEndTime = do_get_time();
+   }
+
+   fclose(files.f_out);
+   fclose(files.f_in);
+   if (pDictionaryData) free(pDictionaryData);
+
+   if (nOriginalSize == (size_t)-1) {
+      remove(pszOutFilename);
+      fprintf(stderr, "decompression error for '%s'\n", pszInFilename);
+      return 100;
+   }
+
+   if (nOptions & OPT_VERBOSE) {
+      double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
+      double fSpeed = ((double)nOriginalSize / 1048576.0) / fDelta;
+      fprintf(stdout, "Decompressed '%s' in %g seconds, %g Mb/s\n",
+         pszInFilename, fDelta, fSpeed);
+   }
+
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int do_decompress(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions) {
+   long long nStartTime = 0LL, nEndTime = 0LL;
+   size_t nCompressedSize, nMaxDecompressedSize, nOriginalSize;
+   file_buffer inBuffer, outBuffer;
+   unsigned char *pCompressedData;
+   unsigned char *pDecompressedData;
+   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+
+   /* Backward streams are decoded from the end of the file and must be read whole; everything else streams */
+   if (!(nOptions & OPT_BACKWARD))
+      return do_decompress_stream(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions);
+
+   nFlags |= (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD);
+
+   /* Get the whole compressed file in memory */
+
+   if (do_open_input_buffer(pszInFilename, 0, 0, 0, &inBuffer))
+      return 100;
 
-   if (nOptions & OPT_BACKWARD)
-      do_reverse_buffer(pCompressedData, nCompressedSize);
+   nCompressedSize = inBuffer.size;
+   pCompressedData = inBuffer.data;
 
-   /* Get max decompressed size */
+   /* Get max decompressed size; frames store the exact size, so that the data is decoded in one pass */
 
-   nMaxDecompressedSize = salvador_get_max_decompressed_size(pCompressedData, nCompressedSize, nFlags);
+   if (nOptions & OPT_FRAME)
+      nMaxDecompressedSize = salvador_get_frame_decompressed_size(pCompressedData, nCompressedSize);
+   else
+      nMaxDecompressedSize = salvador_get_max_decompressed_size(pCompressedData, nCompressedSize, nFlags);
    if (nMaxDecompressedSize == (size_t)-1) {
-      free(pCompressedData);
+      do_close_buffer(&inBuffer, 0, 0, 0);
       fprintf(stderr, "invalid compressed format for file '%s'\n", pszInFilename);
       return 100;
    }
@@ -334,6 +1562,7 @@ static int do_decompress(const char *pszInFilename, const char *pszOutFilename,
       /* Open the dictionary */
       f_dict = fopen(pszDictionaryFilename, "rb");
       if (!f_dict) {
+         do_close_buffer(&inBuffer, 0, 0, 0);
          fprintf(stderr, "error opening dictionary '%s' for reading\n", pszDictionaryFilename);
          return 100;
       }
@@ -346,22 +1575,21 @@ static int do_decompress(const char *pszInFilename, const char *pszOutFilename,
       if (nDictionarySize > BLOCK_SIZE) nDictionarySize = BLOCK_SIZE;
    }
 
-   /* Allocate max decompressed size */
+   /* Decompress straight into the output file, unless the dictionary needs to follow the output */
 
-   pDecompressedData = (unsigned char*)malloc(nDictionarySize + nMaxDecompressedSize);
-   if (!pDecompressedData) {
-      free(pCompressedData);
+   if (do_open_output_buffer(pszOutFilename, 0, nMaxDecompressedSize, nDictionarySize, &inBuffer, &outBuffer)) {
+      do_close_buffer(&inBuffer, 0, 0, 0);
       if (f_dict) fclose(f_dict);
-      fprintf(stderr, "out of memory for decompressing '%s', %zu bytes needed\n", pszInFilename, nMaxDecompressedSize);
       return 100;
    }
 
-   memset(pDecompressedData, 0, nDictionarySize + nMaxDecompressedSize);
+   pDecompressedData = outBuffer.data;
 
    if (f_dict) {
       /* Read dictionary data */
-      if (fread(pDecompressedData, 1, nDictionarySize, f_dict) != nDictionarySize) {
-         free(pDecompressedData);
+      if (fread(pDecompressedData + nMaxDecompressedSize, 1, nDictionarySize, f_dict) != nDictionarySize) {
+         do_close_buffer(&outBuffer, 0, (size_t)-1, 1);
+         do_close_buffer(&inBuffer, 0, 0, 0);
          fclose(f_dict);
          fprintf(stderr, "I/O error while reading dictionary '%s'\n", pszDictionaryFilename);
          return 100;
@@ -369,20 +1597,20 @@ static int do_decompress(const char *pszInFilename, const char *pszOutFilename,
 
       fclose(f_dict);
       f_dict = NULL;
-
-      if (nOptions & OPT_BACKWARD)
-         do_reverse_buffer(pDecompressedData, nDictionarySize);
    }
 
    if (nOptions & OPT_VERBOSE) {
       nStartTime = do_get_time();
    }
 
-   nOriginalSize = salvador_decompress(pCompressedData, pDecompressedData, nCompressedSize, nMaxDecompressedSize, nDictionarySize, nFlags);
-   if (nOriginalSize == (size_t)-1) {
-      free(pDecompressedData);
-      free(pCompressedData);
+   if (nOptions & OPT_FRAME)
+      nOriginalSize = salvador_decompress_frame(pCompressedData, pDecompressedData, nCompressedSize, nMaxDecompressedSize, nDictionarySize, nFlags);
+   else
+      nOriginalSize = salvador_decompress(pCompressedData, pDecompressedData, nCompressedSize, nMaxDecompressedSize, nDictionarySize, nFlags);
+   do_close_buffer(&inBuffer, 0, 0, 0);
 
+   if (nOriginalSize == (size_t)-1) {
+      do_close_buffer(&outBuffer, 0, (size_t)-1, 1);
       fprintf(stderr, "decompression error for '%s'\n", pszInFilename);
       return 100;
    }
@@ -391,25 +1619,12 @@ static int do_decompress(const char *pszInFilename, const char *pszOutFilename,
       nEndTime = do_get_time();
    }
 
-   if (nOptions & OPT_BACKWARD)
-      do_reverse_buffer(pDecompressedData + nDictionarySize, nOriginalSize);
-
-   /* Write whole decompressed file out */
-
-   FILE *f_out = fopen(pszOutFilename, "wb");
-   if (!f_out) {
-      free(pDecompressedData);
-      free(pCompressedData);
+   /* The data ends at the end of the output area; move it to the start if the size estimate was larger */
+   if (nOriginalSize != nMaxDecompressedSize)
+      memmove(pDecompressedData, pDecompressedData + nMaxDecompressedSize - nOriginalSize, nOriginalSize);
 
-      fprintf(stderr, "error opening '%s' for writing\n", pszOutFilename);
+   if (do_close_buffer(&outBuffer, 0, nOriginalSize, 1))
       return 100;
-   }
-   
-   fwrite(pDecompressedData + nDictionarySize, 1, nOriginalSize, f_out);
-   fclose(f_out);
-
-   free(pDecompressedData);
-   free(pCompressedData);
 
    if (nOptions & OPT_VERBOSE) {
       double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
@@ -423,87 +1638,176 @@ static int do_decompress(const char *pszInFilename, const char *pszOutFilename,
 
 /*---------------------------------------------------------------------------*/
 
-static int do_compare(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions) {
+static int do_decompress_inplace(const char *pszInFilename, const char *pszOutFilename, const unsigned int nOptions) {
    long long nStartTime = 0LL, nEndTime = 0LL;
-   size_t nCompressedSize, nMaxDecompressedSize, nOriginalSize, nDecompressedSize;
-   unsigned char *pCompressedData = NULL;
-   unsigned char *pOriginalData = NULL;
-   unsigned char *pDecompressedData = NULL;
+   size_t nCompressedSize, nMaxDecompressedSize, nSafeDistance, nBufferSize, nOriginalSize;
+   file_buffer inBuffer, outBuffer;
+   unsigned char *pBuffer;
    int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
 
    if (nOptions & OPT_BACKWARD)
-      nFlags |= FLG_IS_BACKWARD;
+      nFlags |= (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD);
 
-   /* Read the whole compressed file in memory */
+   /* Get the whole compressed file in memory */
 
-   FILE *f_in = fopen(pszInFilename, "rb");
-   if (!f_in) {
-      fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
+   if (do_open_input_buffer(pszInFilename, 0, 0, 0, &inBuffer))
+      return 100;
+
+   nCompressedSize = inBuffer.size;
+
+   /* Get decompressed size and safe distance, to size the single buffer */
+
+   nMaxDecompressedSize = salvador_get_max_decompressed_size(inBuffer.data, nCompressedSize, nFlags);
+   nSafeDistance = salvador_get_inplace_safe_distance(inBuffer.data, nCompressedSize, nFlags);
+   if (nMaxDecompressedSize == (size_t)-1 || nSafeDistance == (size_t)-1) {
+      do_close_buffer(&inBuffer, 0, 0, 0);
+      fprintf(stderr, "invalid compressed format for file '%s'\n", pszInFilename);
       return 100;
    }
 
-   fseek(f_in, 0, SEEK_END);
-   nCompressedSize = (size_t)ftell(f_in);
-   fseek(f_in, 0, SEEK_SET);
+   /* The output file's memory is the in-place buffer: forward data is placed at its end, backward data at its start */
 
-   pCompressedData = (unsigned char*)malloc(nCompressedSize);
-   if (!pCompressedData) {
-      fclose(f_in);
-      fprintf(stderr, "out of memory for reading '%s', %zu bytes needed\n", pszInFilename, nCompressedSize);
+   nBufferSize = nMaxDecompressedSize + nSafeDistance;
+   if (do_open_output_buffer(pszOutFilename, 0, nBufferSize, 0, &inBuffer, &outBuffer)) {
+      do_close_buffer(&inBuffer, 0, 0, 0);
       return 100;
    }
 
-   if (fread(pCompressedData, 1, nCompressedSize, f_in) != nCompressedSize) {
-      free(pCompressedData);
-      fclose(f_in);
-      fprintf(stderr, "I/O error while reading '%s'\n", pszInFilename);
+   pBuffer = outBuffer.data;
+   memcpy(pBuffer + ((nOptions & OPT_BACKWARD) ? 0 : (nBufferSize - nCompressedSize)), inBuffer.data, nCompressedSize);
+   do_close_buffer(&inBuffer, 0, 0, 0);
+
+   if (nOptions & OPT_VERBOSE) {
+      nStartTime = do_get_time();
+   }
+
+   nOriginalSize = salvador_decompress_inplace(pBuffer, nBufferSize, nCompressedSize, nFlags);
+   if (nOriginalSize == (size_t)-1) {
+      do_close_buffer(&outBuffer, 0, (size_t)-1, 1);
+      fprintf(stderr, "decompression error for '%s'\n", pszInFilename);
       return 100;
    }
 
-   fclose(f_in);
-   f_in = NULL;
+   if (nOptions & OPT_VERBOSE) {
+      nEndTime = do_get_time();
+   }
 
+   /* Backward data ends at the end of the buffer; move it to the start */
    if (nOptions & OPT_BACKWARD)
-      do_reverse_buffer(pCompressedData, nCompressedSize);
+      memmove(pBuffer, pBuffer + nBufferSize - nOriginalSize, nOriginalSize);
 
-   /* Read the whole original file in memory */
+   if (do_close_buffer(&outBuffer, 0, nOriginalSize, 1))
+      return 100;
 
-   f_in = fopen(pszOutFilename, "rb");
-   if (!f_in) {
-      free(pCompressedData);
-      fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
+   if (nOptions & OPT_VERBOSE) {
+      double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
+      double fSpeed = ((double)nOriginalSize / 1048576.0) / fDelta;
+      fprintf(stdout, "Decompressed '%s' in place in %g seconds, %g Mb/s, safe distance: %zu bytes\n",
+         pszInFilename, fDelta, fSpeed, nSafeDistance);
+   }
+
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int do_decompress_range(const char *pszInFilename, const char *pszOutFilename, const unsigned int nOptions, const size_t nRangeOffset, const size_t nRangeSize) {
+   long long nStartTime = 0LL, nEndTime = 0LL;
+   file_buffer inBuffer, outBuffer;
+   size_t nDecompressedSize;
+   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+
+   if (nOptions & OPT_BACKWARD) {
+      fprintf(stderr, "partial decompression isn't supported for backward data\n");
       return 100;
    }
 
-   fseek(f_in, 0, SEEK_END);
-   nOriginalSize = (size_t)ftell(f_in);
-   fseek(f_in, 0, SEEK_SET);
+   /* Get the whole frame in memory; only the part of the stream from the closest checkpoint is decoded */
 
-   pOriginalData = (unsigned char*)malloc(nOriginalSize);
-   if (!pOriginalData) {
-      fclose(f_in);
-      free(pCompressedData);
-      fprintf(stderr, "out of memory for reading '%s', %zu bytes needed\n", pszInFilename, nOriginalSize);
+   if (do_open_input_buffer(pszInFilename, 0, 0, 0, &inBuffer))
+      return 100;
+
+   if (salvador_get_frame_decompressed_size(inBuffer.data, inBuffer.size) == (size_t)-1) {
+      do_close_buffer(&inBuffer, 0, 0, 0);
+      fprintf(stderr, "invalid compressed format for file '%s'\n", pszInFilename);
       return 100;
    }
 
-   if (fread(pOriginalData, 1, nOriginalSize, f_in) != nOriginalSize) {
-      free(pOriginalData);
-      fclose(f_in);
-      free(pCompressedData);
-      fprintf(stderr, "I/O error while reading '%s'\n", pszInFilename);
+   if (do_open_output_buffer(pszOutFilename, 0, nRangeSize, 0, &inBuffer, &outBuffer)) {
+      do_close_buffer(&inBuffer, 0, 0, 0);
       return 100;
    }
 
-   fclose(f_in);
-   f_in = NULL;
+   if (nOptions & OPT_VERBOSE) {
+      nStartTime = do_get_time();
+   }
+
+   nDecompressedSize = salvador_decompress_range(inBuffer.data, inBuffer.size, outBuffer.data, nRangeOffset, nRangeSize, nFlags);
+   do_close_buffer(&inBuffer, 0, 0, 0);
+
+   if (nDecompressedSize == (size_t)-1) {
+      do_close_buffer(&outBuffer, 0, (size_t)-1, 1);
+      fprintf(stderr, "decompression error for '%s': no block index, or range out of bounds\n", pszInFilename);
+      return 100;
+   }
+
+   if (nOptions & OPT_VERBOSE) {
+      nEndTime = do_get_time();
+   }
+
+   if (do_close_buffer(&outBuffer, 0, nDecompressedSize, 1))
+      return 100;
+
+   if (nOptions & OPT_VERBOSE) {
+      double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
+      fprintf(stdout, "Decompressed %zu bytes at offset %zu of '%s' in %g seconds\n",
+         nDecompressedSize, nRangeOffset, pszInFilename, fDelta);
+   }
+
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int do_compare(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions) {
+   long long nStartTime = 0LL, nEndTime = 0LL;
+   size_t nCompressedSize, nMaxDecompressedSize, nOriginalSize, nDecompressedSize;
+   file_buffer compressedBuffer, originalBuffer;
+   unsigned char *pCompressedData = NULL;
+   unsigned char *pOriginalData = NULL;
+   unsigned char *pDecompressedData = NULL;
+   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+
+   if (nOptions & OPT_BACKWARD)
+      nFlags |= (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD);
+
+   /* Get the whole compressed file in memory */
+
+   if (do_open_input_buffer(pszInFilename, 0, 0, 0, &compressedBuffer))
+      return 100;
+
+   nCompressedSize = compressedBuffer.size;
+   pCompressedData = compressedBuffer.data;
+
+   /* Get the whole original file in memory */
+
+   if (do_open_input_buffer(pszOutFilename, 0, 0, 0, &originalBuffer)) {
+      do_close_buffer(&compressedBuffer, 0, 0, 0);
+      return 100;
+   }
+
+   nOriginalSize = originalBuffer.size;
+   pOriginalData = originalBuffer.data;
 
    /* Get max decompressed size */
 
-   nMaxDecompressedSize = salvador_get_max_decompressed_size(pCompressedData, nCompressedSize, nFlags);
+   if (nOptions & OPT_FRAME)
+      nMaxDecompressedSize = salvador_get_frame_decompressed_size(pCompressedData, nCompressedSize);
+   else
+      nMaxDecompressedSize = salvador_get_max_decompressed_size(pCompressedData, nCompressedSize, nFlags);
    if (nMaxDecompressedSize == (size_t)-1) {
-      free(pOriginalData);
-      free(pCompressedData);
+      do_close_buffer(&originalBuffer, 0, 0, 0);
+      do_close_buffer(&compressedBuffer, 0, 0, 0);
       fprintf(stderr, "invalid compressed format for file '%s'\n", pszInFilename);
       return 100;
    }
@@ -514,8 +1818,8 @@ static int do_compare(const char *pszInFilename, const char *pszOutFilename, con
       /* Open the dictionary */
       f_dict = fopen(pszDictionaryFilename, "rb");
       if (!f_dict) {
-         free(pOriginalData);
-         free(pCompressedData);
+         do_close_buffer(&originalBuffer, 0, 0, 0);
+         do_close_buffer(&compressedBuffer, 0, 0, 0);
          fprintf(stderr, "error opening dictionary '%s' for reading\n", pszDictionaryFilename);
          return 100;
       }
@@ -532,8 +1836,8 @@ static int do_compare(const char *pszInFilename, const char *pszOutFilename, con
 
    pDecompressedData = (unsigned char*)malloc(nDictionarySize + nMaxDecompressedSize);
    if (!pDecompressedData) {
-      free(pOriginalData);
-      free(pCompressedData);
+      do_close_buffer(&originalBuffer, 0, 0, 0);
+      do_close_buffer(&compressedBuffer, 0, 0, 0);
       if (f_dict) fclose(f_dict);
       fprintf(stderr, "out of memory for decompressing '%s', %zu bytes needed\n", pszInFilename, nMaxDecompressedSize);
       return 100;
@@ -542,11 +1846,11 @@ static int do_compare(const char *pszInFilename, const char *pszOutFilename, con
    memset(pDecompressedData, 0, nDictionarySize + nMaxDecompressedSize);
 
    if (f_dict) {
-      /* Read dictionary data */
-      if (fread(pDecompressedData, 1, nDictionarySize, f_dict) != nDictionarySize) {
+      /* Read dictionary data, in front of the output, or after it for backward data */
+      if (fread(pDecompressedData + ((nOptions & OPT_BACKWARD) ? nMaxDecompressedSize : 0), 1, nDictionarySize, f_dict) != nDictionarySize) {
          free(pDecompressedData);
-         free(pOriginalData);
-         free(pCompressedData);
+         do_close_buffer(&originalBuffer, 0, 0, 0);
+         do_close_buffer(&compressedBuffer, 0, 0, 0);
          fclose(f_dict);
          fprintf(stderr, "I/O error while reading dictionary '%s'\n", pszDictionaryFilename);
          return 100;
@@ -554,20 +1858,20 @@ static int do_compare(const char *pszInFilename, const char *pszOutFilename, con
 
       fclose(f_dict);
       f_dict = NULL;
-
-      if (nOptions & OPT_BACKWARD)
-         do_reverse_buffer(pDecompressedData, nDictionarySize);
    }
 
    if (nOptions & OPT_VERBOSE) {
       nStartTime = do_get_time();
    }
 
-   nDecompressedSize = salvador_decompress(pCompressedData, pDecompressedData, nCompressedSize, nMaxDecompressedSize, nDictionarySize, nFlags);
+   if (nOptions & OPT_FRAME)
+      nDecompressedSize = salvador_decompress_frame(pCompressedData, pDecompressedData, nCompressedSize, nMaxDecompressedSize, nDictionarySize, nFlags);
+   else
+      nDecompressedSize = salvador_decompress(pCompressedData, pDecompressedData, nCompressedSize, nMaxDecompressedSize, nDictionarySize, nFlags);
    if (nDecompressedSize == (size_t)-1) {
       free(pDecompressedData);
-      free(pOriginalData);
-      free(pCompressedData);
+      do_close_buffer(&originalBuffer, 0, 0, 0);
+      do_close_buffer(&compressedBuffer, 0, 0, 0);
 
       fprintf(stderr, "decompression error for '%s'\n", pszInFilename);
       return 100;
@@ -577,21 +1881,20 @@ static int do_compare(const char *pszInFilename, const char *pszOutFilename, con
       nEndTime = do_get_time();
    }
 
-   if (nOptions & OPT_BACKWARD)
-      do_reverse_buffer(pDecompressedData + nDictionarySize, nDecompressedSize);
-
-   if (nDecompressedSize != nOriginalSize || memcmp(pDecompressedData + nDictionarySize, pOriginalData, nOriginalSize)) {
+   /* Backward data ends at the end of the output area, forward data follows the dictionary */
+   if (nDecompressedSize != nOriginalSize ||
+      memcmp(pDecompressedData + ((nOptions & OPT_BACKWARD) ? (nMaxDecompressedSize - nDecompressedSize) : nDictionarySize), pOriginalData, nOriginalSize)) {
       free(pDecompressedData);
-      free(pOriginalData);
-      free(pCompressedData);
+      do_close_buffer(&originalBuffer, 0, 0, 0);
+      do_close_buffer(&compressedBuffer, 0, 0, 0);
 
       fprintf(stderr, "error comparing compressed file '%s' with original '%s'\n", pszInFilename, pszOutFilename);
       return 100;
    }
 
    free(pDecompressedData);
-   free(pOriginalData);
-   free(pCompressedData);
+   do_close_buffer(&originalBuffer, 0, 0, 0);
+   do_close_buffer(&compressedBuffer, 0, 0, 0);
 
    if (nOptions & OPT_VERBOSE) {
       double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
@@ -605,6 +1908,78 @@ static int do_compare(const char *pszInFilename, const char *pszOutFilename, con
 
 /*---------------------------------------------------------------------------*/
 
+static int do_compare_inplace(const char *pszInFilename, const char *pszOutFilename, const unsigned int nOptions) {
+   size_t nCompressedSize, nMaxDecompressedSize, nSafeDistance, nBufferSize, nDecompressedSize;
+   file_buffer compressedBuffer, originalBuffer;
+   unsigned char *pBuffer;
+   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+   int nResult = 0;
+
+   if (nOptions & OPT_BACKWARD)
+      nFlags |= (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD);
+
+   /* Get the whole compressed file in memory, and report its safe distance */
+
+   if (do_open_input_buffer(pszInFilename, 0, 0, 0, &compressedBuffer))
+      return 100;
+
+   nCompressedSize = compressedBuffer.size;
+   nMaxDecompressedSize = salvador_get_max_decompressed_size(compressedBuffer.data, nCompressedSize, nFlags);
+   nSafeDistance = salvador_get_inplace_safe_distance(compressedBuffer.data, nCompressedSize, nFlags);
+   if (nMaxDecompressedSize == (size_t)-1 || nSafeDistance == (size_t)-1) {
+      do_close_buffer(&compressedBuffer, 0, 0, 0);
+      fprintf(stderr, "invalid compressed format for file '%s'\n", pszInFilename);
+      return 100;
+   }
+
+   fprintf(stdout, "Safe distance for in-place decompression of '%s': %zu bytes\n", pszInFilename, nSafeDistance);
+
+   if (!pszOutFilename) {
+      do_close_buffer(&compressedBuffer, 0, 0, 0);
+      return 0;
+   }
+
+   /* Decompress in a buffer that is exactly as large as the decompressed data plus the safe distance, and compare */
+
+   if (do_open_input_buffer(pszOutFilename, 0, 0, 0, &originalBuffer)) {
+      do_close_buffer(&compressedBuffer, 0, 0, 0);
+      return 100;
+   }
+
+   nBufferSize = nMaxDecompressedSize + nSafeDistance;
+   pBuffer = (unsigned char*)malloc(nBufferSize ? nBufferSize : 1);
+   if (!pBuffer) {
+      do_close_buffer(&originalBuffer, 0, 0, 0);
+      do_close_buffer(&compressedBuffer, 0, 0, 0);
+      fprintf(stderr, "out of memory for decompressing '%s' in place, %zu bytes needed\n", pszInFilename, nBufferSize);
+      return 100;
+   }
+
+   memcpy(pBuffer + ((nOptions & OPT_BACKWARD) ? 0 : (nBufferSize - nCompressedSize)), compressedBuffer.data, nCompressedSize);
+
+   nDecompressedSize = salvador_decompress_inplace(pBuffer, nBufferSize, nCompressedSize, nFlags);
+   if (nDecompressedSize == (size_t)-1) {
+      fprintf(stderr, "in-place decompression error for '%s'\n", pszInFilename);
+      nResult = 100;
+   }
+   else if (nDecompressedSize != originalBuffer.size ||
+      memcmp(pBuffer + ((nOptions & OPT_BACKWARD) ? (nBufferSize - nDecompressedSize) : 0), originalBuffer.data, nDecompressedSize)) {
+      fprintf(stderr, "error comparing compressed file '%s' decompressed in place with original '%s'\n", pszInFilename, pszOutFilename);
+      nResult = 100;
+   }
+
+   free(pBuffer);
+   do_close_buffer(&originalBuffer, 0, 0, 0);
+   do_close_buffer(&compressedBuffer, 0, 0, 0);
+
+   if (nResult == 0 && (nOptions & OPT_VERBOSE))
+      fprintf(stdout, "Compared '%s' decompressed in place\n", pszInFilename);
+
+   return nResult;
+}
+
+/*---------------------------------------------------------------------------*/
+
 static void generate_compressible_data(unsigned char *pBuffer, size_t nBufferSize, unsigned int nSeed, int nNumLiteralValues, float fMatchProbability) {
    size_t nIndex = 0;
    int nMatchProbability = (int)(fMatchProbability * 1023.0f);
@@ -659,11 +2034,39 @@ static void xor_data(unsigned char *pBuffer, size_t nBufferSize, unsigned int nS
    }
 }
 
-static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWindowSize, const int nIsQuickTest) {
+/**
+ * Allocator callback for the self test, that counts live allocations
+ *
+ * @param nSize number of bytes to allocate
+ * @param pUserData pointer to the count of live allocations
+ *
+ * @return allocated memory, or NULL for failure
+ */
+static void *self_test_alloc(size_t nSize, void *pUserData) {
+   void *pMemory = malloc(nSize);
+
+   if (pMemory)
+      (*(int *)pUserData)++;
+   return pMemory;
+}
+
+/**
+ * Free callback for the self test, that counts live allocations
+ *
+ * @param pMemory memory to free
+ * @param pUserData pointer to the count of live allocations
+ */
+static void self_test_free(void *pMemory, void *pUserData) {
+   (*(int *)pUserData)--;
+   free(pMemory);
+}
+
+static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWindowSize, const unsigned int nEffortFlags, const int nNumThreads, const int nIsQuickTest) {
    unsigned char *pGeneratedData;
    unsigned char *pCompressedData;
    unsigned char *pTmpCompressedData;
    unsigned char *pTmpDecompressedData;
+   salvador_context *pContext;
    size_t nGeneratedDataSize;
    size_t nMaxCompressedDataSize;
    unsigned int nSeed = 123;
@@ -672,6 +2075,7 @@ static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWind
 
    if (nOptions & OPT_BACKWARD)
       nFlags |= FLG_IS_BACKWARD;
+   nFlags |= nEffortFlags;
 
    pGeneratedData = (unsigned char*)malloc(4 * BLOCK_SIZE);
    if (!pGeneratedData) {
@@ -713,6 +2117,22 @@ static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWind
       return 100;
    }
 
+   /* Use one compression context for all tests, to also check that it is correctly reused and grown */
+   pContext = salvador_context_create(nNumThreads);
+   if (!pContext) {
+      free(pTmpDecompressedData);
+      pTmpDecompressedData = NULL;
+      free(pTmpCompressedData);
+      pTmpCompressedData = NULL;
+      free(pCompressedData);
+      pCompressedData = NULL;
+      free(pGeneratedData);
+      pGeneratedData = NULL;
+
+      fprintf(stderr, "out of memory for compression context\n");
+      return 100;
+   }
+
    memset(pGeneratedData, 0, 4 * BLOCK_SIZE);
    memset(pCompressedData, 0, nMaxCompressedDataSize);
    memset(pTmpCompressedData, 0, nMaxCompressedDataSize);
@@ -720,7 +2140,7 @@ static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWind
    /* Test compressing with a too small buffer to do anything, expect to fail cleanly */
    for (i = 0; i < 12; i++) {
       generate_compressible_data(pGeneratedData, i, nSeed, 256, 0.5f);
-      salvador_compress(pGeneratedData, pCompressedData, i, i, nFlags, nMaxWindowSize, 0 /* dictionary size */, NULL, NULL);
+      salvador_context_compress(pContext, pGeneratedData, pCompressedData, i, i, nFlags, nMaxWindowSize, 0 /* dictionary size */, NULL, NULL);
    }
 
    size_t nDataSizeStep = 128;
@@ -742,9 +2162,11 @@ static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWind
             generate_compressible_data(pGeneratedData, nGeneratedDataSize, nSeed, nNumLiteralValues[i], fMatchProbability);
 
             /* Try to compress it, expected to succeed */
-            size_t nActualCompressedSize = salvador_compress(pGeneratedData, pCompressedData, nGeneratedDataSize, salvador_get_max_compressed_size(nGeneratedDataSize),
+            size_t nActualCompressedSize = salvador_context_compress(pContext, pGeneratedData, pCompressedData, nGeneratedDataSize, salvador_get_max_compressed_size(nGeneratedDataSize),
                nFlags, nMaxWindowSize, 0 /* dictionary size */, NULL, NULL);
             if (nActualCompressedSize == (size_t)-1 || nActualCompressedSize < (1 + 1 + 1 /* footer */)) {
+               salvador_context_destroy(pContext);
+               pContext = NULL;
                free(pTmpDecompressedData);
                pTmpDecompressedData = NULL;
                free(pTmpCompressedData);
@@ -758,10 +2180,30 @@ static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWind
                return 100;
             }
 
+            /* Get the compressed size without writing the data, expected to be the same when compressing on one thread */
+            if (nNumThreads == 1 &&
+               salvador_context_estimate(pContext, pGeneratedData, nGeneratedDataSize, nFlags, nMaxWindowSize, 0 /* dictionary size */, SALVADOR_ESTIMATE_EXACT, NULL) != nActualCompressedSize) {
+               salvador_context_destroy(pContext);
+               pContext = NULL;
+               free(pTmpDecompressedData);
+               pTmpDecompressedData = NULL;
+               free(pTmpCompressedData);
+               pTmpCompressedData = NULL;
+               free(pCompressedData);
+               pCompressedData = NULL;
+               free(pGeneratedData);
+               pGeneratedData = NULL;
+
+               fprintf(stderr, "\nself-test: error getting the exact compressed size, for size %zu, seed %u, match probability %f, literals range %d\n", nGeneratedDataSize, nSeed, fMatchProbability, nNumLiteralValues[i]);
+               return 100;
+            }
+
             /* Try to decompress it, expected to succeed */
             size_t nActualDecompressedSize;
             nActualDecompressedSize = salvador_decompress(pCompressedData, pTmpDecompressedData, nActualCompressedSize, nGeneratedDataSize, 0 /* dictionary size */, nFlags);
             if (nActualDecompressedSize == (size_t)-1) {
+               salvador_context_destroy(pContext);
+               pContext = NULL;
                free(pTmpDecompressedData);
                pTmpDecompressedData = NULL;
                free(pTmpCompressedData);
@@ -776,6 +2218,8 @@ static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWind
             }
 
             if (memcmp(pGeneratedData, pTmpDecompressedData, nGeneratedDataSize)) {
+               salvador_context_destroy(pContext);
+               pContext = NULL;
                free(pTmpDecompressedData);
                pTmpDecompressedData = NULL;
                free(pTmpCompressedData);
@@ -789,6 +2233,42 @@ static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWind
                return 100;
             }
 
+            /* Decompress it in place, at exactly the safe distance, expected to succeed; one byte closer, expected to fail cleanly */
+            size_t nSafeDistance = salvador_get_inplace_safe_distance(pCompressedData, nActualCompressedSize, nFlags);
+            if (nSafeDistance != (size_t)-1 && (nGeneratedDataSize + nSafeDistance) <= nMaxCompressedDataSize) {
+               const size_t nInPlaceBufferSize = nGeneratedDataSize + nSafeDistance;
+               int nInPlaceError;
+
+               memcpy(pTmpCompressedData + nInPlaceBufferSize - nActualCompressedSize, pCompressedData, nActualCompressedSize);
+               nInPlaceError = (salvador_decompress_inplace(pTmpCompressedData, nInPlaceBufferSize, nActualCompressedSize, nFlags) != nGeneratedDataSize ||
+                  memcmp(pGeneratedData, pTmpCompressedData, nGeneratedDataSize)) ? 1 : 0;
+
+               if (!nInPlaceError && nSafeDistance > 0) {
+                  memcpy(pTmpCompressedData + nInPlaceBufferSize - 1 - nActualCompressedSize, pCompressedData, nActualCompressedSize);
+                  if (salvador_decompress_inplace(pTmpCompressedData, nInPlaceBufferSize - 1, nActualCompressedSize, nFlags) != (size_t)-1)
+                     nInPlaceError = 1;
+               }
+
+               if (nInPlaceError)
+                  nSafeDistance = -1;
+            }
+
+            if (nSafeDistance == (size_t)-1) {
+               salvador_context_destroy(pContext);
+               pContext = NULL;
+               free(pTmpDecompressedData);
+               pTmpDecompressedData = NULL;
+               free(pTmpCompressedData);
+               pTmpCompressedData = NULL;
+               free(pCompressedData);
+               pCompressedData = NULL;
+               free(pGeneratedData);
+               pGeneratedData = NULL;
+
+               fprintf(stderr, "\nself-test: error decompressing in place, size %zu, seed %u, match probability %f, literals range %d\n", nGeneratedDataSize, nSeed, fMatchProbability, nNumLiteralValues[i]);
+               return 100;
+            }
+
             /* Try to decompress corrupted data, expected to fail cleanly, without crashing or corrupting memory outside the output buffer */
             for (fXorProbability = 0.05f; fXorProbability <= 0.5f; fXorProbability += 0.05f) {
                memcpy(pTmpCompressedData, pCompressedData, nActualCompressedSize);
@@ -797,18 +2277,80 @@ static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWind
             }
          }
 
-         nSeed++;
-      }
+         nSeed++;
+      }
+
+      fputc(10, stdout);
+      fflush(stdout);
+
+      nDataSizeStep <<= 1;
+      if (nDataSizeStep > (128 * 4096))
+         nDataSizeStep = 128 * 4096;
+      fProbabilitySizeStep *= 1.25;
+      if (fProbabilitySizeStep > (0.0005f * 4096))
+         fProbabilitySizeStep = 0.0005f * 4096;
+   }
+
+   /* Compress with the tables carved out of a memory block supplied by the caller, too small and then as large as needed, and with
+    * allocator callbacks; expect to fail cleanly, then to get the same output as with the C heap */
+   const size_t nMemoryTestSize = 2 * BLOCK_SIZE;
+   int nMemoryTestError = 0;
+   int nNumLiveAllocs = 0;
+
+   generate_compressible_data(pGeneratedData, nMemoryTestSize, nSeed, 56, 0.5f);
+   size_t nHeapCompressedSize = salvador_context_compress(pContext, pGeneratedData, pCompressedData, nMemoryTestSize, nMaxCompressedDataSize, nFlags, nMaxWindowSize, 0 /* dictionary size */, NULL, NULL);
+
+   salvador_context_reset(pContext);
+   size_t nMemoryBlockSize = salvador_context_get_memory_size(pContext, nMemoryTestSize, nFlags, 0 /* dictionary size */);
+   unsigned char *pMemoryBlock = (unsigned char *)malloc(nMemoryBlockSize);
+   if (nHeapCompressedSize == (size_t)-1 || !pMemoryBlock) {
+      nMemoryTestError = 1;
+   }
+   else {
+      salvador_allocator allocator;
+
+      salvador_context_set_memory(pContext, NULL, pMemoryBlock, nMemoryBlockSize / 2);
+      if (salvador_context_compress(pContext, pGeneratedData, pTmpCompressedData, nMemoryTestSize, nMaxCompressedDataSize, nFlags, nMaxWindowSize, 0 /* dictionary size */, NULL, NULL) != (size_t)-1)
+         nMemoryTestError = 1;
+
+      salvador_context_set_memory(pContext, NULL, pMemoryBlock, nMemoryBlockSize);
+      if (salvador_context_compress(pContext, pGeneratedData, pTmpCompressedData, nMemoryTestSize, nMaxCompressedDataSize, nFlags, nMaxWindowSize, 0 /* dictionary size */, NULL, NULL) != nHeapCompressedSize ||
+         memcmp(pCompressedData, pTmpCompressedData, nHeapCompressedSize))
+         nMemoryTestError = 1;
+
+      allocator.alloc_func = self_test_alloc;
+      allocator.free_func = self_test_free;
+      allocator.user_data = &nNumLiveAllocs;
+      salvador_context_set_memory(pContext, &allocator, NULL, 0);
+      if (salvador_context_compress(pContext, pGeneratedData, pTmpCompressedData, nMemoryTestSize, nMaxCompressedDataSize, nFlags, nMaxWindowSize, 0 /* dictionary size */, NULL, NULL) != nHeapCompressedSize ||
+         memcmp(pCompressedData, pTmpCompressedData, nHeapCompressedSize) || !nNumLiveAllocs)
+         nMemoryTestError = 1;
+
+      salvador_context_set_memory(pContext, NULL, NULL, 0);
+      if (nNumLiveAllocs)
+         nMemoryTestError = 1;
+   }
+
+   if (pMemoryBlock) {
+      free(pMemoryBlock);
+      pMemoryBlock = NULL;
+   }
+
+   salvador_context_destroy(pContext);
+   pContext = NULL;
 
-      fputc(10, stdout);
-      fflush(stdout);
+   if (nMemoryTestError) {
+      free(pTmpDecompressedData);
+      pTmpDecompressedData = NULL;
+      free(pTmpCompressedData);
+      pTmpCompressedData = NULL;
+      free(pCompressedData);
+      pCompressedData = NULL;
+      free(pGeneratedData);
+      pGeneratedData = NULL;
 
-      nDataSizeStep <<= 1;
-      if (nDataSizeStep > (128 * 4096))
-         nDataSizeStep = 128 * 4096;
-      fProbabilitySizeStep *= 1.25;
-      if (fProbabilitySizeStep > (0.0005f * 4096))
-         fProbabilitySizeStep = 0.0005f * 4096;
+      fprintf(stderr, "self-test: error compressing with a memory block or allocator callbacks, seed %u\n", nSeed);
+      return 100;
    }
 
    free(pTmpDecompressedData);
@@ -829,13 +2371,15 @@ static int do_self_test(const unsigned int nOptions, const unsigned int nMaxWind
 
 /*---------------------------------------------------------------------------*/
 
-static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, const unsigned int nMaxWindowSize) {
+static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, const unsigned int nMaxWindowSize, const unsigned int nEffortFlags) {
    size_t nFileSize, nMaxCompressedSize;
    unsigned char *pFileData;
    unsigned char *pCompressedData;
    int nFlags = FLG_IS_INVERTED;
    int i;
 
+   nFlags |= nEffortFlags;
+
    if (pszDictionaryFilename) {
       fprintf(stderr, "in-memory benchmarking does not support dictionaries\n");
       return 100;
@@ -951,120 +2495,669 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
       }
    }
 
-   free(pCompressedData);
-   free(pFileData);
+   free(pCompressedData);
+   free(pFileData);
+
+   fprintf(stdout, "compressed size: %zu bytes\n", nActualCompressedSize);
+   fprintf(stdout, "compression time: %lld microseconds (%g Mb/s)\n", nBestCompTime, ((double)nActualCompressedSize / 1024.0) / ((double)nBestCompTime / 1000.0));
+
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+#define NUM_CORRUPTED_STREAMS 64
+
+static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions) {
+   size_t nFileSize, nMaxDecompressedSize;
+   unsigned char *pFileData;
+   unsigned char *pDecompressedData;
+   unsigned char *pFastDecompressedData;
+   int nFlags = (nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED;
+   int i;
+
+   if (nOptions & OPT_BACKWARD)
+      nFlags |= FLG_IS_BACKWARD;
+
+   if (pszDictionaryFilename) {
+      fprintf(stderr, "in-memory benchmarking does not support dictionaries\n");
+      return 100;
+   }
+
+   /* Read the whole compressed file in memory */
+
+   FILE *f_in = fopen(pszInFilename, "rb");
+   if (!f_in) {
+      fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
+      return 100;
+   }
+
+   fseek(f_in, 0, SEEK_END);
+   nFileSize = (size_t)ftell(f_in);
+   fseek(f_in, 0, SEEK_SET);
+
+   pFileData = (unsigned char*)malloc(nFileSize);
+   if (!pFileData) {
+      fclose(f_in);
+      fprintf(stderr, "out of memory for reading '%s', %zu bytes needed\n", pszInFilename, nFileSize);
+      return 100;
+   }
+
+   if (fread(pFileData, 1, nFileSize, f_in) != nFileSize) {
+      free(pFileData);
+      fclose(f_in);
+      fprintf(stderr, "I/O error while reading '%s'\n", pszInFilename);
+      return 100;
+   }
+
+   fclose(f_in);
+   f_in = NULL;
+
+   if (nOptions & OPT_BACKWARD)
+      do_reverse_buffer(pFileData, nFileSize);
+
+   /* Allocate max decompressed size */
+
+   nMaxDecompressedSize = salvador_get_max_decompressed_size(pFileData, nFileSize, nFlags);
+   if (nMaxDecompressedSize == (size_t)-1) {
+      free(pFileData);
+      fprintf(stderr, "invalid compressed format for file '%s'\n", pszInFilename);
+      return 100;
+   }
+
+   pDecompressedData = (unsigned char*)malloc(nMaxDecompressedSize);
+   pFastDecompressedData = (unsigned char*)malloc(nMaxDecompressedSize + 16 /* slack for wide match copies */);
+   if (!pDecompressedData || !pFastDecompressedData) {
+      if (pFastDecompressedData) free(pFastDecompressedData);
+      if (pDecompressedData) free(pDecompressedData);
+      free(pFileData);
+      fprintf(stderr, "out of memory for decompressing '%s', %zu bytes needed\n", pszInFilename, nMaxDecompressedSize);
+      return 100;
+   }
+
+   memset(pDecompressedData, 0, nMaxDecompressedSize);
+   memset(pFastDecompressedData, 0, nMaxDecompressedSize + 16);
+
+   long long nBestDecTime = -1;
+   long long nBestFastDecTime = -1;
+
+   size_t nActualDecompressedSize = 0;
+   for (i = 0; i < 50; i++) {
+      long long t0 = do_get_time();
+      nActualDecompressedSize = salvador_decompress(pFileData, pDecompressedData, nFileSize, nMaxDecompressedSize, 0 /* dictionary size */, nFlags);
+      long long t1 = do_get_time();
+      if (nActualDecompressedSize == (size_t)-1) {
+         free(pDecompressedData);
+         free(pFileData);
+         fprintf(stderr, "decompression error\n");
+         return 100;
+      }
+
+      long long nCurDecTime = t1 - t0;
+      if (nBestDecTime == -1 || nBestDecTime > nCurDecTime)
+         nBestDecTime = nCurDecTime;
+   }
+
+   size_t nFastDecompressedSize = 0;
+   for (i = 0; i < 50; i++) {
+      long long t0 = do_get_time();
+      nFastDecompressedSize = salvador_decompress_fast(pFileData, pFastDecompressedData, nFileSize, nMaxDecompressedSize + 16, 0 /* dictionary size */, nFlags);
+      long long t1 = do_get_time();
+      if (nFastDecompressedSize != nActualDecompressedSize || memcmp(pFastDecompressedData, pDecompressedData, nActualDecompressedSize)) {
+         free(pFastDecompressedData);
+         free(pDecompressedData);
+         free(pFileData);
+         fprintf(stderr, "fast decompression error\n");
+         return 100;
+      }
+
+      long long nCurDecTime = t1 - t0;
+      if (nBestFastDecTime == -1 || nBestFastDecTime > nCurDecTime)
+         nBestFastDecTime = nCurDecTime;
+   }
+
+   size_t nValidatedSize = 0;
+   long long nBestValidateTime = -1;
+   for (i = 0; i < 50; i++) {
+      long long t0 = do_get_time();
+      nValidatedSize = salvador_validate_compressed_data(pFileData, nFileSize, nMaxDecompressedSize, 0 /* dictionary size */, nFlags);
+      long long t1 = do_get_time();
+      if (nValidatedSize != nActualDecompressedSize) {
+         free(pFastDecompressedData);
+         free(pDecompressedData);
+         free(pFileData);
+         fprintf(stderr, "validation error\n");
+         return 100;
+      }
+
+      long long nCurValidateTime = t1 - t0;
+      if (nBestValidateTime == -1 || nBestValidateTime > nCurValidateTime)
+         nBestValidateTime = nCurValidateTime;
+   }
+
+   /* Corrupt copies of the stream, by flipping bits all over it or by truncating it, and check that validation either rejects each one,
+    * or returns the size that it decompresses to */
+   unsigned char *pCorruptedData = (unsigned char*)malloc(nFileSize);
+   int nNumRejectedByValidation = 0, nNumRejectedByDecompression = 0;
+   long long nTotalValidateTime = 0, nTotalDecTime = 0;
+   if (!pCorruptedData) {
+      free(pFastDecompressedData);
+      free(pDecompressedData);
+      free(pFileData);
+      fprintf(stderr, "out of memory for corrupting '%s', %zu bytes needed\n", pszInFilename, nFileSize);
+      return 100;
+   }
+
+   for (i = 0; i < NUM_CORRUPTED_STREAMS; i++) {
+      const size_t nCorruptedPos = (size_t)(((unsigned long long)nFileSize * (unsigned long long)i) / NUM_CORRUPTED_STREAMS);
+      const size_t nCorruptedSize = ((i & 3) == 3) ? nCorruptedPos : nFileSize;
+
+      memcpy(pCorruptedData, pFileData, nFileSize);
+      if ((i & 3) != 3)
+         pCorruptedData[nCorruptedPos] ^= (unsigned char)(1 << ((i >> 2) & 7));
+
+      long long t0 = do_get_time();
+      nValidatedSize = salvador_validate_compressed_data(pCorruptedData, nCorruptedSize, nMaxDecompressedSize, 0 /* dictionary size */, nFlags);
+      long long t1 = do_get_time();
+      size_t nCorruptedDecompressedSize = salvador_decompress(pCorruptedData, pDecompressedData, nCorruptedSize, nMaxDecompressedSize, 0 /* dictionary size */, nFlags);
+      long long t2 = do_get_time();
+
+      if (nValidatedSize != (size_t)-1 && nValidatedSize != nCorruptedDecompressedSize) {
+         free(pCorruptedData);
+         free(pFastDecompressedData);
+         free(pDecompressedData);
+         free(pFileData);
+         fprintf(stderr, "validation error for corrupted stream %d\n", i);
+         return 100;
+      }
+
+      if (nValidatedSize == (size_t)-1)
+         nNumRejectedByValidation++;
+      if (nCorruptedDecompressedSize == (size_t)-1)
+         nNumRejectedByDecompression++;
+      nTotalValidateTime += t1 - t0;
+      nTotalDecTime += t2 - t1;
+   }
+
+   free(pCorruptedData);
+   pCorruptedData = NULL;
+
+   /* The corrupted streams were decompressed over the output */
+   salvador_decompress(pFileData, pDecompressedData, nFileSize, nMaxDecompressedSize, 0 /* dictionary size */, nFlags);
+
+   if (nOptions & OPT_BACKWARD)
+      do_reverse_buffer(pDecompressedData, nActualDecompressedSize);
+
+   if (pszOutFilename) {
+      FILE *f_out;
+
+      /* Write whole decompressed file out */
+
+      f_out = fopen(pszOutFilename, "wb");
+      if (f_out) {
+         fwrite(pDecompressedData, 1, nActualDecompressedSize, f_out);
+         fclose(f_out);
+      }
+   }
+
+   free(pFastDecompressedData);
+   free(pDecompressedData);
+   free(pFileData);
+
+   fprintf(stdout, "decompressed size: %zu bytes\n", nActualDecompressedSize);
+   fprintf(stdout, "decompression time: %lld microseconds (%g Mb/s)\n", nBestDecTime, ((double)nActualDecompressedSize / 1024.0) / ((double)nBestDecTime / 1000.0));
+   fprintf(stdout, "fast decompression time: %lld microseconds (%g Mb/s)\n", nBestFastDecTime, ((double)nActualDecompressedSize / 1024.0) / ((double)nBestFastDecTime / 1000.0));
+   fprintf(stdout, "validation time: %lld microseconds (%g Mb/s)\n", nBestValidateTime, ((double)nActualDecompressedSize / 1024.0) / ((double)((nBestValidateTime > 0) ? nBestValidateTime : 1) / 1000.0));
+   fprintf(stdout, "corrupted streams: %d, rejected by validation: %d in %lld microseconds, by decompression: %d in %lld microseconds\n", NUM_CORRUPTED_STREAMS,
+      nNumRejectedByValidation, nTotalValidateTime, nNumRejectedByDecompression, nTotalDecTime);
+
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+#define BENCH_FORMAT_TEXT  0
+#define BENCH_FORMAT_JSON  1
+#define BENCH_FORMAT_CSV   2
+
+#define DEFAULT_BENCH_RUNS 5
+#define MAX_BENCH_RUNS     1000
+
+typedef struct _bench_result {
+   const char *pszFilename;
+   const char *pszMode;
+   int nDictionary;
+   int nLevel;
+   size_t nOriginalSize;
+   size_t nCompressedSize;
+   double fCompSpeed[3];         /* Compression speed in Mb/s: median, 10th and 90th percentile */
+   double fDecSpeed[3];          /* Decompression speed in Mb/s: median, 10th and 90th percentile */
+   long long nPeakMemory;        /* Peak resident memory in bytes, -1 if not available */
+} bench_result;
+
+static int do_compare_times(const void *pA, const void *pB) {
+   const long long nA = *(const long long *)pA;
+   const long long nB = *(const long long *)pB;
+
+   return (nA > nB) - (nA < nB);
+}
+
+static void do_get_bench_speeds(long long *pTimes, const int nNumRuns, const size_t nSize, double *pSpeeds) {
+   static const int nPercentiles[3] = { 50, 10, 90 };
+   int i;
+
+   qsort(pTimes, nNumRuns, sizeof(long long), do_compare_times);
+
+   for (i = 0; i < 3; i++) {
+      /* The slowest runs have the lowest throughput: the Nth percentile speed is the (100-N)th percentile time, by nearest rank */
+      long long nTime = pTimes[((100 - nPercentiles[i]) * (nNumRuns - 1) + 50) / 100];
+
+      if (nTime < 1) nTime = 1;
+      pSpeeds[i] = ((double)nSize / 1048576.0) / ((double)nTime / 1000000.0);
+   }
+}
+
+static void do_reset_peak_memory(void) {
+#ifdef __linux__
+   /* Writing 5 to clear_refs resets the peak resident size to the current one, so that each configuration is measured by itself */
+   FILE *f_refs = fopen("/proc/self/clear_refs", "w");
+   if (f_refs) {
+      fputs("5", f_refs);
+      fclose(f_refs);
+   }
+#endif
+}
+
+static long long do_get_peak_memory(void) {
+#ifdef _WIN32
+   PROCESS_MEMORY_COUNTERS pmc;
+
+   if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+      return (long long)pmc.PeakWorkingSetSize;
+   return -1;
+#else
+   struct rusage ru;
+
+   if (getrusage(RUSAGE_SELF, &ru))
+      return -1;
+#ifdef __APPLE__
+   return (long long)ru.ru_maxrss;
+#else
+   return (long long)ru.ru_maxrss * 1024LL;
+#endif
+#endif
+}
+
+static int do_compare_filenames(const void *pA, const void *pB) {
+   return strcmp(*(char * const *)pA, *(char * const *)pB);
+}
+
+static int do_add_bench_file(const char *pszPath, const char *pszName, char ***pppszFiles, int *pNumFiles, int *pMaxFiles) {
+   size_t nPathLen = pszName ? strlen(pszPath) : 0;
+   char *pszFilename;
+
+   if (*pNumFiles == *pMaxFiles) {
+      int nNewMaxFiles = *pMaxFiles ? (*pMaxFiles * 2) : 64;
+      char **ppszNewFiles = (char **)realloc(*pppszFiles, nNewMaxFiles * sizeof(char *));
+      if (!ppszNewFiles)
+         return 100;
+      *pppszFiles = ppszNewFiles;
+      *pMaxFiles = nNewMaxFiles;
+   }
+
+   if (!pszName)
+      pszName = pszPath;
+
+   pszFilename = (char *)malloc(nPathLen + 1 + strlen(pszName) + 1);
+   if (!pszFilename)
+      return 100;
+
+   if (nPathLen) {
+      memcpy(pszFilename, pszPath, nPathLen);
+#ifdef _WIN32
+      pszFilename[nPathLen++] = '\\';
+#else
+      pszFilename[nPathLen++] = '/';
+#endif
+   }
+   strcpy(pszFilename + nPathLen, pszName);
+
+   (*pppszFiles)[(*pNumFiles)++] = pszFilename;
+   return 0;
+}
+
+static int do_add_bench_path(const char *pszPath, char ***pppszFiles, int *pNumFiles, int *pMaxFiles) {
+   int nFirstFile = *pNumFiles;
+   int nResult = 0;
+
+   /* A directory adds the files that it directly contains, sorted by name so that the results always come in the same order */
+
+#ifdef _WIN32
+   DWORD dwAttributes = GetFileAttributesA(pszPath);
+   if (dwAttributes == INVALID_FILE_ATTRIBUTES || !(dwAttributes & FILE_ATTRIBUTE_DIRECTORY))
+      return do_add_bench_file(pszPath, NULL, pppszFiles, pNumFiles, pMaxFiles);
+
+   char *pszPattern = (char *)malloc(strlen(pszPath) + 3);
+   WIN32_FIND_DATAA findData;
+   HANDLE hFind;
+
+   if (!pszPattern)
+      return 100;
+   strcpy(pszPattern, pszPath);
+   strcat(pszPattern, "\\*");
+   hFind = FindFirstFileA(pszPattern, &findData);
+   free(pszPattern);
+
+   if (hFind != INVALID_HANDLE_VALUE) {
+      do {
+         if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            nResult = do_add_bench_file(pszPath, findData.cFileName, pppszFiles, pNumFiles, pMaxFiles);
+      } while (!nResult && FindNextFileA(hFind, &findData));
+      FindClose(hFind);
+   }
+#else
+   struct stat st;
+   DIR *pDir;
+   struct dirent *pEntry;
+
+   if (stat(pszPath, &st) || !S_ISDIR(st.st_mode))
+      return do_add_bench_file(pszPath, NULL, pppszFiles, pNumFiles, pMaxFiles);
+
+   pDir = opendir(pszPath);
+   if (!pDir) {
+      fprintf(stderr, "error opening directory '%s'\n", pszPath);
+      return 100;
+   }
+
+   while (!nResult && (pEntry = readdir(pDir)) != NULL) {
+      if (pEntry->d_name[0] == '.' && (!pEntry->d_name[1] || (pEntry->d_name[1] == '.' && !pEntry->d_name[2])))
+         continue;
+
+      nResult = do_add_bench_file(pszPath, pEntry->d_name, pppszFiles, pNumFiles, pMaxFiles);
+      if (!nResult) {
+         /* Skip subdirectories, special files, and anything else that can't be benchmarked */
+         if (stat((*pppszFiles)[*pNumFiles - 1], &st) || !S_ISREG(st.st_mode))
+            free((*pppszFiles)[--(*pNumFiles)]);
+      }
+   }
+   closedir(pDir);
+#endif
+
+   if (nResult) {
+      fprintf(stderr, "out of memory for listing directory '%s'\n", pszPath);
+      return nResult;
+   }
+
+   qsort(*pppszFiles + nFirstFile, *pNumFiles - nFirstFile, sizeof(char *), do_compare_filenames);
+   return 0;
+}
+
+static void do_print_quoted_string(const char *pszString, const int nFormat) {
+   fputc('"', stdout);
+   while (*pszString) {
+      if (*pszString == '"')
+         fputs((nFormat == BENCH_FORMAT_JSON) ? "\\\"" : "\"\"", stdout);
+      else if (*pszString == '\\' && nFormat == BENCH_FORMAT_JSON)
+         fputs("\\\\", stdout);
+      else if ((unsigned char)*pszString < 0x20 && nFormat == BENCH_FORMAT_JSON)
+         fprintf(stdout, "\\u%04x", (unsigned int)(unsigned char)*pszString);
+      else
+         fputc(*pszString, stdout);
+      pszString++;
+   }
+   fputc('"', stdout);
+}
+
+static void do_print_bench_result(const bench_result *pResult, const int nFormat, const int nIsFirst) {
+   const double fRatio = pResult->nOriginalSize ? ((double)pResult->nCompressedSize * 100.0 / (double)pResult->nOriginalSize) : 0.0;
+
+   switch (nFormat) {
+   case BENCH_FORMAT_JSON:
+      fprintf(stdout, "%s\n    { \"file\": ", nIsFirst ? "" : ",");
+      do_print_quoted_string(pResult->pszFilename, nFormat);
+      fprintf(stdout, ", \"mode\": \"%s\", \"dictionary\": %s, \"level\": %d, \"original_size\": %zu, \"compressed_size\": %zu, \"ratio_percent\": %.3f,\n",
+         pResult->pszMode, pResult->nDictionary ? "true" : "false", pResult->nLevel, pResult->nOriginalSize, pResult->nCompressedSize, fRatio);
+      fprintf(stdout, "      \"compress_mb_s\": { \"median\": %.3f, \"p10\": %.3f, \"p90\": %.3f }, \"decompress_mb_s\": { \"median\": %.3f, \"p10\": %.3f, \"p90\": %.3f }, \"peak_rss_bytes\": %lld }",
+         pResult->fCompSpeed[0], pResult->fCompSpeed[1], pResult->fCompSpeed[2], pResult->fDecSpeed[0], pResult->fDecSpeed[1], pResult->fDecSpeed[2], pResult->nPeakMemory);
+      break;
+
+   case BENCH_FORMAT_CSV:
+      if (nIsFirst)
+         fprintf(stdout, "file,mode,dictionary,level,original_size,compressed_size,ratio_percent,compress_mb_s_median,compress_mb_s_p10,compress_mb_s_p90,decompress_mb_s_median,decompress_mb_s_p10,decompress_mb_s_p90,peak_rss_bytes\n");
+      do_print_quoted_string(pResult->pszFilename, nFormat);
+      fprintf(stdout, ",%s,%d,%d,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%lld\n",
+         pResult->pszMode, pResult->nDictionary, pResult->nLevel, pResult->nOriginalSize, pResult->nCompressedSize, fRatio,
+         pResult->fCompSpeed[0], pResult->fCompSpeed[1], pResult->fCompSpeed[2], pResult->fDecSpeed[0], pResult->fDecSpeed[1], pResult->fDecSpeed[2], pResult->nPeakMemory);
+      break;
+
+   default:
+      if (nIsFirst)
+         fprintf(stdout, "%-24s %-16s %-4s %-5s %10s %10s %8s %22s %22s %9s\n", "file", "mode", "dict", "level", "original", "compressed", "ratio", "compress Mb/s (p10-p90)", "decomp. Mb/s (p10-p90)", "peak RSS");
+      fprintf(stdout, "%-24s %-16s %-4s %-5d %10zu %10zu %7.2f%% %8.2f (%5.2f-%5.2f) %8.2f (%5.2f-%5.2f) %8lldK\n",
+         pResult->pszFilename, pResult->pszMode, pResult->nDictionary ? "yes" : "no", pResult->nLevel, pResult->nOriginalSize, pResult->nCompressedSize, fRatio,
+         pResult->fCompSpeed[0], pResult->fCompSpeed[1], pResult->fCompSpeed[2], pResult->fDecSpeed[0], pResult->fDecSpeed[1], pResult->fDecSpeed[2],
+         (pResult->nPeakMemory >= 0) ? (pResult->nPeakMemory / 1024LL) : -1LL);
+      break;
+   }
+}
+
+static int do_bench_config(unsigned char *pInputData, unsigned char *pCompressedData, unsigned char *pDecompressedData, const size_t nOriginalSize, const size_t nDictionarySize,
+      const size_t nMaxCompressedSize, const int nFlags, const unsigned int nMaxWindowSize, const int nNumThreads, const int nNumRuns, long long *pTimes, bench_result *pResult) {
+   const int nIsBackward = (nFlags & FLG_IS_BACKWARD) ? 1 : 0;
+   size_t nCompressedSize = 0;
+   int i;
+
+   do_reset_peak_memory();
+
+   for (i = 0; i < nNumRuns; i++) {
+      long long t0 = do_get_time();
+      if (nNumThreads != 1)
+         nCompressedSize = salvador_compress_parallel(pInputData, pCompressedData, nDictionarySize + nOriginalSize, nMaxCompressedSize, nFlags, nMaxWindowSize, nDictionarySize, nNumThreads, NULL, NULL);
+      else
+         nCompressedSize = salvador_compress(pInputData, pCompressedData, nDictionarySize + nOriginalSize, nMaxCompressedSize, nFlags, nMaxWindowSize, nDictionarySize, NULL, NULL);
+      pTimes[i] = do_get_time() - t0;
+
+      if (nCompressedSize == (size_t)-1) {
+         fprintf(stderr, "compression error for '%s' (%s, level %d)\n", pResult->pszFilename, pResult->pszMode, pResult->nLevel);
+         return 100;
+      }
+   }
+
+   do_get_bench_speeds(pTimes, nNumRuns, nOriginalSize, pResult->fCompSpeed);
 
-   fprintf(stdout, "compressed size: %zu bytes\n", nActualCompressedSize);
-   fprintf(stdout, "compression time: %lld microseconds (%g Mb/s)\n", nBestCompTime, ((double)nActualCompressedSize / 1024.0) / ((double)nBestCompTime / 1000.0));
+   /* Decompress after the same dictionary; backward data is decompressed from the end of the output area and the dictionary follows it */
 
-   return 0;
-}
+   memcpy(pDecompressedData + (nIsBackward ? nOriginalSize : 0), pInputData + (nIsBackward ? nOriginalSize : 0), nDictionarySize);
 
-/*---------------------------------------------------------------------------*/
+   for (i = 0; i < nNumRuns; i++) {
+      size_t nDecompressedSize;
 
-static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions) {
-   size_t nFileSize, nMaxDecompressedSize;
-   unsigned char *pFileData;
-   unsigned char *pDecompressedData;
-   int nFlags = FLG_IS_INVERTED;
-   int i;
+      long long t0 = do_get_time();
+      nDecompressedSize = salvador_decompress(pCompressedData, pDecompressedData, nCompressedSize, nIsBackward ? nOriginalSize : (nDictionarySize + nOriginalSize), nDictionarySize, nFlags);
+      pTimes[i] = do_get_time() - t0;
 
-   if (pszDictionaryFilename) {
-      fprintf(stderr, "in-memory benchmarking does not support dictionaries\n");
-      return 100;
+      if (nDecompressedSize != nOriginalSize || (i == 0 && memcmp(pDecompressedData + (nIsBackward ? 0 : nDictionarySize), pInputData + (nIsBackward ? 0 : nDictionarySize), nOriginalSize))) {
+         fprintf(stderr, "decompressed data doesn't match for '%s' (%s, level %d)\n", pResult->pszFilename, pResult->pszMode, pResult->nLevel);
+         return 100;
+      }
    }
 
-   /* Read the whole compressed file in memory */
+   do_get_bench_speeds(pTimes, nNumRuns, nOriginalSize, pResult->fDecSpeed);
 
-   FILE *f_in = fopen(pszInFilename, "rb");
+   pResult->nOriginalSize = nOriginalSize;
+   pResult->nCompressedSize = nCompressedSize;
+   pResult->nPeakMemory = do_get_peak_memory();
+   return 0;
+}
+
+static int do_bench_file(const char *pszFilename, const unsigned char *pDictionaryData, const size_t nMaxDictionarySize, const unsigned int *pModes, const int nNumModes,
+      const unsigned int nMaxWindowSize, const unsigned int nEffortFlags, const int nMinLevel, const int nMaxLevel, const int nNumThreads, const int nNumRuns,
+      const int nFormat, long long *pTimes, int *pNumResults) {
+   size_t nOriginalSize, nMaxCompressedSize;
+   unsigned char *pInputData, *pCompressedData, *pDecompressedData;
+   int nResult = 0;
+   int nMode, nDictionary, nLevel;
+
+   /* Read the whole file in memory, leaving room for the dictionary on either side */
+
+   FILE *f_in = fopen(pszFilename, "rb");
    if (!f_in) {
-      fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
+      fprintf(stderr, "error opening '%s' for reading\n", pszFilename);
       return 100;
    }
 
    fseek(f_in, 0, SEEK_END);
-   nFileSize = (size_t)ftell(f_in);
+   nOriginalSize = (size_t)ftell(f_in);
    fseek(f_in, 0, SEEK_SET);
 
-   pFileData = (unsigned char*)malloc(nFileSize);
-   if (!pFileData) {
+   nMaxCompressedSize = salvador_get_max_compressed_size(nMaxDictionarySize + nOriginalSize);
+
+   pInputData = (unsigned char *)malloc(nMaxDictionarySize + nOriginalSize + nMaxDictionarySize);
+   pCompressedData = (unsigned char *)malloc(nMaxCompressedSize);
+   pDecompressedData = (unsigned char *)malloc(nMaxDictionarySize + nOriginalSize);
+   if (!pInputData || !pCompressedData || !pDecompressedData) {
+      if (pDecompressedData) free(pDecompressedData);
+      if (pCompressedData) free(pCompressedData);
+      if (pInputData) free(pInputData);
       fclose(f_in);
-      fprintf(stderr, "out of memory for reading '%s', %zu bytes needed\n", pszInFilename, nFileSize);
+      fprintf(stderr, "out of memory for benchmarking '%s'\n", pszFilename);
       return 100;
    }
 
-   if (fread(pFileData, 1, nFileSize, f_in) != nFileSize) {
-      free(pFileData);
+   if (fread(pInputData + nMaxDictionarySize, 1, nOriginalSize, f_in) != nOriginalSize) {
+      free(pDecompressedData);
+      free(pCompressedData);
+      free(pInputData);
       fclose(f_in);
-      fprintf(stderr, "I/O error while reading '%s'\n", pszInFilename);
+      fprintf(stderr, "I/O error while reading '%s'\n", pszFilename);
       return 100;
    }
 
    fclose(f_in);
    f_in = NULL;
 
-   if (nOptions & OPT_BACKWARD)
-      do_reverse_buffer(pFileData, nFileSize);
+   if (nMaxDictionarySize) {
+      memcpy(pInputData, pDictionaryData, nMaxDictionarySize);
+      memcpy(pInputData + nMaxDictionarySize + nOriginalSize, pDictionaryData, nMaxDictionarySize);
+   }
 
-   /* Allocate max decompressed size */
+   for (nMode = 0; !nResult && nMode < nNumModes; nMode++) {
+      const unsigned int nOptions = pModes[nMode];
+      int nFlags = ((nOptions & OPT_CLASSIC) ? 0 : FLG_IS_INVERTED) | nEffortFlags;
 
-   nMaxDecompressedSize = salvador_get_max_decompressed_size(pFileData, nFileSize, nFlags);
-   if (nMaxDecompressedSize == (size_t)-1) {
-      free(pFileData);
-      fprintf(stderr, "invalid compressed format for file '%s'\n", pszInFilename);
-      return 100;
-   }
+      if (nOptions & OPT_BACKWARD)
+         nFlags |= (FLG_IS_BACKWARD | FLG_NATIVE_BACKWARD);
 
-   pDecompressedData = (unsigned char*)malloc(nMaxDecompressedSize);
-   if (!pDecompressedData) {
-      free(pFileData);
-      fprintf(stderr, "out of memory for decompressing '%s', %zu bytes needed\n", pszInFilename, nMaxDecompressedSize);
-      return 100;
-   }
+      for (nDictionary = 0; !nResult && nDictionary <= (nMaxDictionarySize ? 1 : 0); nDictionary++) {
+         const size_t nDictionarySize = nDictionary ? nMaxDictionarySize : 0;
 
-   memset(pDecompressedData, 0, nMaxDecompressedSize);
+         /* Forward data comes after its dictionary, backward data comes before it */
+         unsigned char *pData = (nOptions & OPT_BACKWARD) ? (pInputData + nMaxDictionarySize) : (pInputData + nMaxDictionarySize - nDictionarySize);
 
-   long long nBestDecTime = -1;
+         for (nLevel = nMinLevel; !nResult && nLevel <= nMaxLevel; nLevel++) {
+            bench_result result;
 
-   size_t nActualDecompressedSize = 0;
-   for (i = 0; i < 50; i++) {
-      long long t0 = do_get_time();
-      nActualDecompressedSize = salvador_decompress(pFileData, pDecompressedData, nFileSize, nMaxDecompressedSize, 0 /* dictionary size */, nFlags);
-      long long t1 = do_get_time();
-      if (nActualDecompressedSize == (size_t)-1) {
-         free(pDecompressedData);
-         free(pFileData);
-         fprintf(stderr, "decompression error\n");
-         return 100;
+            memset(&result, 0, sizeof(result));
+            result.pszFilename = pszFilename;
+            result.pszMode = (nOptions & OPT_BACKWARD) ? ((nOptions & OPT_CLASSIC) ? "backward-classic" : "backward") : ((nOptions & OPT_CLASSIC) ? "classic" : "forward");
+            result.nDictionary = nDictionary;
+            result.nLevel = nLevel;
+
+            nResult = do_bench_config(pData, pCompressedData, pDecompressedData, nOriginalSize, nDictionarySize, nMaxCompressedSize, nFlags | FLG_LEVEL(nLevel),
+               nMaxWindowSize, nNumThreads, nNumRuns, pTimes, &result);
+            if (!nResult) {
+               do_print_bench_result(&result, nFormat, (*pNumResults) == 0);
+               (*pNumResults)++;
+               fflush(stdout);
+            }
+         }
       }
+   }
 
-      long long nCurDecTime = t1 - t0;
-      if (nBestDecTime == -1 || nBestDecTime > nCurDecTime)
-         nBestDecTime = nCurDecTime;
+   free(pDecompressedData);
+   free(pCompressedData);
+   free(pInputData);
+   return nResult;
+}
+
+static int do_bench_suite(const char **ppszPaths, const int nNumPaths, const char *pszDictionaryFilename, const unsigned int nOptions, const unsigned int nMaxWindowSize,
+      const unsigned int nEffortFlags, const int nLevel, const int nNumThreads, const int nNumRuns, const int nFormat) {
+   unsigned int nModes[3];
+   int nNumModes = 0;
+   unsigned char *pDictionaryData = NULL;
+   size_t nDictionarySize = 0;
+   char **ppszFiles = NULL;
+   int nNumFiles = 0, nMaxFiles = 0;
+   long long *pTimes;
+   int nNumResults = 0;
+   int nResult = 0;
+   int i;
+
+   /* Benchmark all the formats unless one is picked, and all the levels unless one is picked */
+
+   if (nOptions & (OPT_BACKWARD | OPT_CLASSIC)) {
+      nModes[nNumModes++] = nOptions & (OPT_BACKWARD | OPT_CLASSIC);
+   }
+   else {
+      nModes[nNumModes++] = 0;
+      nModes[nNumModes++] = OPT_BACKWARD;
+      nModes[nNumModes++] = OPT_CLASSIC;
    }
 
-   if (nOptions & OPT_BACKWARD)
-      do_reverse_buffer(pDecompressedData, nActualDecompressedSize);
+   for (i = 0; !nResult && i < nNumPaths; i++)
+      nResult = do_add_bench_path(ppszPaths[i], &ppszFiles, &nNumFiles, &nMaxFiles);
+   if (!nResult && !nNumFiles) {
+      fprintf(stderr, "no files to benchmark\n");
+      nResult = 100;
+   }
 
-   if (pszOutFilename) {
-      FILE *f_out;
+   if (!nResult && pszDictionaryFilename) {
+      /* Each configuration is benchmarked with and without the dictionary */
+      FILE *f_dict = fopen(pszDictionaryFilename, "rb");
+      if (f_dict) {
+         fseek(f_dict, 0, SEEK_END);
+         nDictionarySize = (size_t)ftell(f_dict);
+         fseek(f_dict, 0, SEEK_SET);
 
-      /* Write whole decompressed file out */
+         if (nDictionarySize > BLOCK_SIZE) nDictionarySize = BLOCK_SIZE;
 
-      f_out = fopen(pszOutFilename, "wb");
-      if (f_out) {
-         fwrite(pDecompressedData, 1, nActualDecompressedSize, f_out);
-         fclose(f_out);
+         pDictionaryData = (unsigned char *)malloc(nDictionarySize ? nDictionarySize : 1);
+         if (!pDictionaryData || fread(pDictionaryData, 1, nDictionarySize, f_dict) != nDictionarySize) {
+            fprintf(stderr, "I/O error while reading dictionary '%s'\n", pszDictionaryFilename);
+            nResult = 100;
+         }
+         fclose(f_dict);
+      }
+      else {
+         fprintf(stderr, "error opening dictionary '%s' for reading\n", pszDictionaryFilename);
+         nResult = 100;
       }
    }
 
-   free(pDecompressedData);
-   free(pFileData);
+   pTimes = (long long *)malloc(nNumRuns * sizeof(long long));
+   if (!nResult && !pTimes) {
+      fprintf(stderr, "out of memory for benchmarking\n");
+      nResult = 100;
+   }
 
-   fprintf(stdout, "decompressed size: %zu bytes\n", nActualDecompressedSize);
-   fprintf(stdout, "decompression time: %lld microseconds (%g Mb/s)\n", nBestDecTime, ((double)nActualDecompressedSize / 1024.0) / ((double)nBestDecTime / 1000.0));
+   if (!nResult && nFormat == BENCH_FORMAT_JSON)
+      fprintf(stdout, "{\n  \"tool\": \"salvador\", \"version\": \"" TOOL_VERSION "\", \"runs\": %d, \"threads\": %d, \"window\": %u,\n  \"results\": [", nNumRuns, nNumThreads, nMaxWindowSize ? nMaxWindowSize : MAX_OFFSET);
 
-   return 0;
+   for (i = 0; !nResult && i < nNumFiles; i++) {
+      nResult = do_bench_file(ppszFiles[i], pDictionaryData, nDictionarySize, nModes, nNumModes, nMaxWindowSize, nEffortFlags,
+         nLevel ? nLevel : MIN_COMPRESSION_LEVEL, nLevel ? nLevel : MAX_COMPRESSION_LEVEL, nNumThreads, nNumRuns, nFormat, pTimes, &nNumResults);
+   }
+
+   if (!nResult && nFormat == BENCH_FORMAT_JSON)
+      fprintf(stdout, "\n  ]\n}\n");
+
+   if (pTimes) free(pTimes);
+   if (pDictionaryData) free(pDictionaryData);
+   for (i = 0; i < nNumFiles; i++)
+      free(ppszFiles[i]);
+   if (ppszFiles) free(ppszFiles);
+
+   return nResult;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -1080,6 +3173,24 @@ int main(int argc, char **argv) {
    char cCommand = 'z';
    unsigned int nOptions = 0;
    unsigned int nMaxWindowSize = 0;
+   int nChainCandidates = 0;
+   int nFastMatchFinder = 0;
+   int nPipeline = 0;
+   int nHugePages = 0;
+   int nParseSegments = 0;
+   int nLevel = 0;
+   unsigned int nEffortFlags;
+   int nNumThreads = 1;
+   int nThreadsDefined = 0;
+   const char *pszManifestFilename = NULL;
+   const char **ppszBatchFilenames = NULL;
+   int nNumBatchFilenames = 0;
+   size_t nCheckpointInterval = 0;
+   size_t nRangeOffset = 0, nRangeSize = 0;
+   int nRangeDefined = 0;
+   int nBenchRuns = 0;
+   int nBenchFormat = -1;
+   int nBlockSizeShift = -1;
 
    for (i = 1; i < argc; i++) {
       if (!strcmp(argv[i], "-d")) {
@@ -1105,6 +3216,30 @@ int main(int argc, char **argv) {
          else
             nArgsError = 1;
       }
+      else if (!strcmp(argv[i], "-batch")) {
+         if (!nCommandDefined) {
+            nCommandDefined = 1;
+            cCommand = 'M';
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-manifest")) {
+         if (!pszManifestFilename && (i + 1) < argc) {
+            pszManifestFilename = argv[i + 1];
+            i++;
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-prepare")) {
+         if (!nCommandDefined) {
+            nCommandDefined = 1;
+            cCommand = 'P';
+         }
+         else
+            nArgsError = 1;
+      }
       else if (!strcmp(argv[i], "-cbench")) {
          if (!nCommandDefined) {
             nCommandDefined = 1;
@@ -1121,6 +3256,50 @@ int main(int argc, char **argv) {
          else
             nArgsError = 1;
       }
+      else if (!strcmp(argv[i], "-bench")) {
+         if (!nCommandDefined) {
+            nCommandDefined = 1;
+            cCommand = 'S';
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-runs")) {
+         if (!nBenchRuns && (i + 1) < argc) {
+            char *pEnd = NULL;
+            nBenchRuns = (int)strtol(argv[i + 1], &pEnd, 10);
+            if (pEnd && pEnd != argv[i + 1] && !*pEnd && (nBenchRuns >= 1 && nBenchRuns <= MAX_BENCH_RUNS)) {
+               i++;
+            }
+            else {
+               nArgsError = 1;
+            }
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-json")) {
+         if (nBenchFormat < 0) {
+            nBenchFormat = BENCH_FORMAT_JSON;
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-csv")) {
+         if (nBenchFormat < 0) {
+            nBenchFormat = BENCH_FORMAT_CSV;
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-estimate")) {
+         if (!nCommandDefined) {
+            nCommandDefined = 1;
+            cCommand = 'E';
+         }
+         else
+            nArgsError = 1;
+      }
       else if (!strcmp(argv[i], "-test")) {
          if (!nCommandDefined) {
             nCommandDefined = 1;
@@ -1184,6 +3363,111 @@ int main(int argc, char **argv) {
          else
             nArgsError = 1;
       }
+      else if (!strcmp(argv[i], "-fast")) {
+         if (!nFastMatchFinder) {
+            nFastMatchFinder = 1;
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-pipe")) {
+         if (!nPipeline) {
+            nPipeline = 1;
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-hugepages")) {
+         if (!nHugePages) {
+            nHugePages = 1;
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-segments")) {
+         if (!nParseSegments && (i + 1) < argc) {
+            char *pEnd = NULL;
+            nParseSegments = (int)strtol(argv[i + 1], &pEnd, 10);
+            if (pEnd && pEnd != argv[i + 1] && !*pEnd && (nParseSegments >= 2 && nParseSegments <= 15)) {
+               i++;
+            }
+            else {
+               nArgsError = 1;
+            }
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-block")) {
+         if (nBlockSizeShift < 0 && (i + 1) < argc) {
+            char *pEnd = NULL;
+            int nBlockSizeKb = (int)strtol(argv[i + 1], &pEnd, 10);
+            if (pEnd && pEnd != argv[i + 1] && !*pEnd) {
+               for (nBlockSizeShift = 0; nBlockSizeShift <= 6 && (64 << nBlockSizeShift) != nBlockSizeKb; nBlockSizeShift++)
+                  ;
+               if (nBlockSizeShift <= 6)
+                  i++;
+               else
+                  nArgsError = 1;
+            }
+            else {
+               nArgsError = 1;
+            }
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-chain")) {
+         if (!nChainCandidates && (i + 1) < argc) {
+            char *pEnd = NULL;
+            nChainCandidates = (int)strtol(argv[i + 1], &pEnd, 10);
+            if (pEnd && pEnd != argv[i + 1] && (nChainCandidates >= 1 && nChainCandidates <= 255)) {
+               nFastMatchFinder = 1;
+               i++;
+            }
+            else {
+               nArgsError = 1;
+            }
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (argv[i][0] == '-' && argv[i][1] >= ('0' + MIN_COMPRESSION_LEVEL) && argv[i][1] <= ('0' + MAX_COMPRESSION_LEVEL) && !argv[i][2]) {
+         if (!nLevel) {
+            nLevel = argv[i][1] - '0';
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-j")) {
+         if (!nThreadsDefined && (i + 1) < argc) {
+            char *pEnd = NULL;
+            nNumThreads = (int)strtol(argv[i + 1], &pEnd, 10);
+            if (pEnd && pEnd != argv[i + 1] && (nNumThreads >= 0 && nNumThreads <= 256)) {
+               nThreadsDefined = 1;
+               i++;
+            }
+            else {
+               nArgsError = 1;
+            }
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strncmp(argv[i], "-j", 2)) {
+         if (!nThreadsDefined) {
+            char *pEnd = NULL;
+            nNumThreads = (int)strtol(argv[i] + 2, &pEnd, 10);
+            if (pEnd && pEnd != (argv[i] + 2) && (nNumThreads >= 0 && nNumThreads <= 256)) {
+               nThreadsDefined = 1;
+            }
+            else {
+               nArgsError = 1;
+            }
+         }
+         else
+            nArgsError = 1;
+      }
       else if (!strcmp(argv[i], "-stats")) {
          if ((nOptions & OPT_STATS) == 0) {
             nOptions |= OPT_STATS;
@@ -1205,6 +3489,61 @@ int main(int argc, char **argv) {
          else
             nArgsError = 1;
       }
+      else if (!strcmp(argv[i], "-frame")) {
+         if ((nOptions & OPT_FRAME) == 0) {
+            nOptions |= OPT_FRAME;
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-inplace")) {
+         if ((nOptions & OPT_INPLACE) == 0) {
+            nOptions |= OPT_INPLACE;
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-index")) {
+         if (!nCheckpointInterval && (i + 1) < argc) {
+            char *pEnd = NULL;
+            nCheckpointInterval = (size_t)strtoul(argv[i + 1], &pEnd, 10);
+            if (pEnd && pEnd != argv[i + 1] && !*pEnd && nCheckpointInterval >= MIN_CHECKPOINT_INTERVAL) {
+               nOptions |= OPT_FRAME;
+               i++;
+            }
+            else {
+               nArgsError = 1;
+            }
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (!strcmp(argv[i], "-range")) {
+         if (!nRangeDefined && (i + 2) < argc) {
+            char *pOffsetEnd = NULL, *pSizeEnd = NULL;
+            nRangeOffset = (size_t)strtoul(argv[i + 1], &pOffsetEnd, 10);
+            nRangeSize = (size_t)strtoul(argv[i + 2], &pSizeEnd, 10);
+            if (pOffsetEnd && pOffsetEnd != argv[i + 1] && !*pOffsetEnd && pSizeEnd && pSizeEnd != argv[i + 2] && !*pSizeEnd) {
+               nRangeDefined = 1;
+               nOptions |= OPT_FRAME;
+               i += 2;
+            }
+            else {
+               nArgsError = 1;
+            }
+         }
+         else
+            nArgsError = 1;
+      }
+      else if (cCommand == 'M' || cCommand == 'S') {
+         /* Input and output pairs for batch compression, or files and directories to benchmark */
+         if (!ppszBatchFilenames)
+            ppszBatchFilenames = (const char **)malloc(argc * sizeof(const char *));
+         if (ppszBatchFilenames)
+            ppszBatchFilenames[nNumBatchFilenames++] = argv[i];
+         else
+            nArgsError = 1;
+      }
       else {
          if (!pszInFilename)
             pszInFilename = argv[i];
@@ -1217,27 +3556,105 @@ int main(int argc, char **argv) {
       }
    }
 
+   nEffortFlags = FLG_LEVEL(nLevel);
+   if (nFastMatchFinder)
+      nEffortFlags |= FLG_FAST_MATCHFINDER;
+   if (nChainCandidates)
+      nEffortFlags |= FLG_CHAIN_CANDIDATES(nChainCandidates);
+   if (nBlockSizeShift > 0)
+      nEffortFlags |= FLG_BLOCK_SIZE(nBlockSizeShift);
+   if (nPipeline)
+      nEffortFlags |= FLG_PIPELINE;
+   if (nHugePages)
+      nEffortFlags |= FLG_HUGE_PAGES;
+   if (nParseSegments)
+      nEffortFlags |= FLG_PARSE_SEGMENTS(nParseSegments);
+
+   if (!nArgsError && cCommand == 'M' && (pszInFilename || (nNumBatchFilenames & 1) || (!pszManifestFilename && !nNumBatchFilenames)))
+      nArgsError = 1;
+   if (!nArgsError && cCommand != 'M' && pszManifestFilename)
+      nArgsError = 1;
+   if (!nArgsError && cCommand == 'S' && (pszInFilename || !nNumBatchFilenames))
+      nArgsError = 1;
+   if (!nArgsError && cCommand != 'S' && (nBenchRuns || nBenchFormat >= 0))
+      nArgsError = 1;
+   if (!nArgsError && ((nCheckpointInterval && (cCommand != 'z' || (nOptions & OPT_BACKWARD) || pszDictionaryFilename)) || (nRangeDefined && cCommand != 'd')))
+      nArgsError = 1;
+   if (!nArgsError && (nOptions & OPT_INPLACE) && ((cCommand != 'z' && cCommand != 'd') || (nOptions & OPT_FRAME) || pszDictionaryFilename))
+      nArgsError = 1;
+
+   if (!nArgsError && cCommand == 'M') {
+      int nResult;
+
+      do_init_time();
+      nResult = do_compress_batch(pszManifestFilename, ppszBatchFilenames, nNumBatchFilenames, pszDictionaryFilename, nOptions, nMaxWindowSize, nEffortFlags,
+         nThreadsDefined ? nNumThreads : 0, nVerifyCompression);
+      free(ppszBatchFilenames);
+      return nResult;
+   }
+   if (!nArgsError && cCommand == 'S') {
+      int nResult;
+
+      do_init_time();
+      nResult = do_bench_suite(ppszBatchFilenames, nNumBatchFilenames, pszDictionaryFilename, nOptions, nMaxWindowSize, nEffortFlags & ~FLG_LEVEL(0xf), nLevel,
+         nNumThreads, nBenchRuns ? nBenchRuns : DEFAULT_BENCH_RUNS, (nBenchFormat >= 0) ? nBenchFormat : BENCH_FORMAT_TEXT);
+      free(ppszBatchFilenames);
+      return nResult;
+   }
+   free(ppszBatchFilenames);
+
    if (!nArgsError && cCommand == 't') {
-      return do_self_test(nOptions, nMaxWindowSize, 0);
+      return do_self_test(nOptions, nMaxWindowSize, nEffortFlags, nNumThreads, 0);
    }
    else if (!nArgsError && cCommand == 'T') {
-      return do_self_test(nOptions, nMaxWindowSize, 1);
+      return do_self_test(nOptions, nMaxWindowSize, nEffortFlags, nNumThreads, 1);
+   }
+
+   if (!nArgsError && cCommand == 'E' && pszInFilename && !pszOutFilename) {
+      do_init_time();
+      return do_estimate(pszInFilename, pszDictionaryFilename, nOptions, nMaxWindowSize, nEffortFlags);
    }
 
    if (nArgsError || !pszInFilename || !pszOutFilename) {
       fprintf(stderr, "salvador command-line tool v" TOOL_VERSION " by Emmanuel Marty\n");
       fprintf(stderr, "usage: %s [-c] [-d] [-v] [-b] <infile> <outfile>\n", argv[0]);
+      fprintf(stderr, "       %s -batch [-c] [-b] [-manifest <file>] [<infile> <outfile>]...\n", argv[0]);
+      fprintf(stderr, "       %s -prepare [-b] <dictfile> <outfile>\n", argv[0]);
+      fprintf(stderr, "       %s -bench [-b] [-classic] [-D <file>] [-runs <n>] [-json|-csv] <file or directory>...\n", argv[0]);
+      fprintf(stderr, "       %s -estimate [-b] [-classic] [-D <file>] <infile>\n", argv[0]);
       fprintf(stderr, "        -c: check resulting stream after compressing\n");
       fprintf(stderr, "        -d: decompress (default: compress)\n");
       fprintf(stderr, "        -b: backwards compression or decompression\n");
       fprintf(stderr, " -w <size>: maximum window size, in bytes (16..32639), defaults to maximum\n");
       fprintf(stderr, " -D <file>: use dictionary file\n");
+      fprintf(stderr, "   -j <n>: compress blocks in parallel on n threads (0 for one per CPU), defaults to 1\n");
+      fprintf(stderr, "   -1..-9: compression level, from fastest (-1) to best (-9), defaults to -9\n");
+      fprintf(stderr, "     -fast: find matches with hash chains: much faster, but compresses less (level defaults to -2)\n");
+      fprintf(stderr, "-chain <n>: find matches with hash chains, checking up to n candidates per position (1..255)\n");
+      fprintf(stderr, "-block <n>: optimize blocks of n KB (64, 128, 256, 512, 1024, 2048 or 4096), defaults to 64; larger blocks compress\n");
+      fprintf(stderr, "            large files better, but need proportionally more memory, especially at the higher levels\n");
+      fprintf(stderr, "     -pipe: without -j, find the matches for the next block on a second thread while the current one is optimized\n");
+      fprintf(stderr, "-hugepages: map the compressor tables with huge pages where the OS grants them, for fewer TLB misses\n");
+      fprintf(stderr, "-segments <n>: experimental: pick the final matches of each block as n segments on n threads (2..15), for files of a\n");
+      fprintf(stderr, "            few blocks; compresses slightly less\n");
+      fprintf(stderr, "    -batch: compress many files in one process, on a pool of -j threads (defaults to one per CPU)\n");
+      fprintf(stderr, "-manifest <file>: read batch input and output pairs from file (- for stdin), one per line, with optional -b -classic -frame -w -D\n");
+      fprintf(stderr, "  -prepare: suffix-sort dictionary file for -batch -D ahead of time, and save it\n");
       fprintf(stderr, "   -cbench: benchmark in-memory compression\n");
-      fprintf(stderr, "   -dbench: benchmark in-memory decompression\n");
+      fprintf(stderr, "   -dbench: benchmark in-memory decompression, with the safe and fast decoders\n");
+      fprintf(stderr, "    -bench: benchmark compression and decompression of many files, in all formats (or just -b and/or -classic), at all levels (or\n");
+      fprintf(stderr, "            just the given one), with and without the -D dictionary; reports median, 10th and 90th percentile speeds and peak memory\n");
+      fprintf(stderr, "  -runs <n>: number of timed runs per configuration for -bench (1..1000), defaults to 5\n");
+      fprintf(stderr, "-json, -csv: write -bench results as JSON or CSV, instead of a table\n");
+      fprintf(stderr, " -estimate: show the compressed size of a file, estimated quickly with a greedy parse, then exactly, without writing it\n");
       fprintf(stderr, "     -test: run full automated self-tests\n");
       fprintf(stderr, "-quicktest: run quick automated self-tests\n");
       fprintf(stderr, "    -stats: show compressed data stats\n");
       fprintf(stderr, "  -classic: encode and decode using classical (V1) format, defaults to modern (V2)\n");
+      fprintf(stderr, "    -frame: prefix compressed data with its sizes, for one-pass decompression into an exact buffer\n");
+      fprintf(stderr, "-index <n>: write a frame with a block index, with checkpoints about every n bytes (256 or more), for -range\n");
+      fprintf(stderr, "-range <offset> <size>: with -d, decompress only size bytes at offset, from a frame with a block index\n");
+      fprintf(stderr, "  -inplace: show the safe distance for in-place decompression (and check it with -c); with -d, decompress in place\n");
       fprintf(stderr, "        -v: be verbose\n");
       return 100;
    }
@@ -1245,18 +3662,27 @@ int main(int argc, char **argv) {
    do_init_time();
 
    if (cCommand == 'z') {
-      int nResult = do_compress(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nMaxWindowSize);
+      int nResult = do_compress(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nMaxWindowSize, nEffortFlags, nNumThreads, nCheckpointInterval);
       if (nResult == 0 && nVerifyCompression) {
-         return do_compare(pszOutFilename, pszInFilename, pszDictionaryFilename, nOptions);
-      } else {
-         return nResult;
+         nResult = do_compare(pszOutFilename, pszInFilename, pszDictionaryFilename, nOptions);
       }
+      if (nResult == 0 && (nOptions & OPT_INPLACE)) {
+         nResult = do_compare_inplace(pszOutFilename, nVerifyCompression ? pszInFilename : NULL, nOptions);
+      }
+      return nResult;
    }
    else if (cCommand == 'd') {
+      if (nRangeDefined)
+         return do_decompress_range(pszInFilename, pszOutFilename, nOptions, nRangeOffset, nRangeSize);
+      if (nOptions & OPT_INPLACE)
+         return do_decompress_inplace(pszInFilename, pszOutFilename, nOptions);
       return do_decompress(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions);
    }
+   else if (cCommand == 'P') {
+      return do_save_prepared_dictionary(pszInFilename, pszOutFilename, nOptions);
+   }
    else if (cCommand == 'B') {
-      return do_compr_benchmark(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nMaxWindowSize);
+      return do_compr_benchmark(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nMaxWindowSize, nEffortFlags);
    }
    else if (cCommand == 'b') {
       return do_dec_benchmark(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions);
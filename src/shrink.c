@@ -35,10 +35,36 @@
 #include "matchfinder.h"
 #include "shrink.h"
 #include "format.h"
+#include "thread.h"
+#include "simd.h"
+
+#ifdef _MSC_VER
+#define FORCE_INLINE __forceinline
+#else /* _MSC_VER */
+#define FORCE_INLINE __attribute__((always_inline))
+#endif /* _MSC_VER */
 
 #define MIN_ENCODED_MATCH_SIZE   2
 #define TOKEN_SIZE               1
-#define OFFSET_COST(__offset)    (((__offset) <= 128) ? 8 : (7 + salvador_get_elias_size((((__offset) - 1) >> 7) + 1)))
+#define SUPER_BLOCK_SIZE         (BLOCK_SIZE * 8)
+
+/** Cost of a match offset in bits: 7 low bits, and the gamma coded high bits looked up as lengths, without their token (offsets 1..MAX_OFFSET) */
+#define OFFSET_COST(__offset)    (7 - TOKEN_SIZE + salvador_cost_for_len[(((__offset) - 1) >> 7) + 1])
+
+/** Blocks are only split into segments at least this large, with FLG_PARSE_SEGMENTS */
+#define MIN_PARSE_SEGMENT_SIZE         4096
+/** Number of positions before a segment that are searched for matches reaching it, for its likely starting rep offsets */
+#define PARSE_SEGMENT_SEED_SCAN        64
+
+/** Number of previous occurrences of the next two bytes that the greedy size estimate checks for matches, at each position */
+#define ESTIMATE_CHAIN_CANDIDATES      16
+/** Number of positions that the greedy size estimate keeps the links to previous occurrences for; must be a power of two above MAX_OFFSET */
+#define ESTIMATE_HISTORY_SIZE          32768
+
+/** Blocks smaller than this are always optimized */
+#define MIN_INCOMPRESSIBLE_BLOCK_SIZE  1024
+/** A block is written as literals if the quick estimate of its matches saves at most 1/(1 << shift) of its size */
+#define INCOMPRESSIBLE_SAVINGS_SHIFT   7
 
 /** Costs, per length */
 static const char salvador_cost_for_len[8192] = {
@@ -83,36 +109,28 @@ static const char salvador_cost_for_len[8192] = {
  *
  * @return number of bits required for encoding
  */
-static int salvador_get_elias_size(const int nValue) {
-   if (nValue >= 0 && nValue < 8192) {
+static inline int salvador_get_elias_size(const int nValue) {
+   if ((unsigned int)nValue < 8192) {
       return salvador_cost_for_len[nValue] - TOKEN_SIZE;
    }
    else {
-      int i = nValue;
+      unsigned int nHighBits = (unsigned int)nValue;
       int nBits = 0;
 
-      i |= (i >> 1);
-      i |= (i >> 2);
-      i |= (i >> 4);
-      i |= (i >> 8);
-      i |= (i >> 16);
-      i = (i - (i >> 1));
-
-      while ((i >>= 1) > 0) {
-         nBits++;
-         nBits++;
-      }
-
-      nBits++;
+      /* Each 13 bits shifted out of the value add 26 bits (13 prefix bits + 13 data bits) to its gamma code, look the rest up */
+      do {
+         nHighBits >>= 13;
+         nBits += 26;
+      } while (nHighBits >= 8192);
 
-      return nBits;
+      return nBits + salvador_cost_for_len[nHighBits] - TOKEN_SIZE;
    }
 }
 
 /**
  * Write packed 0 control bit to output (compressed) buffer
  *
- * @param pOutData pointer to output buffer
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
  * @param nOutOffset current write index into output buffer
  * @param nMaxOutDataSize maximum size of output buffer, in bytes
  * @param nCurBitsOffset write index into output buffer, of current byte being filled with bits
@@ -127,7 +145,9 @@ static int salvador_write_zero_ctrl_bit(unsigned char *pOutData, int nOutOffset,
          if (nOutOffset >= nMaxOutDataSize) return -1;
          (*nCurBitsOffset) = nOutOffset;
          (*nCurBitShift) = 7;
-         pOutData[nOutOffset++] = 0;
+         if (pOutData)
+            pOutData[nOutOffset] = 0;
+         nOutOffset++;
       }
 
       (*nCurBitShift)--;
@@ -139,7 +159,7 @@ static int salvador_write_zero_ctrl_bit(unsigned char *pOutData, int nOutOffset,
 /**
  * Write packed 1 control bit to output (compressed) buffer
  *
- * @param pOutData pointer to output buffer
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
  * @param nOutOffset current write index into output buffer
  * @param nMaxOutDataSize maximum size of output buffer, in bytes
  * @param nCurBitsOffset write index into output buffer, of current byte being filled with bits
@@ -154,10 +174,14 @@ static int salvador_write_one_ctrl_bit(unsigned char* pOutData, int nOutOffset,
          if (nOutOffset >= nMaxOutDataSize) return -1;
          (*nCurBitsOffset) = nOutOffset;
          (*nCurBitShift) = 7;
-         pOutData[nOutOffset++] = 0;
+         if (pOutData)
+            pOutData[nOutOffset] = 0;
+         nOutOffset++;
       }
 
-      pOutData[(*nCurBitsOffset)] |= 1 << ((*nCurBitShift)--);
+      if (pOutData)
+         pOutData[(*nCurBitsOffset)] |= 1 << (*nCurBitShift);
+      (*nCurBitShift)--;
    }
 
    return nOutOffset;
@@ -166,7 +190,7 @@ static int salvador_write_one_ctrl_bit(unsigned char* pOutData, int nOutOffset,
 /**
  * Write packed data bit to output (compressed) buffer
  *
- * @param pOutData pointer to output buffer
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
  * @param nOutOffset current write index into output buffer
  * @param nMaxOutDataSize maximum size of output buffer, in bytes
  * @param nValue bit value to write
@@ -177,7 +201,9 @@ static int salvador_write_one_ctrl_bit(unsigned char* pOutData, int nOutOffset,
  */
 static int salvador_write_data_bit(unsigned char* pOutData, const int nOutOffset, const int nMaxOutDataSize, const int nValue, const int* nCurBitsOffset, int* nCurBitShift) {
    if (nOutOffset >= 0) {
-      pOutData[(*nCurBitsOffset)] |= nValue << ((*nCurBitShift)--);
+      if (pOutData)
+         pOutData[(*nCurBitsOffset)] |= nValue << (*nCurBitShift);
+      (*nCurBitShift)--;
    }
 
    return nOutOffset;
@@ -186,7 +212,7 @@ static int salvador_write_data_bit(unsigned char* pOutData, const int nOutOffset
 /**
  * Write normally encoded, interlaced elias gamma value to output (compressed) buffer
  *
- * @param pOutData pointer to output buffer
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
  * @param nOutOffset current write index into output buffer
  * @param nMaxOutDataSize maximum size of output buffer, in bytes
  * @param nValue value to write with gamma encoding
@@ -196,7 +222,7 @@ static int salvador_write_data_bit(unsigned char* pOutData, const int nOutOffset
  *
  * @return updated write index into output buffer, or -1 in case of an error
  */
-static int salvador_write_normal_elias_value(unsigned char* pOutData, int nOutOffset, const int nMaxOutDataSize, const int nValue, const int nBackward, int* nCurBitsOffset, int* nCurBitShift) {
+static inline FORCE_INLINE int salvador_write_normal_elias_value(unsigned char* pOutData, int nOutOffset, const int nMaxOutDataSize, const int nValue, const int nBackward, int* nCurBitsOffset, int* nCurBitShift) {
    int i = nValue;
 
    i |= (i >> 1);
@@ -227,7 +253,7 @@ static int salvador_write_normal_elias_value(unsigned char* pOutData, int nOutOf
 /**
  * Write inverted, interlaced elias gamma value to output (compressed) buffer
  *
- * @param pOutData pointer to output buffer
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
  * @param nOutOffset current write index into output buffer
  * @param nMaxOutDataSize maximum size of output buffer, in bytes
  * @param nValue value to write with gamma encoding
@@ -237,7 +263,7 @@ static int salvador_write_normal_elias_value(unsigned char* pOutData, int nOutOf
  *
  * @return updated write index into output buffer, or -1 in case of an error
  */
-static int salvador_write_inverted_elias_value(unsigned char* pOutData, int nOutOffset, const int nMaxOutDataSize, const int nValue, const int nBackward, int* nCurBitsOffset, int* nCurBitShift) {
+static inline FORCE_INLINE int salvador_write_inverted_elias_value(unsigned char* pOutData, int nOutOffset, const int nMaxOutDataSize, const int nValue, const int nBackward, int* nCurBitsOffset, int* nCurBitShift) {
    int i = nValue;
 
    i |= (i >> 1);
@@ -268,7 +294,7 @@ static int salvador_write_inverted_elias_value(unsigned char* pOutData, int nOut
 /**
  * Write elias gamma encoded value to output (compressed) buffer, with the first bit stored in a different (match offset) byte
  *
- * @param pOutData pointer to output buffer
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
  * @param nOutOffset current write index into output buffer
  * @param nMaxOutDataSize maximum size of output buffer, in bytes
  * @param nValue value to write with gamma encoding
@@ -278,7 +304,7 @@ static int salvador_write_inverted_elias_value(unsigned char* pOutData, int nOut
  *
  * @return updated write index into output buffer, or -1 in case of an error
  */
-static int salvador_write_split_elias_value(unsigned char* pOutData, int nOutOffset, const int nMaxOutDataSize, const int nValue, const int nBackward, int* nCurBitsOffset, int* nCurBitShift) {
+static inline FORCE_INLINE int salvador_write_split_elias_value(unsigned char* pOutData, int nOutOffset, const int nMaxOutDataSize, const int nValue, const int nBackward, int* nCurBitsOffset, int* nCurBitShift) {
    int i = nValue;
 
    i |= (i >> 1);
@@ -317,7 +343,7 @@ static int salvador_write_split_elias_value(unsigned char* pOutData, int nOutOff
  * @return number of extra bits required
  */
 static inline int salvador_get_literals_varlen_size(const int nLength) {
-   if (nLength >= 0 && nLength < 8192)
+   if ((unsigned int)nLength < 8192)
       return salvador_cost_for_len[nLength];
    else
       return TOKEN_SIZE + salvador_get_elias_size(nLength);
@@ -354,11 +380,11 @@ static inline int salvador_get_literals_varlen_size(const int nLength) {
  */
 static void salvador_insert_forward_match(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int i, const int nMatchOffset, const int nStartOffset, const int nEndOffset, const int nDepth) {
    const salvador_arrival *arrival = pCompressor->arrival + ((i - nStartOffset) * pCompressor->max_arrivals_per_position);
-   const int *rle_len = (const int*)pCompressor->intervals /* reuse */;
-   salvador_visited* visited = ((salvador_visited*)pCompressor->pos_data) - nStartOffset /* reuse */;
+   const int *rle_len = (const int*)pCompressor->rle_len;
+   salvador_visited* visited = pCompressor->visited - nStartOffset;
    int j;
 
-   for (j = 0; j < NINITIAL_ARRIVALS_PER_POSITION && arrival[j].from_slot; j++) {
+   for (j = 0; j < pCompressor->initial_arrivals_per_position && arrival[j].from_slot; j++) {
       if (arrival[j].num_literals) {
          const int nRepOffset = arrival[j].rep_offset;
 
@@ -371,9 +397,10 @@ static void salvador_insert_forward_match(salvador_compressor *pCompressor, cons
 
                visited[nRepPos] = nMatchOffset;
 
-               salvador_match* fwd_match = pCompressor->match + ((nRepPos - nStartOffset) * NMATCHES_PER_INDEX);
+               salvador_match* fwd_match = pCompressor->match + pCompressor->match_row[nRepPos - nStartOffset];
+               const int nFwdRowSize = pCompressor->match_row[nRepPos - nStartOffset + 1] - pCompressor->match_row[nRepPos - nStartOffset];
 
-               if (fwd_match[NMATCHES_PER_INDEX - 1].length == 0) {
+               if (fwd_match[nFwdRowSize - 1].length == 0) {
                   if (nRepPos >= nMatchOffset) {
                      const unsigned char* pInWindowStart = pInWindow + nRepPos;
 
@@ -402,20 +429,16 @@ static void salvador_insert_forward_match(salvador_compressor *pCompressor, cons
                            if (pInWindowAtRepOffset > pInWindowMax)
                               pInWindowAtRepOffset = pInWindowMax;
 
-                           while ((pInWindowAtRepOffset + 8) < pInWindowMax && !memcmp(pInWindowAtRepOffset, pInWindowAtRepOffset - nMatchOffset, 8))
-                              pInWindowAtRepOffset += 8;
-                           while ((pInWindowAtRepOffset + 4) < pInWindowMax && !memcmp(pInWindowAtRepOffset, pInWindowAtRepOffset - nMatchOffset, 4))
-                              pInWindowAtRepOffset += 4;
-                           while (pInWindowAtRepOffset < pInWindowMax && pInWindowAtRepOffset[0] == pInWindowAtRepOffset[-nMatchOffset])
-                              pInWindowAtRepOffset++;
+                           pInWindowAtRepOffset += salvador_get_common_len(pInWindowAtRepOffset, pInWindowAtRepOffset - nMatchOffset, (const int)(pInWindowMax - pInWindowAtRepOffset));
 
                            const unsigned short nCurRepLen = (const unsigned short)(pInWindowAtRepOffset - pInWindowStart);
-                           unsigned short* fwd_depth = pCompressor->match_depth + ((nRepPos - nStartOffset) * NMATCHES_PER_INDEX);
+                           unsigned short* fwd_depth = pCompressor->match_depth + pCompressor->match_row[nRepPos - nStartOffset];
 
                            if (!fwd_match[r].length) {
                               fwd_match[r].length = nCurRepLen;
                               fwd_match[r].offset = nMatchOffset;
                               fwd_depth[r] = 0;
+                              pCompressor->stats.num_forward_matches++;
 
                               if (nDepth < 9)
                                  salvador_insert_forward_match(pCompressor, pInWindow, nRepPos, nMatchOffset, nStartOffset, nEndOffset, nDepth + 1);
@@ -435,6 +458,26 @@ static void salvador_insert_forward_match(salvador_compressor *pCompressor, cons
    }
 }
 
+/**
+ * Initialize the arrivals used by an optimization pass, for positions that the pass reaches for the first time
+ *
+ * @param arrival arrivals, indexed by input window position
+ * @param nStartPos first position to initialize
+ * @param nEndPos position to stop initializing at (exclusive)
+ * @param nMaxArrivalsPerPosition number of arrivals allocated per position
+ * @param nArrivalsPerPosition number of arrivals that the pass records per position
+ */
+static inline void salvador_init_arrivals(salvador_arrival *arrival, int nStartPos, const int nEndPos, const int nMaxArrivalsPerPosition, const int nArrivalsPerPosition) {
+   for (; nStartPos < nEndPos; nStartPos++) {
+      salvador_arrival *pSlots = arrival + nStartPos * nMaxArrivalsPerPosition;
+      int j;
+
+      memset(pSlots, 0, sizeof(salvador_arrival) * nArrivalsPerPosition);
+      for (j = 0; j < nArrivalsPerPosition; j++)
+         pSlots[j].cost = MAX_ARRIVAL_COST;
+   }
+}
+
 /**
  * Attempt to pick optimal matches, so as to produce the smallest possible output that decompresses to the same input
  *
@@ -443,34 +486,36 @@ static void salvador_insert_forward_match(salvador_compressor *pCompressor, cons
  * @param nStartOffset current offset in input window (typically the number of previously compressed bytes)
  * @param nEndOffset offset to end finding matches at (typically the size of the total input window in bytes
  * @param nInsertForwardReps non-zero to insert forward repmatch candidates, zero to use the previously inserted candidates
- * @param nCurRepMatchOffset starting rep offset for this block
+ * @param nCurRepMatchOffset starting rep offset for this block, or starting rep offsets to optimize from
+ * @param nNumRepOffsets number of starting rep offsets (1, unless a segment of a block is optimized on its own), at most nArrivalsPerPosition
  * @param nArrivalsPerPosition number of arrivals to record per input buffer position
  * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 for last block, 0 otherwise
  */
-static void salvador_optimize_forward(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nStartOffset, const int nEndOffset, const int nInsertForwardReps, const int *nCurRepMatchOffset, const int nArrivalsPerPosition, const int nBlockFlags) {
+static void salvador_optimize_forward(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nStartOffset, const int nEndOffset, const int nInsertForwardReps, const int *nCurRepMatchOffset, const int nNumRepOffsets, const int nArrivalsPerPosition, const int nBlockFlags) {
    const int nMaxArrivalsPerPosition = pCompressor->max_arrivals_per_position;
+   const int *match_row = pCompressor->match_row - nStartOffset;
    salvador_arrival *arrival = pCompressor->arrival - (nStartOffset * nMaxArrivalsPerPosition);
-   const int* rle_len = (const int*)pCompressor->intervals /* reuse */;
+   const int* rle_len = (const int*)pCompressor->rle_len;
    salvador_arrival* cur_arrival;
+   long long nArrivalsInserted = 0, nArrivalsEvicted = 0;
+   int nInitEnd;
    int i;
 
    if ((nEndOffset - nStartOffset) > pCompressor->block_size) return;
 
-   for (i = (nStartOffset * nMaxArrivalsPerPosition); i != ((nEndOffset + 1) * nMaxArrivalsPerPosition); i += nMaxArrivalsPerPosition) {
-      int j;
-
-      memset(arrival + i, 0, sizeof(salvador_arrival) * nMaxArrivalsPerPosition);
+   /* Arrivals are only initialized when a literal or a match first reaches their position, and only as many as this pass uses; positions
+    * before nInitEnd are initialized */
+   salvador_init_arrivals(arrival, nStartOffset, nStartOffset + 1, nMaxArrivalsPerPosition, nArrivalsPerPosition);
+   nInitEnd = nStartOffset + 1;
 
-      for (j = 0; j < nMaxArrivalsPerPosition; j++)
-         arrival[i + j].cost = 0x40000000;
+   for (i = 0; i < nNumRepOffsets; i++) {
+      arrival[nStartOffset * nMaxArrivalsPerPosition + i].cost = 0;
+      arrival[nStartOffset * nMaxArrivalsPerPosition + i].from_slot = -1;
+      arrival[nStartOffset * nMaxArrivalsPerPosition + i].rep_offset = nCurRepMatchOffset[i];
    }
 
-   arrival[nStartOffset * nMaxArrivalsPerPosition].cost = 0;
-   arrival[nStartOffset * nMaxArrivalsPerPosition].from_slot = -1;
-   arrival[nStartOffset * nMaxArrivalsPerPosition].rep_offset = *nCurRepMatchOffset;
-
    if (nInsertForwardReps) {
-      salvador_visited* visited = ((salvador_visited*)pCompressor->pos_data) - nStartOffset /* reuse */;
+      salvador_visited* visited = pCompressor->visited - nStartOffset;
 
       memset(visited + nStartOffset, 0, (nEndOffset - nStartOffset) * sizeof(salvador_visited));
    }
@@ -478,7 +523,12 @@ static void salvador_optimize_forward(salvador_compressor *pCompressor, const un
    for (i = nStartOffset, cur_arrival = &arrival[nStartOffset * nMaxArrivalsPerPosition]; i != nEndOffset; i++, cur_arrival += nMaxArrivalsPerPosition) {
       salvador_arrival *pDestLiteralSlots = &cur_arrival[nMaxArrivalsPerPosition];
       int j, m;
-      
+
+      if (nInitEnd <= (i + 1)) {
+         salvador_init_arrivals(arrival, nInitEnd, i + 2, nMaxArrivalsPerPosition, nArrivalsPerPosition);
+         nInitEnd = i + 2;
+      }
+
       for (j = 0; j < nArrivalsPerPosition && cur_arrival[j].from_slot; j++) {
          const int nNumLiterals = cur_arrival[j].num_literals + 1;
          const int nCodingChoiceCost = cur_arrival[j].cost + 8 /* literal */ + (((nNumLiterals & (nNumLiterals - 1)) == 0) ? 2 : 0);
@@ -526,13 +576,17 @@ static void salvador_optimize_forward(salvador_compressor *pCompressor, const un
                            break;
                      }
 
+                     nArrivalsInserted++;
+                     if (pDestLiteralSlots[z].from_slot)
+                        nArrivalsEvicted++;
+
                      memmove(&pDestLiteralSlots[n + 1],
                         &pDestLiteralSlots[n],
                         sizeof(salvador_arrival) * (z - n));
 
                      salvador_arrival* pDestArrival = &pDestLiteralSlots[n];
                      pDestArrival->cost = nCodingChoiceCost;
-                     pDestArrival->from_pos = i;
+                     salvador_set_arrival_from_pos(pDestArrival, i);
                      pDestArrival->from_slot = j + 1;
                      pDestArrival->rep_offset = nRepOffset;
                      pDestArrival->rep_pos = cur_arrival[j].rep_pos;
@@ -576,12 +630,7 @@ static void salvador_optimize_forward(salvador_compressor *pCompressor, const un
                         if (pInWindowAtPos > pInWindowMax)
                            pInWindowAtPos = pInWindowMax;
 
-                        while ((pInWindowAtPos + 8) < pInWindowMax && !memcmp(pInWindowAtPos, pInWindowAtPos - nRepOffset, 8))
-                           pInWindowAtPos += 8;
-                        while ((pInWindowAtPos + 4) < pInWindowMax && !memcmp(pInWindowAtPos, pInWindowAtPos - nRepOffset, 4))
-                           pInWindowAtPos += 4;
-                        while (pInWindowAtPos < pInWindowMax && pInWindowAtPos[0] == pInWindowAtPos[-nRepOffset])
-                           pInWindowAtPos++;
+                        pInWindowAtPos += salvador_get_common_len(pInWindowAtPos, pInWindowAtPos - nRepOffset, (const int)(pInWindowMax - pInWindowAtPos));
                         const int nCurRepLen = (const int)(pInWindowAtPos - pInWindowStart);
 
                         if (nOverallMaxRepLen < nCurRepLen)
@@ -596,10 +645,11 @@ static void salvador_optimize_forward(salvador_compressor *pCompressor, const un
       }
       nRepMatchArrivalIdx[nNumRepMatchArrivals] = -1;
 
-      const salvador_match* match = pCompressor->match + ((i - nStartOffset) * NMATCHES_PER_INDEX);
-      const unsigned short* match_depth = pCompressor->match_depth + ((i - nStartOffset) * NMATCHES_PER_INDEX);
+      const salvador_match* match = pCompressor->match + match_row[i];
+      const unsigned short* match_depth = pCompressor->match_depth + match_row[i];
+      const int nNumMatchSlots = match_row[i + 1] - match_row[i];
 
-      for (m = 0; m < NMATCHES_PER_INDEX && match[m].length; m++) {
+      for (m = 0; m < nNumMatchSlots && match[m].length; m++) {
          int nOrigMatchLen = match[m].length;
          const int nOrigMatchOffset = match[m].offset;
          const unsigned int nOrigMatchDepth = match_depth[m];
@@ -608,6 +658,11 @@ static void salvador_optimize_forward(salvador_compressor *pCompressor, const un
          if ((i + nOrigMatchLen) > nEndOffset)
             nOrigMatchLen = nEndOffset - i;
 
+         if (nInitEnd <= (i + nOrigMatchLen)) {
+            salvador_init_arrivals(arrival, nInitEnd, i + nOrigMatchLen + 1, nMaxArrivalsPerPosition, nArrivalsPerPosition);
+            nInitEnd = i + nOrigMatchLen + 1;
+         }
+
          for (d = 0; d <= nOrigMatchDepth; d += (nOrigMatchDepth ? nOrigMatchDepth : 1)) {
             const int nMatchLen = nOrigMatchLen - d;
             const int nMatchOffset = nOrigMatchOffset - d;
@@ -686,13 +741,17 @@ static void salvador_optimize_forward(salvador_compressor *pCompressor, const un
                                     break;
                               }
 
+                              nArrivalsInserted++;
+                              if (pDestSlots[z].from_slot)
+                                 nArrivalsEvicted++;
+
                               memmove(&pDestSlots[n + 1],
                                  &pDestSlots[n],
                                  sizeof(salvador_arrival) * (z - n));
 
                               salvador_arrival* pDestArrival = &pDestSlots[n];
                               pDestArrival->cost = nCodingChoiceCost;
-                              pDestArrival->from_pos = i;
+                              salvador_set_arrival_from_pos(pDestArrival, i);
                               pDestArrival->from_slot = nNonRepMatchArrivalIdx + 1;
                               pDestArrival->rep_offset = nMatchOffset;
                               pDestArrival->rep_pos = i;
@@ -767,13 +826,17 @@ static void salvador_optimize_forward(salvador_compressor *pCompressor, const un
                                        break;
                                  }
 
+                                 nArrivalsInserted++;
+                                 if (pDestSlots[z].from_slot)
+                                    nArrivalsEvicted++;
+
                                  memmove(&pDestSlots[n + 1],
                                     &pDestSlots[n],
                                     sizeof(salvador_arrival) * (z - n));
 
                                  salvador_arrival* pDestArrival = &pDestSlots[n];
                                  pDestArrival->cost = nRepCodingChoiceCost;
-                                 pDestArrival->from_pos = i;
+                                 salvador_set_arrival_from_pos(pDestArrival, i);
                                  pDestArrival->from_slot = j + 1;
                                  pDestArrival->rep_offset = nRepOffset;
                                  pDestArrival->rep_pos = i;
@@ -797,20 +860,26 @@ static void salvador_optimize_forward(salvador_compressor *pCompressor, const un
             }
          }
 
-         if (nOrigMatchLen >= 1280 && ((m + 1) >= NMATCHES_PER_INDEX || match[m + 1].length < 512))
+         if (nOrigMatchLen >= 1280 && ((m + 1) >= nNumMatchSlots || match[m + 1].length < 512))
             break;
       }
    }
+
+   pCompressor->stats.num_arrivals_inserted += nArrivalsInserted;
+   pCompressor->stats.num_arrivals_evicted += nArrivalsEvicted;
    
    if (!nInsertForwardReps) {
       const salvador_arrival* end_arrival = &arrival[i * nMaxArrivalsPerPosition];
       salvador_match* pBestMatch = pCompressor->best_match - nStartOffset;
 
-      while (end_arrival->from_slot > 0 && end_arrival->from_pos < (const unsigned int)nEndOffset) {
-         pBestMatch[end_arrival->from_pos].length = end_arrival->match_len;
-         pBestMatch[end_arrival->from_pos].offset = (end_arrival->match_len) ? end_arrival->rep_offset : 0;
+      int nFromPos = salvador_get_arrival_from_pos(end_arrival, i);
+
+      while (end_arrival->from_slot > 0 && nFromPos < nEndOffset) {
+         pBestMatch[nFromPos].length = end_arrival->match_len;
+         pBestMatch[nFromPos].offset = (end_arrival->match_len) ? end_arrival->rep_offset : 0;
 
-         end_arrival = &arrival[(end_arrival->from_pos * nMaxArrivalsPerPosition) + (end_arrival->from_slot - 1)];
+         end_arrival = &arrival[(nFromPos * nMaxArrivalsPerPosition) + (end_arrival->from_slot - 1)];
+         nFromPos = salvador_get_arrival_from_pos(end_arrival, nFromPos);
       }
    }
 }
@@ -896,13 +965,7 @@ static int salvador_reduce_commands(salvador_compressor *pCompressor, const unsi
                      /* Check if we can get a missed backward repmatch */
                      if (i >= nRepMatchOffset &&
                         (i - nRepMatchOffset + pMatch->length) <= nEndOffset) {
-                        int nMaxLen = 0;
-                        while ((nMaxLen + 8) < pMatch->length && !memcmp(pInWindow + i - nRepMatchOffset + nMaxLen, pInWindow + i - pMatch->offset + nMaxLen, 8))
-                           nMaxLen += 8;
-                        while ((nMaxLen + 4) < pMatch->length && !memcmp(pInWindow + i - nRepMatchOffset + nMaxLen, pInWindow + i - pMatch->offset + nMaxLen, 4))
-                           nMaxLen += 4;
-                        while (nMaxLen < pMatch->length && pInWindow[i - nRepMatchOffset + nMaxLen] == pInWindow[i - pMatch->offset + nMaxLen])
-                           nMaxLen++;
+                        int nMaxLen = salvador_get_common_len(pInWindow + i - nRepMatchOffset, pInWindow + i - pMatch->offset, pMatch->length);
 
                         if (nMaxLen >= 1) {
                            int nCurCommandSize, nReducedCommandSize;
@@ -949,13 +1012,7 @@ static int salvador_reduce_commands(salvador_compressor *pCompressor, const unsi
                   if (pBestMatch[nNextIndex].offset && pMatch->offset != pBestMatch[nNextIndex].offset && nRepMatchOffset != pBestMatch[nNextIndex].offset && nNextLiterals) {
                      /* Otherwise, try to gain a match forward as well */
                      if (i >= pBestMatch[nNextIndex].offset && (i - pBestMatch[nNextIndex].offset + pMatch->length) <= nEndOffset && pMatch->offset != nRepMatchOffset) {
-                        int nMaxLen = 0;
-                        while ((nMaxLen + 8) < pMatch->length && !memcmp(pInWindow + i - pBestMatch[nNextIndex].offset + nMaxLen, pInWindow + i - pMatch->offset + nMaxLen, 8))
-                           nMaxLen += 8;
-                        while ((nMaxLen + 4) < pMatch->length && !memcmp(pInWindow + i - pBestMatch[nNextIndex].offset + nMaxLen, pInWindow + i - pMatch->offset + nMaxLen, 4))
-                           nMaxLen += 4;
-                        while (nMaxLen < pMatch->length && pInWindow[i - pBestMatch[nNextIndex].offset + nMaxLen] == pInWindow[i - pMatch->offset + nMaxLen])
-                           nMaxLen++;
+                        int nMaxLen = salvador_get_common_len(pInWindow + i - pBestMatch[nNextIndex].offset, pInWindow + i - pMatch->offset, pMatch->length);
                         if (nMaxLen >= pMatch->length) {
                            /* Replace */
                            pMatch->offset = pBestMatch[nNextIndex].offset;
@@ -1333,29 +1390,30 @@ static int salvador_reduce_commands(salvador_compressor *pCompressor, const unsi
 }
 
 /**
- * Emit a block of compressed data
+ * Emit a block of compressed data, in one stream format
  *
  * @param pCompressor compression context
  * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
  * @param nStartOffset current offset in input window (typically the number of previously compressed bytes)
  * @param nEndOffset offset to end finding matches at (typically the size of the total input window in bytes
- * @param pOutData pointer to output buffer
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
  * @param nMaxOutDataSize maximum size of output buffer, in bytes
  * @param nCurBitsOffset write index into output buffer, of current byte being filled with bits
  * @param nCurBitShift bit shift count
  * @param nFinalLiterals output number of literals not written after writing this block, that need to be written in the next block
  * @param nCurRepMatchOffset starting rep offset for this block, updated after the block is compressed successfully
  * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 for last block, 0 otherwise
+ * @param nIsInverted 1 to write the high bits of match offsets inverted (V2 format), 0 otherwise
+ * @param nIsBackward 1 for backward compression, 0 for forward compression
  *
  * @return size of compressed data in output buffer, or -1 if the data is uncompressible
  */
-static int salvador_write_block(salvador_compressor* pCompressor, const unsigned char* pInWindow, const int nStartOffset, const int nEndOffset, unsigned char* pOutData, const int nMaxOutDataSize, int* nCurBitsOffset, int* nCurBitShift, int* nFinalLiterals, int* nCurRepMatchOffset, const int nBlockFlags) {
+static inline FORCE_INLINE int salvador_write_block_format(salvador_compressor* pCompressor, const unsigned char* pInWindow, const int nStartOffset, const int nEndOffset, unsigned char* pOutData, const int nMaxOutDataSize, int* nCurBitsOffset, int* nCurBitShift, int* nFinalLiterals, int* nCurRepMatchOffset, const int nBlockFlags,
+      const int nIsInverted, const int nIsBackward) {
    const salvador_match* pBestMatch = pCompressor->best_match - nStartOffset;
    int nRepMatchOffset = *nCurRepMatchOffset;
    int nOutOffset = 0;
    const int nMaxOffset = pCompressor->max_offset;
-   const int nIsInverted = pCompressor->flags & FLG_IS_INVERTED;
-   const int nIsBackward = (pCompressor->flags & FLG_IS_BACKWARD) >> 1;
    int nNumLiterals = 0;
    int nInFirstLiteralOffset = 0;
    int nIsFirstCommand = nBlockFlags & 1;
@@ -1399,7 +1457,8 @@ static int salvador_write_block(salvador_compressor* pCompressor, const unsigned
 
             if ((nOutOffset + nNumLiterals) > nMaxOutDataSize)
                return -1;
-            memcpy(pOutData + nOutOffset, pInWindow + nInFirstLiteralOffset, nNumLiterals);
+            if (pOutData)
+               memcpy(pOutData + nOutOffset, pInWindow + nInFirstLiteralOffset, nNumLiterals);
             nOutOffset += nNumLiterals;
          }
 
@@ -1427,22 +1486,19 @@ static int salvador_write_block(salvador_compressor* pCompressor, const unsigned
             /* Write low byte of match offset */
             if (nOutOffset >= nMaxOutDataSize)
                return -1;
-            if (nIsBackward)
-               pOutData[nOutOffset++] = ((nMatchOffset - 1) & 0x7f) << 1;
-            else
-               pOutData[nOutOffset++] = (255 - ((nMatchOffset - 1) & 0x7f)) << 1;
+            if (pOutData) {
+               if (nIsBackward)
+                  pOutData[nOutOffset] = (((nMatchOffset - 1) & 0x7f) << 1) | ((nMatchLen > 2) ? 1 : 0);
+               else
+                  pOutData[nOutOffset] = ((255 - ((nMatchOffset - 1) & 0x7f)) << 1) | ((nMatchLen > 2) ? 0 : 1);
+            }
+            nOutOffset++;
 
             /* Write match length */
             if (nMatchLen > 2) {
-               if (nIsBackward)
-                  pOutData[nOutOffset - 1] |= 1;
                nOutOffset = salvador_write_split_elias_value(pOutData, nOutOffset, nMaxOutDataSize, nMatchLen - 1, nIsBackward, nCurBitsOffset, nCurBitShift);
                if (nOutOffset < 0) return -1;
             }
-            else {
-               if (!nIsBackward)
-                  pOutData[nOutOffset - 1] |= 1;
-            }
          }
 
          nNumLiterals = 0;
@@ -1523,7 +1579,8 @@ static int salvador_write_block(salvador_compressor* pCompressor, const unsigned
 
          if ((nOutOffset + nNumLiterals) > nMaxOutDataSize)
             return -1;
-         memcpy(pOutData + nOutOffset, pInWindow + nInFirstLiteralOffset, nNumLiterals);
+         if (pOutData)
+            memcpy(pOutData + nOutOffset, pInWindow + nInFirstLiteralOffset, nNumLiterals);
          nOutOffset += nNumLiterals;
       }
 
@@ -1547,13 +1604,15 @@ static int salvador_write_block(salvador_compressor* pCompressor, const unsigned
 }
 
 /**
- * Select the most optimal matches, reduce the token count if possible, and then emit a block of compressed data
+ * Emit a block of compressed data
+ *
+ * The format is selected once per block, so that each stream format gets its own copy of the writer, without format checks per command
  *
  * @param pCompressor compression context
  * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
- * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
- * @param nInDataSize number of input bytes to compress
- * @param pOutData pointer to output buffer
+ * @param nStartOffset current offset in input window (typically the number of previously compressed bytes)
+ * @param nEndOffset offset to end finding matches at (typically the size of the total input window in bytes
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
  * @param nMaxOutDataSize maximum size of output buffer, in bytes
  * @param nCurBitsOffset write index into output buffer, of current byte being filled with bits
  * @param nCurBitShift bit shift count
@@ -1563,32 +1622,37 @@ static int salvador_write_block(salvador_compressor* pCompressor, const unsigned
  *
  * @return size of compressed data in output buffer, or -1 if the data is uncompressible
  */
-static int salvador_optimize_and_write_block(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, unsigned char *pOutData, const int nMaxOutDataSize, int *nCurBitsOffset, int *nCurBitShift, int *nFinalLiterals, int *nCurRepMatchOffset, const int nBlockFlags) {
+static int salvador_write_block(salvador_compressor* pCompressor, const unsigned char* pInWindow, const int nStartOffset, const int nEndOffset, unsigned char* pOutData, const int nMaxOutDataSize, int* nCurBitsOffset, int* nCurBitShift, int* nFinalLiterals, int* nCurRepMatchOffset, const int nBlockFlags) {
+   /* Backward streams never invert the offsets, FLG_IS_INVERTED is cleared for them when the compressor is configured */
+   if (pCompressor->flags & FLG_IS_BACKWARD)
+      return salvador_write_block_format(pCompressor, pInWindow, nStartOffset, nEndOffset, pOutData, nMaxOutDataSize, nCurBitsOffset, nCurBitShift, nFinalLiterals, nCurRepMatchOffset, nBlockFlags, 0, 1);
+   else if (pCompressor->flags & FLG_IS_INVERTED)
+      return salvador_write_block_format(pCompressor, pInWindow, nStartOffset, nEndOffset, pOutData, nMaxOutDataSize, nCurBitsOffset, nCurBitShift, nFinalLiterals, nCurRepMatchOffset, nBlockFlags, 1, 0);
+   else
+      return salvador_write_block_format(pCompressor, pInWindow, nStartOffset, nEndOffset, pOutData, nMaxOutDataSize, nCurBitsOffset, nCurBitShift, nFinalLiterals, nCurRepMatchOffset, nBlockFlags, 0, 0);
+}
+
+/**
+ * Find more matches for the block: small matches that the match finder doesn't return, and the matches that the arrivals of a first, quick
+ * optimization pass can reach with their rep offsets
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param nCurRepMatchOffset starting rep offset for this block
+ * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 for last block, 0 otherwise
+ */
+static void salvador_supplement_matches(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, const int *nCurRepMatchOffset, const int nBlockFlags) {
    const int nEndOffset = nPreviousBlockSize + nInDataSize;
-   int *rle_len = (int*)pCompressor->intervals /* reuse */;
+   const int *rle_len = pCompressor->rle_len;
    int *first_offset_for_byte = pCompressor->first_offset_for_byte;
    int *next_offset_for_pos = pCompressor->next_offset_for_pos;
    int *offset_cache = pCompressor->offset_cache;
-   int i, nPosition;
-
-   memset(pCompressor->best_match, 0, pCompressor->block_size * sizeof(salvador_match));
-
-   /* Count identical bytes */
-
-   i = 0;
-   while (i < nEndOffset) {
-      int nRangeStartIdx = i;
-      const unsigned char c = pInWindow[nRangeStartIdx];
-
-      do {
-         i++;
-      } while (i < nEndOffset && pInWindow[i] == c);
-
-      while (nRangeStartIdx < i) {
-         rle_len[nRangeStartIdx] = i - nRangeStartIdx;
-         nRangeStartIdx++;
-      }
-   }
+   const int *match_row = pCompressor->match_row - nPreviousBlockSize;
+   const int nMaxSmallMatches = pCompressor->supplement_small_matches ? 16 : 0;
+   long long nStartTime = (pCompressor->flags & FLG_PHASE_STATS) ? salvador_get_time() : 0LL;
+   int nPosition;
 
    /* Supplement small matches */
 
@@ -1603,21 +1667,23 @@ static int salvador_optimize_and_write_block(salvador_compressor *pCompressor, c
    memset(offset_cache, 0xff, sizeof(int) * 2048);
 
    for (nPosition = nPreviousBlockSize + 1; nPosition < (nEndOffset - 1); nPosition++) {
-      salvador_match *match = pCompressor->match + ((nPosition - nPreviousBlockSize) * NMATCHES_PER_INDEX);
+      salvador_match *match = pCompressor->match + match_row[nPosition];
       const int nMaxMatchLen = ((nPosition + 130) < nEndOffset) ? 130 : (nEndOffset - nPosition);
       const unsigned char* pInWindowMax = pInWindow + nPosition + nMaxMatchLen;
       const unsigned char* pInWindowStart = pInWindow + nPosition;
-      unsigned short *match_depth = pCompressor->match_depth + ((nPosition - nPreviousBlockSize) * NMATCHES_PER_INDEX);
+      unsigned short *match_depth = pCompressor->match_depth + match_row[nPosition];
+      const int nNumMatchSlots = match_row[nPosition + 1] - match_row[nPosition];
+      const int nMaxMatches = (nNumMatchSlots < nMaxSmallMatches) ? nNumMatchSlots : nMaxSmallMatches;
       int m = 0;
       int nMatchPos;
 
-      while (m < 16 && match[m].length) {
+      while (m < nMaxMatches && match[m].length) {
          offset_cache[match[m].offset & 2047] = nPosition;
          offset_cache[(match[m].offset - match_depth[m]) & 2047] = nPosition;
          m++;
       }
 
-      for (nMatchPos = next_offset_for_pos[nPosition - nPreviousBlockSize]; m < 16 && nMatchPos >= 0; nMatchPos = next_offset_for_pos[nMatchPos - nPreviousBlockSize]) {
+      for (nMatchPos = next_offset_for_pos[nPosition - nPreviousBlockSize]; m < nMaxMatches && nMatchPos >= 0; nMatchPos = next_offset_for_pos[nMatchPos - nPreviousBlockSize]) {
          const int nMatchOffset = nPosition - nMatchPos;
 
          if (nMatchOffset <= pCompressor->max_offset) {
@@ -1644,12 +1710,7 @@ static int salvador_optimize_and_write_block(salvador_compressor *pCompressor, c
                if (pInWindowAtPos > pInWindowMax)
                   pInWindowAtPos = pInWindowMax;
 
-               while ((pInWindowAtPos + 8) < pInWindowMax && !memcmp(pInWindowAtPos, pInWindowAtPos - nMatchOffset, 8))
-                  pInWindowAtPos += 8;
-               while ((pInWindowAtPos + 4) < pInWindowMax && !memcmp(pInWindowAtPos, pInWindowAtPos - nMatchOffset, 4))
-                  pInWindowAtPos += 4;
-               while (pInWindowAtPos < pInWindowMax && pInWindowAtPos[0] == pInWindowAtPos[-nMatchOffset])
-                  pInWindowAtPos++;
+               pInWindowAtPos += salvador_get_common_len(pInWindowAtPos, pInWindowAtPos - nMatchOffset, (const int)(pInWindowMax - pInWindowAtPos));
 
                match[m].length = (const unsigned short)(pInWindowAtPos - pInWindowStart);
                match[m].offset = nMatchOffset;
@@ -1663,19 +1724,40 @@ static int salvador_optimize_and_write_block(salvador_compressor *pCompressor, c
       }
    }
 
+   if (pCompressor->flags & FLG_PHASE_STATS) {
+      const long long nTime = salvador_get_time();
+
+      pCompressor->stats.supplement_time += nTime - nStartTime;
+      nStartTime = nTime;
+   }
+
+   if (!pCompressor->initial_arrivals_per_position)
+      return;
+
    /* Compress and insert additional matches */
-   salvador_optimize_forward(pCompressor, pInWindow, nPreviousBlockSize, nEndOffset, 1 /* nInsertForwardReps */, nCurRepMatchOffset, NINITIAL_ARRIVALS_PER_POSITION, nBlockFlags);
+   salvador_optimize_forward(pCompressor, pInWindow, nPreviousBlockSize, nEndOffset, 1 /* nInsertForwardReps */, nCurRepMatchOffset, 1, pCompressor->initial_arrivals_per_position, nBlockFlags);
+
+   if (pCompressor->flags & FLG_PHASE_STATS) {
+      const long long nTime = salvador_get_time();
+
+      pCompressor->stats.first_pass_time += nTime - nStartTime;
+      nStartTime = nTime;
+   }
+
+   if (!pCompressor->supplement_further)
+      return;
 
    /* Supplement matches further */
 
    for (nPosition = nPreviousBlockSize + 1; nPosition < (nEndOffset - 1); nPosition++) {
-      salvador_match* match = pCompressor->match + ((nPosition - nPreviousBlockSize) * NMATCHES_PER_INDEX);
+      salvador_match* match = pCompressor->match + match_row[nPosition];
 
       if (match[0].length < 8) {
          const int nMaxMatchLen = ((nPosition + 130) < nEndOffset) ? 130 : (nEndOffset - nPosition);
          const unsigned char* pInWindowMax = pInWindow + nPosition + nMaxMatchLen;
          const unsigned char* pInWindowStart = pInWindow + nPosition;
-         unsigned short* match_depth = pCompressor->match_depth + ((nPosition - nPreviousBlockSize) * NMATCHES_PER_INDEX);
+         unsigned short* match_depth = pCompressor->match_depth + match_row[nPosition];
+         const int nNumMatchSlots = match_row[nPosition + 1] - match_row[nPosition];
          int m = 0, nInserted = 0;
          int nMatchPos;
          int nMaxForwardPos = nPosition + 2 + 1 + 3;
@@ -1683,13 +1765,13 @@ static int salvador_optimize_and_write_block(salvador_compressor *pCompressor, c
          if (nMaxForwardPos > (nEndOffset - 2))
             nMaxForwardPos = nEndOffset - 2;
 
-         while (m < NMATCHES_PER_INDEX && match[m].length) {
+         while (m < nNumMatchSlots && match[m].length) {
             offset_cache[match[m].offset & 2047] = nPosition;
             offset_cache[(match[m].offset - match_depth[m]) & 2047] = nPosition;
             m++;
          }
 
-         for (nMatchPos = next_offset_for_pos[nPosition - nPreviousBlockSize]; m < NMATCHES_PER_INDEX && nMatchPos >= 0; nMatchPos = next_offset_for_pos[nMatchPos - nPreviousBlockSize]) {
+         for (nMatchPos = next_offset_for_pos[nPosition - nPreviousBlockSize]; m < nNumMatchSlots && nMatchPos >= 0; nMatchPos = next_offset_for_pos[nMatchPos - nPreviousBlockSize]) {
             const int nMatchOffset = nPosition - nMatchPos;
 
             if (nMatchOffset <= pCompressor->max_offset) {
@@ -1727,12 +1809,7 @@ static int salvador_optimize_and_write_block(salvador_compressor *pCompressor, c
                         if (pInWindowAtPos > pInWindowMax)
                            pInWindowAtPos = pInWindowMax;
 
-                        while ((pInWindowAtPos + 8) < pInWindowMax && !memcmp(pInWindowAtPos, pInWindowAtPos - nMatchOffset, 8))
-                           pInWindowAtPos += 8;
-                        while ((pInWindowAtPos + 4) < pInWindowMax && !memcmp(pInWindowAtPos, pInWindowAtPos - nMatchOffset, 4))
-                           pInWindowAtPos += 4;
-                        while (pInWindowAtPos < pInWindowMax && pInWindowAtPos[0] == pInWindowAtPos[-nMatchOffset])
-                           pInWindowAtPos++;
+                        pInWindowAtPos += salvador_get_common_len(pInWindowAtPos, pInWindowAtPos - nMatchOffset, (const int)(pInWindowMax - pInWindowAtPos));
 
                         match[m].length = (const unsigned short)(pInWindowAtPos - pInWindowStart);
                         match[m].offset = nMatchOffset;
@@ -1755,309 +1832,2469 @@ static int salvador_optimize_and_write_block(salvador_compressor *pCompressor, c
       }
    }
 
-   /* Pick final matches */
-   salvador_optimize_forward(pCompressor, pInWindow, nPreviousBlockSize, nEndOffset, 0 /* nInsertForwardReps */, nCurRepMatchOffset, pCompressor->max_arrivals_per_position, nBlockFlags);
+   if (pCompressor->flags & FLG_PHASE_STATS)
+      pCompressor->stats.supplement_time += salvador_get_time() - nStartTime;
+}
 
-   /* Apply reduction and merge pass */
-   int nDidReduce;
-   int nPasses = 0;
-   do {
-      nDidReduce = salvador_reduce_commands(pCompressor, pInWindow, nPreviousBlockSize, nEndOffset, nCurRepMatchOffset, nBlockFlags);
-      nPasses++;
-   } while (nDidReduce && nPasses < 20);
+/**
+ * Add the work counters and phase timings of one compression context to another's
+ *
+ * @param pDestStats stats to add to
+ * @param pSrcStats stats to add
+ */
+static void salvador_add_work_stats(salvador_stats *pDestStats, const salvador_stats *pSrcStats) {
+   pDestStats->num_matches_found += pSrcStats->num_matches_found;
+   pDestStats->num_forward_matches += pSrcStats->num_forward_matches;
+   pDestStats->num_arrivals_inserted += pSrcStats->num_arrivals_inserted;
+   pDestStats->num_arrivals_evicted += pSrcStats->num_arrivals_evicted;
+   pDestStats->num_blocks += pSrcStats->num_blocks;
+   pDestStats->num_literal_blocks += pSrcStats->num_literal_blocks;
+   pDestStats->num_reduce_passes += pSrcStats->num_reduce_passes;
+   pDestStats->num_segments += pSrcStats->num_segments;
+   pDestStats->num_segment_reparses += pSrcStats->num_segment_reparses;
+
+   pDestStats->sort_time += pSrcStats->sort_time;
+   pDestStats->interval_time += pSrcStats->interval_time;
+   pDestStats->find_matches_time += pSrcStats->find_matches_time;
+   pDestStats->supplement_time += pSrcStats->supplement_time;
+   pDestStats->first_pass_time += pSrcStats->first_pass_time;
+   pDestStats->final_pass_time += pSrcStats->final_pass_time;
+   pDestStats->reduce_time += pSrcStats->reduce_time;
+   pDestStats->write_time += pSrcStats->write_time;
+}
 
-   /* Write compressed block */
+/**
+ * Optimize one segment of a block, on its own thread
+ *
+ * @param pArg segment
+ */
+static void salvador_run_parse_segment(void *pArg) {
+   salvador_parse_segment *pSegment = (salvador_parse_segment *)pArg;
 
-   return salvador_write_block(pCompressor, pInWindow, nPreviousBlockSize, nEndOffset, pOutData, nMaxOutDataSize, nCurBitsOffset, nCurBitShift, nFinalLiterals, nCurRepMatchOffset, nBlockFlags);
+   salvador_optimize_forward(&pSegment->parser, pSegment->in_window, pSegment->start, pSegment->end, 0 /* nInsertForwardReps */, pSegment->seed_rep_offset, pSegment->num_seeds,
+      pSegment->parser.max_arrivals_per_position, 0 /* nBlockFlags */);
 }
 
-/* Forward declaration */
-static void salvador_compressor_destroy(salvador_compressor *pCompressor);
-
 /**
- * Initialize compression context
+ * Get likely rep offsets at the start of a segment: the rep offset at the start of the block, and the offsets of the matches that reach the
+ * segment from just before it
  *
- * @param pCompressor compression context to initialize
- * @param nBlockSize maximum size of input data (bytes to compress only)
- * @param nMaxWindowSize maximum size of input data window (previously compressed bytes + bytes to compress)
- * @param nMaxOffset maximum match offset to use (0 for default)
- * @param nMaxArrivals maximum number of arrivals per position
- * @param nFlags compression flags
+ * @param pCompressor compression context
+ * @param nBlockStart start of the block in the input window
+ * @param nSegmentStart start of the segment in the input window
+ * @param nRepMatchOffset rep offset at the start of the block
+ * @param pSeeds array to fill with the rep offsets
+ * @param nMaxSeeds maximum number of rep offsets to return
  *
- * @return 0 for success, non-zero for failure
+ * @return number of rep offsets returned
  */
-static int salvador_compressor_init(salvador_compressor *pCompressor, const int nBlockSize, const int nMaxWindowSize, const size_t nMaxOffset, const int nMaxArrivals, const int nFlags) {
-   int nResult;
+static int salvador_get_segment_seeds(const salvador_compressor *pCompressor, const int nBlockStart, const int nSegmentStart, const int nRepMatchOffset, int *pSeeds, const int nMaxSeeds) {
+   const int *match_row = pCompressor->match_row - nBlockStart;
+   int nNumSeeds = 0;
+   int i;
 
-   nResult = divsufsort_init(&pCompressor->divsufsort_context);
-   pCompressor->intervals = NULL;
-   pCompressor->pos_data = NULL;
-   pCompressor->open_intervals = NULL;
-   pCompressor->match = NULL;
-   pCompressor->match_depth = NULL;
-   pCompressor->best_match = NULL;
-   pCompressor->arrival = NULL;
-   pCompressor->first_offset_for_byte = NULL;
-   pCompressor->next_offset_for_pos = NULL;
-   pCompressor->offset_cache = NULL;
-   if (nFlags & FLG_IS_BACKWARD)
-      pCompressor->flags = nFlags & (~FLG_IS_INVERTED);
-   else
-      pCompressor->flags = nFlags;
-   pCompressor->block_size = nBlockSize;
-   pCompressor->max_offset = nMaxOffset ? (int)nMaxOffset : MAX_OFFSET;
-   pCompressor->max_arrivals_per_position = nMaxArrivals;
+   pSeeds[nNumSeeds++] = nRepMatchOffset;
 
-   memset(&pCompressor->stats, 0, sizeof(pCompressor->stats));
-   pCompressor->stats.min_match_len = -1;
-   pCompressor->stats.min_offset = -1;
-   pCompressor->stats.min_rle1_len = -1;
-   pCompressor->stats.min_rle2_len = -1;
+   for (i = nSegmentStart - 1; i >= nBlockStart && i >= (nSegmentStart - PARSE_SEGMENT_SEED_SCAN) && nNumSeeds < nMaxSeeds; i--) {
+      const salvador_match *match = pCompressor->match + match_row[i];
+      const int nNumMatchSlots = match_row[i + 1] - match_row[i];
+      int m;
 
-   if (!nResult) {
-      pCompressor->intervals = (unsigned long long *)malloc(nMaxWindowSize * sizeof(unsigned long long));
-
-      if (pCompressor->intervals) {
-         pCompressor->pos_data = (unsigned long long *)malloc(nMaxWindowSize * sizeof(unsigned long long));
-
-         if (pCompressor->pos_data) {
-            pCompressor->open_intervals = (unsigned long long *)malloc((LCP_AND_TAG_MAX + 1) * sizeof(unsigned long long));
-
-            if (pCompressor->open_intervals) {
-               pCompressor->arrival = (salvador_arrival *)malloc((nBlockSize + 1) * nMaxArrivals * sizeof(salvador_arrival));
-
-               if (pCompressor->arrival) {
-                  pCompressor->best_match = (salvador_match *)malloc(nBlockSize * sizeof(salvador_match));
-
-                  if (pCompressor->best_match) {
-                     pCompressor->match = (salvador_match *)malloc(nBlockSize * NMATCHES_PER_INDEX * sizeof(salvador_match));
-                     if (pCompressor->match) {
-                        pCompressor->match_depth = (unsigned short *)malloc(nBlockSize * NMATCHES_PER_INDEX * sizeof(unsigned short));
-                        if (pCompressor->match_depth) {
-                           pCompressor->first_offset_for_byte = (int*)malloc(65536 * sizeof(int));
-                           if (pCompressor->first_offset_for_byte) {
-                              pCompressor->next_offset_for_pos = (int*)malloc(nBlockSize * sizeof(int));
-                              if (pCompressor->next_offset_for_pos) {
-                                 pCompressor->offset_cache = (int*)malloc(2048 * sizeof(int));
-                                 if (pCompressor->offset_cache) {
-                                    return 0;
-                                 }
-                              }
-                           }
-                        }
-                     }
-                  }
-               }
-            }
+      for (m = 0; m < nNumMatchSlots && match[m].length && nNumSeeds < nMaxSeeds; m++) {
+         if ((i + match[m].length) >= nSegmentStart) {
+            int n;
+
+            for (n = 0; n < nNumSeeds && pSeeds[n] != match[m].offset; n++)
+               ;
+            if (n == nNumSeeds)
+               pSeeds[nNumSeeds++] = match[m].offset;
          }
       }
    }
 
-   salvador_compressor_destroy(pCompressor);
-   return 100;
+   return nNumSeeds;
 }
 
 /**
- * Clean up compression context and free up any associated resources
+ * Check whether the path to one of the arrivals at the end of a segment holds with the actual rep offset at its start. It doesn't if its
+ * first match was picked as a rep match with a seed rep offset that turned out to be different
  *
- * @param pCompressor compression context to clean up
+ * @param pSegment segment
+ * @param nSlot arrival at the end of the segment
+ * @param nRepMatchOffset actual rep offset at the start of the segment
+ * @param nNextRepMatchOffset returned rep offset at the end of the segment, if the path holds
+ *
+ * @return 1 if the path holds, 0 if it doesn't
  */
-static void salvador_compressor_destroy(salvador_compressor *pCompressor) {
-   divsufsort_destroy(&pCompressor->divsufsort_context);
-
-   if (pCompressor->offset_cache) {
-      free(pCompressor->offset_cache);
-      pCompressor->offset_cache = NULL;
-   }
-
-   if (pCompressor->next_offset_for_pos) {
-      free(pCompressor->next_offset_for_pos);
-      pCompressor->next_offset_for_pos = NULL;
-   }
-
-   if (pCompressor->first_offset_for_byte) {
-      free(pCompressor->first_offset_for_byte);
-      pCompressor->first_offset_for_byte = NULL;
-   }
+static int salvador_check_segment_path(const salvador_parse_segment *pSegment, const int nSlot, const int nRepMatchOffset, int *nNextRepMatchOffset) {
+   const int nMaxArrivalsPerPosition = pSegment->parser.max_arrivals_per_position;
+   const salvador_arrival *arrival = pSegment->arrival - (pSegment->start * nMaxArrivalsPerPosition);
+   const salvador_arrival *end_arrival = &arrival[(pSegment->end * nMaxArrivalsPerPosition) + nSlot];
+   const salvador_arrival *cur_arrival = end_arrival;
+   int nFromPos = salvador_get_arrival_from_pos(cur_arrival, pSegment->end);
+   int nHasMatch = 0, nFirstMatchOffset = 0, nFirstMatchIsRep = 0;
+
+   if (cur_arrival->from_slot <= 0)
+      return 0;
+
+   /* Walk back to the seed that the path starts from, noting the first match */
+   while (cur_arrival->from_slot > 0) {
+      const salvador_arrival *from_arrival = &arrival[(nFromPos * nMaxArrivalsPerPosition) + (cur_arrival->from_slot - 1)];
+
+      if (cur_arrival->match_len) {
+         nHasMatch = 1;
+         nFirstMatchOffset = cur_arrival->rep_offset;
+         nFirstMatchIsRep = (from_arrival->num_literals != 0 && from_arrival->rep_offset == cur_arrival->rep_offset) ? 1 : 0;
+      }
 
-   if (pCompressor->match_depth) {
-      free(pCompressor->match_depth);
-      pCompressor->match_depth = NULL;
+      cur_arrival = from_arrival;
+      nFromPos = salvador_get_arrival_from_pos(cur_arrival, nFromPos);
    }
 
-   if (pCompressor->match) {
-      free(pCompressor->match);
-      pCompressor->match = NULL;
-   }
+   if (nFirstMatchIsRep && nFirstMatchOffset != nRepMatchOffset)
+      return 0;
 
-   if (pCompressor->arrival) {
-      free(pCompressor->arrival);
-      pCompressor->arrival = NULL;
-   }
+   *nNextRepMatchOffset = nHasMatch ? (int)end_arrival->rep_offset : nRepMatchOffset;
+   return 1;
+}
 
-   if (pCompressor->best_match) {
-      free(pCompressor->best_match);
-      pCompressor->best_match = NULL;
-   }
+/**
+ * Set the final matches of a segment to the path to one of the arrivals at its end
+ *
+ * @param pSegment segment
+ * @param nSlot arrival at the end of the segment
+ */
+static void salvador_apply_segment_path(salvador_parse_segment *pSegment, const int nSlot) {
+   const int nMaxArrivalsPerPosition = pSegment->parser.max_arrivals_per_position;
+   const salvador_arrival *arrival = pSegment->arrival - (pSegment->start * nMaxArrivalsPerPosition);
+   const salvador_arrival *end_arrival = &arrival[(pSegment->end * nMaxArrivalsPerPosition) + nSlot];
+   salvador_match *pBestMatch = pSegment->parser.best_match - pSegment->start;
+   int nFromPos = salvador_get_arrival_from_pos(end_arrival, pSegment->end);
 
-   if (pCompressor->open_intervals) {
-      free(pCompressor->open_intervals);
-      pCompressor->open_intervals = NULL;
-   }
+   memset(pBestMatch + pSegment->start, 0, (pSegment->end - pSegment->start) * sizeof(salvador_match));
 
-   if (pCompressor->pos_data) {
-      free(pCompressor->pos_data);
-      pCompressor->pos_data = NULL;
-   }
+   while (end_arrival->from_slot > 0 && nFromPos < pSegment->end) {
+      pBestMatch[nFromPos].length = end_arrival->match_len;
+      pBestMatch[nFromPos].offset = (end_arrival->match_len) ? end_arrival->rep_offset : 0;
 
-   if (pCompressor->intervals) {
-      free(pCompressor->intervals);
-      pCompressor->intervals = NULL;
+      end_arrival = &arrival[(nFromPos * nMaxArrivalsPerPosition) + (end_arrival->from_slot - 1)];
+      nFromPos = salvador_get_arrival_from_pos(end_arrival, nFromPos);
    }
 }
 
 /**
- * Compress one block of data
+ * Set up the block segments of a compression context, with FLG_PARSE_SEGMENTS
  *
  * @param pCompressor compression context
- * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
- * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
- * @param nInDataSize number of input bytes to compress
- * @param pOutData pointer to output buffer
- * @param nMaxOutDataSize maximum size of output buffer, in bytes
- * @param nCurBitsOffset write index into output buffer, of current byte being filled with bits
- * @param nCurBitShift bit shift count
- * @param nFinalLiterals output number of literals not written after writing this block, that need to be written in the next block
- * @param nCurRepMatchOffset starting rep offset for this block, updated after the block is compressed successfully
- * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 for last block, 0 otherwise
+ * @param nNumSegments number of segments
  *
- * @return size of compressed data in output buffer, or -1 if the data is uncompressible
+ * @return 0 for success, non-zero for failure
  */
-static int salvador_compressor_shrink_block(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, unsigned char *pOutData, const int nMaxOutDataSize, int *nCurBitsOffset, int *nCurBitShift, int *nFinalLiterals, int *nCurRepMatchOffset, const int nBlockFlags) {
-   int nCompressedSize;
+static int salvador_init_parse_segments(salvador_compressor *pCompressor, const int nNumSegments) {
+   int nMaxSegmentSize = (pCompressor->block_size + nNumSegments - 1) / nNumSegments;
+   int i;
 
-   if (salvador_build_suffix_array(pCompressor, pInWindow, nPreviousBlockSize + nInDataSize))
-      nCompressedSize = -1;
-   else {
-      if (nPreviousBlockSize) {
-         salvador_skip_matches(pCompressor, 0, nPreviousBlockSize);
-      }
-      salvador_find_all_matches(pCompressor, NMATCHES_PER_INDEX, nPreviousBlockSize, nPreviousBlockSize + nInDataSize);
+   /* Blocks too small for all the segments are split into fewer, larger ones */
+   if (nMaxSegmentSize < (2 * MIN_PARSE_SEGMENT_SIZE))
+      nMaxSegmentSize = 2 * MIN_PARSE_SEGMENT_SIZE;
+
+   pCompressor->parse_segments = (salvador_parse_segment *)salvador_mem_alloc(&pCompressor->arena.allocator, nNumSegments * sizeof(salvador_parse_segment));
+   if (!pCompressor->parse_segments)
+      return 100;
+   memset(pCompressor->parse_segments, 0, nNumSegments * sizeof(salvador_parse_segment));
+   pCompressor->num_parse_segments = nNumSegments;
 
-      nCompressedSize = salvador_optimize_and_write_block(pCompressor, pInWindow, nPreviousBlockSize, nInDataSize, pOutData, nMaxOutDataSize, nCurBitsOffset, nCurBitShift, nFinalLiterals, nCurRepMatchOffset, nBlockFlags);
+   for (i = 0; i < nNumSegments; i++) {
+      pCompressor->parse_segments[i].arrival = (salvador_arrival *)salvador_mem_alloc(&pCompressor->arena.allocator, (nMaxSegmentSize + 1) * pCompressor->allocated_arrivals_per_position * sizeof(salvador_arrival));
+      if (!pCompressor->parse_segments[i].arrival)
+         return 100;
    }
 
-   return nCompressedSize;
+   return 0;
 }
 
 /**
- * Get maximum compressed size of input(source) data
- *
- * @param nInputSize input(source) size in bytes
+ * Free the block segments of a compression context, if any
  *
- * @return maximum compressed size
+ * @param pCompressor compression context
  */
-size_t salvador_get_max_compressed_size(const size_t nInputSize) {
-   return ((nInputSize + 65535) >> 16) * 128 + nInputSize;
+static void salvador_destroy_parse_segments(salvador_compressor *pCompressor) {
+   if (pCompressor->parse_segments) {
+      int i;
+
+      for (i = 0; i < pCompressor->num_parse_segments; i++) {
+         salvador_mem_free(&pCompressor->arena.allocator, pCompressor->parse_segments[i].arrival);
+      }
+
+      salvador_mem_free(&pCompressor->arena.allocator, pCompressor->parse_segments);
+      pCompressor->parse_segments = NULL;
+      pCompressor->num_parse_segments = 0;
+   }
 }
 
 /**
- * Compress memory
+ * Pick the final matches of a block as segments that are optimized on their own threads, with FLG_PARSE_SEGMENTS
  *
- * @param pInputData pointer to input(source) data to compress
- * @param pOutBuffer buffer for compressed data
- * @param nInputSize input(source) size in bytes
- * @param nMaxOutBufferSize maximum capacity of compression buffer
- * @param nFlags compression flags (set to FLG_IS_INVERTED)
- * @param nMaxOffset maximum match offset to use (0 for default)
- * @param nDictionarySize size of dictionary in front of input data (0 for none)
- * @param progress progress function, called after compressing each block, or NULL for none
- * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ * All segments but the first are optimized from a few likely rep offsets at once. They are then stitched together in order, each with the
+ * best path to its end that holds with the rep offset that the previous segment ends with; a segment is optimized again from that rep offset
+ * if none of its paths does.
  *
- * @return actual compressed size, or -1 for error
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nStartOffset current offset in input window (typically the number of previously compressed bytes)
+ * @param nEndOffset offset to end finding matches at (typically the size of the total input window in bytes
+ * @param nCurRepMatchOffset starting rep offset for this block
+ * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 for last block, 0 otherwise
+ *
+ * @return 1 if the final matches were picked, 0 if the block must be optimized in one pass instead
  */
-size_t salvador_compress(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
-      const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats) {
-   salvador_compressor compressor;
-   size_t nOriginalSize = 0;
-   size_t nCompressedSize = 0L;
-   int nResult;
-   int nMaxArrivals = NMAX_ARRIVALS_PER_POSITION;
-   int nError = 0;
-   const int nBlockSize = (nInputSize < BLOCK_SIZE) ? ((nInputSize < 1024) ? 1024 : (int)nInputSize) : BLOCK_SIZE;
-   const int nMaxOutBlockSize = (int)salvador_get_max_compressed_size(nBlockSize);
+static int salvador_optimize_forward_segments(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nStartOffset, const int nEndOffset, const int *nCurRepMatchOffset, const int nBlockFlags) {
+   const int nMaxArrivalsPerPosition = pCompressor->max_arrivals_per_position;
+   int nNumSegments = (pCompressor->flags >> FLG_PARSE_SEGMENTS_SHIFT) & 0xf;
+   int nMaxSeeds = (nMaxArrivalsPerPosition < (2 * NPARSE_SEGMENT_SEEDS)) ? (nMaxArrivalsPerPosition >> 1) : NPARSE_SEGMENT_SEEDS;
+   int nSegmentSize, nRepMatchOffset;
+   int i;
 
-   nResult = salvador_compressor_init(&compressor, nBlockSize, nBlockSize * 2, nMaxOffset, nMaxArrivals, nFlags);
-   if (nResult != 0) {
-      return -1;
-   }
+   if (nNumSegments > ((nEndOffset - nStartOffset) / MIN_PARSE_SEGMENT_SIZE))
+      nNumSegments = (nEndOffset - nStartOffset) / MIN_PARSE_SEGMENT_SIZE;
+   if (nNumSegments < 2)
+      return 0;
 
-   int nPreviousBlockSize = 0;
-   int nNumBlocks = 0;
-   int nCurBitsOffset = 0, nCurBitShift = -1, nCurFinalLiterals = 0;
-   int nBlockFlags = 1;
-   int nCurRepMatchOffset = 1;
+   if (pCompressor->parse_segments && pCompressor->num_parse_segments != ((pCompressor->flags >> FLG_PARSE_SEGMENTS_SHIFT) & 0xf))
+      salvador_destroy_parse_segments(pCompressor);
+   if (!pCompressor->parse_segments && salvador_init_parse_segments(pCompressor, (pCompressor->flags >> FLG_PARSE_SEGMENTS_SHIFT) & 0xf)) {
+      salvador_destroy_parse_segments(pCompressor);
+      return 0;
+   }
 
-   if (nDictionarySize) {
-      nOriginalSize = (int)nDictionarySize;
-      nPreviousBlockSize = (int)nDictionarySize;
+   if (nMaxSeeds < 1)
+      nMaxSeeds = 1;
+   nSegmentSize = (nEndOffset - nStartOffset + nNumSegments - 1) / nNumSegments;
+
+   /* Start optimizing all segments but the first on their own threads, then optimize the first one on this thread */
+
+   for (i = nNumSegments - 1; i >= 0; i--) {
+      salvador_parse_segment *pSegment = &pCompressor->parse_segments[i];
+      salvador_compressor *pParser = &pSegment->parser;
+
+      pSegment->start = nStartOffset + i * nSegmentSize;
+      pSegment->end = (i == (nNumSegments - 1)) ? nEndOffset : (pSegment->start + nSegmentSize);
+      pSegment->in_window = pInWindow;
+
+      *pParser = *pCompressor;
+      pParser->arrival = pSegment->arrival;
+      pParser->best_match = pCompressor->best_match + (pSegment->start - nStartOffset);
+      pParser->match_row = pCompressor->match_row + (pSegment->start - nStartOffset);
+      pParser->prefetch = NULL;
+      pParser->parse_segments = NULL;
+      pParser->num_parse_segments = 0;
+      memset(&pParser->stats, 0, sizeof(salvador_stats));
+
+      if (i) {
+         pSegment->num_seeds = salvador_get_segment_seeds(pCompressor, nStartOffset, pSegment->start, *nCurRepMatchOffset, pSegment->seed_rep_offset, nMaxSeeds);
+         pSegment->running = salvador_thread_create(&pSegment->thread, salvador_run_parse_segment, pSegment) ? 0 : 1;
+         if (!pSegment->running)
+            salvador_run_parse_segment(pSegment);
+      }
+      else {
+         pSegment->seed_rep_offset[0] = *nCurRepMatchOffset;
+         pSegment->num_seeds = 1;
+         salvador_optimize_forward(pParser, pInWindow, pSegment->start, pSegment->end, 0 /* nInsertForwardReps */, pSegment->seed_rep_offset, 1, nMaxArrivalsPerPosition, nBlockFlags);
+      }
    }
 
-   while (nOriginalSize < nInputSize && !nError) {
-      int nInDataSize;
+   /* Stitch the segments together, in order */
 
-      nInDataSize = (int)(nInputSize - nOriginalSize);
-      if (nInDataSize > nBlockSize)
-         nInDataSize = nBlockSize;
+   nRepMatchOffset = *nCurRepMatchOffset;
+   for (i = 0; i < nNumSegments; i++) {
+      salvador_parse_segment *pSegment = &pCompressor->parse_segments[i];
+      int nNextRepMatchOffset = nRepMatchOffset;
+      int nSlot;
 
-      if (nInDataSize > 0) {
-         int nOutDataSize;
-         int nOutDataEnd = (int)(nMaxOutBufferSize - nCompressedSize);
+      if (pSegment->running) {
+         salvador_thread_join(&pSegment->thread);
+         pSegment->running = 0;
+      }
 
-         if (nOutDataEnd > nMaxOutBlockSize)
-            nOutDataEnd = nMaxOutBlockSize;
+      /* The segment's thread already set the final matches to the best path overall; look for the best one that holds */
+      for (nSlot = 0; nSlot < nMaxArrivalsPerPosition; nSlot++) {
+         if (salvador_check_segment_path(pSegment, nSlot, nRepMatchOffset, &nNextRepMatchOffset))
+            break;
+      }
 
-         if ((nOriginalSize + nInDataSize) >= nInputSize)
-            nBlockFlags |= 2;
-         nOutDataSize = salvador_compressor_shrink_block(&compressor, pInputData + nOriginalSize - nPreviousBlockSize, nPreviousBlockSize, nInDataSize, pOutBuffer + nCompressedSize, nOutDataEnd,
-            &nCurBitsOffset, &nCurBitShift, &nCurFinalLiterals, &nCurRepMatchOffset, nBlockFlags);
-         nBlockFlags &= (~1);
+      if (nSlot == nMaxArrivalsPerPosition) {
+         /* None holds: optimize the segment again, from the actual rep offset */
+         memset(pSegment->parser.best_match, 0, (pSegment->end - pSegment->start) * sizeof(salvador_match));
+         pSegment->seed_rep_offset[0] = nRepMatchOffset;
+         pSegment->num_seeds = 1;
+         salvador_run_parse_segment(pSegment);
+         salvador_check_segment_path(pSegment, 0, nRepMatchOffset, &nNextRepMatchOffset);
+         pSegment->parser.stats.num_segment_reparses++;
+      }
+      else if (nSlot != 0) {
+         salvador_apply_segment_path(pSegment, nSlot);
+      }
 
-         if (nOutDataSize >= 0 && nCurFinalLiterals >= 0 && nCurFinalLiterals < nInDataSize) {
-            /* Write compressed block */
+      pSegment->parser.stats.num_segments++;
+      salvador_add_work_stats(&pCompressor->stats, &pSegment->parser.stats);
+      nRepMatchOffset = nNextRepMatchOffset;
+   }
 
-            nInDataSize -= nCurFinalLiterals;
-            nOriginalSize += nInDataSize;
-            nCurFinalLiterals = 0;
-            nCompressedSize += nOutDataSize;
-            if (nCurBitShift != -1)
-               nCurBitsOffset -= nOutDataSize;
-         }
-         else {
-            nError = -1;
-         }
+   return 1;
+}
 
-         nPreviousBlockSize = nInDataSize;
-         nNumBlocks++;
+/**
+ * Select the most optimal matches and reduce the token count if possible, leaving the final choices in best_match
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param nCurRepMatchOffset starting rep offset for this block
+ * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 for last block, 0 otherwise
+ */
+static void salvador_optimize_block(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, const int *nCurRepMatchOffset, const int nBlockFlags) {
+   const int nEndOffset = nPreviousBlockSize + nInDataSize;
+   int *rle_len = pCompressor->rle_len;
+   int i;
+
+   memset(pCompressor->best_match, 0, pCompressor->block_size * sizeof(salvador_match));
+
+   /* Count identical bytes */
+
+   i = 0;
+   while (i < nEndOffset) {
+      int nRangeStartIdx = i;
+
+      i += salvador_get_run_len(pInWindow + i, nEndOffset - i);
+
+      while (nRangeStartIdx < i) {
+         rle_len[nRangeStartIdx] = i - nRangeStartIdx;
+         nRangeStartIdx++;
+      }
+   }
+
+   /* The lower compression levels trade ratio for speed and skip some or all of the extra matches */
+   if (pCompressor->supplement_small_matches || pCompressor->initial_arrivals_per_position)
+      salvador_supplement_matches(pCompressor, pInWindow, nPreviousBlockSize, nInDataSize, nCurRepMatchOffset, nBlockFlags);
+
+   /* Pick final matches */
+   long long nStartTime = (pCompressor->flags & FLG_PHASE_STATS) ? salvador_get_time() : 0LL;
+   if (!salvador_optimize_forward_segments(pCompressor, pInWindow, nPreviousBlockSize, nEndOffset, nCurRepMatchOffset, nBlockFlags))
+      salvador_optimize_forward(pCompressor, pInWindow, nPreviousBlockSize, nEndOffset, 0 /* nInsertForwardReps */, nCurRepMatchOffset, 1, pCompressor->max_arrivals_per_position, nBlockFlags);
+
+   if (pCompressor->flags & FLG_PHASE_STATS) {
+      const long long nTime = salvador_get_time();
+
+      pCompressor->stats.final_pass_time += nTime - nStartTime;
+      nStartTime = nTime;
+   }
+
+   /* Apply reduction and merge pass */
+   int nDidReduce;
+   int nPasses = 0;
+   do {
+      nDidReduce = salvador_reduce_commands(pCompressor, pInWindow, nPreviousBlockSize, nEndOffset, nCurRepMatchOffset, nBlockFlags);
+      nPasses++;
+   } while (nDidReduce && nPasses < pCompressor->reduce_passes);
+
+   pCompressor->stats.num_blocks++;
+   pCompressor->stats.num_reduce_passes += nPasses;
+   if (pCompressor->flags & FLG_PHASE_STATS)
+      pCompressor->stats.reduce_time += salvador_get_time() - nStartTime;
+}
+
+/**
+ * Select the most optimal matches, reduce the token count if possible, and then emit a block of compressed data
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
+ * @param nMaxOutDataSize maximum size of output buffer, in bytes
+ * @param nCurBitsOffset write index into output buffer, of current byte being filled with bits
+ * @param nCurBitShift bit shift count
+ * @param nFinalLiterals output number of literals not written after writing this block, that need to be written in the next block
+ * @param nCurRepMatchOffset starting rep offset for this block, updated after the block is compressed successfully
+ * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 for last block, 0 otherwise
+ *
+ * @return size of compressed data in output buffer, or -1 if the data is uncompressible
+ */
+static int salvador_optimize_and_write_block(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, unsigned char *pOutData, const int nMaxOutDataSize, int *nCurBitsOffset, int *nCurBitShift, int *nFinalLiterals, int *nCurRepMatchOffset, const int nBlockFlags) {
+   long long nStartTime;
+   int nOutDataSize;
+
+   salvador_optimize_block(pCompressor, pInWindow, nPreviousBlockSize, nInDataSize, nCurRepMatchOffset, nBlockFlags);
+
+   /* Write compressed block */
+
+   nStartTime = (pCompressor->flags & FLG_PHASE_STATS) ? salvador_get_time() : 0LL;
+   nOutDataSize = salvador_write_block(pCompressor, pInWindow, nPreviousBlockSize, nPreviousBlockSize + nInDataSize, pOutData, nMaxOutDataSize, nCurBitsOffset, nCurBitShift, nFinalLiterals, nCurRepMatchOffset, nBlockFlags);
+   if (pCompressor->flags & FLG_PHASE_STATS)
+      pCompressor->stats.write_time += salvador_get_time() - nStartTime;
+
+   return nOutDataSize;
+}
+
+/** Effort settings for one compression level */
+typedef struct _salvador_level {
+   int arrivals_per_position;           /**< arrivals kept per position when picking the final matches */
+   int initial_arrivals_per_position;   /**< arrivals per position in the first pass that inserts forward rep matches, or 0 to skip it */
+   int matches_per_index;               /**< match candidates stored per position */
+   int supplement_small_matches;        /**< 1 to add the small matches that the match finder doesn't return */
+   int supplement_further;              /**< 1 to supplement matches further after the first pass */
+   int reduce_passes;                   /**< maximum number of command reduction passes */
+   int chain_candidates;                /**< hash chain candidates to check per position, or 0 to use the suffix array */
+} salvador_level;
+
+/** Effort settings, for levels 1 (fastest) to 9 (best ratio) */
+static const salvador_level salvador_levels[MAX_COMPRESSION_LEVEL] = {
+   {   4,  0,  8, 0, 0,  1,   8 },
+   {   8,  0, 16, 0, 0, 20,  32 },
+   {  16,  0, 32, 0, 0, 20, 128 },
+   {  16,  0, 32, 1, 0, 20,   0 },
+   {  32,  0, 48, 1, 0, 20,   0 },
+   {  48, 24, 64, 1, 0, 20,   0 },
+   {  64, 32, NMATCHES_PER_INDEX, 1, 1, 20, 0 },
+   {  80, NINITIAL_ARRIVALS_PER_POSITION, NMATCHES_PER_INDEX, 1, 1, 20, 0 },
+   { NMAX_ARRIVALS_PER_POSITION, NINITIAL_ARRIVALS_PER_POSITION, NMATCHES_PER_INDEX, 1, 1, 20, 0 },
+};
+
+/**
+ * Get effort settings for the compression level requested in the compression flags
+ *
+ * @param nFlags compression flags
+ *
+ * @return effort settings
+ */
+static const salvador_level *salvador_get_level(const int nFlags) {
+   int nLevel = (nFlags >> FLG_LEVEL_SHIFT) & 0xf;
+
+   if (!nLevel)
+      nLevel = (nFlags & FLG_FAST_MATCHFINDER) ? FAST_COMPRESSION_LEVEL : MAX_COMPRESSION_LEVEL;
+   if (nLevel > MAX_COMPRESSION_LEVEL)
+      nLevel = MAX_COMPRESSION_LEVEL;
+
+   return &salvador_levels[nLevel - 1];
+}
+
+/* Forward declaration */
+static void salvador_compressor_destroy(salvador_compressor *pCompressor);
+
+/**
+ * Reset compression statistics
+ *
+ * @param pCompressor compression context
+ */
+static void salvador_compressor_reset_stats(salvador_compressor *pCompressor) {
+   memset(&pCompressor->stats, 0, sizeof(pCompressor->stats));
+   pCompressor->stats.min_match_len = -1;
+   pCompressor->stats.min_offset = -1;
+   pCompressor->stats.min_rle1_len = -1;
+   pCompressor->stats.min_rle2_len = -1;
+}
+
+/**
+ * Find matches ahead, on the pipelined match finder's thread
+ *
+ * @param pArg pipelined match finder
+ */
+static void salvador_run_match_prefetch(void *pArg) {
+   salvador_match_prefetch *pPrefetch = (salvador_match_prefetch *)pArg;
+   salvador_compressor *pFinder = &pPrefetch->finder;
+
+   pPrefetch->error = salvador_find_all_matches(pFinder, pFinder->matches_per_index, (int)(pPrefetch->end - pFinder->window_start), (int)(pPrefetch->target - pFinder->window_start),
+      (int)(pPrefetch->start - pFinder->window_start));
+}
+
+/**
+ * Take back the match store and the work counters of the pipelined match finder, once it has stopped finding matches
+ *
+ * @param pCompressor compression context
+ */
+static void salvador_finish_match_prefetch(salvador_compressor *pCompressor) {
+   salvador_match_prefetch *pPrefetch = pCompressor->prefetch;
+   const salvador_compressor *pFinder = &pPrefetch->finder;
+
+   /* The store may have been grown by the match finder */
+   pPrefetch->match = pFinder->match;
+   pPrefetch->match_depth = pFinder->match_depth;
+   pPrefetch->match_pool_size = pFinder->match_pool_size;
+
+   pCompressor->stats.num_matches_found += pFinder->stats.num_matches_found;
+   pCompressor->stats.find_matches_time += pFinder->stats.find_matches_time;
+
+   if (!pPrefetch->error)
+      pPrefetch->end = pPrefetch->target;
+   pPrefetch->running = 0;
+}
+
+/**
+ * Wait for the pipelined match finder, if it is running
+ *
+ * @param pCompressor compression context
+ */
+static void salvador_wait_match_prefetch(salvador_compressor *pCompressor) {
+   salvador_match_prefetch *pPrefetch = pCompressor->prefetch;
+
+   if (pPrefetch && pPrefetch->running) {
+      salvador_thread_join(&pPrefetch->thread);
+      salvador_finish_match_prefetch(pCompressor);
+   }
+}
+
+/**
+ * Stop the pipelined match finder, if it is running, and drop the matches that it found ahead
+ *
+ * @param pCompressor compression context
+ */
+static void salvador_stop_match_prefetch(salvador_compressor *pCompressor) {
+   salvador_match_prefetch *pPrefetch = pCompressor->prefetch;
+
+   if (pPrefetch) {
+      salvador_wait_match_prefetch(pCompressor);
+      pPrefetch->start = 0;
+      pPrefetch->end = 0;
+      pPrefetch->error = 0;
+   }
+}
+
+/**
+ * Start the pipelined match finder on the matches after the ones already found, up to the given position in the current window. The match
+ * finder then owns the match index until it is waited for
+ *
+ * @param pCompressor compression context
+ * @param nTargetEnd position to find matches up to, relative to the input data
+ */
+static void salvador_start_match_prefetch(salvador_compressor *pCompressor, const size_t nTargetEnd) {
+   salvador_match_prefetch *pPrefetch = pCompressor->prefetch;
+   salvador_compressor *pFinder = &pPrefetch->finder;
+
+   if (pPrefetch->end > pCompressor->matched_end) {
+      /* Move the matches found ahead that are still unused to the start of the store */
+      const int nFirstRow = (int)(pCompressor->matched_end - pPrefetch->start);
+      const int nNumRows = (int)(pPrefetch->end - pCompressor->matched_end);
+      const int nFirstMatch = pPrefetch->match_row[nFirstRow];
+      int i;
+
+      memmove(pPrefetch->match, pPrefetch->match + nFirstMatch, (pPrefetch->match_row[nFirstRow + nNumRows] - nFirstMatch) * sizeof(salvador_match));
+      memmove(pPrefetch->match_depth, pPrefetch->match_depth + nFirstMatch, (pPrefetch->match_row[nFirstRow + nNumRows] - nFirstMatch) * sizeof(unsigned short));
+      for (i = 0; i <= nNumRows; i++)
+         pPrefetch->match_row[i] = pPrefetch->match_row[nFirstRow + i] - nFirstMatch;
+   }
+   else {
+      pPrefetch->end = pCompressor->matched_end;
+   }
+   pPrefetch->start = pCompressor->matched_end;
+
+   if (nTargetEnd <= pPrefetch->end)
+      return;
+
+   *pFinder = *pCompressor;
+   pFinder->match = pPrefetch->match;
+   pFinder->match_depth = pPrefetch->match_depth;
+   pFinder->match_row = pPrefetch->match_row;
+   pFinder->match_pool_size = pPrefetch->match_pool_size;
+   pFinder->prefetch = NULL;
+   pFinder->parse_segments = NULL;
+   pFinder->num_parse_segments = 0;
+   memset(&pFinder->stats, 0, sizeof(salvador_stats));
+
+   pPrefetch->target = nTargetEnd;
+   pPrefetch->error = 0;
+   if (salvador_thread_create(&pPrefetch->thread, salvador_run_match_prefetch, pPrefetch)) {
+      /* Find the matches right away if no thread can be started */
+      salvador_run_match_prefetch(pPrefetch);
+      salvador_finish_match_prefetch(pCompressor);
+   }
+   else {
+      pPrefetch->running = 1;
+   }
+}
+
+/**
+ * Append the matches that the pipelined match finder found ahead, from the current match finding position up to the given one at most, to
+ * the match store. The pipelined match finder must not be running
+ *
+ * @param pCompressor compression context
+ * @param nEnd position to take matches up to, relative to the input data
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int salvador_take_prefetched_matches(salvador_compressor *pCompressor, const size_t nEnd) {
+   salvador_match_prefetch *pPrefetch = pCompressor->prefetch;
+
+   if (pPrefetch && pPrefetch->end > pCompressor->matched_end && nEnd > pCompressor->matched_end) {
+      const int nFirstRow = (int)(pCompressor->matched_end - pPrefetch->start);
+      const int nNumRows = (int)(((nEnd < pPrefetch->end) ? nEnd : pPrefetch->end) - pCompressor->matched_end);
+      const int nFirstMatch = pPrefetch->match_row[nFirstRow];
+      const int nNumMatches = pPrefetch->match_row[nFirstRow + nNumRows] - nFirstMatch;
+      int *match_row = pCompressor->match_row + (pCompressor->matched_end - pCompressor->first_row_offset);
+      int nRowStart;
+      int i;
+
+      if (pCompressor->matched_end == pCompressor->first_row_offset)
+         match_row[0] = 0;
+      nRowStart = match_row[0];
+
+      if ((nRowStart + nNumMatches) > pCompressor->match_pool_size) {
+         /* Grow the match pool, as the match finder would have */
+         int nNewPoolSize = pCompressor->match_pool_size * 2;
+         salvador_match *pNewMatch;
+         unsigned short *pNewMatchDepth;
+
+         if (nNewPoolSize < (nRowStart + nNumMatches))
+            nNewPoolSize = nRowStart + nNumMatches;
+
+         pNewMatch = (salvador_match *)salvador_mem_realloc(&pCompressor->arena.allocator, pCompressor->match, pCompressor->match_pool_size * sizeof(salvador_match), nNewPoolSize * sizeof(salvador_match));
+         if (!pNewMatch)
+            return 100;
+         pCompressor->match = pNewMatch;
+
+         pNewMatchDepth = (unsigned short *)salvador_mem_realloc(&pCompressor->arena.allocator, pCompressor->match_depth, pCompressor->match_pool_size * sizeof(unsigned short), nNewPoolSize * sizeof(unsigned short));
+         if (!pNewMatchDepth)
+            return 100;
+         pCompressor->match_depth = pNewMatchDepth;
+
+         pCompressor->match_pool_size = nNewPoolSize;
+      }
+
+      memcpy(pCompressor->match + nRowStart, pPrefetch->match + nFirstMatch, nNumMatches * sizeof(salvador_match));
+      memcpy(pCompressor->match_depth + nRowStart, pPrefetch->match_depth + nFirstMatch, nNumMatches * sizeof(unsigned short));
+      for (i = 1; i <= nNumRows; i++)
+         match_row[i] = nRowStart + (pPrefetch->match_row[nFirstRow + i] - nFirstMatch);
+
+      pCompressor->matched_end += nNumRows;
+   }
+
+   return 0;
+}
+
+/**
+ * Set up the pipelined match finder of a compression context
+ *
+ * @param pCompressor compression context
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int salvador_init_match_prefetch(salvador_compressor *pCompressor) {
+   const salvador_allocator *pAllocator = &pCompressor->arena.allocator;
+   salvador_match_prefetch *pPrefetch = (salvador_match_prefetch *)salvador_mem_alloc(pAllocator, sizeof(salvador_match_prefetch));
+
+   if (pPrefetch) {
+      pPrefetch->match_pool_size = pCompressor->block_size * NMATCH_ROW_RESERVE;
+      pPrefetch->match = (salvador_match *)salvador_mem_alloc(pAllocator, pPrefetch->match_pool_size * sizeof(salvador_match));
+      pPrefetch->match_depth = (unsigned short *)salvador_mem_alloc(pAllocator, pPrefetch->match_pool_size * sizeof(unsigned short));
+      pPrefetch->match_row = (int *)salvador_mem_alloc(pAllocator, (pCompressor->block_size + 1) * sizeof(int));
+      pPrefetch->start = 0;
+      pPrefetch->end = 0;
+      pPrefetch->target = 0;
+      pPrefetch->running = 0;
+      pPrefetch->error = 0;
+
+      if (pPrefetch->match && pPrefetch->match_depth && pPrefetch->match_row) {
+         pCompressor->prefetch = pPrefetch;
+         return 0;
+      }
+
+      salvador_mem_free(pAllocator, pPrefetch->match_row);
+      salvador_mem_free(pAllocator, pPrefetch->match_depth);
+      salvador_mem_free(pAllocator, pPrefetch->match);
+      salvador_mem_free(pAllocator, pPrefetch);
+   }
+
+   return 100;
+}
+
+/**
+ * Stop and free the pipelined match finder of a compression context, if any
+ *
+ * @param pCompressor compression context
+ */
+static void salvador_destroy_match_prefetch(salvador_compressor *pCompressor) {
+   salvador_match_prefetch *pPrefetch = pCompressor->prefetch;
+
+   if (pPrefetch) {
+      salvador_wait_match_prefetch(pCompressor);
+      salvador_mem_free(&pCompressor->arena.allocator, pPrefetch->match_row);
+      salvador_mem_free(&pCompressor->arena.allocator, pPrefetch->match_depth);
+      salvador_mem_free(&pCompressor->arena.allocator, pPrefetch->match);
+      salvador_mem_free(&pCompressor->arena.allocator, pPrefetch);
+      pCompressor->prefetch = NULL;
+   }
+}
+
+/**
+ * Set up compression context for compressing new data, keeping the allocated tables
+ *
+ * @param pCompressor compression context
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nFlags compression flags
+ */
+static void salvador_compressor_configure(salvador_compressor *pCompressor, const size_t nMaxOffset, const int nFlags) {
+   const salvador_level *pLevel = salvador_get_level(nFlags);
+
+   if (nFlags & FLG_IS_BACKWARD)
+      pCompressor->flags = nFlags & (~FLG_IS_INVERTED);
+   else
+      pCompressor->flags = nFlags & (~FLG_NATIVE_BACKWARD);
+   if (pLevel->chain_candidates || !pCompressor->pos_data)
+      pCompressor->flags |= FLG_FAST_MATCHFINDER;
+   pCompressor->max_offset = nMaxOffset ? (int)nMaxOffset : MAX_OFFSET;
+
+   /* Apply the effort settings of the level, within what the tables were allocated for */
+   pCompressor->max_arrivals_per_position = pLevel->arrivals_per_position;
+   if (pCompressor->max_arrivals_per_position > pCompressor->allocated_arrivals_per_position)
+      pCompressor->max_arrivals_per_position = pCompressor->allocated_arrivals_per_position;
+   pCompressor->initial_arrivals_per_position = pLevel->initial_arrivals_per_position;
+   if (pCompressor->initial_arrivals_per_position > pCompressor->max_arrivals_per_position)
+      pCompressor->initial_arrivals_per_position = pCompressor->max_arrivals_per_position;
+   pCompressor->matches_per_index = pLevel->matches_per_index;
+   if (pCompressor->matches_per_index > pCompressor->allocated_matches_per_index)
+      pCompressor->matches_per_index = pCompressor->allocated_matches_per_index;
+   pCompressor->supplement_small_matches = pLevel->supplement_small_matches;
+   pCompressor->supplement_further = pLevel->supplement_further;
+   pCompressor->reduce_passes = pLevel->reduce_passes;
+
+   pCompressor->max_chain_candidates = (nFlags >> FLG_CHAIN_CANDIDATES_SHIFT) & 0xff;
+   if (!pCompressor->max_chain_candidates)
+      pCompressor->max_chain_candidates = pLevel->chain_candidates ? pLevel->chain_candidates : NDEFAULT_CHAIN_CANDIDATES;
+   pCompressor->window_start = 0;
+   pCompressor->window_end = 0;
+   pCompressor->matched_end = 0;
+   pCompressor->first_row_offset = 0;
+   pCompressor->dictionary = NULL;
+   pCompressor->dictionary_size = 0;
+   pCompressor->index_start = 0;
+
+   salvador_compressor_reset_stats(pCompressor);
+}
+
+/**
+ * Carve the fixed-size tables of a compression context out of its arena, or only count the bytes that they need while the arena is measured
+ *
+ * Tables that are only live in one phase share memory with another table instead of being carved out on their own: the hash chains of
+ * the hash chain match finder are stored in the intervals, and the permuted LCP array lives in pos_data while the intervals are built
+ * from it; the other tables are live across phases, or on two threads at once with FLG_PIPELINE and FLG_PARSE_SEGMENTS. The match store
+ * grows while finding matches, and is allocated separately with the allocator of the arena.
+ *
+ * @param pCompressor compression context
+ * @param nBlockSize maximum size of input data (bytes to compress only)
+ * @param nMaxWindowSize maximum size of input data window (previously compressed bytes + bytes to compress)
+ * @param nMaxArrivals maximum number of arrivals per position
+ * @param nSuffixArray 1 to carve the tables for the suffix array match finder out too, 0 if only hash chains are used
+ */
+static void salvador_compressor_carve_tables(salvador_compressor *pCompressor, const int nBlockSize, const int nMaxWindowSize, const int nMaxArrivals, const int nSuffixArray) {
+   salvador_arena *pArena = &pCompressor->arena;
+
+   /* The arrivals come first, as the largest and most randomly accessed table, so that they start on a huge page when the arena is mapped */
+   pCompressor->arrival = (salvador_arrival *)salvador_arena_carve(pArena, (size_t)(nBlockSize + 1) * nMaxArrivals * sizeof(salvador_arrival));
+   pCompressor->match_row = (int *)salvador_arena_carve(pArena, (nBlockSize + 1) * sizeof(int));
+   pCompressor->best_match = (salvador_match *)salvador_arena_carve(pArena, nBlockSize * sizeof(salvador_match));
+   pCompressor->intervals = (unsigned long long *)salvador_arena_carve(pArena, nMaxWindowSize * sizeof(unsigned long long));
+   pCompressor->pos_data = nSuffixArray ? (unsigned long long *)salvador_arena_carve(pArena, nMaxWindowSize * sizeof(unsigned long long)) : NULL;
+   pCompressor->open_intervals = nSuffixArray ? (unsigned long long *)salvador_arena_carve(pArena, (LCP_AND_TAG_MAX + 1) * sizeof(unsigned long long)) : NULL;
+   pCompressor->rle_len = (int *)salvador_arena_carve(pArena, nBlockSize * 2 * sizeof(int));
+   pCompressor->visited = (salvador_visited *)salvador_arena_carve(pArena, nBlockSize * sizeof(salvador_visited));
+   pCompressor->first_offset_for_byte = (int *)salvador_arena_carve(pArena, 65536 * sizeof(int));
+   pCompressor->next_offset_for_pos = (int *)salvador_arena_carve(pArena, nBlockSize * sizeof(int));
+   pCompressor->offset_cache = (int *)salvador_arena_carve(pArena, 2048 * sizeof(int));
+   pCompressor->hash_head = (int *)salvador_arena_carve(pArena, (1 << HASH_CHAIN_BITS) * sizeof(int));
+}
+
+/**
+ * Initialize compression context
+ *
+ * @param pCompressor compression context to initialize
+ * @param nBlockSize maximum size of input data (bytes to compress only)
+ * @param nMaxWindowSize maximum size of input data window (previously compressed bytes + bytes to compress)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nMaxArrivals maximum number of arrivals per position
+ * @param nMatchesPerIndex maximum number of match candidates per position
+ * @param nSuffixArray 1 to allocate the tables for the suffix array match finder, 0 if only hash chains are used
+ * @param pSource source of the memory for the arena of the context, or NULL for the C heap
+ * @param nFlags compression flags
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int salvador_compressor_init(salvador_compressor *pCompressor, const int nBlockSize, const int nMaxWindowSize, const size_t nMaxOffset, const int nMaxArrivals, const int nMatchesPerIndex, const int nSuffixArray,
+      const salvador_memory_source *pSource, const int nFlags) {
+   int nResult;
+
+   salvador_simd_init();
+
+   nResult = divsufsort_init(&pCompressor->divsufsort_context);
+   pCompressor->match = NULL;
+   pCompressor->match_depth = NULL;
+   pCompressor->prefetch = NULL;
+   pCompressor->parse_segments = NULL;
+   pCompressor->num_parse_segments = 0;
+   pCompressor->in_window = NULL;
+   pCompressor->in_window_size = 0;
+   pCompressor->reversed_window = NULL;
+   pCompressor->block_size = nBlockSize;
+   pCompressor->max_window_size = nMaxWindowSize;
+   pCompressor->allocated_arrivals_per_position = nMaxArrivals;
+   pCompressor->allocated_matches_per_index = nMatchesPerIndex;
+
+   /* Count the bytes that the tables need, then allocate the arena and carve the tables out of it */
+   salvador_arena_measure(&pCompressor->arena, pSource);
+   salvador_compressor_carve_tables(pCompressor, nBlockSize, nMaxWindowSize, nMaxArrivals, nSuffixArray);
+
+   if (!nResult && !salvador_arena_init(&pCompressor->arena, pSource)) {
+      const size_t nArenaSize = pCompressor->arena.size;
+
+      salvador_compressor_carve_tables(pCompressor, nBlockSize, nMaxWindowSize, nMaxArrivals, nSuffixArray);
+
+      if (pCompressor->arena.used == nArenaSize) {
+         /* The match pool starts with room for a few matches per position, and grows as needed while finding matches */
+         pCompressor->match_pool_size = nBlockSize * NMATCH_ROW_RESERVE;
+         pCompressor->match = (salvador_match *)salvador_mem_alloc(&pCompressor->arena.allocator, pCompressor->match_pool_size * sizeof(salvador_match));
+         if (pCompressor->match) {
+            pCompressor->match_depth = (unsigned short *)salvador_mem_alloc(&pCompressor->arena.allocator, pCompressor->match_pool_size * sizeof(unsigned short));
+            if (pCompressor->match_depth) {
+               salvador_compressor_configure(pCompressor, nMaxOffset, nFlags);
+               return 0;
+            }
+         }
+      }
+   }
+
+   salvador_compressor_destroy(pCompressor);
+   return 100;
+}
+
+/**
+ * Clean up compression context and free up any associated resources
+ *
+ * @param pCompressor compression context to clean up
+ */
+static void salvador_compressor_destroy(salvador_compressor *pCompressor) {
+   salvador_destroy_match_prefetch(pCompressor);
+   salvador_destroy_parse_segments(pCompressor);
+   divsufsort_destroy(&pCompressor->divsufsort_context);
+
+   if (pCompressor->reversed_window) {
+      salvador_mem_free(&pCompressor->arena.allocator, pCompressor->reversed_window);
+      pCompressor->reversed_window = NULL;
+   }
+
+   if (pCompressor->match_depth) {
+      salvador_mem_free(&pCompressor->arena.allocator, pCompressor->match_depth);
+      pCompressor->match_depth = NULL;
+   }
+
+   if (pCompressor->match) {
+      salvador_mem_free(&pCompressor->arena.allocator, pCompressor->match);
+      pCompressor->match = NULL;
+   }
+
+   salvador_arena_destroy(&pCompressor->arena);
+   pCompressor->intervals = NULL;
+   pCompressor->pos_data = NULL;
+   pCompressor->open_intervals = NULL;
+   pCompressor->best_match = NULL;
+   pCompressor->arrival = NULL;
+   pCompressor->rle_len = NULL;
+   pCompressor->visited = NULL;
+   pCompressor->first_offset_for_byte = NULL;
+   pCompressor->next_offset_for_pos = NULL;
+   pCompressor->offset_cache = NULL;
+   pCompressor->hash_head = NULL;
+   pCompressor->match_row = NULL;
+}
+
+/**
+ * Get a range of input data compressed with FLG_NATIVE_BACKWARD, in the order that the compressor walks it: from the end of the input
+ * towards the start. The bytes are copied in reverse into a window owned by the compression context
+ *
+ * @param pCompressor compression context
+ * @param pInputData pointer to input(source) data, in file order
+ * @param nInputSize input(source) size in bytes
+ * @param nOffset offset of the first byte to get, counted from the end of the input data
+ * @param nSize number of bytes to get, at most the input window size that the compression context was allocated for
+ *
+ * @return window holding the bytes, or NULL for failure
+ */
+static const unsigned char *salvador_get_reversed_window(salvador_compressor *pCompressor, const unsigned char *pInputData, const size_t nInputSize, const size_t nOffset, const int nSize) {
+   const unsigned char *pSrc = pInputData + (nInputSize - 1 - nOffset);
+   int i;
+
+   if (nSize > pCompressor->max_window_size)
+      return NULL;
+
+   if (!pCompressor->reversed_window) {
+      pCompressor->reversed_window = (unsigned char *)salvador_mem_alloc(&pCompressor->arena.allocator, pCompressor->max_window_size);
+      if (!pCompressor->reversed_window)
+         return NULL;
+   }
+
+   for (i = 0; i < nSize; i++)
+      pCompressor->reversed_window[i] = pSrc[-i];
+
+   return pCompressor->reversed_window;
+}
+
+/**
+ * Quickly estimate whether a block is worth optimizing, by greedily taking the most recent earlier occurrence of each pair of bytes, in the
+ * history or in the block, that a match can reach; also find the last match in the block that can end a run of literals. Blocks where the
+ * matches found this way save next to nothing are written as literals, without finding all the matches and running the optimizer
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param nRepMatchOffset starting rep offset for this block, or 0 if it isn't known
+ * @param pLastMatch returned last match in the block that literals can be followed by, with a length of 0 if there is none
+ * @param nLastMatchPos returned position of that match, in the input window
+ *
+ * @return 1 if the block is incompressible, 0 if it should be optimized
+ */
+static int salvador_is_block_incompressible(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, const int nRepMatchOffset, salvador_match *pLastMatch, int *nLastMatchPos) {
+   const int nEndOffset = nPreviousBlockSize + nInDataSize;
+   const int nMaxOffset = pCompressor->max_offset;
+   const int nMaxSavings = (nInDataSize << 3) >> INCOMPRESSIBLE_SAVINGS_SHIFT;
+   int *first_offset_for_byte = pCompressor->first_offset_for_byte;
+   int nSavings = 0;
+   int nNextPosition = nPreviousBlockSize;
+   int nPosition;
+
+   pLastMatch->length = 0;
+   pLastMatch->offset = 0;
+   *nLastMatchPos = -1;
+
+   if (nInDataSize < MIN_INCOMPRESSIBLE_BLOCK_SIZE)
+      return 0;
+
+   memset(first_offset_for_byte, 0xff, sizeof(int) * 65536);
+
+   for (nPosition = (nPreviousBlockSize > nMaxOffset) ? (nPreviousBlockSize - nMaxOffset) : 0; nPosition < (nEndOffset - 1); nPosition++) {
+      const unsigned int nPair = ((unsigned int)pInWindow[nPosition]) | (((unsigned int)pInWindow[nPosition + 1]) << 8);
+      const int nMatchPos = first_offset_for_byte[nPair];
+
+      first_offset_for_byte[nPair] = nPosition;
+
+      if (nPosition >= nPreviousBlockSize) {
+         if (nMatchPos >= 0 && (nPosition - nMatchPos) <= nMaxOffset) {
+            const int nMatchOffset = nPosition - nMatchPos;
+
+            if (nPosition > nPreviousBlockSize) {
+               pLastMatch->length = 2;
+               pLastMatch->offset = nMatchOffset;
+               *nLastMatchPos = nPosition;
+            }
+
+            if (nPosition >= nNextPosition) {
+               const int nMaxLen = ((nEndOffset - nPosition) < 256) ? (nEndOffset - nPosition) : 256;
+               const int nLen = 2 + salvador_get_common_len(pInWindow + nPosition + 2, pInWindow + nMatchPos + 2, nMaxLen - 2);
+               const int nMatchSavings = (nLen << 3) - (TOKEN_SIZE + OFFSET_COST(nMatchOffset) + salvador_get_match_varlen_size_norep(nLen) + TOKEN_SIZE + 2);
+
+               if (nMatchSavings > 0) {
+                  nSavings += nMatchSavings;
+                  if (nSavings > nMaxSavings)
+                     return 0;
+                  nNextPosition = nPosition + nLen;
+               }
+            }
+         }
+         else if (nPosition > nPreviousBlockSize && nRepMatchOffset && nPosition >= nRepMatchOffset && pInWindow[nPosition] == pInWindow[nPosition - nRepMatchOffset]) {
+            pLastMatch->length = 1;
+            pLastMatch->offset = nRepMatchOffset;
+            *nLastMatchPos = nPosition;
+         }
+      }
+   }
+
+   return 1;
+}
+
+/**
+ * Write a block that was found to be incompressible as literals, followed by the last match in the block unless it is the last one, and
+ * update the match finder for the bytes that were written, without storing their matches
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param pLastMatch last match in the block that literals can be followed by
+ * @param nLastMatchPos position of that match, in the input window
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
+ * @param nMaxOutDataSize maximum size of output buffer, in bytes
+ * @param nCurBitsOffset write index into output buffer, of current byte being filled with bits
+ * @param nCurBitShift bit shift count
+ * @param nFinalLiterals output number of literals not written after writing this block, that need to be written in the next block
+ * @param nCurRepMatchOffset starting rep offset for this block, updated after the block is compressed successfully
+ * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 for last block, 0 otherwise
+ *
+ * @return size of compressed data in output buffer, or -1 if the data is uncompressible
+ */
+static int salvador_write_literal_block(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, const salvador_match *pLastMatch, const int nLastMatchPos,
+      unsigned char *pOutData, const int nMaxOutDataSize, int *nCurBitsOffset, int *nCurBitShift, int *nFinalLiterals, int *nCurRepMatchOffset, const int nBlockFlags) {
+   long long nStartTime;
+   int nOutDataSize;
+
+   memset(pCompressor->best_match, 0, nInDataSize * sizeof(salvador_match));
+   if (!(nBlockFlags & 2))
+      pCompressor->best_match[nLastMatchPos - nPreviousBlockSize] = *pLastMatch;
+
+   pCompressor->stats.num_blocks++;
+   pCompressor->stats.num_literal_blocks++;
+
+   nStartTime = (pCompressor->flags & FLG_PHASE_STATS) ? salvador_get_time() : 0LL;
+   nOutDataSize = salvador_write_block(pCompressor, pInWindow, nPreviousBlockSize, nPreviousBlockSize + nInDataSize, pOutData, nMaxOutDataSize, nCurBitsOffset, nCurBitShift, nFinalLiterals, nCurRepMatchOffset, nBlockFlags);
+   if (pCompressor->flags & FLG_PHASE_STATS)
+      pCompressor->stats.write_time += salvador_get_time() - nStartTime;
+
+   return nOutDataSize;
+}
+
+/**
+ * Select matches for one block of data, without emitting any compressed data
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param nDictionarySize number of previously compressed bytes that come from the dictionary (0 for none)
+ * @param nCurRepMatchOffset assumed starting rep offset for this block
+ * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 for last block, 0 otherwise
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int salvador_compressor_parse_block(salvador_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, const int nDictionarySize, const int *nCurRepMatchOffset, const int nBlockFlags) {
+   salvador_match lastMatch;
+   int nLastMatchPos;
+
+   /* The rep offset is only assumed here, so only a match with an explicit offset can end the literals */
+   if (salvador_is_block_incompressible(pCompressor, pInWindow, nPreviousBlockSize, nInDataSize, 0, &lastMatch, &nLastMatchPos) &&
+      ((nBlockFlags & 2) || lastMatch.length)) {
+      memset(pCompressor->best_match, 0, nInDataSize * sizeof(salvador_match));
+      if (!(nBlockFlags & 2))
+         pCompressor->best_match[nLastMatchPos - nPreviousBlockSize] = lastMatch;
+      pCompressor->stats.num_blocks++;
+      pCompressor->stats.num_literal_blocks++;
+      return 0;
+   }
+
+   if (salvador_build_match_index(pCompressor, pInWindow, nPreviousBlockSize + nInDataSize, nDictionarySize))
+      return 100;
+
+   if (nPreviousBlockSize) {
+      salvador_skip_matches(pCompressor, 0, nPreviousBlockSize);
+   }
+   if (salvador_find_all_matches(pCompressor, pCompressor->matches_per_index, nPreviousBlockSize, nPreviousBlockSize + nInDataSize, nPreviousBlockSize))
+      return 100;
+
+   salvador_optimize_block(pCompressor, pInWindow, nPreviousBlockSize, nInDataSize, nCurRepMatchOffset, nBlockFlags);
+   return 0;
+}
+
+/**
+ * Get the position that the pipelined match finder can find matches up to for the next block: the furthest that the next block can reach
+ * in the current window, or the current position if the next block will likely index a new window
+ *
+ * @param pCompressor compression context, after finding the matches for the current block
+ * @param nMaxInDataSize maximum number of bytes to compress in a block
+ * @param nInputSize number of bytes of input(source) data available
+ *
+ * @return position to find matches up to, relative to the input data
+ */
+static size_t salvador_get_prefetch_end(const salvador_compressor *pCompressor, const int nMaxInDataSize, const size_t nInputSize) {
+   if ((pCompressor->matched_end + nMaxInDataSize) <= pCompressor->window_end)
+      return pCompressor->matched_end + nMaxInDataSize;
+   else if (pCompressor->window_end >= nInputSize)
+      return pCompressor->window_end;
+   else
+      return pCompressor->matched_end;
+}
+
+/**
+ * Compress the next block of data, querying the suffix array and intervals that are shared by all the blocks of the current input window.
+ * A new window is indexed first if there is none yet, or if a full block doesn't fit in the current one anymore. Each window holds as much
+ * history as matches can reach, followed by as many bytes as the compression context was allocated for; the matches found for bytes that
+ * the previous block deferred to this one as literals are kept, instead of being found again
+ *
+ * @param pCompressor compression context
+ * @param pInputData pointer to input(source) data that window offsets are relative to
+ * @param nBlockOffset offset of the first byte to compress in this block
+ * @param nInputSize number of bytes of input(source) data available, from pInputData
+ * @param nMaxInDataSize maximum number of bytes to compress in this block
+ * @param nInDataSize output number of bytes compressed in this block, including the final literals
+ * @param pOutData pointer to output buffer, or NULL to only count the bytes that would be written
+ * @param nMaxOutDataSize maximum size of output buffer, in bytes
+ * @param nCurBitsOffset write index into output buffer, of current byte being filled with bits
+ * @param nCurBitShift bit shift count
+ * @param nFinalLiterals output number of literals not written after writing this block, that need to be written in the next block
+ * @param nCurRepMatchOffset starting rep offset for this block, updated after the block is compressed successfully
+ * @param nBlockFlags bit 0: 1 for first block, 0 otherwise; bit 1: 1 if no input data follows nInputSize, in which case the block that reaches it is the last one
+ *
+ * @return size of compressed data in output buffer, or -1 if the data is uncompressible
+ */
+static int salvador_compressor_shrink_indexed_block(salvador_compressor *pCompressor, const unsigned char *pInputData, const size_t nBlockOffset, const size_t nInputSize, const int nMaxInDataSize, int *nInDataSize,
+      unsigned char *pOutData, const int nMaxOutDataSize, int *nCurBitsOffset, int *nCurBitShift, int *nFinalLiterals, int *nCurRepMatchOffset, const int nBlockFlags) {
+   const int nMaxPreviousBlockSize = (nMaxInDataSize > BLOCK_SIZE) ? nMaxInDataSize : BLOCK_SIZE;
+   const unsigned char *pWindowData;
+   salvador_match lastMatch;
+   int nLastMatchPos;
+   int nPreviousBlockSize;
+   int nCurBlockFlags;
+
+   /* The match index is only used here once the matches found ahead for this block are ready */
+   if ((pCompressor->flags & FLG_PIPELINE) && !pCompressor->prefetch)
+      salvador_init_match_prefetch(pCompressor);
+   salvador_wait_match_prefetch(pCompressor);
+
+   if (pCompressor->matched_end > nBlockOffset) {
+      /* Keep the matches that were already found for the bytes deferred to this block as literals, at the end of the previous block */
+      const int nDeferredRows = (int)(pCompressor->matched_end - nBlockOffset);
+      const int nFirstDeferredRow = (int)(nBlockOffset - pCompressor->first_row_offset);
+      int *match_row = pCompressor->match_row;
+      const int nFirstDeferredMatch = match_row[nFirstDeferredRow];
+      int i;
+
+      memmove(pCompressor->match, pCompressor->match + nFirstDeferredMatch, (match_row[nFirstDeferredRow + nDeferredRows] - nFirstDeferredMatch) * sizeof(salvador_match));
+      memmove(pCompressor->match_depth, pCompressor->match_depth + nFirstDeferredMatch, (match_row[nFirstDeferredRow + nDeferredRows] - nFirstDeferredMatch) * sizeof(unsigned short));
+      for (i = 0; i <= nDeferredRows; i++)
+         match_row[i] = match_row[nFirstDeferredRow + i] - nFirstDeferredMatch;
+   }
+   else {
+      pCompressor->matched_end = nBlockOffset;
+   }
+   pCompressor->first_row_offset = nBlockOffset;
+
+   if (!pCompressor->window_end || ((nBlockOffset + nMaxInDataSize) > pCompressor->window_end && pCompressor->window_end < nInputSize)) {
+      const int nHistorySize = (nBlockOffset < (size_t)pCompressor->max_offset) ? (int)nBlockOffset : pCompressor->max_offset;
+
+      /* Matches found ahead in the previous window are found again in the new one */
+      salvador_stop_match_prefetch(pCompressor);
+
+      pCompressor->window_start = nBlockOffset - nHistorySize;
+      pCompressor->window_end = pCompressor->window_start + pCompressor->max_window_size;
+      if (pCompressor->window_end > nInputSize)
+         pCompressor->window_end = nInputSize;
+
+      if (pCompressor->flags & FLG_NATIVE_BACKWARD) {
+         if (!salvador_get_reversed_window(pCompressor, pInputData, nInputSize, pCompressor->window_start, (int)(pCompressor->window_end - pCompressor->window_start))) {
+            pCompressor->window_end = 0;
+            return -1;
+         }
+      }
+
+      if (salvador_build_match_index(pCompressor, (pCompressor->flags & FLG_NATIVE_BACKWARD) ? pCompressor->reversed_window : (pInputData + pCompressor->window_start),
+            (int)(pCompressor->window_end - pCompressor->window_start),
+            (pCompressor->window_start < pCompressor->dictionary_size) ? (int)(pCompressor->dictionary_size - pCompressor->window_start) : 0)) {
+         pCompressor->window_end = 0;
+         return -1;
+      }
+
+      /* Update the intervals for the history, and for the deferred bytes that already have matches */
+      salvador_skip_matches(pCompressor, 0, (int)(pCompressor->matched_end - pCompressor->window_start));
+   }
+
+   *nInDataSize = (int)(pCompressor->window_end - nBlockOffset);
+   if (*nInDataSize > nMaxInDataSize)
+      *nInDataSize = nMaxInDataSize;
+   nCurBlockFlags = ((nBlockOffset + *nInDataSize) < nInputSize) ? (nBlockFlags & (~2)) : nBlockFlags;
+
+   /* Optimize with at most one block of history in front, so that positions in the window fit in the arrivals */
+   nPreviousBlockSize = (int)(nBlockOffset - pCompressor->window_start);
+   if (nPreviousBlockSize > nMaxPreviousBlockSize)
+      nPreviousBlockSize = nMaxPreviousBlockSize;
+
+   pWindowData = ((pCompressor->flags & FLG_NATIVE_BACKWARD) ? pCompressor->reversed_window : (pInputData + pCompressor->window_start)) + (nBlockOffset - pCompressor->window_start) - nPreviousBlockSize;
+
+   if (salvador_is_block_incompressible(pCompressor, pWindowData, nPreviousBlockSize, *nInDataSize, *nCurRepMatchOffset, &lastMatch, &nLastMatchPos) &&
+      ((nCurBlockFlags & 2) || lastMatch.length)) {
+      /* Only the bytes up to the end of the final match get written; the next block finds the matches for the deferred literals */
+      const size_t nWrittenEnd = (nCurBlockFlags & 2) ? (nBlockOffset + *nInDataSize) : (nBlockOffset + (nLastMatchPos - nPreviousBlockSize) + lastMatch.length);
+
+      if (pCompressor->matched_end < nWrittenEnd) {
+         /* The bytes that the pipelined match finder already went past don't need to be skipped */
+         const size_t nVisitedEnd = (pCompressor->prefetch && pCompressor->prefetch->end > pCompressor->matched_end) ? pCompressor->prefetch->end : pCompressor->matched_end;
+
+         if (nVisitedEnd < nWrittenEnd)
+            salvador_skip_matches(pCompressor, (int)(nVisitedEnd - pCompressor->window_start), (int)(nWrittenEnd - pCompressor->window_start));
+         pCompressor->matched_end = nWrittenEnd;
+      }
+      if (pCompressor->prefetch)
+         salvador_start_match_prefetch(pCompressor, salvador_get_prefetch_end(pCompressor, nMaxInDataSize, nInputSize));
+
+      return salvador_write_literal_block(pCompressor, pWindowData, nPreviousBlockSize, *nInDataSize, &lastMatch, nLastMatchPos, pOutData, nMaxOutDataSize,
+         nCurBitsOffset, nCurBitShift, nFinalLiterals, nCurRepMatchOffset, nCurBlockFlags);
+   }
+
+   if ((pCompressor->prefetch && pCompressor->prefetch->error) || salvador_take_prefetched_matches(pCompressor, nBlockOffset + *nInDataSize) ||
+      salvador_find_all_matches(pCompressor, pCompressor->matches_per_index, (int)(pCompressor->matched_end - pCompressor->window_start), (int)(nBlockOffset + *nInDataSize - pCompressor->window_start),
+      (int)(nBlockOffset - pCompressor->window_start))) {
+      salvador_stop_match_prefetch(pCompressor);
+      pCompressor->window_end = 0;
+      pCompressor->matched_end = nBlockOffset;
+      return -1;
+   }
+   pCompressor->matched_end = nBlockOffset + *nInDataSize;
+
+   /* Find the matches for the next block while this one is optimized */
+   if (pCompressor->prefetch)
+      salvador_start_match_prefetch(pCompressor, salvador_get_prefetch_end(pCompressor, nMaxInDataSize, nInputSize));
+
+   return salvador_optimize_and_write_block(pCompressor, pWindowData, nPreviousBlockSize, *nInDataSize, pOutData, nMaxOutDataSize,
+      nCurBitsOffset, nCurBitShift, nFinalLiterals, nCurRepMatchOffset, nCurBlockFlags);
+}
+
+/**
+ * Get maximum compressed size of input(source) data
+ *
+ * @param nInputSize input(source) size in bytes
+ *
+ * @return maximum compressed size
+ */
+size_t salvador_get_max_compressed_size(const size_t nInputSize) {
+   return ((nInputSize + 65535) >> 16) * 128 + nInputSize;
+}
+
+/**
+ * Get the size of the blocks that the input is optimized in, selected with FLG_BLOCK_SIZE
+ *
+ * @param nFlags compression flags
+ *
+ * @return block size in bytes
+ */
+static int salvador_get_max_block_size(const unsigned int nFlags) {
+   const int nShift = (nFlags >> FLG_BLOCK_SIZE_SHIFT) & 0x7;
+
+   return BLOCK_SIZE << ((nShift < MAX_BLOCK_SIZE_SHIFT) ? nShift : MAX_BLOCK_SIZE_SHIFT);
+}
+
+/**
+ * Get the block size that the compression context tables must be allocated for, to compress the specified input
+ *
+ * @param nInputSize input(source) size in bytes, including the dictionary
+ * @param nFlags compression flags, selecting the block size
+ *
+ * @return block size in bytes
+ */
+static int salvador_get_block_size(const size_t nInputSize, const unsigned int nFlags) {
+   const int nMaxBlockSize = salvador_get_max_block_size(nFlags);
+
+   return (nInputSize < (size_t)nMaxBlockSize) ? ((nInputSize < 1024) ? 1024 : (int)nInputSize) : nMaxBlockSize;
+}
+
+/**
+ * Get the input window size that the compression context tables must be allocated for, to compress the specified input on one thread
+ *
+ * @param nInputSize input(source) size in bytes, including the dictionary; (size_t)-1 for a stream of unknown size
+ * @param nBlockSize block size in bytes
+ *
+ * @return window size in bytes
+ */
+static int salvador_get_window_size(const size_t nInputSize, const int nBlockSize) {
+   /* Blocks larger than a super block are indexed two at a time */
+   const int nMaxWindowSize = nBlockSize + ((nBlockSize > SUPER_BLOCK_SIZE) ? nBlockSize : SUPER_BLOCK_SIZE);
+
+   if (nInputSize > (size_t)nMaxWindowSize)
+      return nMaxWindowSize;
+   else
+      return (nInputSize > (size_t)(nBlockSize * 2)) ? (int)nInputSize : (nBlockSize * 2);
+}
+
+/**
+ * Compress memory on the calling thread, using an already allocated compression context
+ *
+ * @param pCompressor compression context, with tables allocated for at least the block size for this input
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data, or NULL to only count the compressed size
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nDictionarySize size of dictionary in front of input data (0 for none)
+ * @param nCheckpointInterval approximate number of bytes between checkpoints, where decompression can start without any previous output
+ *        (0 for none; the dictionary size must be 0 otherwise)
+ * @param pCheckpoints array of checkpoints to fill out, if nCheckpointInterval isn't 0
+ * @param nMaxCheckpoints capacity of checkpoints array, at least salvador_get_max_checkpoints()
+ * @param pNumCheckpoints pointer to returned number of checkpoints, if nCheckpointInterval isn't 0
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return actual compressed size, or -1 for error
+ */
+static size_t salvador_compress_serial(salvador_compressor *pCompressor, const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+      const size_t nDictionarySize, const size_t nCheckpointInterval, salvador_checkpoint *pCheckpoints, const int nMaxCheckpoints, int *pNumCheckpoints,
+      void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats) {
+   size_t nOriginalSize = 0;
+   size_t nCompressedSize = 0L;
+   int nError = 0;
+   const int nBlockSize = salvador_get_block_size(nInputSize, pCompressor->flags);
+   const int nMaxOutBlockSize = (int)salvador_get_max_compressed_size(nBlockSize);
+
+   int nNumBlocks = 0;
+   int nCurBitsOffset = 0, nCurBitShift = -1, nCurFinalLiterals = 0;
+   int nBlockFlags = 3;
+   int nCurRepMatchOffset = 1;
+   size_t nSegmentStart = 0, nSegmentEnd = nInputSize;
+   int nNumCheckpoints = 0;
+   int nCheckpointDue = nCheckpointInterval ? 1 : 0;
+
+   if (nDictionarySize) {
+      nOriginalSize = (int)nDictionarySize;
+   }
+
+   while (nOriginalSize < nInputSize && !nError) {
+      int nInDataSize = 0;
+      int nOutDataSize;
+      int nOutDataEnd = (int)(nMaxOutBufferSize - nCompressedSize);
+
+      if (nOutDataEnd > nMaxOutBlockSize)
+         nOutDataEnd = nMaxOutBlockSize;
+
+      if (nCheckpointDue) {
+         /* The previous block ended at the planned checkpoint, apart from the literals that it deferred to this block. Place the checkpoint
+          * here, unless deferring literals brought it too close to the previous one, in which case the segment is extended instead */
+         nCheckpointDue = 0;
+         if (!nNumCheckpoints || (nOriginalSize - pCheckpoints[nNumCheckpoints - 1].out_offset) >= (nCheckpointInterval >> 1)) {
+            salvador_checkpoint *pCheckpoint;
+
+            if (nNumCheckpoints >= nMaxCheckpoints) {
+               nError = -1;
+               break;
+            }
+
+            pCheckpoint = &pCheckpoints[nNumCheckpoints++];
+            pCheckpoint->out_offset = nOriginalSize;
+            pCheckpoint->in_offset = nCompressedSize;
+            pCheckpoint->bits_offset = (nCurBitShift != -1) ? (nCompressedSize + nCurBitsOffset) : 0;
+            pCheckpoint->bit_shift = nCurBitShift;
+            pCheckpoint->rep_offset = nCurRepMatchOffset;
+
+            /* Compress the new segment as if the input started at the checkpoint, so that no match reaches before it */
+            nSegmentStart = nOriginalSize;
+            nSegmentEnd = nOriginalSize + nCheckpointInterval;
+            pCompressor->window_end = 0;
+            pCompressor->matched_end = 0;
+         }
+         else {
+            nSegmentEnd += (nCheckpointInterval >> 1);
+         }
+
+         if (nSegmentEnd > nInputSize)
+            nSegmentEnd = nInputSize;
+      }
+
+      nOutDataSize = salvador_compressor_shrink_indexed_block(pCompressor, pInputData + nSegmentStart, nOriginalSize - nSegmentStart, nSegmentEnd - nSegmentStart, nBlockSize, &nInDataSize, pOutBuffer ? (pOutBuffer + nCompressedSize) : NULL, nOutDataEnd,
+         &nCurBitsOffset, &nCurBitShift, &nCurFinalLiterals, &nCurRepMatchOffset, (nSegmentEnd < nInputSize) ? (nBlockFlags & (~2)) : nBlockFlags);
+
+      if (nSegmentEnd < nInputSize && (nOriginalSize + nInDataSize) >= nSegmentEnd)
+         nCheckpointDue = 1;
+
+      if (nOutDataSize >= 0 && nCurFinalLiterals >= 0 && nCurFinalLiterals < nInDataSize) {
+         /* Write compressed block */
+
+         nBlockFlags &= (~1);
+         nOriginalSize += (nInDataSize - nCurFinalLiterals);
+         nCurFinalLiterals = 0;
+         nCompressedSize += nOutDataSize;
+         if (nCurBitShift != -1)
+            nCurBitsOffset -= nOutDataSize;
+      }
+      else if (nOutDataSize == 0 && nCurFinalLiterals == nInDataSize && nSegmentEnd < nInputSize) {
+         /* The segment ends with literals only, that can't be written before a match follows them; extend it and compress them again */
+         nCurFinalLiterals = 0;
+         nCheckpointDue = 0;
+         nSegmentEnd += (nCheckpointInterval >> 1);
+         if (nSegmentEnd > nInputSize)
+            nSegmentEnd = nInputSize;
+      }
+      else {
+         nError = -1;
+      }
+
+      nNumBlocks++;
+
+      if (!nError && nOriginalSize < nInputSize) {
+         if (progress)
+            progress(nOriginalSize, nCompressedSize);
+      }
+   }
+
+   /* The caller may free the input data once this returns */
+   salvador_stop_match_prefetch(pCompressor);
+
+   if (progress)
+      progress(nOriginalSize, nCompressedSize);
+   if (pStats)
+      *pStats = pCompressor->stats;
+   if (pNumCheckpoints)
+      *pNumCheckpoints = nNumCheckpoints;
+
+   if (nError) {
+      return -1;
+   }
+   else {
+      return nCompressedSize;
+   }
+}
+
+/** Shared state for block-parallel compression */
+typedef struct _salvador_parallel_job {
+   salvador_mutex lock;
+   const unsigned char *pInputData;
+   size_t nInputSize;
+   size_t nDictionarySize;
+   int nBlockSize;
+   int nNumBlocks;
+   int nNextBlock;
+   int nError;
+   salvador_match *pBestMatch;
+} salvador_parallel_job;
+
+/** Per-thread state for block-parallel compression */
+typedef struct _salvador_parallel_worker {
+   salvador_parallel_job *pJob;
+   salvador_compressor *pCompressor;
+   salvador_thread thread;
+} salvador_parallel_worker;
+
+/**
+ * Worker thread for block-parallel compression: parse blocks until there are none left
+ *
+ * @param pArg worker state
+ */
+static void salvador_parallel_worker_func(void *pArg) {
+   salvador_parallel_worker *pWorker = (salvador_parallel_worker *)pArg;
+   salvador_parallel_job *pJob = pWorker->pJob;
+
+   while (1) {
+      int nBlockIdx;
+
+      salvador_mutex_lock(&pJob->lock);
+      nBlockIdx = pJob->nError ? pJob->nNumBlocks : pJob->nNextBlock++;
+      salvador_mutex_unlock(&pJob->lock);
+
+      if (nBlockIdx >= pJob->nNumBlocks)
+         break;
+
+      const size_t nBlockStart = pJob->nDictionarySize + (size_t)nBlockIdx * pJob->nBlockSize;
+      int nInDataSize = (int)(pJob->nInputSize - nBlockStart);
+      if (nInDataSize > pJob->nBlockSize)
+         nInDataSize = pJob->nBlockSize;
+
+      /* The previous block, or the dictionary for the first block, serves as history. The incoming rep offset isn't known until the
+       * previous blocks are parsed, so the parse starts with the initial rep offset; the writer only emits rep matches that are valid. */
+      const int nPreviousBlockSize = nBlockIdx ? pJob->nBlockSize : (int)pJob->nDictionarySize;
+      const int nAssumedRepMatchOffset = 1;
+      int nBlockFlags = nBlockIdx ? 0 : 1;
+      if (nBlockIdx == (pJob->nNumBlocks - 1))
+         nBlockFlags |= 2;
+
+      const unsigned char *pWindowData = pJob->pInputData + nBlockStart - nPreviousBlockSize;
+      if (pWorker->pCompressor->flags & FLG_NATIVE_BACKWARD)
+         pWindowData = salvador_get_reversed_window(pWorker->pCompressor, pJob->pInputData, pJob->nInputSize, nBlockStart - nPreviousBlockSize, nPreviousBlockSize + nInDataSize);
+
+      if (!pWindowData || salvador_compressor_parse_block(pWorker->pCompressor, pWindowData, nPreviousBlockSize, nInDataSize, nBlockIdx ? 0 : nPreviousBlockSize, &nAssumedRepMatchOffset, nBlockFlags)) {
+         salvador_mutex_lock(&pJob->lock);
+         pJob->nError = 1;
+         salvador_mutex_unlock(&pJob->lock);
+         break;
+      }
+
+      memcpy(pJob->pBestMatch + (nBlockStart - pJob->nDictionarySize), pWorker->pCompressor->best_match, nInDataSize * sizeof(salvador_match));
+   }
+}
+
+/**
+ * Compress memory, parsing blocks in parallel on several threads, using already allocated compression contexts
+ *
+ * @param pCompressors compression contexts, one per thread, with tables allocated for the block size selected by the flags
+ * @param nNumThreads number of threads to use
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none)
+ * @param pDictionary prepared dictionary to query for matches into the dictionary, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return actual compressed size, or -1 for error
+ */
+static size_t salvador_compress_blocks_parallel(salvador_compressor *pCompressors, const int nNumThreads, const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+      const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, const salvador_dictionary *pDictionary, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats) {
+   salvador_parallel_job job;
+   salvador_parallel_worker *pWorkers;
+   salvador_compressor writer;
+   const int nBlockSize = salvador_get_max_block_size(nFlags);
+   const int nMaxOutBlockSize = (int)salvador_get_max_compressed_size(nBlockSize * 2);
+   const int nNumBlocks = (int)((nInputSize - nDictionarySize + nBlockSize - 1) / nBlockSize);
+   long long nStartTime;
+   int nNumStarted;
+   int i;
+
+   job.pInputData = pInputData;
+   job.nInputSize = nInputSize;
+   job.nDictionarySize = nDictionarySize;
+   job.nBlockSize = nBlockSize;
+   job.nNumBlocks = nNumBlocks;
+   job.nNextBlock = 0;
+   job.nError = 0;
+   job.pBestMatch = (salvador_match *)malloc((nInputSize - nDictionarySize) * sizeof(salvador_match));
+   if (!job.pBestMatch)
+      return -1;
+
+   pWorkers = (salvador_parallel_worker *)malloc(nNumThreads * sizeof(salvador_parallel_worker));
+   if (!pWorkers) {
+      free(job.pBestMatch);
+      return -1;
+   }
+
+   if (salvador_mutex_init(&job.lock)) {
+      free(pWorkers);
+      free(job.pBestMatch);
+      return -1;
+   }
+
+   /* Parse all blocks */
+
+   for (nNumStarted = 0; nNumStarted < nNumThreads; nNumStarted++) {
+      salvador_parallel_worker *pWorker = &pWorkers[nNumStarted];
+
+      pWorker->pJob = &job;
+      pWorker->pCompressor = &pCompressors[nNumStarted];
+      salvador_compressor_configure(pWorker->pCompressor, nMaxOffset, nFlags);
+      pWorker->pCompressor->dictionary = pDictionary;
+      pWorker->pCompressor->dictionary_size = nDictionarySize;
+      if (salvador_thread_create(&pWorker->thread, salvador_parallel_worker_func, pWorker))
+         break;
+   }
+
+   if (nNumStarted == 0) {
+      job.nError = 1;
+   }
+
+   for (i = 0; i < nNumStarted; i++) {
+      salvador_thread_join(&pWorkers[i].thread);
+   }
+
+   salvador_mutex_destroy(&job.lock);
+   free(pWorkers);
+   pWorkers = NULL;
+
+   /* Serially emit the selected matches. The rep offset, bit-packing state and pending literals are carried across blocks here, exactly
+    * as in single-threaded compression. Output blocks end where the parsed blocks end, so that no match straddles two of them. */
+
+   memset(&writer, 0, sizeof(writer));
+   writer.max_window_size = nBlockSize * 2;
+   salvador_compressor_configure(&writer, nMaxOffset, nFlags);
+   for (i = 0; i < nNumStarted; i++) {
+      salvador_add_work_stats(&writer.stats, &pCompressors[i].stats);
+   }
+
+   size_t nOriginalSize = nDictionarySize;
+   size_t nCompressedSize = 0L;
+   int nCurBitsOffset = 0, nCurBitShift = -1, nCurFinalLiterals = 0;
+   int nBlockFlags = 1;
+   int nCurRepMatchOffset = 1;
+   int nError = job.nError;
+
+   for (i = 0; i < nNumBlocks && !nError; i++) {
+      size_t nBlockEnd = nDictionarySize + (size_t)(i + 1) * nBlockSize;
+      int nInDataSize, nOutDataSize;
+      int nOutDataEnd = (int)(nMaxOutBufferSize - nCompressedSize);
+
+      if (nBlockEnd > nInputSize)
+         nBlockEnd = nInputSize;
+      nInDataSize = (int)(nBlockEnd - nOriginalSize);
+
+      if (nOutDataEnd > nMaxOutBlockSize)
+         nOutDataEnd = nMaxOutBlockSize;
+
+      if (nBlockEnd >= nInputSize)
+         nBlockFlags |= 2;
+
+      writer.best_match = job.pBestMatch + (nOriginalSize - nDictionarySize);
+      nStartTime = (nFlags & FLG_PHASE_STATS) ? salvador_get_time() : 0LL;
+      if (writer.flags & FLG_NATIVE_BACKWARD) {
+         /* The writer only reads the literals, from the start of the pending bytes */
+         const unsigned char *pWindowData = salvador_get_reversed_window(&writer, pInputData, nInputSize, nOriginalSize, nInDataSize);
+
+         nOutDataSize = pWindowData ? salvador_write_block(&writer, pWindowData, 0, nInDataSize, pOutBuffer + nCompressedSize, nOutDataEnd,
+            &nCurBitsOffset, &nCurBitShift, &nCurFinalLiterals, &nCurRepMatchOffset, nBlockFlags) : -1;
+      }
+      else {
+         nOutDataSize = salvador_write_block(&writer, pInputData, (int)nOriginalSize, (int)nBlockEnd, pOutBuffer + nCompressedSize, nOutDataEnd,
+            &nCurBitsOffset, &nCurBitShift, &nCurFinalLiterals, &nCurRepMatchOffset, nBlockFlags);
+      }
+      if (nFlags & FLG_PHASE_STATS)
+         writer.stats.write_time += salvador_get_time() - nStartTime;
+
+      if (nOutDataSize >= 0 && nCurFinalLiterals >= 0 && nCurFinalLiterals <= nInDataSize) {
+         if (nCurFinalLiterals < nInDataSize)
+            nBlockFlags &= (~1);
+
+         nOriginalSize += (nInDataSize - nCurFinalLiterals);
+         nCurFinalLiterals = 0;
+         nCompressedSize += nOutDataSize;
+         if (nCurBitShift != -1)
+            nCurBitsOffset -= nOutDataSize;
+
+         if (progress && nOriginalSize < nInputSize)
+            progress(nOriginalSize, nCompressedSize);
+      }
+      else {
+         nError = -1;
+      }
+   }
+
+   free(job.pBestMatch);
+   job.pBestMatch = NULL;
+   if (writer.reversed_window) {
+      free(writer.reversed_window);
+      writer.reversed_window = NULL;
+   }
+
+   if (progress)
+      progress(nOriginalSize, nCompressedSize);
+   if (pStats)
+      *pStats = writer.stats;
+
+   if (nError) {
+      return -1;
+   }
+   else {
+      return nCompressedSize;
+   }
+}
+
+/**
+ * Check if compressing with the specified flags requires the suffix array match finder
+ *
+ * @param nFlags compression flags
+ *
+ * @return 1 if the suffix array is used, 0 if only hash chains are
+ */
+static int salvador_level_uses_suffix_array(const int nFlags) {
+   return (!(nFlags & FLG_FAST_MATCHFINDER) && !salvador_get_level(nFlags)->chain_candidates) ? 1 : 0;
+}
+
+/**
+ * Make sure that the specified number of compression contexts are allocated, for at least the specified block size and the effort of the compression level
+ *
+ * @param pContext reusable compression context
+ * @param nNumCompressors number of compression contexts required
+ * @param nBlockSize block size required
+ * @param nWindowSize input window size required
+ * @param nFlags compression flags, selecting the compression level
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int salvador_context_prepare(salvador_context *pContext, const int nNumCompressors, const int nBlockSize, const int nWindowSize, const int nFlags) {
+   const salvador_level *pLevel = salvador_get_level(nFlags);
+   const int nSuffixArray = salvador_level_uses_suffix_array(nFlags);
+
+   if (nBlockSize > pContext->block_size || nWindowSize > pContext->window_size ||
+      pLevel->arrivals_per_position > pContext->arrivals_per_position || pLevel->matches_per_index > pContext->matches_per_index ||
+      nSuffixArray > pContext->has_suffix_array) {
+      /* Grow tables to the largest block and window sizes, and the highest effort seen so far */
+      const int nMaxBlockSize = (nBlockSize > pContext->block_size) ? nBlockSize : pContext->block_size;
+      const int nMaxWindowSize = (nWindowSize > pContext->window_size) ? nWindowSize : pContext->window_size;
+      const int nMaxArrivals = (pLevel->arrivals_per_position > pContext->arrivals_per_position) ? pLevel->arrivals_per_position : pContext->arrivals_per_position;
+      const int nMaxMatches = (pLevel->matches_per_index > pContext->matches_per_index) ? pLevel->matches_per_index : pContext->matches_per_index;
+      const int nHasSuffixArray = nSuffixArray | pContext->has_suffix_array;
+
+      salvador_context_reset(pContext);
+      pContext->block_size = nMaxBlockSize;
+      pContext->window_size = nMaxWindowSize;
+      pContext->arrivals_per_position = nMaxArrivals;
+      pContext->matches_per_index = nMaxMatches;
+      pContext->has_suffix_array = nHasSuffixArray;
+   }
+
+   while (pContext->num_compressors < nNumCompressors) {
+      salvador_compressor *pCompressor = &pContext->compressors[pContext->num_compressors];
+      salvador_memory_source source = pContext->memory;
+
+      source.huge_pages = (nFlags & FLG_HUGE_PAGES) ? 1 : 0;
+
+      /* The arenas are carved out of the memory block supplied by the caller one after the other */
+      if (source.block) {
+         source.block += pContext->memory_used;
+         source.block_size = (pContext->memory_used < pContext->memory.block_size) ? (pContext->memory.block_size - pContext->memory_used) : 0;
+      }
+
+      if (salvador_compressor_init(pCompressor, pContext->block_size, pContext->window_size, 0, pContext->arrivals_per_position, pContext->matches_per_index, pContext->has_suffix_array, &source, 0))
+         return 100;
+      if (source.block)
+         pContext->memory_used += salvador_arena_get_footprint(&pCompressor->arena);
+      pContext->num_compressors++;
+   }
+
+   return 0;
+}
+
+/**
+ * Create reusable compression context
+ *
+ * @param nNumThreads number of threads to compress blocks on (0 for one per CPU, 1 for single-threaded compression); threads left over when
+ *        there are fewer blocks than threads are used to sort suffixes
+ *
+ * @return compression context, or NULL for failure
+ */
+salvador_context *salvador_context_create(int nNumThreads) {
+   salvador_context *pContext;
+
+   if (nNumThreads <= 0)
+      nNumThreads = salvador_get_num_cpus();
+
+   pContext = (salvador_context *)malloc(sizeof(salvador_context));
+   if (!pContext)
+      return NULL;
+
+   pContext->compressors = (salvador_compressor *)malloc(nNumThreads * sizeof(salvador_compressor));
+   if (!pContext->compressors) {
+      free(pContext);
+      return NULL;
+   }
+
+   pContext->num_threads = nNumThreads;
+   pContext->num_compressors = 0;
+   pContext->block_size = 0;
+   pContext->window_size = 0;
+   pContext->arrivals_per_position = 0;
+   pContext->matches_per_index = 0;
+   pContext->has_suffix_array = 0;
+   pContext->dictionary = NULL;
+   memset(&pContext->memory, 0, sizeof(salvador_memory_source));
+   pContext->memory_used = 0;
+   return pContext;
+}
+
+/**
+ * Compress memory using a reusable compression context
+ *
+ * @param pContext reusable compression context
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t salvador_context_compress(salvador_context *pContext, const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+      const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats) {
+   const int nBlockSize = salvador_get_block_size(nInputSize, nFlags);
+   size_t nCompressedSize;
+   int nNumBlocks, i;
+
+   if (nDictionarySize > nInputSize)
+      return -1;
+
+   nNumBlocks = (int)((nInputSize - nDictionarySize + salvador_get_max_block_size(nFlags) - 1) / salvador_get_max_block_size(nFlags));
+   if (pContext->num_threads > 1 && nNumBlocks > 1) {
+      const int nNumThreads = (pContext->num_threads < nNumBlocks) ? pContext->num_threads : nNumBlocks;
+
+      if (salvador_context_prepare(pContext, nNumThreads, salvador_get_max_block_size(nFlags), salvador_get_max_block_size(nFlags) * 2, nFlags))
+         return -1;
+
+      /* Threads that no block is left for help sort the suffixes of the windows */
+      for (i = 0; i < nNumThreads; i++)
+         pContext->compressors[i].divsufsort_context.num_threads = pContext->num_threads / nNumThreads;
+
+      nCompressedSize = salvador_compress_blocks_parallel(pContext->compressors, nNumThreads, pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, nFlags, nMaxOffset, nDictionarySize, pContext->dictionary, progress, pStats);
+   }
+   else {
+      if (salvador_context_prepare(pContext, 1, nBlockSize, salvador_get_window_size(nInputSize, nBlockSize), nFlags))
+         return -1;
+
+      /* Blocks depend on each other and are compressed one after the other; sort the suffixes of each window on all threads instead */
+      pContext->compressors[0].divsufsort_context.num_threads = pContext->num_threads;
+      salvador_compressor_configure(&pContext->compressors[0], nMaxOffset, nFlags);
+      pContext->compressors[0].dictionary = pContext->dictionary;
+      pContext->compressors[0].dictionary_size = nDictionarySize;
+      nCompressedSize = salvador_compress_serial(&pContext->compressors[0], pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, nDictionarySize, 0, NULL, 0, NULL, progress, pStats);
+   }
+
+   if (nCompressedSize != (size_t)-1 && (nFlags & FLG_IS_BACKWARD) && (nFlags & FLG_NATIVE_BACKWARD)) {
+      /* The stream was emitted in the order that the decompressor reads it, starting at the end; store it in file order */
+      unsigned char *pLeft = pOutBuffer;
+      unsigned char *pRight = pOutBuffer + nCompressedSize;
+
+      while (pLeft < pRight) {
+         const unsigned char c = *pLeft;
+
+         *pLeft++ = *--pRight;
+         *pRight = c;
+      }
+   }
+
+   return nCompressedSize;
+}
+
+/**
+ * Index one more position for the greedy size estimate, linking it to the previous occurrence of the same two bytes
+ *
+ * @param pInputData pointer to input(source) data
+ * @param nPosition position to index; the next byte must be available
+ * @param nMaxOffset maximum match offset to use
+ * @param last_pos_for_pair last position that each pair of bytes was seen at, or (size_t)-1
+ * @param prev_offset_for_pos offset back to the previous occurrence of the pair of bytes at each position, for the last ESTIMATE_HISTORY_SIZE positions (0 for none)
+ */
+static inline void salvador_estimate_insert(const unsigned char *pInputData, const size_t nPosition, const size_t nMaxOffset, size_t *last_pos_for_pair, unsigned short *prev_offset_for_pos) {
+   const unsigned int nPair = ((unsigned int)pInputData[nPosition]) | (((unsigned int)pInputData[nPosition + 1]) << 8);
+   const size_t nPrevPos = last_pos_for_pair[nPair];
+
+   prev_offset_for_pos[nPosition & (ESTIMATE_HISTORY_SIZE - 1)] = (nPrevPos != (size_t)-1 && (nPosition - nPrevPos) <= nMaxOffset) ? (unsigned short)(nPosition - nPrevPos) : 0;
+   last_pos_for_pair[nPair] = nPosition;
+}
+
+/**
+ * Estimate the compressed size with a quick greedy parse: at each position, the match that saves the most bits over literals is taken,
+ * out of the rep match and of a few previous occurrences of the next two bytes, without finding all the matches or running the optimizer
+ *
+ * @param pInputData pointer to input(source) data, in the order that it is compressed in
+ * @param nInputSize input(source) size in bytes, including the dictionary
+ * @param nMaxOffset maximum match offset to use
+ * @param nDictionarySize size of dictionary in front of input data (0 for none)
+ *
+ * @return estimated compressed size, or -1 for error
+ */
+static size_t salvador_estimate_greedy(const unsigned char *pInputData, const size_t nInputSize, const size_t nMaxOffset, const size_t nDictionarySize) {
+   size_t *last_pos_for_pair;
+   unsigned short *prev_offset_for_pos;
+   long long nBits = 0LL;
+   size_t nNumLiterals = 0;
+   size_t nRepMatchOffset = 1;
+   size_t nPosition;
+
+   last_pos_for_pair = (size_t *)malloc(65536 * sizeof(size_t));
+   if (!last_pos_for_pair)
+      return -1;
+   prev_offset_for_pos = (unsigned short *)malloc(ESTIMATE_HISTORY_SIZE * sizeof(unsigned short));
+   if (!prev_offset_for_pos) {
+      free(last_pos_for_pair);
+      return -1;
+   }
+   memset(last_pos_for_pair, 0xff, 65536 * sizeof(size_t));
+   salvador_simd_init();
+
+   /* Index the end of the dictionary that matches can reach */
+   for (nPosition = (nDictionarySize > nMaxOffset) ? (nDictionarySize - nMaxOffset) : 0; nPosition < nDictionarySize && (nPosition + 1) < nInputSize; nPosition++)
+      salvador_estimate_insert(pInputData, nPosition, nMaxOffset, last_pos_for_pair, prev_offset_for_pos);
+
+   nPosition = nDictionarySize;
+   while (nPosition < nInputSize) {
+      const int nMaxLen = ((nInputSize - nPosition) < 65536) ? (int)(nInputSize - nPosition) : 65536;
+      size_t nBestOffset = 0;
+      int nBestLen = 0;
+      int nBestSavings = 0;
+
+      if (nMaxLen >= 2) {
+         size_t nMatchOffset;
+         int nCandidates = ESTIMATE_CHAIN_CANDIDATES;
+
+         salvador_estimate_insert(pInputData, nPosition, nMaxOffset, last_pos_for_pair, prev_offset_for_pos);
+
+         for (nMatchOffset = prev_offset_for_pos[nPosition & (ESTIMATE_HISTORY_SIZE - 1)]; nMatchOffset && nMatchOffset <= nMaxOffset && nCandidates--; ) {
+            const size_t nMatchPos = nPosition - nMatchOffset;
+
+            if (nBestLen < 2 || (nBestLen < nMaxLen && pInputData[nMatchPos + nBestLen] == pInputData[nPosition + nBestLen])) {
+               const int nLen = 2 + salvador_get_common_len(pInputData + nPosition + 2, pInputData + nMatchPos + 2, nMaxLen - 2);
+               const int nMatchLenCost = (nLen < 8192) ? salvador_cost_for_len[nLen - 1] : (salvador_get_match_varlen_size_norep(nLen) + TOKEN_SIZE);
+               const int nSavings = (nLen << 3) - (OFFSET_COST(nMatchOffset) + nMatchLenCost);
+
+               if (nSavings > nBestSavings) {
+                  nBestOffset = nMatchOffset;
+                  nBestLen = nLen;
+                  nBestSavings = nSavings;
+               }
+            }
+
+            /* Candidates are visited by increasing offset: only a longer match can save more than the best one so far */
+            if (!prev_offset_for_pos[nMatchPos & (ESTIMATE_HISTORY_SIZE - 1)])
+               break;
+            nMatchOffset += prev_offset_for_pos[nMatchPos & (ESTIMATE_HISTORY_SIZE - 1)];
+         }
       }
 
-      if (!nError && nOriginalSize < nInputSize) {
-         if (progress)
-            progress(nOriginalSize, nCompressedSize);
+      if (nNumLiterals && nPosition >= nRepMatchOffset && pInputData[nPosition] == pInputData[nPosition - nRepMatchOffset]) {
+         /* A rep match can only follow literals */
+         const int nLen = 1 + salvador_get_common_len(pInputData + nPosition + 1, pInputData + nPosition - nRepMatchOffset + 1, nMaxLen - 1);
+         const int nRepSavings = (nLen << 3) - ((nLen < 8192) ? salvador_cost_for_len[nLen] : (salvador_get_match_varlen_size_rep(nLen) + TOKEN_SIZE));
+
+         if (nRepSavings > nBestSavings) {
+            nBestOffset = nRepMatchOffset;
+            nBestLen = nLen;
+            nBestSavings = nRepSavings;
+         }
+      }
+
+      if (nBestSavings > 0 && nPosition > nDictionarySize) {
+         /* The stream always starts with a literal */
+         size_t i;
+
+         if (nNumLiterals) {
+            nBits += (long long)salvador_get_literals_varlen_size((int)nNumLiterals) + (((long long)nNumLiterals) << 3);
+            nNumLiterals = 0;
+         }
+
+         nBits += (long long)((nBestLen << 3) - nBestSavings);
+         nRepMatchOffset = nBestOffset;
+
+         for (i = nPosition + 1; i < (nPosition + nBestLen) && (i + 1) < nInputSize; i++)
+            salvador_estimate_insert(pInputData, i, nMaxOffset, last_pos_for_pair, prev_offset_for_pos);
+         nPosition += nBestLen;
+      }
+      else {
+         nNumLiterals++;
+         nPosition++;
       }
    }
 
-   if (progress)
-      progress(nOriginalSize, nCompressedSize);
-   if (pStats)
-      *pStats = compressor.stats;
+   if (nNumLiterals)
+      nBits += (long long)salvador_get_literals_varlen_size((int)nNumLiterals) + (((long long)nNumLiterals) << 3);
+   nBits += TOKEN_SIZE + salvador_get_elias_size(256) /* EOD */;
 
-   salvador_compressor_destroy(&compressor);
+   free(prev_offset_for_pos);
+   prev_offset_for_pos = NULL;
+   free(last_pos_for_pair);
+   last_pos_for_pair = NULL;
 
-   if (nError) {
+   return (size_t)((nBits + 7) >> 3);
+}
+
+/**
+ * Get the compressed size of memory using a reusable compression context, without writing any compressed data
+ *
+ * @param pContext reusable compression context (unused with SALVADOR_ESTIMATE_GREEDY, and can then be NULL)
+ * @param pInputData pointer to input(source) data to compress
+ * @param nInputSize input(source) size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param nMode SALVADOR_ESTIMATE_EXACT or SALVADOR_ESTIMATE_GREEDY
+ * @param pStats pointer to compression stats that are filled for SALVADOR_ESTIMATE_EXACT if this function is successful, or NULL
+ *
+ * @return compressed size (exact, or estimated), or -1 for error
+ */
+size_t salvador_context_estimate(salvador_context *pContext, const unsigned char *pInputData, const size_t nInputSize, const unsigned int nFlags, const size_t nMaxOffset,
+      const size_t nDictionarySize, const int nMode, salvador_stats *pStats) {
+   if (nDictionarySize > nInputSize)
       return -1;
+
+   if (nMode == SALVADOR_ESTIMATE_GREEDY) {
+      const size_t nParseMaxOffset = (nMaxOffset && nMaxOffset < MAX_OFFSET) ? nMaxOffset : MAX_OFFSET;
+
+      if ((nFlags & FLG_IS_BACKWARD) && (nFlags & FLG_NATIVE_BACKWARD)) {
+         /* Parse the data in the order that it is compressed in, with the dictionary that follows it in front */
+         unsigned char *pReversedData = (unsigned char *)malloc(nInputSize ? nInputSize : 1);
+         size_t nEstimatedSize;
+         size_t i;
+
+         if (!pReversedData)
+            return -1;
+         for (i = 0; i < nInputSize; i++)
+            pReversedData[i] = pInputData[nInputSize - 1 - i];
+
+         nEstimatedSize = salvador_estimate_greedy(pReversedData, nInputSize, nParseMaxOffset, nDictionarySize);
+         free(pReversedData);
+         pReversedData = NULL;
+
+         return nEstimatedSize;
+      }
+      else {
+         return salvador_estimate_greedy(pInputData, nInputSize, nParseMaxOffset, nDictionarySize);
+      }
+   }
+   else if (nMode == SALVADOR_ESTIMATE_EXACT) {
+      const int nBlockSize = salvador_get_block_size(nInputSize, nFlags);
+
+      /* Run the single-threaded compressor, with the writer counting the bytes it would emit */
+      if (salvador_context_prepare(pContext, 1, nBlockSize, salvador_get_window_size(nInputSize, nBlockSize), nFlags))
+         return -1;
+
+      pContext->compressors[0].divsufsort_context.num_threads = pContext->num_threads;
+      salvador_compressor_configure(&pContext->compressors[0], nMaxOffset, nFlags);
+      pContext->compressors[0].dictionary = pContext->dictionary;
+      pContext->compressors[0].dictionary_size = nDictionarySize;
+      return salvador_compress_serial(&pContext->compressors[0], pInputData, NULL, nInputSize, salvador_get_max_compressed_size(nInputSize), nDictionarySize, 0, NULL, 0, NULL, NULL, pStats);
    }
    else {
-      return nCompressedSize;
+      return -1;
+   }
+}
+
+/**
+ * Attach a prepared dictionary to a reusable compression context, or detach it
+ *
+ * @param pContext reusable compression context
+ * @param pDictionary prepared dictionary, or NULL to detach it
+ */
+void salvador_context_set_dictionary(salvador_context *pContext, const salvador_dictionary *pDictionary) {
+   pContext->dictionary = pDictionary;
+}
+
+/**
+ * Free the tables held by a reusable compression context; they are allocated again as needed by the next compression
+ *
+ * @param pContext reusable compression context
+ */
+void salvador_context_reset(salvador_context *pContext) {
+   int i;
+
+   for (i = 0; i < pContext->num_compressors; i++)
+      salvador_compressor_destroy(&pContext->compressors[i]);
+   pContext->num_compressors = 0;
+   pContext->block_size = 0;
+   pContext->window_size = 0;
+   pContext->arrivals_per_position = 0;
+   pContext->matches_per_index = 0;
+   pContext->has_suffix_array = 0;
+   pContext->memory_used = 0;
+}
+
+/**
+ * Set where a reusable compression context gets its working memory from
+ *
+ * @param pContext reusable compression context
+ * @param pAllocator allocator callbacks for the arenas and the tables that grow, or NULL for the C heap; both callbacks must be set
+ * @param pMemory memory block to carve the arenas of all the threads out of, or NULL to allocate them; it must remain valid, and must
+ *        not be used for anything else, until the context is destroyed, reset, or given another source. Compressing fails if it is too small
+ * @param nMemorySize size of that memory block in bytes
+ */
+void salvador_context_set_memory(salvador_context *pContext, const salvador_allocator *pAllocator, void *pMemory, const size_t nMemorySize) {
+   salvador_context_reset(pContext);
+
+   memset(&pContext->memory, 0, sizeof(salvador_memory_source));
+   if (pAllocator && pAllocator->alloc_func && pAllocator->free_func)
+      pContext->memory.allocator = *pAllocator;
+   pContext->memory.block = (unsigned char *)pMemory;
+   pContext->memory.block_size = pMemory ? nMemorySize : 0;
+}
+
+/**
+ * Get the size of the memory block that compressing with a reusable compression context needs, for salvador_context_set_memory()
+ *
+ * @param pContext reusable compression context
+ * @param nInputSize input(source) size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none)
+ *
+ * @return size in bytes, enough for the arenas of all the threads that salvador_context_compress() uses for this input
+ */
+size_t salvador_context_get_memory_size(const salvador_context *pContext, const size_t nInputSize, const unsigned int nFlags, const size_t nDictionarySize) {
+   const salvador_level *pLevel = salvador_get_level(nFlags);
+   const int nMaxBlockSize = salvador_get_max_block_size(nFlags);
+   const int nNumBlocks = (nDictionarySize < nInputSize) ? (int)((nInputSize - nDictionarySize + nMaxBlockSize - 1) / nMaxBlockSize) : 0;
+   salvador_compressor measure;
+   int nNumCompressors, nBlockSize, nWindowSize, nArrivals;
+
+   /* Size the tables as salvador_context_prepare() does, for the threads that salvador_context_compress() uses */
+   if (pContext->num_threads > 1 && nNumBlocks > 1) {
+      nNumCompressors = (pContext->num_threads < nNumBlocks) ? pContext->num_threads : nNumBlocks;
+      nBlockSize = nMaxBlockSize;
+      nWindowSize = nMaxBlockSize * 2;
+   }
+   else {
+      nNumCompressors = 1;
+      nBlockSize = salvador_get_block_size(nInputSize, nFlags);
+      nWindowSize = salvador_get_window_size(nInputSize, nBlockSize);
+   }
+
+   if (nNumCompressors < pContext->num_compressors)
+      nNumCompressors = pContext->num_compressors;
+   if (nBlockSize < pContext->block_size)
+      nBlockSize = pContext->block_size;
+   if (nWindowSize < pContext->window_size)
+      nWindowSize = pContext->window_size;
+   nArrivals = (pLevel->arrivals_per_position > pContext->arrivals_per_position) ? pLevel->arrivals_per_position : pContext->arrivals_per_position;
+
+   salvador_arena_measure(&measure.arena, NULL);
+   salvador_compressor_carve_tables(&measure, nBlockSize, nWindowSize, nArrivals, salvador_level_uses_suffix_array(nFlags) | pContext->has_suffix_array);
+
+   /* Each arena may have to skip a few bytes to start aligned */
+   return (measure.arena.used + SALVADOR_ARENA_ALIGNMENT - 1) * (size_t)nNumCompressors;
+}
+
+/**
+ * Destroy reusable compression context and free up all associated resources
+ *
+ * @param pContext reusable compression context, or NULL
+ */
+void salvador_context_destroy(salvador_context *pContext) {
+   if (pContext) {
+      salvador_context_reset(pContext);
+
+      free(pContext->compressors);
+      pContext->compressors = NULL;
+      free(pContext);
+   }
+}
+
+/**
+ * Compress memory
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t salvador_compress(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+      const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats) {
+   return salvador_compress_parallel(pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, nFlags, nMaxOffset, nDictionarySize, 1, progress, pStats);
+}
+
+/**
+ * Compress memory, parsing blocks in parallel on several threads
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param nNumThreads number of threads to use (0 for one per CPU)
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t salvador_compress_parallel(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+      const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, int nNumThreads, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats) {
+   salvador_context *pContext = salvador_context_create(nNumThreads);
+   size_t nCompressedSize;
+
+   if (!pContext)
+      return -1;
+
+   nCompressedSize = salvador_context_compress(pContext, pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, nFlags, nMaxOffset, nDictionarySize, progress, pStats);
+   salvador_context_destroy(pContext);
+
+   return nCompressedSize;
+}
+
+/**
+ * Get the compressed size of memory, without writing any compressed data
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param nInputSize input(source) size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param nMode SALVADOR_ESTIMATE_EXACT or SALVADOR_ESTIMATE_GREEDY
+ *
+ * @return compressed size (exact, or estimated), or -1 for error
+ */
+size_t salvador_estimate_compressed_size(const unsigned char *pInputData, const size_t nInputSize, const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, const int nMode) {
+   salvador_context *pContext;
+   size_t nCompressedSize;
+
+   if (nMode == SALVADOR_ESTIMATE_GREEDY)
+      return salvador_context_estimate(NULL, pInputData, nInputSize, nFlags, nMaxOffset, nDictionarySize, nMode, NULL);
+
+   pContext = salvador_context_create(1);
+   if (!pContext)
+      return -1;
+
+   nCompressedSize = salvador_context_estimate(pContext, pInputData, nInputSize, nFlags, nMaxOffset, nDictionarySize, nMode, NULL);
+   salvador_context_destroy(pContext);
+
+   return nCompressedSize;
+}
+
+/**
+ * Get maximum number of checkpoints that compressing with salvador_compress_indexed() records
+ *
+ * @param nInputSize input(source) size in bytes
+ * @param nCheckpointInterval approximate number of bytes between checkpoints
+ *
+ * @return maximum number of checkpoints, or -1 for error
+ */
+int salvador_get_max_checkpoints(const size_t nInputSize, const size_t nCheckpointInterval) {
+   /* Checkpoints are at least half an interval apart */
+   if (nCheckpointInterval < MIN_CHECKPOINT_INTERVAL || (nInputSize / (nCheckpointInterval >> 1)) >= 0x7ffffffe)
+      return -1;
+   return (int)(nInputSize / (nCheckpointInterval >> 1)) + 1;
+}
+
+/**
+ * Compress memory, recording checkpoints at regular intervals of the input, where decompression can start with
+ * salvador_decompress_checkpoint() without any previously decompressed data. Matches never reach before the last checkpoint, which
+ * costs a little compression; the output is a regular stream otherwise. Backward compression and dictionaries aren't supported.
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nCheckpointInterval approximate number of bytes between checkpoints, at least MIN_CHECKPOINT_INTERVAL
+ * @param pCheckpoints array of checkpoints to fill out, in increasing order of offsets; the first one is at the start of the data
+ * @param nMaxCheckpoints capacity of checkpoints array, at least salvador_get_max_checkpoints()
+ * @param pNumCheckpoints pointer to returned number of checkpoints
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t salvador_compress_indexed(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+      const unsigned int nFlags, const size_t nMaxOffset, const size_t nCheckpointInterval, salvador_checkpoint *pCheckpoints, const int nMaxCheckpoints, int *pNumCheckpoints,
+      void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats) {
+   const int nBlockSize = salvador_get_block_size(nInputSize, nFlags);
+   salvador_context *pContext;
+   size_t nCompressedSize;
+
+   *pNumCheckpoints = 0;
+   if ((nFlags & FLG_IS_BACKWARD) || nCheckpointInterval < MIN_CHECKPOINT_INTERVAL)
+      return -1;
+
+   pContext = salvador_context_create(1);
+   if (!pContext)
+      return -1;
+
+   if (salvador_context_prepare(pContext, 1, nBlockSize, salvador_get_window_size(nInputSize, nBlockSize), nFlags)) {
+      salvador_context_destroy(pContext);
+      return -1;
+   }
+
+   salvador_compressor_configure(&pContext->compressors[0], nMaxOffset, nFlags);
+   nCompressedSize = salvador_compress_serial(&pContext->compressors[0], pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, 0, nCheckpointInterval, pCheckpoints, nMaxCheckpoints, pNumCheckpoints,
+      progress, pStats);
+   salvador_context_destroy(pContext);
+
+   return nCompressedSize;
+}
+
+/**
+ * Compress the next block of buffered streaming input, and write out the compressed bytes that later blocks can no longer change
+ *
+ * @param pStream streaming compressor
+ * @param nIsFinal non-zero if no more input follows the buffered bytes
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int salvador_stream_shrink_block(salvador_stream_compressor *pStream, const int nIsFinal) {
+   salvador_compressor *pCompressor = &pStream->compressor;
+   const int nMaxOutBlockSize = (int)salvador_get_max_compressed_size(pCompressor->block_size);
+   const int nBlockFlags = pStream->block_flags | (nIsFinal ? 2 : 0);
+   int nInDataSize = 0;
+   int nCurFinalLiterals = 0;
+   int nOutDataSize, nTotalSize, nFinalSize;
+
+   nOutDataSize = salvador_compressor_shrink_indexed_block(pCompressor, pStream->in_buffer, pStream->history_size, pStream->buffered_size, pCompressor->block_size, &nInDataSize, pStream->out_buffer + pStream->held_size, nMaxOutBlockSize,
+      &pStream->cur_bits_offset, &pStream->cur_bit_shift, &nCurFinalLiterals, &pStream->cur_rep_match_offset, nBlockFlags);
+   pStream->block_flags &= (~1);
+
+   if (nOutDataSize < 0 || nCurFinalLiterals < 0 || nCurFinalLiterals >= nInDataSize) {
+      pStream->error = 1;
+      return 100;
+   }
+
+   /* Everything before the byte that is still being filled with bits is final */
+
+   nTotalSize = pStream->held_size + nOutDataSize;
+   if (pStream->cur_bit_shift != -1)
+      nFinalSize = pStream->held_size + pStream->cur_bits_offset;
+   else
+      nFinalSize = nTotalSize;
+
+   if (nFinalSize > 0) {
+      if (pStream->write_func(pStream->out_buffer, nFinalSize, pStream->user_data)) {
+         pStream->error = 1;
+         return 100;
+      }
+      memmove(pStream->out_buffer, pStream->out_buffer + nFinalSize, nTotalSize - nFinalSize);
+   }
+
+   pStream->held_size = nTotalSize - nFinalSize;
+   pStream->cur_bits_offset = -pStream->held_size;
+   pStream->compressed_size += nFinalSize;
+
+   /* The bytes compressed in this block become history for the next ones; deferred literals are compressed again */
+
+   pStream->history_size += nInDataSize - nCurFinalLiterals;
+   pStream->original_size += nInDataSize - nCurFinalLiterals;
+
+   if (!nIsFinal && (size_t)(pStream->history_size + pCompressor->block_size) > pCompressor->window_end) {
+      /* A full block doesn't fit in the indexed window anymore; drop the bytes that matches can't reach, so that the window can be refilled
+       * and indexed again */
+      const int nDiscardSize = (pStream->history_size > pCompressor->max_offset) ? (pStream->history_size - pCompressor->max_offset) : 0;
+
+      salvador_stop_match_prefetch(pCompressor);
+      memmove(pStream->in_buffer, pStream->in_buffer + nDiscardSize, pStream->buffered_size - nDiscardSize);
+      pStream->buffered_size -= nDiscardSize;
+      pStream->history_size -= nDiscardSize;
+      pCompressor->matched_end -= nDiscardSize;
+      pCompressor->first_row_offset -= nDiscardSize;
+      pCompressor->window_end = 0;
+   }
+
+   if (pStream->progress)
+      pStream->progress(pStream->original_size, pStream->compressed_size + pStream->held_size);
+
+   return 0;
+}
+
+/**
+ * Create streaming compressor
+ *
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param pDictionaryData dictionary to compress with (NULL for none); only the last BLOCK_SIZE bytes are used
+ * @param nDictionarySize size of dictionary in bytes (0 for none)
+ * @param write_func callback that receives compressed data
+ * @param pUserData user data passed to the write callback
+ * @param progress progress function, called after compressing each block, or NULL for none
+ *
+ * @return streaming compressor, or NULL for failure
+ */
+salvador_stream_compressor *salvador_stream_compressor_create(const unsigned int nFlags, const size_t nMaxOffset, const unsigned char *pDictionaryData, size_t nDictionarySize,
+      salvador_stream_write_func write_func, void *pUserData, void(*progress)(long long nOriginalSize, long long nCompressedSize)) {
+   const int nBlockSize = salvador_get_max_block_size(nFlags);
+   const int nWindowSize = salvador_get_window_size((size_t)-1, nBlockSize);
+   salvador_stream_compressor *pStream;
+   salvador_memory_source source;
+
+   if ((nFlags & FLG_IS_BACKWARD) && (nFlags & FLG_NATIVE_BACKWARD))
+      return NULL;
+
+   memset(&source, 0, sizeof(salvador_memory_source));
+   source.huge_pages = (nFlags & FLG_HUGE_PAGES) ? 1 : 0;
+
+   pStream = (salvador_stream_compressor *)malloc(sizeof(salvador_stream_compressor));
+   if (!pStream)
+      return NULL;
+
+   if (salvador_compressor_init(&pStream->compressor, nBlockSize, nWindowSize, nMaxOffset, salvador_get_level(nFlags)->arrivals_per_position,
+         salvador_get_level(nFlags)->matches_per_index, salvador_level_uses_suffix_array(nFlags), &source, nFlags)) {
+      salvador_compressor_destroy(&pStream->compressor);
+      free(pStream);
+      return NULL;
+   }
+
+   pStream->in_buffer = (unsigned char *)malloc(nWindowSize);
+   pStream->out_buffer = (unsigned char *)malloc(salvador_get_max_compressed_size(nBlockSize) * 2);
+   if (!pStream->in_buffer || !pStream->out_buffer) {
+      salvador_stream_compressor_destroy(pStream);
+      return NULL;
+   }
+
+   if (!pDictionaryData)
+      nDictionarySize = 0;
+   if (nDictionarySize > BLOCK_SIZE) {
+      pDictionaryData += (nDictionarySize - BLOCK_SIZE);
+      nDictionarySize = BLOCK_SIZE;
+   }
+   if (nDictionarySize)
+      memcpy(pStream->in_buffer, pDictionaryData, nDictionarySize);
+
+   pStream->history_size = (int)nDictionarySize;
+   pStream->buffered_size = (int)nDictionarySize;
+   pStream->held_size = 0;
+   pStream->cur_bits_offset = 0;
+   pStream->cur_bit_shift = -1;
+   pStream->cur_rep_match_offset = 1;
+   pStream->block_flags = 1;
+   pStream->error = 0;
+   pStream->original_size = 0;
+   pStream->compressed_size = 0;
+   pStream->write_func = write_func;
+   pStream->user_data = pUserData;
+   pStream->progress = progress;
+
+   return pStream;
+}
+
+/**
+ * Supply more input data to a streaming compressor
+ *
+ * @param pStream streaming compressor
+ * @param pInputData pointer to input(source) data to compress
+ * @param nInputSize input(source) size in bytes
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_stream_compress(salvador_stream_compressor *pStream, const unsigned char *pInputData, size_t nInputSize) {
+   while (nInputSize && !pStream->error) {
+      size_t nCopySize = (size_t)(pStream->compressor.max_window_size - pStream->buffered_size);
+
+      if (nCopySize == 0) {
+         /* The window is full and more data follows, so this can't be the last block */
+         salvador_stream_shrink_block(pStream, 0);
+         continue;
+      }
+
+      if (nCopySize > nInputSize)
+         nCopySize = nInputSize;
+
+      memcpy(pStream->in_buffer + pStream->buffered_size, pInputData, nCopySize);
+      pStream->buffered_size += (int)nCopySize;
+      pInputData += nCopySize;
+      nInputSize -= nCopySize;
+   }
+
+   return pStream->error ? 100 : 0;
+}
+
+/**
+ * Compress the remaining input data of a streaming compressor and write out the end of the compressed stream
+ *
+ * @param pStream streaming compressor
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return total compressed size, or -1 for error
+ */
+size_t salvador_stream_compress_finish(salvador_stream_compressor *pStream, salvador_stats *pStats) {
+   while (!pStream->error && pStream->buffered_size > pStream->history_size) {
+      salvador_stream_shrink_block(pStream, 1);
+   }
+   salvador_stop_match_prefetch(&pStream->compressor);
+
+   if (!pStream->error && pStream->held_size) {
+      if (pStream->write_func(pStream->out_buffer, pStream->held_size, pStream->user_data))
+         pStream->error = 1;
+      pStream->compressed_size += pStream->held_size;
+      pStream->held_size = 0;
+   }
+
+   if (pStream->error)
+      return -1;
+
+   if (pStats)
+      *pStats = pStream->compressor.stats;
+   return (size_t)pStream->compressed_size;
+}
+
+/**
+ * Destroy streaming compressor and free up all associated resources
+ *
+ * @param pStream streaming compressor, or NULL
+ */
+void salvador_stream_compressor_destroy(salvador_stream_compressor *pStream) {
+   if (pStream) {
+      salvador_compressor_destroy(&pStream->compressor);
+
+      if (pStream->out_buffer) {
+         free(pStream->out_buffer);
+         pStream->out_buffer = NULL;
+      }
+
+      if (pStream->in_buffer) {
+         free(pStream->in_buffer);
+         pStream->in_buffer = NULL;
+      }
+
+      free(pStream);
    }
 }
@@ -32,6 +32,10 @@
 #define _SHRINK_H
 
 #include "divsufsort.h"
+#include "expand.h"
+#include "dictionary.h"
+#include "thread.h"
+#include "arena.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -50,31 +54,83 @@ extern "C" {
 #define NINITIAL_ARRIVALS_PER_POSITION 40
 #define NMAX_ARRIVALS_PER_POSITION 109
 #define NMATCHES_PER_INDEX 78
+#define NMATCH_ROW_RESERVE 32
+#define NPARSE_SEGMENT_SEEDS 8
+
+#define HASH_CHAIN_BITS 16
+#define NDEFAULT_CHAIN_CANDIDATES 32
+
+#define FAST_COMPRESSION_LEVEL 2
 
 #define LEAVE_ALONE_MATCH_SIZE 340
 
+#define SALVADOR_ESTIMATE_EXACT 0      /**< Get the exact compressed size: run the compressor, with the writer only counting bytes */
+#define SALVADOR_ESTIMATE_GREEDY 1     /**< Estimate the compressed size quickly with a greedy parse, without finding all the matches */
+
 /** One match option */
 typedef struct _salvador_match {
    unsigned short length;
    unsigned short offset;
 } salvador_match;
 
-/** Forward arrival slot */
+#ifdef SALVADOR_COMPACT_ARRIVALS
+
+/** Arrival cost for unused slots */
+#define MAX_ARRIVAL_COST 0x7fffff
+
+/** Largest block size that FLG_BLOCK_SIZE can select, as a shift of BLOCK_SIZE: positions in the arrivals only fit 128 KB windows */
+#define MAX_BLOCK_SIZE_SHIFT 0
+
+/**
+ * Forward arrival slot, packed into 16 bytes. Positions are limited to 17 bits (128 KB windows) and costs to 23 bits,
+ * which is enough for BLOCK_SIZE blocks. The position that an arrival comes from isn't stored: it is always its own
+ * position minus the match length, or minus 1 for a literal
+ */
+typedef struct _salvador_arrival {
+   unsigned int cost:23;
+   int from_slot:9;
+
+   unsigned int score:18;
+   unsigned int match_len:14;
+
+   unsigned int rep_offset:15;
+   unsigned int rep_pos:17;
+
+   unsigned int num_literals:17;
+} salvador_arrival;
+
+#define salvador_set_arrival_from_pos(__arrival, __pos)
+#define salvador_get_arrival_from_pos(__arrival, __pos) ((__pos) - ((__arrival)->match_len ? (__arrival)->match_len : 1))
+
+#else
+
+/** Arrival cost for unused slots */
+#define MAX_ARRIVAL_COST 0x40000000
+
+/** Largest block size that FLG_BLOCK_SIZE can select, as a shift of BLOCK_SIZE (4 MB blocks, for windows of up to 8 MB) */
+#define MAX_BLOCK_SIZE_SHIFT 6
+
+/** Forward arrival slot. Positions are limited to 23 bits, which is enough for a block and as much history, for the largest blocks */
 typedef struct _salvador_arrival {
    int cost;
 
-   unsigned int from_pos:17;
-   int from_slot:11;
+   unsigned int from_pos:23;
+   int from_slot:9;
 
-   unsigned int rep_offset;
+   unsigned int rep_offset:16;
+   unsigned int match_len:16;
 
-   unsigned int rep_pos:17;
-   unsigned int match_len:14;
+   unsigned int rep_pos;
 
    int num_literals;
    int score;
 } salvador_arrival;
 
+#define salvador_set_arrival_from_pos(__arrival, __pos) (__arrival)->from_pos = (__pos)
+#define salvador_get_arrival_from_pos(__arrival, __pos) ((__arrival)->from_pos)
+
+#endif /* SALVADOR_COMPACT_ARRIVALS */
+
 /** Visited match */
 typedef int salvador_visited;
 
@@ -112,6 +168,27 @@ typedef struct _salvador_stats {
    int match_divisor;
    int rle1_divisor;
    int rle2_divisor;
+
+   /* Work counters */
+   long long num_matches_found;        /**< matches stored by the match finder */
+   long long num_forward_matches;      /**< rep matches inserted forward by the first optimization pass */
+   long long num_arrivals_inserted;    /**< arrivals inserted by the optimization passes */
+   long long num_arrivals_evicted;     /**< arrivals overwritten by an insertion: a costlier one with the same rep offset, or the last one */
+   int num_blocks;                     /**< blocks optimized */
+   int num_literal_blocks;             /**< blocks found to be incompressible and written as literals, without optimizing them */
+   int num_reduce_passes;              /**< command reduction passes */
+   int num_segments;                   /**< block segments optimized on their own, with FLG_PARSE_SEGMENTS */
+   int num_segment_reparses;           /**< segments optimized again, as none of their paths held with the rep offset before them */
+
+   /* Time spent in each phase, in microseconds, with FLG_PHASE_STATS; summed over all threads for parallel compression */
+   long long sort_time;                /**< sorting suffixes */
+   long long interval_time;            /**< building the LCP intervals, or resetting the hash chains */
+   long long find_matches_time;        /**< finding matches */
+   long long supplement_time;          /**< supplementing small matches and further matches */
+   long long first_pass_time;          /**< first optimization pass, inserting forward rep matches */
+   long long final_pass_time;          /**< optimization pass that picks the final matches */
+   long long reduce_time;              /**< command reduction passes */
+   long long write_time;               /**< writing compressed blocks */
 } salvador_stats;
 
 /** Compression context */
@@ -122,18 +199,109 @@ typedef struct _salvador_compressor {
    unsigned long long *open_intervals;
    salvador_match *match;
    unsigned short *match_depth;
+   int *match_row;
+   int match_pool_size;
    salvador_match *best_match;
    salvador_arrival *arrival;
+   int *rle_len;
+   salvador_visited *visited;
    int *first_offset_for_byte;
    int *next_offset_for_pos;
    int *offset_cache;
+   int *hash_head;
+   salvador_arena arena;
+   const unsigned char *in_window;
+   int in_window_size;
+   unsigned char *reversed_window;
+   size_t window_start;
+   size_t window_end;
+   size_t matched_end;
+   size_t first_row_offset;
+   const salvador_dictionary *dictionary;
+   size_t dictionary_size;
+   int index_start;
    int flags;
    int block_size;
+   int max_window_size;
    int max_offset;
+   int allocated_arrivals_per_position;
+   int allocated_matches_per_index;
    int max_arrivals_per_position;
+   int initial_arrivals_per_position;
+   int matches_per_index;
+   int supplement_small_matches;
+   int supplement_further;
+   int reduce_passes;
+   int max_chain_candidates;
    salvador_stats stats;
+   struct _salvador_match_prefetch *prefetch;
+   struct _salvador_parse_segment *parse_segments;
+   int num_parse_segments;
 } salvador_compressor;
 
+/** Match finder that runs ahead of the optimizer on a second thread, with FLG_PIPELINE */
+typedef struct _salvador_match_prefetch {
+   salvador_compressor finder;         /**< copy of the compression context that shares its match index, and finds matches into the store below */
+   salvador_thread thread;
+   salvador_match *match;              /**< match store for the matches found ahead, with the same layout as the compression context's */
+   unsigned short *match_depth;
+   int *match_row;
+   int match_pool_size;
+   size_t start;                       /**< position of the first row of the store, relative to the input data */
+   size_t end;                         /**< position up to which the store holds matches */
+   size_t target;                      /**< position up to which the thread is finding matches */
+   int running;                        /**< 1 while the thread is running */
+   int error;                          /**< non-zero if finding matches failed */
+} salvador_match_prefetch;
+
+/** Segment of a block that is optimized on its own thread, with FLG_PARSE_SEGMENTS */
+typedef struct _salvador_parse_segment {
+   salvador_compressor parser;         /**< copy of the compression context, with its own arrivals, that optimizes the segment */
+   salvador_thread thread;
+   salvador_arrival *arrival;          /**< arrivals for the positions of the segment */
+   const unsigned char *in_window;
+   int start;                          /**< first position of the segment in the input window */
+   int end;                            /**< position that the segment ends at (exclusive) */
+   int seed_rep_offset[NPARSE_SEGMENT_SEEDS];   /**< likely rep offsets at the start of the segment, that it is optimized from */
+   int num_seeds;
+   int running;                        /**< 1 while the thread is running */
+} salvador_parse_segment;
+
+/** Reusable compression context, holding one lazily allocated compression context per thread */
+typedef struct _salvador_context {
+   salvador_compressor *compressors;
+   int num_threads;
+   int num_compressors;
+   int block_size;
+   int window_size;
+   int arrivals_per_position;
+   int matches_per_index;
+   int has_suffix_array;
+   const salvador_dictionary *dictionary;
+   salvador_memory_source memory;     /**< where the arenas of the compression contexts come from */
+   size_t memory_used;                /**< bytes of the memory block supplied by the caller that the arenas take, if any */
+} salvador_context;
+
+/** Streaming compression state */
+typedef struct _salvador_stream_compressor {
+   salvador_compressor compressor;
+   unsigned char *in_buffer;
+   unsigned char *out_buffer;
+   int history_size;
+   int buffered_size;
+   int held_size;
+   int cur_bits_offset;
+   int cur_bit_shift;
+   int cur_rep_match_offset;
+   int block_flags;
+   int error;
+   long long original_size;
+   long long compressed_size;
+   salvador_stream_write_func write_func;
+   void *user_data;
+   void(*progress)(long long nOriginalSize, long long nCompressedSize);
+} salvador_stream_compressor;
+
 /**
  * Get maximum compressed size of input(source) data
  *
@@ -152,7 +320,7 @@ size_t salvador_get_max_compressed_size(const size_t nInputSize);
  * @param nMaxOutBufferSize maximum capacity of compression buffer
  * @param nFlags compression flags (set to FLG_IS_INVERTED)
  * @param nMaxOffset maximum match offset to use (0 for default)
- * @param nDictionarySize size of dictionary in front of input data (0 for none)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
  * @param progress progress function, called after compressing each block, or NULL for none
  * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
  *
@@ -161,6 +329,240 @@ size_t salvador_get_max_compressed_size(const size_t nInputSize);
 size_t salvador_compress(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
    const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats);
 
+/**
+ * Compress memory, parsing blocks in parallel on several threads
+ *
+ * Each thread parses whole blocks independently, using the previous block as history; the matches are then emitted serially, carrying
+ * the rep offset and bit-packing state across blocks. As the incoming rep offset of each block isn't known while parsing it, the output
+ * can be slightly larger than with salvador_compress(), but remains a valid ZX0 stream. Each thread uses its own compression context.
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param nNumThreads number of threads to use (0 for one per CPU)
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t salvador_compress_parallel(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+   const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, int nNumThreads, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats);
+
+/**
+ * Get the compressed size of memory, without writing any compressed data
+ *
+ * SALVADOR_ESTIMATE_EXACT returns the size that salvador_compress() produces, at the cost of a full compression, minus writing the output.
+ * SALVADOR_ESTIMATE_GREEDY only looks at a few previous occurrences of each pair of bytes and at the rep offset, and runs at a small
+ * fraction of the cost of even the fastest compression level; it typically overestimates the size by 5 to 20%, and is meant for comparing
+ * inputs quickly. Neither mode allocates an output buffer.
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param nInputSize input(source) size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param nMode SALVADOR_ESTIMATE_EXACT or SALVADOR_ESTIMATE_GREEDY
+ *
+ * @return compressed size (exact, or estimated), or -1 for error
+ */
+size_t salvador_estimate_compressed_size(const unsigned char *pInputData, const size_t nInputSize, const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, const int nMode);
+
+/**
+ * Get maximum number of checkpoints that compressing with salvador_compress_indexed() records
+ *
+ * @param nInputSize input(source) size in bytes
+ * @param nCheckpointInterval approximate number of bytes between checkpoints
+ *
+ * @return maximum number of checkpoints, or -1 for error
+ */
+int salvador_get_max_checkpoints(const size_t nInputSize, const size_t nCheckpointInterval);
+
+/**
+ * Compress memory, recording checkpoints at regular intervals of the input, where decompression can start with
+ * salvador_decompress_checkpoint() without any previously decompressed data. Matches never reach before the last checkpoint, which
+ * costs a little compression; the output is a regular stream otherwise. Backward compression and dictionaries aren't supported.
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nCheckpointInterval approximate number of bytes between checkpoints, at least MIN_CHECKPOINT_INTERVAL
+ * @param pCheckpoints array of checkpoints to fill out, in increasing order of offsets; the first one is at the start of the data
+ * @param nMaxCheckpoints capacity of checkpoints array, at least salvador_get_max_checkpoints()
+ * @param pNumCheckpoints pointer to returned number of checkpoints
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t salvador_compress_indexed(const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+   const unsigned int nFlags, const size_t nMaxOffset, const size_t nCheckpointInterval, salvador_checkpoint *pCheckpoints, const int nMaxCheckpoints, int *pNumCheckpoints,
+   void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats);
+
+/**
+ * Create reusable compression context
+ *
+ * The context keeps its tables allocated across compression calls, sized for the largest input seen so far, which avoids allocating
+ * and freeing them for each call when compressing many files. A context can only be used by one compression call at a time.
+ *
+ * @param nNumThreads number of threads to compress blocks on (0 for one per CPU, 1 for single-threaded compression); threads left over when
+ *        there are fewer blocks than threads are used to sort suffixes
+ *
+ * @return compression context, or NULL for failure
+ */
+salvador_context *salvador_context_create(int nNumThreads);
+
+/**
+ * Compress memory using a reusable compression context
+ *
+ * @param pContext reusable compression context
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t salvador_context_compress(salvador_context *pContext, const unsigned char *pInputData, unsigned char *pOutBuffer, const size_t nInputSize, const size_t nMaxOutBufferSize,
+   const unsigned int nFlags, const size_t nMaxOffset, const size_t nDictionarySize, void(*progress)(long long nOriginalSize, long long nCompressedSize), salvador_stats *pStats);
+
+/**
+ * Get the compressed size of memory using a reusable compression context, without writing any compressed data
+ *
+ * SALVADOR_ESTIMATE_EXACT reuses the tables of the context like salvador_context_compress(), but always compresses on one thread, and
+ * returns the size that salvador_compress() produces. The attached dictionary, if any, is used.
+ *
+ * @param pContext reusable compression context (unused with SALVADOR_ESTIMATE_GREEDY, and can then be NULL)
+ * @param pInputData pointer to input(source) data to compress
+ * @param nInputSize input(source) size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none); with FLG_NATIVE_BACKWARD, the dictionary follows the input data instead
+ * @param nMode SALVADOR_ESTIMATE_EXACT or SALVADOR_ESTIMATE_GREEDY
+ * @param pStats pointer to compression stats that are filled for SALVADOR_ESTIMATE_EXACT if this function is successful, or NULL
+ *
+ * @return compressed size (exact, or estimated), or -1 for error
+ */
+size_t salvador_context_estimate(salvador_context *pContext, const unsigned char *pInputData, const size_t nInputSize, const unsigned int nFlags, const size_t nMaxOffset,
+   const size_t nDictionarySize, const int nMode, salvador_stats *pStats);
+
+/**
+ * Attach a prepared dictionary to a reusable compression context, or detach it
+ *
+ * When the dictionary in front of the data to compress ends with the bytes of the prepared dictionary, the compression calls
+ * query the prepared suffix array for matches into the dictionary, instead of suffix-sorting the dictionary again with each
+ * input. Otherwise, or with the hash chain match finder, the dictionary is indexed with the input as usual. The prepared
+ * dictionary must remain valid for as long as it is attached, and can be attached to any number of contexts at once.
+ *
+ * @param pContext reusable compression context
+ * @param pDictionary prepared dictionary, or NULL to detach it
+ */
+void salvador_context_set_dictionary(salvador_context *pContext, const salvador_dictionary *pDictionary);
+
+/**
+ * Set where a reusable compression context gets its working memory from
+ *
+ * The fixed-size tables of each compression thread (the match finder index, the arrivals, the match rows and the tables that
+ * supplement matches) are carved out of one arena per thread. By default, the arenas come from the C heap; with FLG_HUGE_PAGES,
+ * arenas of at least SALVADOR_HUGE_PAGE_SIZE bytes are mapped directly from the OS instead, backed by huge pages where the OS grants
+ * them. The tables that grow while compressing, such as the match store, are allocated with the allocator callbacks, or with the C
+ * heap. The tables that are allocated are freed, and are allocated again from the new source by the next compression.
+ *
+ * @param pContext reusable compression context
+ * @param pAllocator allocator callbacks for the arenas and the tables that grow, or NULL for the C heap; both callbacks must be set
+ * @param pMemory memory block to carve the arenas of all the threads out of, or NULL to allocate them; it must remain valid, and must
+ *        not be used for anything else, until the context is destroyed, reset, or given another source. Compressing fails if it is too small
+ * @param nMemorySize size of that memory block in bytes
+ */
+void salvador_context_set_memory(salvador_context *pContext, const salvador_allocator *pAllocator, void *pMemory, const size_t nMemorySize);
+
+/**
+ * Get the size of the memory block that compressing with a reusable compression context needs, for salvador_context_set_memory()
+ *
+ * @param pContext reusable compression context
+ * @param nInputSize input(source) size in bytes
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nDictionarySize size of dictionary in front of input data (0 for none)
+ *
+ * @return size in bytes, enough for the arenas of all the threads that salvador_context_compress() uses for this input
+ */
+size_t salvador_context_get_memory_size(const salvador_context *pContext, const size_t nInputSize, const unsigned int nFlags, const size_t nDictionarySize);
+
+/**
+ * Free the tables held by a reusable compression context; they are allocated again as needed by the next compression
+ *
+ * @param pContext reusable compression context
+ */
+void salvador_context_reset(salvador_context *pContext);
+
+/**
+ * Destroy reusable compression context and free up all associated resources
+ *
+ * @param pContext reusable compression context, or NULL
+ */
+void salvador_context_destroy(salvador_context *pContext);
+
+/**
+ * Create streaming compressor
+ *
+ * The input is supplied in chunks of any size with salvador_stream_compress(). Only the previous block is kept as history, and
+ * the output for each block is passed to the write callback as soon as it is final, so that memory use stays at about two
+ * blocks. The output is identical to salvador_compress() for the same data. With FLG_IS_BACKWARD, the input must be supplied
+ * reversed, starting with its last byte, and the compressed data is written out reversed too; FLG_NATIVE_BACKWARD needs the whole
+ * input and isn't supported.
+ *
+ * @param nFlags compression flags (set to FLG_IS_INVERTED)
+ * @param nMaxOffset maximum match offset to use (0 for default)
+ * @param pDictionaryData dictionary to compress with (NULL for none); only the last BLOCK_SIZE bytes are used
+ * @param nDictionarySize size of dictionary in bytes (0 for none)
+ * @param write_func callback that receives compressed data
+ * @param pUserData user data passed to the write callback
+ * @param progress progress function, called after compressing each block, or NULL for none
+ *
+ * @return streaming compressor, or NULL for failure
+ */
+salvador_stream_compressor *salvador_stream_compressor_create(const unsigned int nFlags, const size_t nMaxOffset, const unsigned char *pDictionaryData, size_t nDictionarySize,
+   salvador_stream_write_func write_func, void *pUserData, void(*progress)(long long nOriginalSize, long long nCompressedSize));
+
+/**
+ * Supply more input data to a streaming compressor
+ *
+ * @param pStream streaming compressor
+ * @param pInputData pointer to input(source) data to compress
+ * @param nInputSize input(source) size in bytes
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_stream_compress(salvador_stream_compressor *pStream, const unsigned char *pInputData, size_t nInputSize);
+
+/**
+ * Compress the remaining input data of a streaming compressor and write out the end of the compressed stream
+ *
+ * @param pStream streaming compressor
+ * @param pStats pointer to compression stats that are filled if this function is successful, or NULL
+ *
+ * @return total compressed size, or -1 for error
+ */
+size_t salvador_stream_compress_finish(salvador_stream_compressor *pStream, salvador_stats *pStats);
+
+/**
+ * Destroy streaming compressor and free up all associated resources
+ *
+ * @param pStream streaming compressor, or NULL
+ */
+void salvador_stream_compressor_destroy(salvador_stream_compressor *pStream);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,436 @@
+/*
+ * simd.c - vectorized byte comparison kernels
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#include <string.h>
+#include "simd.h"
+
+#if !defined(SALVADOR_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SALVADOR_SIMD_SSE2
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define SALVADOR_SIMD_AVX2
+#endif
+#include <emmintrin.h>
+#ifdef SALVADOR_SIMD_AVX2
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif !defined(SALVADOR_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64)) && !defined(__AARCH64EB__)
+#define SALVADOR_SIMD_NEON
+#include <arm_neon.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__) || defined(_M_ARM64)
+#define SALVADOR_SIMD_WORD64
+#endif
+
+#if defined(SALVADOR_SIMD_AVX2) && defined(__GNUC__)
+#define SALVADOR_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SALVADOR_TARGET_AVX2
+#endif
+
+#if !defined(SALVADOR_SIMD_SSE2) && !defined(SALVADOR_SIMD_NEON)
+
+/**
+ * Count how many leading bytes two buffers have in common, with the original 8/4/1 byte compare chains
+ *
+ * @param pData1 first buffer
+ * @param pData2 second buffer
+ * @param nMaxLen maximum number of bytes to compare
+ *
+ * @return number of identical leading bytes, between 0 and nMaxLen
+ */
+static int salvador_get_common_len_scalar(const unsigned char *pData1, const unsigned char *pData2, const int nMaxLen) {
+   int nLen = 0;
+
+   while ((nLen + 8) < nMaxLen && !memcmp(pData1 + nLen, pData2 + nLen, 8))
+      nLen += 8;
+   while ((nLen + 4) < nMaxLen && !memcmp(pData1 + nLen, pData2 + nLen, 4))
+      nLen += 4;
+   while (nLen < nMaxLen && pData1[nLen] == pData2[nLen])
+      nLen++;
+
+   return nLen;
+}
+
+/**
+ * Get the length of the run of identical bytes starting at the specified position, one byte at a time
+ *
+ * @param pData start of run
+ * @param nMaxLen maximum run length to report; must be at least 1
+ *
+ * @return run length, between 1 and nMaxLen
+ */
+static int salvador_get_run_len_scalar(const unsigned char *pData, const int nMaxLen) {
+   const unsigned char c = pData[0];
+   int nLen = 1;
+
+   while (nLen < nMaxLen && pData[nLen] == c)
+      nLen++;
+
+   return nLen;
+}
+
+#else
+
+#ifdef SALVADOR_SIMD_SSE2
+/**
+ * Get index of the lowest set bit
+ *
+ * @param nValue value to scan, must be non-zero
+ *
+ * @return bit index
+ */
+static int salvador_get_lowest_bit(const unsigned int nValue) {
+#ifdef _MSC_VER
+   unsigned long nIndex;
+
+   _BitScanForward(&nIndex, nValue);
+   return (int)nIndex;
+#else
+   return __builtin_ctz(nValue);
+#endif
+}
+#endif
+
+#ifdef SALVADOR_SIMD_WORD64
+/**
+ * Get index of the lowest set bit in a 64-bit value
+ *
+ * @param nValue value to scan, must be non-zero
+ *
+ * @return bit index
+ */
+static int salvador_get_lowest_bit64(const unsigned long long nValue) {
+#ifdef _MSC_VER
+   unsigned long nIndex;
+
+   _BitScanForward64(&nIndex, nValue);
+   return (int)nIndex;
+#else
+   return __builtin_ctzll(nValue);
+#endif
+}
+#endif
+
+/**
+ * Finish comparing two buffers once fewer than a vector's worth of bytes remain
+ *
+ * @param pData1 first buffer
+ * @param pData2 second buffer
+ * @param nLen number of bytes already known to be identical
+ * @param nMaxLen maximum number of bytes to compare
+ *
+ * @return number of identical leading bytes, between nLen and nMaxLen
+ */
+static int salvador_get_common_len_tail(const unsigned char *pData1, const unsigned char *pData2, int nLen, const int nMaxLen) {
+#ifdef SALVADOR_SIMD_WORD64
+   while ((nLen + 8) <= nMaxLen) {
+      unsigned long long nWord1, nWord2;
+
+      memcpy(&nWord1, pData1 + nLen, 8);
+      memcpy(&nWord2, pData2 + nLen, 8);
+      if (nWord1 != nWord2)
+         return nLen + (salvador_get_lowest_bit64(nWord1 ^ nWord2) >> 3);
+      nLen += 8;
+   }
+#endif
+
+   while (nLen < nMaxLen && pData1[nLen] == pData2[nLen])
+      nLen++;
+
+   return nLen;
+}
+
+/**
+ * Finish measuring a run once fewer than a vector's worth of bytes remain
+ *
+ * @param pData start of run
+ * @param nLen number of bytes already known to belong to the run
+ * @param nMaxLen maximum run length to report
+ *
+ * @return run length, between nLen and nMaxLen
+ */
+static int salvador_get_run_len_tail(const unsigned char *pData, int nLen, const int nMaxLen) {
+   const unsigned char c = pData[0];
+
+#ifdef SALVADOR_SIMD_WORD64
+   const unsigned long long nPattern = 0x0101010101010101ULL * c;
+
+   while ((nLen + 8) <= nMaxLen) {
+      unsigned long long nWord;
+
+      memcpy(&nWord, pData + nLen, 8);
+      if (nWord != nPattern)
+         return nLen + (salvador_get_lowest_bit64(nWord ^ nPattern) >> 3);
+      nLen += 8;
+   }
+#endif
+
+   while (nLen < nMaxLen && pData[nLen] == c)
+      nLen++;
+
+   return nLen;
+}
+
+#endif /* !SALVADOR_SIMD_SSE2 && !SALVADOR_SIMD_NEON */
+
+#ifdef SALVADOR_SIMD_SSE2
+
+/**
+ * Count how many leading bytes two buffers have in common, 16 bytes at a time
+ *
+ * @param pData1 first buffer
+ * @param pData2 second buffer
+ * @param nMaxLen maximum number of bytes to compare
+ *
+ * @return number of identical leading bytes, between 0 and nMaxLen
+ */
+static int salvador_get_common_len_sse2(const unsigned char *pData1, const unsigned char *pData2, const int nMaxLen) {
+   int nLen = 0;
+
+   while ((nLen + 16) <= nMaxLen) {
+      const __m128i v1 = _mm_loadu_si128((const __m128i *)(pData1 + nLen));
+      const __m128i v2 = _mm_loadu_si128((const __m128i *)(pData2 + nLen));
+      const unsigned int nMask = ((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2))) ^ 0xffff;
+
+      if (nMask)
+         return nLen + salvador_get_lowest_bit(nMask);
+      nLen += 16;
+   }
+
+   return salvador_get_common_len_tail(pData1, pData2, nLen, nMaxLen);
+}
+
+/**
+ * Get the length of the run of identical bytes starting at the specified position, 16 bytes at a time
+ *
+ * @param pData start of run
+ * @param nMaxLen maximum run length to report; must be at least 1
+ *
+ * @return run length, between 1 and nMaxLen
+ */
+static int salvador_get_run_len_sse2(const unsigned char *pData, const int nMaxLen) {
+   const __m128i vRun = _mm_set1_epi8((char)pData[0]);
+   int nLen = 1;
+
+   while ((nLen + 16) <= nMaxLen) {
+      const unsigned int nMask = ((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pData + nLen)), vRun))) ^ 0xffff;
+
+      if (nMask)
+         return nLen + salvador_get_lowest_bit(nMask);
+      nLen += 16;
+   }
+
+   return salvador_get_run_len_tail(pData, nLen, nMaxLen);
+}
+
+#endif /* SALVADOR_SIMD_SSE2 */
+
+#ifdef SALVADOR_SIMD_AVX2
+
+/**
+ * Count how many leading bytes two buffers have in common, 32 bytes at a time
+ *
+ * @param pData1 first buffer
+ * @param pData2 second buffer
+ * @param nMaxLen maximum number of bytes to compare
+ *
+ * @return number of identical leading bytes, between 0 and nMaxLen
+ */
+SALVADOR_TARGET_AVX2 static int salvador_get_common_len_avx2(const unsigned char *pData1, const unsigned char *pData2, const int nMaxLen) {
+   int nLen = 0;
+
+   while ((nLen + 32) <= nMaxLen) {
+      const __m256i v1 = _mm256_loadu_si256((const __m256i *)(pData1 + nLen));
+      const __m256i v2 = _mm256_loadu_si256((const __m256i *)(pData2 + nLen));
+      const unsigned int nMask = ~((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, v2)));
+
+      if (nMask)
+         return nLen + salvador_get_lowest_bit(nMask);
+      nLen += 32;
+   }
+
+   return nLen + salvador_get_common_len_sse2(pData1 + nLen, pData2 + nLen, nMaxLen - nLen);
+}
+
+/**
+ * Get the length of the run of identical bytes starting at the specified position, 32 bytes at a time
+ *
+ * @param pData start of run
+ * @param nMaxLen maximum run length to report; must be at least 1
+ *
+ * @return run length, between 1 and nMaxLen
+ */
+SALVADOR_TARGET_AVX2 static int salvador_get_run_len_avx2(const unsigned char *pData, const int nMaxLen) {
+   const __m256i vRun = _mm256_set1_epi8((char)pData[0]);
+   int nLen = 1;
+
+   while ((nLen + 32) <= nMaxLen) {
+      const unsigned int nMask = ~((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pData + nLen)), vRun)));
+
+      if (nMask)
+         return nLen + salvador_get_lowest_bit(nMask);
+      nLen += 32;
+   }
+
+   /* The first byte is part of the run by definition, so the remainder can be measured from the last byte seen */
+   return nLen - 1 + salvador_get_run_len_sse2(pData + nLen - 1, nMaxLen - nLen + 1);
+}
+
+/**
+ * Check whether the CPU and operating system support AVX2
+ *
+ * @return non-zero if AVX2 kernels can be used, 0 otherwise
+ */
+static int salvador_cpu_has_avx2(void) {
+#ifdef _MSC_VER
+   int nRegs[4];
+
+   __cpuid(nRegs, 0);
+   if (nRegs[0] < 7)
+      return 0;
+
+   /* Check for OSXSAVE and AVX, then that the OS saves the YMM registers */
+   __cpuid(nRegs, 1);
+   if ((nRegs[2] & ((1 << 27) | (1 << 28))) != ((1 << 27) | (1 << 28)))
+      return 0;
+   if ((_xgetbv(0) & 6) != 6)
+      return 0;
+
+   __cpuidex(nRegs, 7, 0);
+   return (nRegs[1] & (1 << 5)) ? 1 : 0;
+#else
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+}
+
+#endif /* SALVADOR_SIMD_AVX2 */
+
+#ifdef SALVADOR_SIMD_NEON
+
+/**
+ * Count how many leading bytes two buffers have in common, 16 bytes at a time
+ *
+ * @param pData1 first buffer
+ * @param pData2 second buffer
+ * @param nMaxLen maximum number of bytes to compare
+ *
+ * @return number of identical leading bytes, between 0 and nMaxLen
+ */
+static int salvador_get_common_len_neon(const unsigned char *pData1, const unsigned char *pData2, const int nMaxLen) {
+   int nLen = 0;
+
+   while ((nLen + 16) <= nMaxLen) {
+      const uint8x16_t vEqual = vceqq_u8(vld1q_u8(pData1 + nLen), vld1q_u8(pData2 + nLen));
+      /* Narrow the byte mask to 4 bits per byte, NEON has no movemask */
+      const unsigned long long nMask = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vEqual), 4)), 0);
+
+      if (nMask)
+         return nLen + (salvador_get_lowest_bit64(nMask) >> 2);
+      nLen += 16;
+   }
+
+   return salvador_get_common_len_tail(pData1, pData2, nLen, nMaxLen);
+}
+
+/**
+ * Get the length of the run of identical bytes starting at the specified position, 16 bytes at a time
+ *
+ * @param pData start of run
+ * @param nMaxLen maximum run length to report; must be at least 1
+ *
+ * @return run length, between 1 and nMaxLen
+ */
+static int salvador_get_run_len_neon(const unsigned char *pData, const int nMaxLen) {
+   const uint8x16_t vRun = vdupq_n_u8(pData[0]);
+   int nLen = 1;
+
+   while ((nLen + 16) <= nMaxLen) {
+      const uint8x16_t vEqual = vceqq_u8(vld1q_u8(pData + nLen), vRun);
+      const unsigned long long nMask = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vEqual), 4)), 0);
+
+      if (nMask)
+         return nLen + (salvador_get_lowest_bit64(nMask) >> 2);
+      nLen += 16;
+   }
+
+   return salvador_get_run_len_tail(pData, nLen, nMaxLen);
+}
+
+#endif /* SALVADOR_SIMD_NEON */
+
+#if defined(SALVADOR_SIMD_SSE2)
+salvador_common_len_func salvador_get_common_len = salvador_get_common_len_sse2;
+salvador_run_len_func salvador_get_run_len = salvador_get_run_len_sse2;
+static const char *salvador_simd_name = "sse2";
+#elif defined(SALVADOR_SIMD_NEON)
+salvador_common_len_func salvador_get_common_len = salvador_get_common_len_neon;
+salvador_run_len_func salvador_get_run_len = salvador_get_run_len_neon;
+static const char *salvador_simd_name = "neon";
+#else
+salvador_common_len_func salvador_get_common_len = salvador_get_common_len_scalar;
+salvador_run_len_func salvador_get_run_len = salvador_get_run_len_scalar;
+static const char *salvador_simd_name = "scalar";
+#endif
+
+/**
+ * Select the fastest comparison kernels supported by the CPU that is running the compressor
+ */
+void salvador_simd_init(void) {
+#ifdef SALVADOR_SIMD_AVX2
+   static int nChecked = 0;
+
+   /* Every caller stores the same values, so concurrent calls from several compressors are harmless */
+   if (!nChecked) {
+      if (salvador_cpu_has_avx2()) {
+         salvador_get_common_len = salvador_get_common_len_avx2;
+         salvador_get_run_len = salvador_get_run_len_avx2;
+         salvador_simd_name = "avx2";
+      }
+      nChecked = 1;
+   }
+#endif
+}
+
+/**
+ * Get the name of the comparison kernels currently in use
+ *
+ * @return kernel name, such as "avx2", "sse2", "neon" or "scalar"
+ */
+const char *salvador_simd_get_name(void) {
+   return salvador_simd_name;
+}
@@ -0,0 +1,79 @@
+/*
+ * simd.h - vectorized byte comparison kernels
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Count how many leading bytes two buffers have in common
+ *
+ * @param pData1 first buffer
+ * @param pData2 second buffer
+ * @param nMaxLen maximum number of bytes to compare; both buffers must be readable for that many bytes
+ *
+ * @return number of identical leading bytes, between 0 and nMaxLen
+ */
+typedef int (*salvador_common_len_func)(const unsigned char *pData1, const unsigned char *pData2, const int nMaxLen);
+
+/**
+ * Get the length of the run of identical bytes starting at the specified position
+ *
+ * @param pData start of run
+ * @param nMaxLen maximum run length to report; must be at least 1
+ *
+ * @return run length, between 1 and nMaxLen
+ */
+typedef int (*salvador_run_len_func)(const unsigned char *pData, const int nMaxLen);
+
+/** Kernels selected for this CPU; usable before salvador_simd_init(), which only upgrades them */
+extern salvador_common_len_func salvador_get_common_len;
+extern salvador_run_len_func salvador_get_run_len;
+
+/**
+ * Select the fastest comparison kernels supported by the CPU that is running the compressor
+ */
+void salvador_simd_init(void);
+
+/**
+ * Get the name of the comparison kernels currently in use
+ *
+ * @return kernel name, such as "avx2", "sse2", "neon" or "scalar"
+ */
+const char *salvador_simd_get_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SIMD_H */
@@ -0,0 +1,183 @@
+/*
+ * thread.c - portable threading implementation
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#include <stdlib.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <time.h>
+#endif
+#include "thread.h"
+
+#ifdef _WIN32
+static DWORD WINAPI salvador_thread_entry(LPVOID pParam) {
+   salvador_thread *pThread = (salvador_thread *)pParam;
+
+   pThread->func(pThread->arg);
+   return 0;
+}
+#else
+static void *salvador_thread_entry(void *pParam) {
+   salvador_thread *pThread = (salvador_thread *)pParam;
+
+   pThread->func(pThread->arg);
+   return NULL;
+}
+#endif
+
+/**
+ * Start a new thread
+ *
+ * @param pThread thread handle to fill out
+ * @param func function to run in the new thread
+ * @param pArg argument passed to the thread function
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_thread_create(salvador_thread *pThread, void (*func)(void *pArg), void *pArg) {
+   pThread->func = func;
+   pThread->arg = pArg;
+
+#ifdef _WIN32
+   pThread->handle = CreateThread(NULL, 0, salvador_thread_entry, pThread, 0, NULL);
+   return (pThread->handle != NULL) ? 0 : 100;
+#else
+   return pthread_create(&pThread->handle, NULL, salvador_thread_entry, pThread) ? 100 : 0;
+#endif
+}
+
+/**
+ * Wait for a thread to finish and release its resources
+ *
+ * @param pThread thread to wait for
+ */
+void salvador_thread_join(salvador_thread *pThread) {
+#ifdef _WIN32
+   WaitForSingleObject(pThread->handle, INFINITE);
+   CloseHandle(pThread->handle);
+   pThread->handle = NULL;
+#else
+   pthread_join(pThread->handle, NULL);
+#endif
+}
+
+/**
+ * Initialize mutex
+ *
+ * @param pMutex mutex to initialize
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_mutex_init(salvador_mutex *pMutex) {
+#ifdef _WIN32
+   InitializeCriticalSection(&pMutex->handle);
+   return 0;
+#else
+   return pthread_mutex_init(&pMutex->handle, NULL) ? 100 : 0;
+#endif
+}
+
+/**
+ * Acquire mutex
+ *
+ * @param pMutex mutex to acquire
+ */
+void salvador_mutex_lock(salvador_mutex *pMutex) {
+#ifdef _WIN32
+   EnterCriticalSection(&pMutex->handle);
+#else
+   pthread_mutex_lock(&pMutex->handle);
+#endif
+}
+
+/**
+ * Release mutex
+ *
+ * @param pMutex mutex to release
+ */
+void salvador_mutex_unlock(salvador_mutex *pMutex) {
+#ifdef _WIN32
+   LeaveCriticalSection(&pMutex->handle);
+#else
+   pthread_mutex_unlock(&pMutex->handle);
+#endif
+}
+
+/**
+ * Clean up mutex
+ *
+ * @param pMutex mutex to clean up
+ */
+void salvador_mutex_destroy(salvador_mutex *pMutex) {
+#ifdef _WIN32
+   DeleteCriticalSection(&pMutex->handle);
+#else
+   pthread_mutex_destroy(&pMutex->handle);
+#endif
+}
+
+/**
+ * Get number of logical CPUs available to this process
+ *
+ * @return number of CPUs, at least 1
+ */
+int salvador_get_num_cpus(void) {
+   int nNumCPUs;
+
+#ifdef _WIN32
+   SYSTEM_INFO si;
+
+   GetSystemInfo(&si);
+   nNumCPUs = (int)si.dwNumberOfProcessors;
+#else
+   nNumCPUs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+   return (nNumCPUs >= 1) ? nNumCPUs : 1;
+}
+
+/**
+ * Get a monotonic time stamp, for measuring elapsed time
+ *
+ * @return time stamp, in microseconds
+ */
+long long salvador_get_time(void) {
+#ifdef _WIN32
+   LARGE_INTEGER nFrequency, nCurTime;
+
+   QueryPerformanceFrequency(&nFrequency);
+   QueryPerformanceCounter(&nCurTime);
+   return (long long)((nCurTime.QuadPart / nFrequency.QuadPart) * 1000000LL + ((nCurTime.QuadPart % nFrequency.QuadPart) * 1000000LL) / nFrequency.QuadPart);
+#else
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000000LL + (long long)(ts.tv_nsec / 1000);
+#endif
+}
@@ -0,0 +1,130 @@
+/*
+ * thread.h - portable threading definitions
+ *
+ * Copyright (C) 2021 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Implements the ZX0 encoding designed by Einar Saukas. https://github.com/einar-saukas/ZX0
+ * Also inspired by Charles Bloom's compression blog. http://cbloomrants.blogspot.com/
+ *
+ */
+
+#ifndef _THREAD_H
+#define _THREAD_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Thread handle */
+typedef struct _salvador_thread {
+#ifdef _WIN32
+   HANDLE handle;
+#else
+   pthread_t handle;
+#endif
+   void (*func)(void *pArg);
+   void *arg;
+} salvador_thread;
+
+/** Mutex */
+typedef struct _salvador_mutex {
+#ifdef _WIN32
+   CRITICAL_SECTION handle;
+#else
+   pthread_mutex_t handle;
+#endif
+} salvador_mutex;
+
+/**
+ * Start a new thread
+ *
+ * @param pThread thread handle to fill out
+ * @param func function to run in the new thread
+ * @param pArg argument passed to the thread function
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_thread_create(salvador_thread *pThread, void (*func)(void *pArg), void *pArg);
+
+/**
+ * Wait for a thread to finish and release its resources
+ *
+ * @param pThread thread to wait for
+ */
+void salvador_thread_join(salvador_thread *pThread);
+
+/**
+ * Initialize mutex
+ *
+ * @param pMutex mutex to initialize
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int salvador_mutex_init(salvador_mutex *pMutex);
+
+/**
+ * Acquire mutex
+ *
+ * @param pMutex mutex to acquire
+ */
+void salvador_mutex_lock(salvador_mutex *pMutex);
+
+/**
+ * Release mutex
+ *
+ * @param pMutex mutex to release
+ */
+void salvador_mutex_unlock(salvador_mutex *pMutex);
+
+/**
+ * Clean up mutex
+ *
+ * @param pMutex mutex to clean up
+ */
+void salvador_mutex_destroy(salvador_mutex *pMutex);
+
+/**
+ * Get number of logical CPUs available to this process
+ *
+ * @return number of CPUs, at least 1
+ */
+int salvador_get_num_cpus(void);
+
+/**
+ * Get a monotonic time stamp, for measuring elapsed time
+ *
+ * @return time stamp, in microseconds
+ */
+long long salvador_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _THREAD_H */